@@ -92,6 +92,7 @@ struct ui_ctx {
 	int maxx;
 	int numbering; // Deprecated currently - 'cat -n' is a convenient alternative
 	int statsthread;
+	int follow; // 'F': the view follows what is appended to the source
 } uigbl;
 
 #endif
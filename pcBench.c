@@ -0,0 +1,332 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Cross-backend benchmark. See pcBench.h. */
+
+#include <stdarg.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "pipecut.h"
+#include "pcBench.h"
+#include "pcExec.h"
+
+#define LPC_BENCHARGS 8
+
+// One way of running the toolset, and how it did
+struct lpc_backend {
+    const char *label;
+    char *argv[LPC_BENCHARGS];
+    char file[PATH_MAX];	// The program or .pct it runs, if there's one to write
+    char arg[24];		// -j's count
+    const char *skip;		// Why it can't be run here, if it can't
+    char out[PATH_MAX];		// Its output, from the last run
+    int rc;			// Exit status of the last run, -1 if it was killed
+    double wall;		// The fastest run: wall and CPU seconds, peak RSS in KB
+    double cpu;
+    long rss;
+};
+
+static void
+lpc_bench_add(struct lpc_backend *b, const char *label, ...)
+{
+    va_list ap;
+    int i = 0;
+
+    memset(b, 0, sizeof(struct lpc_backend));
+    b->label = label;
+    va_start(ap, label);
+    while (i < LPC_BENCHARGS - 1 && (b->argv[i] = va_arg(ap, char *)))
+	i++;
+    va_end(ap);
+}
+
+// The running pipecut, for the backends that are options of its own
+static char *
+lpc_bench_self(const char *av0, char *buf, size_t size)
+{
+    ssize_t n;
+
+    if ((n = readlink("/proc/self/exe", buf, size - 1)) > 0) {
+	buf[n] = '\0';
+	return buf;
+    }
+    return (char *)av0;		// execvp() finds it in $PATH
+}
+
+/* Run argv with stdin from in and stdout to out, and wait for it. Returns its exit
+ * status, or -1 if it was killed; with the wall time, and its rusage (which counts
+ * the processes it waited for, like the shell's pipeline, too).
+ */
+static int
+lpc_bench_spawn(char *const argv[], const char *in, const char *out,
+    double *wall, struct rusage *ru)
+{
+    struct timespec t0, t1;
+    pid_t pid;
+    int status, fd;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if ((pid = fork()) == -1) {
+	fprintf(stderr, "Pipecut Error: fork: %s\n", strerror(errno));
+	exit(-1);
+    }
+    if (pid == 0) {
+	if ((fd = open(in, O_RDONLY)) == -1 || dup2(fd, 0) == -1)
+	    _exit(127);
+	close(fd);
+	if ((fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1
+	    || dup2(fd, 1) == -1)
+	    _exit(127);
+	close(fd);
+	if (!lpc_ctx.debug && (fd = open("/dev/null", O_WRONLY)) != -1)
+	    dup2(fd, 2);
+	execvp(argv[0], argv);
+	_exit(127);
+    }
+    while (wait4(pid, &status, 0, ru) == -1) {
+	if (errno != EINTR) {
+	    fprintf(stderr, "Pipecut Error: wait4: %s\n", strerror(errno));
+	    exit(-1);
+	}
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    *wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Write out what a backend runs, with argv. why is for the table if that fails.
+static void
+lpc_bench_prep(struct lpc_backend *b, char *const argv[], const char *out,
+    const char *why)
+{
+    struct rusage ru;
+    double wall;
+
+    if (lpc_ctx.debug)
+	fprintf(stderr, "pipecut: --bench: %s: preparing with %s\n", b->label,
+	    argv[0]);
+    if (lpc_bench_spawn(argv, "/dev/null", out, &wall, &ru) != 0)
+	b->skip = why;
+}
+
+// Have pipecut --compile write the .pct that b runs
+static void
+lpc_bench_pct(struct lpc_backend *b, char *self, char *name)
+{
+    char *argv[] = { self, "--compile", name, "-o", b->file, NULL };
+
+    lpc_bench_prep(b, argv, "/dev/null", "--compile failed");
+}
+
+// Have pipecut --emit write the program b runs to path
+static void
+lpc_bench_emit(struct lpc_backend *b, char *self, char *lang, char *name,
+    const char *path)
+{
+    char *argv[] = { self, "--emit", lang, name, NULL };
+
+    lpc_bench_prep(b, argv, path, "--emit failed");
+}
+
+// Have pipecut --emit c write the program b runs, and build it with $CC or cc
+static void
+lpc_bench_cc(struct lpc_backend *b, char *self, char *name)
+{
+    char src[PATH_MAX + 2];
+    char *argv[] = { "/bin/sh", "-c", "exec ${CC:-cc} \"$@\"", "sh", "-O2",
+	"-o", b->file, src, NULL
+    };
+
+    snprintf(src, sizeof(src), "%s.c", b->file);
+    lpc_bench_emit(b, self, "c", name, src);
+    if (!b->skip)
+	lpc_bench_prep(b, argv, "/dev/null", "no C compiler");
+    unlink(src);
+}
+
+// 1 if the files hold the same bytes
+static int
+lpc_bench_same(const char *a, const char *b)
+{
+    struct lpc_map ma, mb;
+    int same;
+
+    memset(&ma, 0, sizeof(ma));
+    memset(&mb, 0, sizeof(mb));
+    same = lpc_map_file(&ma, a) && lpc_map_file(&mb, b) && ma.len == mb.len
+	&& (ma.len == 0 || !memcmp(ma.p, mb.p, ma.len));
+    lpc_map_close(&ma);
+    lpc_map_close(&mb);
+    return same;
+}
+
+int
+lpc_bench(const char *av0, const char *name, const char *sample)
+{
+    static char script[BLADECACHE];
+    struct lpc_backend b[16], *ref = NULL;
+    struct rusage ru;
+    struct lpc_map m;
+    char dir[PATH_MAX - 32], selfbuf[PATH_MAX];
+    char *self, *n = (char *)name;
+    const char *tmp, *p, *end;
+    long lines = 0, jobs;
+    double wall, cpu, secs;
+    int i, r, nb = 0, bad = 0;
+
+    memset(&m, 0, sizeof(m));
+    if (!lpc_map_file(&m, sample)) {
+	fprintf(stderr, "Pipecut Error: can't read %s: %s\n", sample,
+	    strerror(errno));
+	exit(-1);
+    }
+    // Counting the lines reads the sample into the page cache, for the first backend
+    for (p = m.p, end = m.p + m.len; p < end; lines++) {
+	if (!(p = memchr(p, '\n', end - p)))
+	    p = end;
+	else
+	    p++;
+    }
+    if (!(tmp = getenv("TMPDIR")) || !*tmp)
+	tmp = "/tmp";
+    snprintf(dir, sizeof(dir), "%s/pipecut-bench-XXXXXX", tmp);
+    if (!mkdtemp(dir)) {
+	fprintf(stderr, "Pipecut Error: can't make %s: %s\n", dir,
+	    strerror(errno));
+	exit(-1);
+    }
+    // The shell pipeline is the UI's script ('!'), cat'ing the sample
+    strlcpy(lpc_ctx.sourcefile, sample, PATH_MAX);
+    updateTextPipeline(script, 1);
+    if (lpc_ctx.debug)
+	fprintf(stderr, "pipecut: --bench: shell: %s\n", script);
+
+    self = lpc_bench_self(av0, selfbuf, sizeof(selfbuf));
+    if ((jobs = lpc_ctx.jobs) < 1)
+	jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    lpc_bench_add(&b[nb++], "shell", "/bin/sh", "-c", script, NULL);
+    lpc_bench_add(&b[nb++], "-t", self, "-t", n, NULL);
+    lpc_bench_add(&b[nb++], "-P", self, "-P", "-t", n, NULL);
+    lpc_bench_add(&b[nb], "-j", self, "-j", b[nb].arg, "-t", n, NULL);
+    snprintf(b[nb].arg, sizeof(b[nb].arg), "%ld", jobs < 1 ? 1 : jobs);
+    nb++;
+    lpc_bench_add(&b[nb], "-f", self, "-f", b[nb].file, NULL);
+    snprintf(b[nb].file, PATH_MAX, "%s/toolset.pct", dir);
+    lpc_bench_pct(&b[nb++], self, n);
+    lpc_bench_add(&b[nb++], "--jit", self, "--jit", "-t", n, NULL);
+    lpc_bench_add(&b[nb], "--emit c", b[nb].file, NULL);
+    snprintf(b[nb].file, PATH_MAX, "%s/filter", dir);
+    lpc_bench_cc(&b[nb++], self, n);
+    lpc_bench_add(&b[nb], "--emit awk", "sh", b[nb].file, NULL);
+    snprintf(b[nb].file, PATH_MAX, "%s/filter.awk", dir);
+    lpc_bench_emit(&b[nb], self, "awk", n, b[nb].file);
+    nb++;
+    lpc_bench_add(&b[nb], "--emit perl", "perl", b[nb].file, NULL);
+    snprintf(b[nb].file, PATH_MAX, "%s/filter.pl", dir);
+    lpc_bench_emit(&b[nb], self, "perl", n, b[nb].file);
+    nb++;
+    lpc_bench_add(&b[nb], "--emit python", "python3", b[nb].file, NULL);
+    snprintf(b[nb].file, PATH_MAX, "%s/filter.py", dir);
+    lpc_bench_emit(&b[nb], self, "python", n, b[nb].file);
+    nb++;
+
+    for (i = 0; i < nb; i++) {
+	snprintf(b[i].out, sizeof(b[i].out), "%s/out.%d", dir, i);
+	if (b[i].skip)
+	    continue;
+	if (!strcmp(b[i].label, "--jit"))	// Build the cached object first
+	    lpc_bench_spawn(b[i].argv, "/dev/null", "/dev/null", &wall, &ru);
+	for (r = 0; r < LPC_BENCHRUNS; r++) {
+	    if (lpc_ctx.debug)
+		fprintf(stderr, "pipecut: --bench: %s: run %d\n", b[i].label,
+		    r + 1);
+	    b[i].rc = lpc_bench_spawn(b[i].argv, sample, b[i].out, &wall, &ru);
+	    if (b[i].rc == 127)	// Not installed (perl, python3)
+		break;
+	    cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+		+ ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+	    if (r == 0 || wall < b[i].wall) {
+		b[i].wall = wall;
+		b[i].cpu = cpu;
+#ifdef __APPLE__
+		b[i].rss = ru.ru_maxrss / 1024;	// Bytes, rather than KB
+#else
+		b[i].rss = ru.ru_maxrss;
+#endif
+	    }
+	}
+	if (b[i].rc == 127)
+	    b[i].skip = "not installed";
+    }
+
+    printf("Toolset %s over %s: %zu bytes, %ld lines; fastest of %d runs\n\n",
+	name, sample, m.len, lines, LPC_BENCHRUNS);
+    printf("%-14s %9s %9s %9s %12s %10s  %s\n", "backend", "wall s",
+	"cpu s", "MB/s", "lines/s", "peak RSS K", "output");
+    for (i = 0; i < nb; i++) {
+	printf("%-14s ", b[i].label);
+	if (b[i].skip) {
+	    printf("%9s %9s %9s %12s %10s  not run: %s\n", "-", "-", "-", "-",
+		"-", b[i].skip);
+	    continue;
+	}
+	secs = b[i].wall > 0 ? b[i].wall : 1e-9;
+	printf("%9.3f %9.3f %9.1f %12.0f %10ld  ", b[i].wall, b[i].cpu,
+	    m.len / secs / 1e6, lines / secs, b[i].rss);
+	if (b[i].rc == -1) {
+	    bad = 1;
+	    printf("killed\n");
+	    continue;
+	}
+	if (!ref) {		// The first to finish is what the others must make
+	    ref = &b[i];
+	    printf("reference");
+	} else if (lpc_bench_same(ref->out, b[i].out)) {
+	    printf("same");
+	} else {
+	    bad = 1;
+	    printf("DIFFERS from %s", ref->label);
+	}
+	// Not a failure as such: a pipeline ending in egrep that selects nothing exits 1
+	if (b[i].rc != 0)
+	    printf(" (exit %d)", b[i].rc);
+	printf("\n");
+    }
+
+    for (i = 0; i < nb; i++) {
+	unlink(b[i].out);
+	if (b[i].file[0])
+	    unlink(b[i].file);
+    }
+    rmdir(dir);
+    lpc_map_close(&m);
+    return bad;
+}
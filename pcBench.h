@@ -0,0 +1,54 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Cross-backend benchmark (--bench NAME SAMPLE).
+ *
+ * pipecut --bench runs the toolset NAME over the file SAMPLE in every way pipecut can
+ * run it: as the shell pipeline updateTextPipeline() writes for the UI's script, in the
+ * engine (-t, -P, -j), from a compiled toolset (-f), with --jit, and as each program
+ * --emit writes (C, built with $CC or cc, then awk, perl and python). Each backend
+ * runs as a process of its own, LPC_BENCHRUNS times, and the fastest run is kept. Its
+ * output must be byte-for-byte what the shell pipeline's is. The table on stdout gives
+ * throughput (MB/s and lines/s), wall and CPU time, and peak RSS, as wait4(2) reports
+ * them, so they include the shell, awk or interpreter a backend runs under. A backend
+ * that can't be run here (no compiler, no perl) is reported as such, and the others
+ * still are. The exit status is 0 if every backend that ran made the same output.
+ * --serve/--connect isn't in the table: the filtering happens in the server, whose
+ * time can't be told apart per request; it runs the toolset as -t does.
+ */
+
+#ifndef PCBENCH_H
+#define PCBENCH_H
+
+#define LPC_BENCHRUNS 3			// Runs of each backend; the fastest is reported
+
+int lpc_bench(const char *av0, const char *name, const char *sample);
+
+#endif
@@ -222,6 +222,23 @@ closeDB()
     sqlite3_close(db);
 }
 
+// Whether there's a toolset called name. pc_loadToolset(2) exits if there isn't.
+int
+pc_toolsetExists(const char *name)
+{
+    int bladecount = 0;
+
+    initDB(0);
+    sqlite3_prepare_v2(db, "SELECT bladecount from toolset where name = ? ;",
+	-1, &stmt, NULL);
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+	bladecount = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    closeDB();
+    return bladecount > 0;
+}
+
 // XXX Needs to be split front/back.
 void
 pc_loadToolset(int mode)
@@ -270,10 +287,12 @@ pc_loadToolset(int mode)
     sqlite3_finalize(stmt);
 
     if (bladecount < 1) {
-	mvprintw(uigbl.maxy - 1, 0, "No toolset with that name exists.");
-	if (mode == 2)
+	if (mode == 2) {	// No curses in filter mode
 	    fprintf(stderr,
 		"Pipecut Error: No toolset with specified name in ~/.pipecut.db\n");
+	    exit(-1);
+	}
+	mvprintw(uigbl.maxy - 1, 0, "No toolset with that name exists.");
 	getnstr(inc, 1024);
 	return;
     } else {
@@ -334,13 +353,16 @@ pc_loadToolset(int mode)
 	    lpc_newIN(pattern);
 	}			// YYY 
 	if (!strncmp((char *)typetmp, "SUMMARIZE", 20)) {
-	    lpc_newEX(pattern);
+	    lpc_newSUM();
+	}
+	if (!strncmp((char *)typetmp, "FORMAT", 20)) {
+	    lpc_newFMT(pattern);
 	}
 	if (!strncmp((char *)typetmp, "ORDER", 20)) {
-	    lpc_newEX(pattern);
+	    lpc_newORD(pattern);
 	}
 	if (!strncmp((char *)typetmp, "UNIQUE", 20)) {
-	    lpc_newEX(pattern);
+	    lpc_newUNQ(pattern);
 	}
 
 	free(pattern);
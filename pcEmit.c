@@ -0,0 +1,1020 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Code generation. See pcEmit.h. */
+
+#include "pipecut.h"
+#include "pcDB.h"
+#include "pcEmit.h"
+#include "pcExec.h"
+#include "pcMatch.h"
+#include "pcPlan.h"
+#include "pcScan.h"
+#include "pcSort.h"
+#include "pcSubst.h"
+
+/* The program's fixed parts */
+
+static const char lpc_emit_base[] =
+    "\n#define BUFSIZE (256 * 1024)\n"
+    "\n"
+    "#define ISBLANK(c) ((c) == ' ' || (c) == '\\t')\n"
+    "\n"
+    "/* Every line handed to a stage is followed by a NUL. */\n"
+    "static int noeol;		/* The line is the input's last, and had no '\\n' */\n"
+    "static int done;		/* Stages before this one (from 1) want no more input */\n"
+    "static int outfd = 1;		/* stdout, or the shell running the rest */\n"
+    "static int werr;		/* errno of a failed write: we stop then */\n"
+    "static char obuf[BUFSIZE];\n"
+    "static size_t olen;\n"
+    "\n"
+    "struct text {\n"
+    "    char *p;\n"
+    "    size_t len;\n"
+    "    size_t cap;\n"
+    "};\n"
+    "\n"
+    "static void *\n"
+    "xrealloc(void *p, size_t size)\n"
+    "{\n"
+    "    if (!(p = realloc(p, size))) {\n"
+    "        fprintf(stderr, \"%s: out of memory\\n\", PROG);\n"
+    "        exit(1);\n"
+    "    }\n"
+    "    return p;\n"
+    "}\n"
+    "\n"
+    "static void\n"
+    "flush(void)\n"
+    "{\n"
+    "    size_t off = 0;\n"
+    "    ssize_t n;\n"
+    "\n"
+    "    while (off < olen) {\n"
+    "        n = write(outfd, obuf + off, olen - off);\n"
+    "        if (n < 0 && errno == EINTR)\n"
+    "            continue;\n"
+    "        if (n < 0) {\n"
+    "            werr = errno;\n"
+    "            done = INT_MAX;\n"
+    "            break;\n"
+    "        }\n"
+    "        off += n;\n"
+    "    }\n"
+    "    olen = 0;\n"
+    "}\n"
+    "\n"
+    "/* The end of the toolset: a line of output */\n"
+    "static void\n"
+    "output(const char *p, size_t len)\n"
+    "{\n"
+    "    size_t n;\n"
+    "\n"
+    "    while (len + 1 > sizeof(obuf) - olen) {\n"
+    "        n = sizeof(obuf) - olen < len ? sizeof(obuf) - olen : len;\n"
+    "        memcpy(obuf + olen, p, n);\n"
+    "        olen += n;\n"
+    "        p += n;\n"
+    "        len -= n;\n"
+    "        flush();\n"
+    "    }\n"
+    "    memcpy(obuf + olen, p, len);\n"
+    "    olen += len;\n"
+    "    if (!noeol)\n"
+    "        obuf[olen++] = '\\n';\n"
+    "}\n";
+
+static const char lpc_emit_put[] =
+    "\n"
+    "/* Append to t, and NUL terminate it */\n"
+    "static void\n"
+    "put(struct text *t, const char *p, size_t len)\n"
+    "{\n"
+    "    if (t->len + len + 1 > t->cap) {\n"
+    "        t->cap = 2 * (t->len + len + 1);\n"
+    "        t->p = xrealloc(t->p, t->cap);\n"
+    "    }\n"
+    "    memcpy(t->p + t->len, p, len);\n"
+    "    t->len += len;\n"
+    "    t->p[t->len] = '\\0';\n"
+    "}\n"
+;
+
+static const char lpc_emit_re[] =
+    "\n"
+    "static void\n"
+    "recomp(regex_t *re, const char *pattern)\n"
+    "{\n"
+    "    if (regcomp(re, pattern, REG_EXTENDED | REG_NOSUB)) {\n"
+    "        fprintf(stderr, \"%s: regex compile failed: %s\\n\", PROG, pattern);\n"
+    "        exit(1);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static int\n"
+    "rematch(const regex_t *re, const char *p, size_t len)\n"
+    "{\n"
+    "    int rc;\n"
+    "#ifdef REG_STARTEND\n"
+    "    regmatch_t pm[1];\n"
+    "\n"
+    "    pm[0].rm_so = 0;\n"
+    "    pm[0].rm_eo = len;\n"
+    "    rc = regexec(re, p, 1, pm, REG_STARTEND);\n"
+    "#else\n"
+    "    rc = regexec(re, p, 0, NULL, 0);\n"
+    "#endif\n"
+    "    if (rc != 0 && rc != REG_NOMATCH) {\n"
+    "        fprintf(stderr, \"%s: regex execution failed = %d\\n\", PROG, rc);\n"
+    "        exit(1);\n"
+    "    }\n"
+    "    return rc == 0;\n"
+    "}\n";
+
+static const char lpc_emit_fields[] =
+    "\n"
+    "struct span {\n"
+    "    const char *p;\n"
+    "    size_t len;\n"
+    "};\n"
+    "\n"
+    "/* Split a line into awk fields at blanks, up to max of them (-1 for all) */\n"
+    "static int\n"
+    "fields(const char *p, size_t len, int max, struct span **f, int *cap)\n"
+    "{\n"
+    "    const char *e = p + len, *s;\n"
+    "    int n = 0;\n"
+    "\n"
+    "    while (n != max) {\n"
+    "        while (p < e && ISBLANK(*p))\n"
+    "            p++;\n"
+    "        if (p == e)\n"
+    "            break;\n"
+    "        for (s = p; p < e && !ISBLANK(*p); p++)\n"
+    "            ;\n"
+    "        if (n == *cap) {\n"
+    "            *cap = *cap ? 2 * *cap : 64;\n"
+    "            *f = xrealloc(*f, *cap * sizeof(struct span));\n"
+    "        }\n"
+    "        (*f)[n].p = s;\n"
+    "        (*f)[n].len = p - s;\n"
+    "        n++;\n"
+    "    }\n"
+    "    return n;\n"
+    "}\n";
+
+static const char lpc_emit_wc[] =
+    "\n"
+    "struct wcount {\n"
+    "    long lines;\n"
+    "    long words;\n"
+    "    long bytes;\n"
+    "    int inword;\n"
+    "};\n"
+    "\n"
+    "/* The words in a line (which holds no '\\n'), going on from c->inword */\n"
+    "static void\n"
+    "wc(struct wcount *c, const char *s, size_t len)\n"
+    "{\n"
+    "    static unsigned char class[256];	/* 1 space, 2 word character */\n"
+    "    const unsigned char *p = (const unsigned char *)s, *e = p + len;\n"
+    "    long words = 0;\n"
+    "    int k, in = c->inword;\n"
+    "\n"
+    "    if (!class[' '])\n"
+    "        for (k = 0; k < 256; k++)\n"
+    "            class[k] = ISSPACE(k) ? 1 : ISWORD(k) ? 2 : 0;\n"
+    "    for (; p < e; p++) {\n"
+    "        if ((k = class[*p])) {\n"
+    "            words += (k == 2) & !in;\n"
+    "            in = (k == 2);\n"
+    "        }\n"
+    "    }\n"
+    "    c->words += words;\n"
+    "    c->inword = in;\n"
+    "    c->bytes += len;\n"
+    "}\n";
+
+// sort(1) in the C locale, as pcSort.c compares lines
+static const char lpc_emit_sort[] =
+    "\n"
+    "#define ISDIGIT(c) ((unsigned)((c) - '0') < 10)\n"
+    "\n"
+    "struct sortkey {\n"
+    "    size_t sword, schar;	/* Start field and character, from 0 */\n"
+    "    size_t eword, echar;	/* End: SIZE_MAX for the end of the line, 0 for the field's */\n"
+    "    int skipsblanks, skipeblanks, numeric, fold, reverse;\n"
+    "};\n"
+    "\n"
+    "struct sortspec {\n"
+    "    const struct sortkey *keys;\n"
+    "    int nkeys;\n"
+    "    int tab;			/* -t, or -1 for blanks */\n"
+    "    int reverse;\n"
+    "    int stable;\n"
+    "};\n"
+    "\n"
+    "struct sortrec {\n"
+    "    size_t off;			/* Of the line, in the stage's text */\n"
+    "    size_t len;\n"
+    "    size_t idx;			/* Input order, for equal keys */\n"
+    "};\n"
+    "\n"
+    "static const char *\n"
+    "begfield(const struct sortspec *sp, const struct sortkey *k, const char *p,\n"
+    "    const char *lim)\n"
+    "{\n"
+    "    size_t sword = k->sword;\n"
+    "\n"
+    "    while (p < lim && sword--) {\n"
+    "        if (sp->tab >= 0) {\n"
+    "            while (p < lim && (unsigned char)*p != sp->tab)\n"
+    "                p++;\n"
+    "            if (p < lim)\n"
+    "                p++;\n"
+    "        } else {\n"
+    "            while (p < lim && ISBLANK(*p))\n"
+    "                p++;\n"
+    "            while (p < lim && !ISBLANK(*p))\n"
+    "                p++;\n"
+    "        }\n"
+    "    }\n"
+    "    if (k->skipsblanks)\n"
+    "        while (p < lim && ISBLANK(*p))\n"
+    "            p++;\n"
+    "    return (size_t)(lim - p) < k->schar ? lim : p + k->schar;\n"
+    "}\n"
+    "\n"
+    "static const char *\n"
+    "limfield(const struct sortspec *sp, const struct sortkey *k, const char *p,\n"
+    "    const char *lim)\n"
+    "{\n"
+    "    size_t eword = k->eword, echar = k->echar;\n"
+    "\n"
+    "    if (echar == 0)\n"
+    "        eword++;\n"
+    "    while (p < lim && eword--) {\n"
+    "        if (sp->tab >= 0) {\n"
+    "            while (p < lim && (unsigned char)*p != sp->tab)\n"
+    "                p++;\n"
+    "            if (p < lim && (eword || echar))\n"
+    "                p++;\n"
+    "        } else {\n"
+    "            while (p < lim && ISBLANK(*p))\n"
+    "                p++;\n"
+    "            while (p < lim && !ISBLANK(*p))\n"
+    "                p++;\n"
+    "        }\n"
+    "    }\n"
+    "    if (echar != 0) {\n"
+    "        if (k->skipeblanks)\n"
+    "            while (p < lim && ISBLANK(*p))\n"
+    "                p++;\n"
+    "        p = (size_t)(lim - p) < echar ? lim : p + echar;\n"
+    "    }\n"
+    "    return p;\n"
+    "}\n"
+    "\n"
+    "/* sort -n: blanks, an optional '-', digits and a fraction; anything else is 0 */\n"
+    "static void\n"
+    "number(const char *p, const char *lim, int *neg, const char **ip,\n"
+    "    size_t *ilen, const char **fp, size_t *flen)\n"
+    "{\n"
+    "    const char *q;\n"
+    "\n"
+    "    while (p < lim && ISBLANK(*p))\n"
+    "        p++;\n"
+    "    if ((*neg = (p < lim && *p == '-')))\n"
+    "        p++;\n"
+    "    while (p < lim && *p == '0')\n"
+    "        p++;\n"
+    "    for (*ip = p; p < lim && ISDIGIT(*p); p++)\n"
+    "        ;\n"
+    "    *ilen = p - *ip;\n"
+    "    *fp = p;\n"
+    "    *flen = 0;\n"
+    "    if (p < lim && *p == '.') {\n"
+    "        for (*fp = ++p; p < lim && ISDIGIT(*p); p++)\n"
+    "            ;\n"
+    "        for (q = p; q > *fp && q[-1] == '0'; q--)\n"
+    "            ;\n"
+    "        *flen = q - *fp;\n"
+    "    }\n"
+    "    if (*ilen == 0 && *flen == 0)\n"
+    "        *neg = 0;\n"
+    "}\n"
+    "\n"
+    "static int\n"
+    "numcmp(const char *a, const char *alim, const char *b, const char *blim)\n"
+    "{\n"
+    "    const char *xi, *xf, *yi, *yf;\n"
+    "    size_t xil, xfl, yil, yfl;\n"
+    "    int xneg, yneg, diff;\n"
+    "\n"
+    "    number(a, alim, &xneg, &xi, &xil, &xf, &xfl);\n"
+    "    number(b, blim, &yneg, &yi, &yil, &yf, &yfl);\n"
+    "    if (xneg != yneg)\n"
+    "        return xneg ? -1 : 1;\n"
+    "    if (xil != yil)\n"
+    "        diff = xil < yil ? -1 : 1;\n"
+    "    else if (!(diff = memcmp(xi, yi, xil))) {\n"
+    "        diff = memcmp(xf, yf, xfl < yfl ? xfl : yfl);\n"
+    "        if (!diff)\n"
+    "            diff = xfl < yfl ? -1 : xfl != yfl;\n"
+    "    }\n"
+    "    return xneg ? -diff : diff;\n"
+    "}\n"
+    "\n"
+    "static int\n"
+    "foldcmp(const char *a, size_t alen, const char *b, size_t blen)\n"
+    "{\n"
+    "    size_t i, n = alen < blen ? alen : blen;\n"
+    "    int diff;\n"
+    "\n"
+    "    for (i = 0; i < n; i++)\n"
+    "        if ((diff = toupper((unsigned char)a[i]) - toupper((unsigned char)b[i])))\n"
+    "            return diff;\n"
+    "    return alen < blen ? -1 : alen != blen;\n"
+    "}\n"
+    "\n"
+    "static int\n"
+    "bytecmp(const char *a, size_t alen, const char *b, size_t blen)\n"
+    "{\n"
+    "    int diff = memcmp(a, b, alen < blen ? alen : blen);\n"
+    "\n"
+    "    return diff ? diff : alen < blen ? -1 : alen != blen;\n"
+    "}\n"
+    "\n"
+    "static int\n"
+    "sortcmp(const struct sortspec *sp, const char *a, size_t alen, const char *b,\n"
+    "    size_t blen)\n"
+    "{\n"
+    "    const struct sortkey *k;\n"
+    "    const char *ta, *la, *tb, *lb;\n"
+    "    int i, diff;\n"
+    "\n"
+    "    for (i = 0; i < sp->nkeys; i++) {\n"
+    "        k = &sp->keys[i];\n"
+    "        ta = begfield(sp, k, a, a + alen);\n"
+    "        la = k->eword == SIZE_MAX ? a + alen : limfield(sp, k, a, a + alen);\n"
+    "        tb = begfield(sp, k, b, b + blen);\n"
+    "        lb = k->eword == SIZE_MAX ? b + blen : limfield(sp, k, b, b + blen);\n"
+    "        if (la < ta)\n"
+    "            la = ta;\n"
+    "        if (lb < tb)\n"
+    "            lb = tb;\n"
+    "        if (k->numeric)\n"
+    "            diff = numcmp(ta, la, tb, lb);\n"
+    "        else if (k->fold)\n"
+    "            diff = foldcmp(ta, la - ta, tb, lb - tb);\n"
+    "        else\n"
+    "            diff = bytecmp(ta, la - ta, tb, lb - tb);\n"
+    "        if (diff)\n"
+    "            return k->reverse ? -diff : diff;\n"
+    "    }\n"
+    "    if (sp->stable)\n"
+    "        return 0;\n"
+    "    diff = bytecmp(a, alen, b, blen);\n"
+    "    return sp->reverse ? -diff : diff;\n"
+    "}\n";
+
+/* Writing the program */
+
+/* p as a C string literal. Anything but plain printable text is an octal escape, and
+ * so is a '/' after a '*' and a '?' after a '?', so that the literal can go in a
+ * comment too, and never reads as a trigraph.
+ */
+static void
+lpc_emit_str(FILE *out, const char *p, size_t len)
+{
+    unsigned char c, prev = 0;
+    size_t i;
+
+    putc('"', out);
+    for (i = 0; i < len; i++, prev = c) {
+	c = p[i];
+	if (c == '"' || c == '\\')
+	    fprintf(out, "\\%c", c);
+	else if (c == '\n')
+	    fputs("\\n", out);
+	else if (c == '\t')
+	    fputs("\\t", out);
+	else if (c < ' ' || c >= 0x7f || (c == '/' && prev == '*')
+	    || (c == '?' && prev == '?'))
+	    fprintf(out, "\\%03o", c);
+	else
+	    putc(c, out);
+    }
+    putc('"', out);
+}
+
+// A /* */ comment naming the blade step k runs, in front of its code
+static void
+lpc_emit_comment(struct lpc_emitter *em, int k)
+{
+    struct lpc_estep *sp = &em->steps[k];
+    char type[32];
+
+    txtFromType(type, sp->ttype);
+    fprintf(em->out, "\n/* %d: %s ", k, type);
+    lpc_emit_str(em->out, sp->pattern, strlen(sp->pattern));
+    fprintf(em->out, " */\n");
+}
+
+static void
+lpc_emit_stepfree(struct lpc_estep *sp)
+{
+    free(sp->pattern);
+    free(sp->sort);
+    free(sp->uniq);
+    memset(sp, 0, sizeof(struct lpc_estep));
+}
+
+/* Fill in sp for the blade te. Returns 0 if the generated program can't run it: it
+ * goes to the shell then, with the rest of the toolset.
+ */
+static int
+lpc_emit_step(struct lpc_emitter *em, struct lpc_estep *sp,
+    struct toolelement *te)
+{
+    struct lpc_subst sb;
+    struct lpc_lines *ln;
+    const char *patt = te->pattern;
+    int ok = 1;
+
+    memset(sp, 0, sizeof(struct lpc_estep));
+    memset(&sb, 0, sizeof(struct lpc_subst));
+    sp->ttype = te->ttype;
+    if (te->ttype == BLACKBOX) {
+	switch (lpc_subst_parse(te->pattern, &sb)) {
+	case LPC_SUB_BLADE:
+	    sp->ttype = sb.ttype;
+	    patt = sb.pattern;
+	    break;
+	case LPC_SUB_HEAD:
+	    ln = sb.spec;
+	    sp->kind = LPC_SUB_HEAD;
+	    sp->count = ln->count;
+	    break;
+	case LPC_SUB_COUNT:
+	    sp->kind = LPC_SUB_COUNT;
+	    break;
+	default:
+	    ok = 0;
+	    break;
+	}
+    }
+    switch (sp->ttype) {
+    case INCLUDE:
+    case EXCLUDE:
+	ok = em->lang != LPC_LANG_AWK || lpc_script_awkre(patt);
+	break;
+    case FORMAT:
+	break;
+    case SUMMARIZE:		// awk can't count bytes in every locale. wc(1) does it.
+	ok = em->lang != LPC_LANG_AWK;
+	break;
+    case ORDER:		// In the engine, --jit or not: it sorts on every core
+	sp->sort = malloc(sizeof(struct lpc_sortspec));
+	ok = !(em->flags & LPC_EMIT_LIB) && em->lang != LPC_LANG_AWK
+	    && lpc_sort_clocale() && lpc_sortspec_parse(sp->sort, patt);
+	break;
+    case UNIQUE:
+	sp->uniq = malloc(sizeof(struct lpc_uniqspec));
+	ok = lpc_uniqspec_parse(sp->uniq, patt);
+	break;
+    case BLACKBOX:		// awk can't tell a last line with no '\n' from the rest
+	ok = ok && (em->lang != LPC_LANG_AWK || em->nsteps > 0);
+	break;
+    default:
+	ok = 0;
+	break;
+    }
+    if (ok)
+	sp->pattern = strdup(patt);
+    else
+	lpc_emit_stepfree(sp);
+    lpc_subst_free(&sb);
+    return ok;
+}
+
+// Steps for the blades, as lpc_compile() would make stages of them
+void
+lpc_emit_steps(struct lpc_emitter *em, struct tailhead *blades)
+{
+    struct lpc_format *fmt;
+    struct lpc_estep *sp;
+    struct toolelement *te;
+    char *lit;
+    int n = 0;
+
+    TAILQ_FOREACH(te, blades, entries) {
+	n++;
+    }
+    em->steps = calloc(n + 1, sizeof(struct lpc_estep));
+    TAILQ_FOREACH(te, blades, entries) {
+	if (em->tail[0] == '\0' && (te->ttype == STDIN || te->ttype == CAT
+		|| te->ttype == TNONE))
+	    continue;		// The source is the program's stdin
+	sp = &em->steps[em->nsteps];
+	if (em->tail[0] == '\0' && lpc_emit_step(em, sp, te)) {
+	    switch (sp->ttype) {
+	    case INCLUDE:
+	    case EXCLUDE:
+		lit = malloc(strlen(sp->pattern) + 1);
+		if ((sp->needre = (lpc_plainstring(sp->pattern, lit) <= 0)))
+		    em->uses |= LPC_EUSE_RE;
+		free(lit);
+		break;
+	    case FORMAT:
+		fmt = lpc_format_new(sp->pattern);
+		if (fmt->maxfield)
+		    em->uses |= LPC_EUSE_FIELDS;
+		lpc_format_free(fmt);
+		em->uses |= LPC_EUSE_TEXT;
+		break;
+	    case UNIQUE:
+		em->uses |= LPC_EUSE_TEXT;
+		break;
+	    case SUMMARIZE:
+		em->uses |= LPC_EUSE_WC;
+		break;
+	    case ORDER:
+		em->uses |= LPC_EUSE_SORT | LPC_EUSE_TEXT;
+		break;
+	    default:
+		break;
+	    }
+	    em->nsteps++;
+	    continue;
+	}
+	lpc_tailtext(em->tail, te);
+    }
+}
+
+// INCLUDE/EXCLUDE: return from the stage if the line is to go
+static void
+lpc_emit_grep(struct lpc_emitter *em, int k)
+{
+    struct lpc_estep *sp = &em->steps[k];
+    FILE *out = em->out;
+    char *lit = malloc(strlen(sp->pattern) + 1);
+    int n, keep = (sp->ttype == INCLUDE);
+
+    if (!sp->needre) {
+	n = lpc_plainstring(sp->pattern, lit);
+	fprintf(out, "    if (%smemmem(p, len, ", keep ? "!" : "");
+	lpc_emit_str(out, lit, n);
+	fprintf(out, ", %d))\n        return;\n", n);
+    } else if ((n = lpc_reqlit(sp->pattern, lit)) >= LPC_MINLIT) {
+	// Only lines holding the required literal go to regexec
+	fprintf(out, "    if (%smemmem(p, len, ", keep ? "!" : "");
+	lpc_emit_str(out, lit, n);
+	fprintf(out, ", %d) %s rematch(&re%d, p, len))\n        return;\n", n,
+	    keep ? "|| !" : "&&", k);
+    } else {
+	fprintf(out, "    if (%srematch(&re%d, p, len))\n        return;\n",
+	    keep ? "!" : "", k);
+    }
+    fprintf(out, "    noeol = 0;\n    s%d(p, len);\n}\n", k + 1);
+    free(lit);
+}
+
+static void
+lpc_emit_formatvars(struct lpc_emitter *em, int k)
+{
+    struct lpc_format *fmt = lpc_format_new(em->steps[k].pattern);
+
+    if (fmt->maxfield)
+	fprintf(em->out, "static struct span *f%d;\nstatic int fcap%d;\n", k,
+	    k);
+    fprintf(em->out, "static struct text o%d;\n\n", k);
+    lpc_format_free(fmt);
+}
+
+// FORMAT: build each output line in o<k>, and pass it on
+static void
+lpc_emit_format(struct lpc_emitter *em, int k)
+{
+    struct lpc_format *fmt = lpc_format_new(em->steps[k].pattern);
+    struct lpc_fmtpart *fp;
+    FILE *out = em->out;
+    int i;
+
+    if (fmt->maxfield)
+	fprintf(out, "    int nf = fields(p, len, %d, &f%d, &fcap%d);\n\n",
+	    fmt->maxfield, k, k);
+    for (i = 0; i <= fmt->nparts; i++) {
+	fp = &fmt->parts[i];
+	if (i == fmt->nparts || fp->what == LPC_FMT_EOL) {
+	    fprintf(out, "    put(&o%d, \"\", 0);\n    noeol = 0;\n"
+		"    s%d(o%d.p, o%d.len);\n    o%d.len = 0;\n", k, k + 1, k, k,
+		k);
+	    continue;
+	}
+	switch (fp->what) {
+	case LPC_FMT_TEXT:
+	    fprintf(out, "    put(&o%d, ", k);
+	    lpc_emit_str(out, fmt->text + fp->off, fp->len);
+	    fprintf(out, ", %zu);\n", fp->len);
+	    break;
+	case LPC_FMT_NF:	// $NF is $0 on a line with no fields
+	    fprintf(out, "    if (nf)\n"
+		"        put(&o%d, f%d[nf - 1].p, f%d[nf - 1].len);\n"
+		"    else\n        put(&o%d, p, len);\n", k, k, k, k);
+	    break;
+	case 0:
+	    fprintf(out, "    put(&o%d, p, len);\n", k);
+	    break;
+	default:
+	    fprintf(out, "    if (nf >= %d)\n"
+		"        put(&o%d, f%d[%d].p, f%d[%d].len);\n", fp->what, k, k,
+		fp->what - 1, k, fp->what - 1);
+	    break;
+	}
+    }
+    fprintf(out, "}\n");
+    lpc_format_free(fmt);
+}
+
+// The function for step k: s<k>(line), and e<k>() at the end of input
+static void
+lpc_emit_stage(struct lpc_emitter *em, int k)
+{
+    struct lpc_estep *sp = &em->steps[k];
+    FILE *out = em->out;
+    const struct lpc_sortkey *key;
+    int i;
+
+    lpc_emit_comment(em, k);
+    switch (sp->ttype) {
+    case INCLUDE:
+    case EXCLUDE:
+	fprintf(out, "static void\ns%d(const char *p, size_t len)\n{\n", k);
+	lpc_emit_grep(em, k);
+	break;
+    case FORMAT:
+	lpc_emit_formatvars(em, k);
+	fprintf(out, "static void\ns%d(const char *p, size_t len)\n{\n", k);
+	lpc_emit_format(em, k);
+	break;
+    case SUMMARIZE:
+	fprintf(out, "static struct wcount w%d;\n\n"
+	    "static void\ns%d(const char *p, size_t len)\n{\n"
+	    "    wc(&w%d, p, len);\n"
+	    "    if (!noeol) {		/* wc only counts newlines */\n"
+	    "        w%d.lines++;\n        w%d.bytes++;\n"
+	    "        w%d.inword = 0;\n    }\n}\n\n", k, k, k, k, k, k);
+	fprintf(out, "static void\ne%d(void)\n{\n    char b[80];\n    int n;\n\n"
+	    "    if (done <= %d) {\n"
+	    "        n = snprintf(b, sizeof(b), WCFMT, w%d.lines, w%d.words, "
+	    "w%d.bytes);\n"
+	    "        b[--n] = '\\0';\n        noeol = 0;\n        s%d(b, n);\n"
+	    "    }\n    e%d();\n}\n", k, k + 1, k, k, k, k + 1, k + 1);
+	break;
+    case UNIQUE:
+	fprintf(out, "static struct text u%d;	/* The current group's line */\n"
+	    "static long n%d;			/* How many times it came */\n", k, k);
+	if (sp->uniq->count)
+	    fprintf(out, "static struct text o%d;\n", k);
+	fprintf(out, "\nstatic void\ng%d(void)\n{\n", k);
+	if (sp->uniq->count)
+	    fprintf(out, "    char pre[32];\n\n");
+	if (sp->uniq->dups)
+	    fprintf(out, "    if (n%d == 1)\n        return;\n", k);
+	if (sp->uniq->uniqs)
+	    fprintf(out, "    if (n%d > 1)\n        return;\n", k);
+	fprintf(out, "    noeol = 0;\n");
+	if (sp->uniq->count)
+	    fprintf(out, "    o%d.len = 0;\n"
+		"    put(&o%d, pre, snprintf(pre, sizeof(pre), UNIQFMT, n%d));\n"
+		"    put(&o%d, u%d.p, u%d.len);\n    s%d(o%d.p, o%d.len);\n",
+		k, k, k, k, k, k, k + 1, k, k);
+	else
+	    fprintf(out, "    s%d(u%d.p, u%d.len);\n", k + 1, k, k);
+	fprintf(out, "}\n\n");
+	fprintf(out, "static void\ns%d(const char *p, size_t len)\n{\n"
+	    "    if (n%d && len == u%d.len && !memcmp(p, u%d.p, len)) {\n"
+	    "        n%d++;\n        return;\n    }\n"
+	    "    if (n%d)\n        g%d();\n"
+	    "    u%d.len = 0;\n    put(&u%d, p, len);\n    n%d = 1;\n}\n\n", k,
+	    k, k, k, k, k, k, k, k, k);
+	fprintf(out, "static void\ne%d(void)\n{\n"
+	    "    if (done <= %d && n%d)\n        g%d();\n    e%d();\n}\n", k,
+	    k + 1, k, k, k + 1);
+	break;
+    case ORDER:
+	if (sp->sort->nkeys) {
+	    fprintf(out, "static const struct sortkey k%d[] = {\n", k);
+	    for (i = 0; i < sp->sort->nkeys; i++) {
+		key = &sp->sort->keys[i];
+		fprintf(out, "    {%zu, %zu, ", key->sword, key->schar);
+		if (key->eword == SIZE_MAX)
+		    fprintf(out, "SIZE_MAX");
+		else
+		    fprintf(out, "%zu", key->eword);
+		fprintf(out, ", %zu, %d, %d, %d, %d, %d},\n", key->echar,
+		    key->skipsblanks, key->skipeblanks, key->numeric,
+		    key->fold, key->reverse);
+	    }
+	    fprintf(out, "};\n");
+	}
+	fprintf(out, "static const struct sortspec spec%d = {", k);
+	if (sp->sort->nkeys)
+	    fprintf(out, "k%d", k);
+	else
+	    fprintf(out, "NULL");
+	fprintf(out, ", %d, %d, %d, %d};\n", sp->sort->nkeys, sp->sort->tab,
+	    sp->sort->reverse, sp->sort->stable);
+	fprintf(out, "static struct text a%d;		/* The lines, each NUL "
+	    "terminated */\nstatic struct sortrec *r%d;\n"
+	    "static size_t n%d, cap%d;\n\n", k, k, k, k);
+	fprintf(out, "static int\ncmp%d(const void *x, const void *y)\n{\n"
+	    "    const struct sortrec *a = x, *b = y;\n"
+	    "    int diff = sortcmp(&spec%d, a%d.p + a->off, a->len, "
+	    "a%d.p + b->off, b->len);\n\n"
+	    "    return diff ? diff : (a->idx > b->idx) - (a->idx < b->idx);\n"
+	    "}\n\n", k, k, k, k);
+	fprintf(out, "static void\ns%d(const char *p, size_t len)\n{\n"
+	    "    if (n%d == cap%d) {\n"
+	    "        cap%d = cap%d ? 2 * cap%d : 1024;\n"
+	    "        r%d = xrealloc(r%d, cap%d * sizeof(struct sortrec));\n"
+	    "    }\n"
+	    "    r%d[n%d].off = a%d.len;\n    r%d[n%d].len = len;\n"
+	    "    r%d[n%d].idx = n%d;\n    n%d++;\n"
+	    "    put(&a%d, p, len + 1);\n}\n\n", k, k, k, k, k, k, k, k, k, k,
+	    k, k, k, k, k, k, k, k, k);
+	fprintf(out, "static void\ne%d(void)\n{\n    size_t i;\n\n"
+	    "    if (done <= %d) {\n"
+	    "        qsort(r%d, n%d, sizeof(struct sortrec), cmp%d);\n"
+	    "        noeol = 0;\n"
+	    "        for (i = 0; i < n%d && done <= %d; i++)\n"
+	    "            s%d(a%d.p + r%d[i].off, r%d[i].len);\n"
+	    "    }\n    e%d();\n}\n", k, k + 1, k, k, k, k, k + 1, k + 1, k,
+	    k, k, k + 1);
+	break;
+    case BLACKBOX:
+	if (sp->kind == LPC_SUB_HEAD) {
+	    fprintf(out, "static long h%d = %ld;\n\n"
+		"static void\ns%d(const char *p, size_t len)\n{\n"
+		"    if (h%d > 0) {\n        h%d--;\n        s%d(p, len);\n    }\n"
+		"    if (h%d == 0 && done < %d)\n        done = %d;\n}\n", k,
+		sp->count, k, k, k, k + 1, k, k + 1, k + 1);
+	} else {		// wc -l
+	    fprintf(out, "static long c%d;\n\n"
+		"static void\ns%d(const char *p, size_t len)\n{\n"
+		"    if (!noeol)\n        c%d++;\n}\n\n", k, k, k);
+	    fprintf(out, "static void\ne%d(void)\n{\n    char b[32];\n\n"
+		"    if (done <= %d) {\n        noeol = 0;\n"
+		"        s%d(b, snprintf(b, sizeof(b), WCLFMT, c%d));\n"
+		"    }\n    e%d();\n}\n", k, k + 1, k + 1, k, k + 1);
+	}
+	break;
+    default:
+	break;
+    }
+    // Stages with nothing to do at the end of input
+    if (sp->ttype == INCLUDE || sp->ttype == EXCLUDE || sp->ttype == FORMAT
+	|| (sp->ttype == BLACKBOX && sp->kind == LPC_SUB_HEAD))
+	fprintf(out, "\nstatic void\ne%d(void)\n{\n    e%d();\n}\n", k, k + 1);
+}
+
+// The read loop, with main() or the --jit entry point around it
+static void
+lpc_emit_main(struct lpc_emitter *em)
+{
+    FILE *out = em->out;
+    int k;
+
+    fprintf(out, "\n/* Hand the input to s0() a line at a time. rd() is read(2). */\n"
+	"static void\nrun(ssize_t (*rd)(void *, char *, size_t), void *arg)\n{\n"
+	"    size_t cap = BUFSIZE, have = 0;\n"
+	"    char *buf = xrealloc(NULL, cap + 1), *bol, *eol, *end;\n"
+	"    ssize_t n;\n\n");
+    for (k = 0; k < em->nsteps; k++) {
+	if (em->steps[k].needre) {
+	    fprintf(out, "    recomp(&re%d, ", k);
+	    lpc_emit_str(out, em->steps[k].pattern,
+		strlen(em->steps[k].pattern));
+	    fprintf(out, ");\n");
+	}
+    }
+    fprintf(out, "    while (!done) {\n"
+	"        n = rd(arg, buf + have, cap - have);\n"
+	"        if (n < 0 && errno == EINTR)\n            continue;\n"
+	"        if (n < 0) {\n"
+	"            fprintf(stderr, \"%%s: read error: %%s\\n\", PROG, "
+	"strerror(errno));\n"
+	"            exit(1);\n        }\n"
+	"        if (n == 0)\n            break;\n"
+	"        end = buf + have + n;\n"
+	"        for (bol = buf; !done && (eol = memchr(bol, '\\n', end - bol));\n"
+	"            bol = eol + 1) {\n"
+	"            *eol = '\\0';\n            s0(bol, eol - bol);\n        }\n"
+	"        have = end - bol;\n        memmove(buf, bol, have);\n"
+	"        if (have == cap)		/* A line longer than the buffer */\n"
+	"            buf = xrealloc(buf, (cap *= 2) + 1);\n"
+	"        flush();		/* Don't sit on output a reader is waiting for */\n"
+	"    }\n"
+	"    if (have && !done) {\n        buf[have] = '\\0';\n"
+	"        noeol = 1;\n        s0(buf, have);\n    }\n"
+	"    e0();\n    flush();\n    free(buf);\n}\n");
+    if (em->flags & LPC_EMIT_LIB) {
+	fprintf(out, "\n/* pipecut runs the toolset with this, once, in place of its "
+	    "engine. Output\n * goes to fd. Returns -1, with errno set, if a "
+	    "write failed. */\nint\n"
+	    "pipecut_jit(ssize_t (*rd)(void *, char *, size_t), void *arg, "
+	    "int fd)\n{\n    outfd = fd;\n    run(rd, arg);\n"
+	    "    errno = werr;\n    return werr ? -1 : 0;\n}\n");
+	return;
+    }
+    fprintf(out, "\nstatic ssize_t\nrdfd(void *arg, char *buf, size_t len)\n{\n"
+	"    return read(*(int *)arg, buf, len);\n}\n\n"
+	"int\nmain(void)\n{\n    int fd = 0;\n");
+    if (em->tail[0])
+	fprintf(out, "    FILE *shell;\n    int rc;\n");
+    fprintf(out, "\n");
+    /* The shell may stop reading before we stop writing (head, false ...): write()
+     * fails with EPIPE then and run() stops, and the shell's status is ours, as it
+     * would be at the end of a pipeline. The shell gets SIGPIPE as usual. */
+    if (em->tail[0]) {
+	fprintf(out, "    if (!(shell = popen(TAIL, \"w\"))) {\n"
+	    "        fprintf(stderr, \"%%s: could not start %%s\\n\", PROG, TAIL);\n"
+	    "        exit(1);\n    }\n    outfd = fileno(shell);\n"
+	    "    signal(SIGPIPE, SIG_IGN);\n");
+    }
+    fprintf(out, "    run(rdfd, &fd);\n"
+	"    if (werr && werr != EPIPE)\n"
+	"        fprintf(stderr, \"%%s: write error: %%s\\n\", PROG, "
+	"strerror(werr));\n");
+    if (em->tail[0]) {
+	fprintf(out, "    if ((rc = pclose(shell)) == -1 || (werr && werr != EPIPE))\n"
+	    "        return 1;\n"
+	    "    return WIFEXITED(rc) ? WEXITSTATUS(rc) : 128 + WTERMSIG(rc);\n}\n");
+	return;
+    }
+    fprintf(out, "    return werr ? 1 : 0;\n}\n");
+}
+
+static void
+lpc_emit_c(struct lpc_emitter *em, const char *name)
+{
+    FILE *out = em->out;
+    int k;
+
+    if (em->flags & LPC_EMIT_LIB) {
+	name = "pipecut";
+	fprintf(out, "/* A toolset, generated by pipecut --jit, to be built as a "
+	    "shared object and\n * loaded by pipecut. See pipecut_jit().\n");
+    } else {
+	fprintf(out, "/* pipecut toolset ");
+	lpc_emit_str(out, name, strlen(name));
+	fprintf(out, ", as a filter of its own: stdin to stdout, as\n"
+	    " * pipecut -t would. Generated by pipecut --emit c. To build it:\n"
+	    " *     cc -O2 -o filter filter.c\n");
+    }
+    if (em->tail[0]) {
+	fprintf(out, " * From blade %d on, the toolset runs in /bin/sh:\n *     ",
+	    em->nsteps);
+	lpc_emit_str(out, em->tail, strlen(em->tail));
+	fprintf(out, "\n");
+    }
+    fprintf(out, " */\n\n#define _GNU_SOURCE		/* memmem */\n"
+	"#include <ctype.h>\n#include <errno.h>\n#include <limits.h>\n");
+    if (em->uses & LPC_EUSE_RE)
+	fprintf(out, "#include <regex.h>\n");
+    if (em->tail[0])
+	fprintf(out, "#include <signal.h>\n");
+    fprintf(out, "#include <stdint.h>\n#include <stdio.h>\n#include <stdlib.h>\n"
+	"#include <string.h>\n");
+    if (em->tail[0])
+	fprintf(out, "#include <sys/wait.h>\n");
+    fprintf(out, "#include <unistd.h>\n\n#define PROG ");
+    lpc_emit_str(out, name, strlen(name));
+    if (em->tail[0]) {
+	fprintf(out, "\n#define TAIL ");
+	lpc_emit_str(out, em->tail, strlen(em->tail));
+    }
+    // As the engine writes them (pcExec.h, pcScan.c)
+    fprintf(out, "\n\n#define WCFMT ");
+    lpc_emit_str(out, LPC_WC_FMT, strlen(LPC_WC_FMT));
+    fprintf(out, "\n#define WCLFMT ");
+    lpc_emit_str(out, LPC_WCL_FMT, strlen(LPC_WCL_FMT));
+    fprintf(out, "\n#define UNIQFMT ");
+    lpc_emit_str(out, LPC_UNIQ_FMT, strlen(LPC_UNIQ_FMT));
+    fprintf(out, "\n#define ISSPACE(c) ((c) == ' ' || ((c) >= '\\t' && "
+	"(c) <= '\\r'))\n");
+#ifdef LPC_WC_GNU
+    fprintf(out, "#define ISWORD(c) ((c) > ' ' && (c) < 0x7f)\n");
+#else
+    fprintf(out, "#define ISWORD(c) (!ISSPACE(c))\n");
+#endif
+    fputs(lpc_emit_base, out);
+    if (em->uses & LPC_EUSE_TEXT)
+	fputs(lpc_emit_put, out);
+    if (em->uses & LPC_EUSE_RE)
+	fputs(lpc_emit_re, out);
+    if (em->uses & LPC_EUSE_FIELDS)
+	fputs(lpc_emit_fields, out);
+    if (em->uses & LPC_EUSE_WC)
+	fputs(lpc_emit_wc, out);
+    if (em->uses & LPC_EUSE_SORT)
+	fputs(lpc_emit_sort, out);
+
+    // Each stage calls the next, so they are all declared first
+    fprintf(out, "\n");
+    for (k = 0; k < em->nsteps; k++) {
+	if (em->steps[k].needre)
+	    fprintf(out, "static regex_t re%d;\n", k);
+    }
+    for (k = 0; k <= em->nsteps; k++)
+	fprintf(out, "static void s%d(const char *p, size_t len);\n"
+	    "static void e%d(void);\n", k, k);
+    for (k = 0; k < em->nsteps; k++)
+	lpc_emit_stage(em, k);
+    fprintf(out, "\n/* %d: the output */\nstatic void\n"
+	"s%d(const char *p, size_t len)\n{\n    output(p, len);\n}\n\n"
+	"static void\ne%d(void)\n{\n}\n", em->nsteps, em->nsteps, em->nsteps);
+    lpc_emit_main(em);
+}
+
+/* Write the plan's blades to out as C. The shell text for the blades the program
+ * hands off goes to tail (BLADECACHE bytes), if it isn't NULL.
+ */
+void
+lpc_emit_plan(struct tailhead *blades, const char *name, int lang, int flags,
+    FILE *out, char *tail)
+{
+    struct lpc_emitter em;
+    int k;
+
+    memset(&em, 0, sizeof(struct lpc_emitter));
+    em.out = out;
+    em.lang = lang;
+    em.flags = flags;
+    lpc_emit_steps(&em, blades);
+    if (lpc_ctx.debug && em.tail[0] && !(flags & LPC_EMIT_LIB))
+	fprintf(stderr, "pipecut: --emit: handing off to the shell: %s\n",
+	    em.tail);
+    if (lang == LPC_LANG_C)
+	lpc_emit_c(&em, name);
+    else
+	lpc_script(&em, name);
+    if (tail)
+	strcpy(tail, em.tail);
+    for (k = 0; k < em.nsteps; k++)
+	lpc_emit_stepfree(&em.steps[k]);
+    free(em.steps);
+}
+
+// --emit: write the toolset 'blades' (called name) to out as a program in lang
+void
+lpc_emit(struct tailhead *blades, const char *name, const char *lang,
+    FILE *out)
+{
+    static const char *langs[] = {"c", "awk", "perl", "python", NULL};
+    struct lpc_plan plan;
+    int i;
+
+    for (i = 0; langs[i] && strcmp(lang, langs[i]); i++)
+	;
+    if (!langs[i]) {
+	fprintf(stderr, "Pipecut Error: --emit: no such language: %s\n", lang);
+	exit(-1);
+    }
+    lpc_plan_build(&plan, blades, LPC_PLAN_NATIVE);
+    lpc_emit_plan(&plan.blades, name, i, 0, out, NULL);
+    if (fflush(out) == EOF || ferror(out)) {
+	fprintf(stderr, "Pipecut Error: write error: %s\n", strerror(errno));
+	exit(-1);
+    }
+    lpc_plan_free(&plan);
+}
@@ -0,0 +1,110 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Code generation (--emit c|awk|perl|python NAME).
+ *
+ * Filter mode runs a toolset through the engine: batches of lines handed from stage
+ * to stage through function pointers, with each blade's options looked up as it runs.
+ * --emit writes the toolset out as a program of its own instead, for an ingestion
+ * path that runs the same filter all day. Every blade becomes a function that takes
+ * one line and calls the next blade's directly, so the compiler folds the whole chain
+ * into the read loop; patterns, field numbers and sort keys are constants. The
+ * program reads stdin and writes stdout a block at a time, and its output is the same
+ * as pipecut -t's.
+ *
+ * It is generated from the plan, as -t would run it, and covers what the engine runs
+ * natively: INCLUDE/EXCLUDE (a plain string is found with memmem, a regex only runs
+ * on lines holding its required literal), SUMMARIZE, FORMAT, UNIQUE, ORDER, and
+ * BLACKBOX head -n, wc -l and those that stand in for a blade type. As with -t, the
+ * rest of the toolset from the first blade it can't do goes to /bin/sh. ORDER sorts
+ * in memory, and only when the locale is C as the program is made; otherwise sort(1)
+ * does it, in the shell.
+ *
+ * awk, perl and python get a script in the same shape: one process and one read loop
+ * for the whole toolset, with the regular expressions compiled once, where the shell
+ * pipeline (script.sh) runs a process per blade and copies every line through each
+ * pipe. perl and python read and write bytes, and match as pipecut does in the C
+ * locale. awk leaves ORDER and SUMMARIZE to sort(1) and wc(1), and a toolset that
+ * doesn't start with INCLUDE, EXCLUDE, FORMAT or UNIQUE to the shell: it can't see
+ * whether the last line ended in a '\n'. Nor does it have back-references or the
+ * GNU word boundaries, so a regex with those goes to egrep(1).
+ */
+
+#ifndef PCEMIT_H
+#define PCEMIT_H
+
+// Languages
+#define LPC_LANG_C 0
+#define LPC_LANG_AWK 1			// A sh script around a single awk (pcScript.c)
+#define LPC_LANG_PERL 2
+#define LPC_LANG_PYTHON 3
+
+// One stage of the generated program: a blade, as it runs
+struct lpc_estep {
+    Tooltype ttype;		// A BLACKBOX stand-in: the blade type it runs as
+    int kind;			// Other BLACKBOX commands: LPC_SUB_HEAD, LPC_SUB_COUNT
+    char *pattern;		// ttype's pattern
+    int needre;			// INCLUDE/EXCLUDE: not a plain string
+    long count;			// head -n
+    struct lpc_sortspec *sort;	// ORDER
+    struct lpc_uniqspec *uniq;	// UNIQUE
+};
+
+struct lpc_emitter {
+    FILE *out;
+    int lang;			// LPC_LANG_*
+    int flags;			// LPC_EMIT_*
+    struct lpc_estep *steps;
+    int nsteps;
+    int uses;			// LPC_EUSE_*: the helpers the stages call
+    char tail[BLADECACHE];	// Shell text for the blades from the first we can't do
+};
+
+#define LPC_EUSE_RE 1
+#define LPC_EUSE_FIELDS 2
+#define LPC_EUSE_WC 4
+#define LPC_EUSE_SORT 8
+#define LPC_EUSE_TEXT 16
+
+// lpc_emit_plan() flags
+#define LPC_EMIT_LIB 1		// pipecut_jit() for --jit (pcJit.h) in place of main()
+
+void lpc_emit(struct tailhead *blades, const char *name, const char *lang,
+    FILE *out);
+void lpc_emit_plan(struct tailhead *blades, const char *name, int lang,
+    int flags, FILE *out, char *tail);
+void lpc_emit_steps(struct lpc_emitter *em, struct tailhead *blades);
+
+// The script languages (pcScript.c)
+void lpc_script(struct lpc_emitter *em, const char *name);
+int lpc_script_awkre(const char *re);
+
+#endif
@@ -0,0 +1,1927 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Native execution of a toolset. See pcExec.h for the overview.
+ * Everything in here is lpc_: no curses, no uigbl.
+ */
+
+#include <poll.h>
+#include <signal.h>
+
+#include "pipecut.h"
+#include "pcExec.h"
+#include "pcGzip.h"
+#include "pcJit.h"
+#include "pcMatch.h"
+#include "pcPlan.h"
+#include "pcScan.h"
+#include "pcSort.h"
+#include "pcState.h"
+#include "pcSubst.h"
+
+extern struct pipecut_ctx lpc_ctx;
+
+/* Text buffers */
+
+void
+lpc_text_reserve(struct lpc_text *t, size_t need)
+{
+    size_t ncap;
+
+    if (t->len + need <= t->cap)
+	return;
+    ncap = t->cap ? t->cap : 4096;
+    while (ncap < t->len + need)
+	ncap *= 2;
+    t->p = realloc(t->p, ncap);
+    if (!t->p) {
+	fprintf(stderr, "Pipecut Error: out of memory\n");
+	exit(-1);
+    }
+    t->cap = ncap;
+}
+
+/* Batches */
+
+void
+lpc_batch_init(struct lpc_batch *b)
+{
+    memset(b, 0, sizeof(struct lpc_batch));
+}
+
+void
+lpc_batch_free(struct lpc_batch *b)
+{
+    free(b->in.p);
+    free(b->own.p);
+    free(b->tmp.p);
+    free(b->lines);
+    free(b->olines);
+    memset(b, 0, sizeof(struct lpc_batch));
+}
+
+// Drop all lines (the raw input bytes are left for the reader to manage)
+void
+lpc_batch_clear(struct lpc_batch *b)
+{
+    b->nlines = 0;
+    b->own.len = 0;
+    b->noeol = 0;
+}
+
+void
+lpc_batch_addline(struct lpc_batch *b, const char *p, size_t len)
+{
+    lpc_addspan(&b->lines, &b->nlines, &b->linecap, p, len);
+}
+
+// Add every '\n' terminated line in [bol, end). Returns the start of the unterminated rest.
+const char *
+lpc_batch_index(struct lpc_batch *b, const char *bol, const char *end)
+{
+    return lpc_scanlines(bol, end, &b->lines, &b->nlines, &b->linecap);
+}
+
+// Append bytes to the output line under construction
+void
+lpc_batch_put(struct lpc_batch *b, const char *p, size_t len)
+{
+    lpc_text_reserve(&b->tmp, len);
+    memcpy(b->tmp.p + b->tmp.len, p, len);
+    b->tmp.len += len;
+}
+
+// Finish the output line under construction
+void
+lpc_batch_endline(struct lpc_batch *b)
+{
+    if (b->nolines == b->olinecap) {
+	b->olinecap = b->olinecap ? b->olinecap * 2 : 1024;
+	b->olines = realloc(b->olines, b->olinecap * sizeof(struct lpc_span));
+	if (!b->olines) {
+	    fprintf(stderr, "Pipecut Error: out of memory\n");
+	    exit(-1);
+	}
+    }
+    // tmp may move while it grows, so record offsets until the commit.
+    b->olines[b->nolines].p = (const char *)b->olinestart;
+    b->olines[b->nolines].len = b->tmp.len - b->olinestart;
+    b->nolines++;
+    b->olinestart = b->tmp.len;
+}
+
+// Replace the batch's lines with the ones built since the last commit
+void
+lpc_batch_commit(struct lpc_batch *b)
+{
+    struct lpc_text t;
+    struct lpc_span *s;
+    int i, n;
+
+    for (i = 0; i < b->nolines; i++) {
+	b->olines[i].p = b->tmp.p + (size_t)b->olines[i].p;
+    }
+    t = b->own;
+    b->own = b->tmp;
+    b->tmp = t;
+    b->tmp.len = 0;
+
+    s = b->lines;
+    n = b->linecap;
+    b->lines = b->olines;
+    b->linecap = b->olinecap;
+    b->nlines = b->nolines;
+    b->olines = s;
+    b->olinecap = n;
+    b->nolines = 0;
+    b->olinestart = 0;
+    b->noeol = 0;		// Everything we generate is '\n' terminated
+}
+
+// Returns -1 on a write error (e.g. EPIPE), 0 otherwise.
+int
+lpc_batch_write(struct lpc_batch *b, FILE *out)
+{
+    int i;
+
+    for (i = 0; i < b->nlines; i++) {
+	if (b->lines[i].len)
+	    fwrite(b->lines[i].p, 1, b->lines[i].len, out);
+	if (i < b->nlines - 1 || !b->noeol)
+	    putc('\n', out);
+    }
+    if (b->nlines)		// Don't sit on sparse output that a reader is waiting for
+	fflush(out);
+    return ferror(out) || lpc_output_gone(out) ? -1 : 0;
+}
+
+/* Whether whoever reads 'out' has gone away (pipecut -t x | head). Output sits in the
+ * stdio buffer, often for a long time when most lines are filtered out, so we'd only
+ * find out with EPIPE long after. A pipe or socket with no reader polls as an error or
+ * hang up.
+ */
+int
+lpc_output_gone(FILE *out)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fileno(out);
+    pfd.events = 0;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLERR | POLLHUP));
+}
+
+/* Line matching */
+
+/* An INCLUDE/EXCLUDE blade's regex. Blades made for a plan, or read from a compiled
+ * toolset (-f), only get theirs when a stage first needs it: a regex that is all plain
+ * text, or one the joined EXCLUDE alternation covers, never does. The file pool compiles
+ * its pipelines on several threads, over the same blades.
+ */
+regex_t *
+lpc_blade_re(struct toolelement *te)
+{
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+    pthread_mutex_lock(&lock);
+    if (!te->hasre) {
+	if (regcomp(&te->preg, te->pattern, REG_EXTENDED)) {
+	    fprintf(stderr, "Pipecut Error: regex compile failed: %s\n",
+		te->pattern);
+	    exit(-1);
+	}
+	te->hasre = 1;
+    }
+    pthread_mutex_unlock(&lock);
+    return &te->preg;
+}
+
+// regexec() over a line that isn't NUL terminated. scratch holds a copy if the
+// platform has no REG_STARTEND.
+int
+lpc_regexec_span(regex_t *re, const char *p, size_t len,
+    struct lpc_text *scratch)
+{
+#ifdef REG_STARTEND
+    regmatch_t pm[1];
+
+    pm[0].rm_so = 0;
+    pm[0].rm_eo = len;
+    return regexec(re, p, 1, pm, REG_STARTEND);
+#else
+    scratch->len = 0;
+    lpc_text_reserve(scratch, len + 1);
+    memcpy(scratch->p, p, len);
+    scratch->p[len] = '\0';
+    return regexec(re, scratch->p, 0, NULL, 0);
+#endif
+}
+
+// As lpc_regexec_span(), also reporting up to nmatch (>= 1) submatches, relative to p
+int
+lpc_regmatch_span(regex_t *re, const char *p, size_t len, size_t nmatch,
+    regmatch_t *pm, struct lpc_text *scratch)
+{
+#ifdef REG_STARTEND
+    pm[0].rm_so = 0;
+    pm[0].rm_eo = len;
+    return regexec(re, p, nmatch, pm, REG_STARTEND);
+#else
+    scratch->len = 0;
+    lpc_text_reserve(scratch, len + 1);
+    memcpy(scratch->p, p, len);
+    scratch->p[len] = '\0';
+    return regexec(re, scratch->p, nmatch, pm, 0);
+#endif
+}
+
+/* INCLUDE (keep == REG_OK) and EXCLUDE (keep == REG_NOMATCH)
+ * When the blade has a required literal, runs of adjacent lines are searched for it in
+ * one go, and regexec only sees the lines where it turned up.
+ */
+static int
+lpc_grep(struct lpc_stage *st, struct lpc_batch *b, int keep)
+{
+    const char *lit = st->blade->reqlit;
+    size_t litlen = st->blade->reqlitlen;
+    const char *bol, *eol, *segend = NULL, *hit = NULL;
+    int i, j, rc, segk = 0;
+
+    for (i = 0, j = 0; i < b->nlines; i++) {
+	bol = b->lines[i].p;
+	eol = bol + b->lines[i].len;
+	if (lit) {
+	    if (i >= segk) {	// Start of a run of lines that are adjacent in memory
+		for (segk = i + 1; segk < b->nlines; segk++) {
+		    if (b->lines[segk].p !=
+			b->lines[segk - 1].p + b->lines[segk - 1].len + 1)
+			break;
+		}
+		segend = b->lines[segk - 1].p + b->lines[segk - 1].len;
+		hit = lpc_memmem(bol, segend - bol, lit, litlen);
+	    } else if (hit && hit < bol) {	// That hit was in an earlier line
+		hit = lpc_memmem(bol, segend - bol, lit, litlen);
+	    }
+	    if (!hit || hit + litlen > eol) {
+		// Not in this line, so the regex can't match it either
+		if (keep == REG_NOMATCH)
+		    b->lines[j++] = b->lines[i];
+		continue;
+	    }
+	}
+	rc = lpc_regexec_span(st->re, bol, eol - bol, &st->scratch);
+	if (rc != REG_OK && rc != REG_NOMATCH) {
+	    fprintf(stderr, "Regex execution failed on %s = %d\n",
+		st->blade->pattern, rc);
+	    exit(-1);
+	}
+	if (rc == keep)
+	    b->lines[j++] = b->lines[i];
+    }
+    b->nlines = j;
+    b->noeol = 0;		// egrep terminates the last line
+    return LPC_MORE;
+}
+
+static int
+lpc_run_include(struct lpc_stage *st, struct lpc_batch *b)
+{
+    return lpc_grep(st, b, REG_OK);
+}
+
+static int
+lpc_run_exclude(struct lpc_stage *st, struct lpc_batch *b)
+{
+    return lpc_grep(st, b, REG_NOMATCH);
+}
+
+// A run of INCLUDE/EXCLUDE blades, matched together (pcMatch.c)
+static int
+lpc_run_fused(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_matcher *m = st->priv;
+    int i, j;
+
+    for (i = 0, j = 0; i < b->nlines; i++) {
+	if (lpc_matcher_exec(m, b->lines[i].p, b->lines[i].len, 0) == m->npat)
+	    b->lines[j++] = b->lines[i];
+    }
+    b->nlines = j;
+    b->noeol = 0;
+    return LPC_MORE;
+}
+
+/* SUMMARIZE (wc) */
+
+static int
+lpc_run_summarize(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_wcount *wc = st->priv;
+    const char *segp;
+    int i, k;
+
+    // Lines that still sit next to each other in the source are counted in one go,
+    // along with the '\n's between them.
+    for (i = 0; i < b->nlines; i = k) {
+	for (k = i + 1; k < b->nlines; k++) {
+	    if (b->lines[k].p !=
+		b->lines[k - 1].p + b->lines[k - 1].len + 1
+		|| b->lines[k].p[-1] != '\n')
+		break;
+	}
+	segp = b->lines[i].p;
+	lpc_wc_scan(wc, segp, b->lines[k - 1].p + b->lines[k - 1].len - segp);
+	lpc_wc_scan(wc, "\n", 1);
+    }
+    if (b->nlines && b->noeol) {	// wc only counts newlines
+	wc->bytes--;
+	wc->lines--;
+    }
+    b->nlines = 0;
+    return LPC_MORE;
+}
+
+/* SUMMARIZE at the head of the toolset doesn't need the input split into lines at
+ * all: count the raw bytes, straight from the mapping when there is one.
+ */
+static void
+lpc_summarize_raw(struct lpc_stage *st, struct lpc_reader *rd)
+{
+    struct lpc_wcount *wc = st->priv;
+    ssize_t n;
+
+    if (rd->mapped) {
+	if (rd->pos < rd->map.len)
+	    lpc_wc_scan(wc, rd->map.p + rd->pos, rd->map.len - rd->pos);
+	rd->pos = rd->map.len;
+	return;
+    }
+    lpc_text_reserve(&rd->carry, LPC_BATCHSIZE);
+    for (;;) {
+	n = lpc_reader_read(rd, rd->carry.p, LPC_BATCHSIZE);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    break;
+	lpc_wc_scan(wc, rd->carry.p, n);
+    }
+    rd->eof = 1;
+}
+
+// Fold the counts of a partial (e.g. one chunk of the input) into dst
+static void
+lpc_merge_summarize(struct lpc_stage *dst, struct lpc_stage *src)
+{
+    lpc_wc_merge(dst->priv, src->priv);
+}
+
+// --state: the counts so far
+static void
+lpc_save_summarize(struct lpc_stage *st, struct lpc_state *s)
+{
+    struct lpc_wcount *wc = st->priv;
+
+    lpc_state_putlong(s, wc->lines);
+    lpc_state_putlong(s, wc->words);
+    lpc_state_putlong(s, wc->bytes);
+    lpc_state_putlong(s, wc->any);
+    lpc_state_putlong(s, wc->startword);
+    lpc_state_putlong(s, wc->inword);
+}
+
+static int
+lpc_load_summarize(struct lpc_stage *st, struct lpc_state *s)
+{
+    struct lpc_wcount *wc = st->priv;
+
+    wc->lines = lpc_state_getlong(s);
+    wc->words = lpc_state_getlong(s);
+    wc->bytes = lpc_state_getlong(s);
+    wc->any = lpc_state_getlong(s);
+    wc->startword = lpc_state_getlong(s);
+    wc->inword = lpc_state_getlong(s);
+    return !s->bad;
+}
+
+static int
+lpc_flush_summarize(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_wcount *wc = st->priv;
+    char out[80];
+    int n;
+
+    n = snprintf(out, 80, LPC_WC_FMT, wc->lines, wc->words, wc->bytes);
+    lpc_batch_put(b, out, n - 1);
+    lpc_batch_endline(b);
+    lpc_batch_commit(b);
+    return LPC_DONE;
+}
+
+/* FORMAT (awk '{print "..." $1 ...}') */
+
+// Undo awk string escapes. dst must be at least strlen(src)+1. Returns the length.
+size_t
+lpc_awkunescape(char *dst, const char *src)
+{
+    char *d = dst;
+    int n, v;
+
+    while (*src) {
+	if (*src != '\\' || !src[1]) {
+	    *d++ = *src++;
+	    continue;
+	}
+	src++;
+	switch (*src) {
+	case 'n':
+	    *d++ = '\n';
+	    break;
+	case 't':
+	    *d++ = '\t';
+	    break;
+	case 'r':
+	    *d++ = '\r';
+	    break;
+	case 'a':
+	    *d++ = '\a';
+	    break;
+	case 'b':
+	    *d++ = '\b';
+	    break;
+	case 'f':
+	    *d++ = '\f';
+	    break;
+	case 'v':
+	    *d++ = '\v';
+	    break;
+	case '0':
+	case '1':
+	case '2':
+	case '3':
+	case '4':
+	case '5':
+	case '6':
+	case '7':
+	    for (n = 0, v = 0; n < 3 && *src >= '0' && *src <= '7'; n++)
+		v = v * 8 + (*src++ - '0');
+	    *d++ = (char)v;
+	    continue;
+	default:		// \\ \" \/ and unknown escapes yield the character itself
+	    *d++ = *src;
+	    break;
+	}
+	src++;
+    }
+    *d = '\0';
+    return d - dst;
+}
+
+/* A FORMAT pattern is the text of an awk print string. $1, $2 ... $NF and $0 in it
+ * stand for fields of the input line, as they would outside the quotes in awk; \$ is
+ * a plain '$'. The pattern is compiled once into a list of parts.
+ */
+
+// Length of the field reference at cp (0 if there is none), and its number in *field.
+static int
+lpc_fmt_field(const char *cp, int *field)
+{
+    const char *p = cp + 1;
+    int n = 0;
+
+    if (*cp != '$')
+	return 0;
+    if (p[0] == 'N' && p[1] == 'F') {
+	*field = LPC_FMT_NF;
+	return 3;
+    }
+    if (!isdigit((unsigned char)*p))
+	return 0;
+    for (; isdigit((unsigned char)*p); p++) {
+	if (n < 1000000)
+	    n = n * 10 + (*p - '0');
+    }
+    *field = n;
+    return p - cp;
+}
+
+/* Next piece of a pattern: a field, or a run of literal text (still escaped) in *lit
+ * and *len with *field set to LPC_FMT_TEXT. Returns 0 at the end of the pattern.
+ */
+static int
+lpc_fmt_next(const char **pp, int *field, const char **lit, size_t *len)
+{
+    const char *cp = *pp;
+    int n;
+
+    if (*cp == '\0')
+	return 0;
+    if ((n = lpc_fmt_field(cp, field))) {
+	*pp = cp + n;
+	return 1;
+    }
+    *lit = cp;
+    while (*cp && !lpc_fmt_field(cp, &n))
+	cp += (*cp == '\\' && cp[1]) ? 2 : 1;
+    *field = LPC_FMT_TEXT;
+    *len = cp - *lit;
+    *pp = cp;
+    return 1;
+}
+
+static void
+lpc_fmt_add(struct lpc_format *fmt, int what, size_t off, size_t len)
+{
+    fmt->parts[fmt->nparts].what = what;
+    fmt->parts[fmt->nparts].off = off;
+    fmt->parts[fmt->nparts].len = len;
+    fmt->nparts++;
+}
+
+// Compile a FORMAT pattern
+struct lpc_format *
+lpc_format_new(const char *patt)
+{
+    struct lpc_format *fmt;
+    const char *cp = patt;
+    const char *lit, *tp, *nl;
+    char *raw;
+    size_t len, off = 0, n;
+    int field;
+
+    fmt = calloc(1, sizeof(struct lpc_format));
+    fmt->src = strdup(patt);
+    fmt->parts = calloc(2 * strlen(patt) + 1, sizeof(struct lpc_fmtpart));
+    fmt->text = malloc(strlen(patt) + 1);
+    raw = malloc(strlen(patt) + 1);
+    while (lpc_fmt_next(&cp, &field, &lit, &len)) {
+	if (field != LPC_FMT_TEXT) {
+	    lpc_fmt_add(fmt, field, 0, 0);
+	    if (field == LPC_FMT_NF)
+		fmt->maxfield = -1;
+	    else if (fmt->maxfield >= 0 && field > fmt->maxfield)
+		fmt->maxfield = field;
+	    continue;
+	}
+	memcpy(raw, lit, len);
+	raw[len] = '\0';
+	n = lpc_awkunescape(fmt->text + off, raw);
+	// Text holding a '\n' prints several lines
+	for (tp = fmt->text + off; (nl = memchr(tp, '\n', n)); tp = nl + 1) {
+	    if (nl > tp)
+		lpc_fmt_add(fmt, LPC_FMT_TEXT, tp - fmt->text, nl - tp);
+	    lpc_fmt_add(fmt, LPC_FMT_EOL, 0, 0);
+	    n -= nl + 1 - tp;
+	}
+	if (n)
+	    lpc_fmt_add(fmt, LPC_FMT_TEXT, tp - fmt->text, n);
+	off = tp + n - fmt->text;
+    }
+    free(raw);
+    return fmt;
+}
+
+void
+lpc_format_free(struct lpc_format *fmt)
+{
+    free(fmt->src);
+    free(fmt->parts);
+    free(fmt->text);
+    free(fmt->fields);
+    free(fmt);
+}
+
+// Print one input line through fmt, into b's output lines (the ORS included).
+void
+lpc_format_apply(struct lpc_format *fmt, struct lpc_batch *b, const char *p,
+    size_t len)
+{
+    struct lpc_fmtpart *fp = fmt->parts;
+    struct lpc_fmtpart *ep = fp + fmt->nparts;
+    struct lpc_span *f;
+    int nf = 0;
+
+    if (fmt->maxfield)
+	nf = lpc_fields(p, len, &fmt->fields, &fmt->fieldcap, fmt->maxfield);
+    f = fmt->fields;
+    for (; fp < ep; fp++) {
+	switch (fp->what) {
+	case LPC_FMT_TEXT:
+	    lpc_batch_put(b, fmt->text + fp->off, fp->len);
+	    break;
+	case LPC_FMT_EOL:
+	    lpc_batch_endline(b);
+	    break;
+	case LPC_FMT_NF:	// $NF is $0 on a line with no fields
+	    if (nf)
+		lpc_batch_put(b, f[nf - 1].p, f[nf - 1].len);
+	    else
+		lpc_batch_put(b, p, len);
+	    break;
+	case 0:
+	    lpc_batch_put(b, p, len);
+	    break;
+	default:
+	    if (fp->what <= nf)
+		lpc_batch_put(b, f[fp->what - 1].p, f[fp->what - 1].len);
+	    break;
+	}
+    }
+    lpc_batch_endline(b);
+}
+
+static void
+lpc_fmt_cat(char *out, size_t size, size_t *o, const char *p, size_t len)
+{
+    if (*o + len >= size)
+	len = *o < size ? size - *o - 1 : 0;
+    memcpy(out + *o, p, len);
+    *o += len;
+    out[*o] = '\0';
+}
+
+/* The awk(1) command the shell pipeline runs for a FORMAT pattern, e.g. "$8 $9"
+ * becomes awk '{print $8 " " $9}'.
+ */
+void
+lpc_format_awk(const char *patt, char *out, size_t size)
+{
+    const char *cp = patt;
+    const char *lit, *ep;
+    char num[16];
+    size_t len, o = 0;
+    int field, any = 0;
+
+    lpc_fmt_cat(out, size, &o, "awk '{print", 11);
+    while (lpc_fmt_next(&cp, &field, &lit, &len)) {
+	any = 1;
+	if (field == LPC_FMT_NF) {
+	    lpc_fmt_cat(out, size, &o, " $NF", 4);
+	    continue;
+	}
+	if (field != LPC_FMT_TEXT) {
+	    snprintf(num, sizeof(num), " $%d", field);
+	    lpc_fmt_cat(out, size, &o, num, strlen(num));
+	    continue;
+	}
+	lpc_fmt_cat(out, size, &o, " \"", 2);
+	for (ep = lit + len; lit < ep; lit++) {
+	    if (lit[0] == '\\' && lit + 1 < ep) {	// Escapes pass through, but \$ is only '$'
+		lpc_fmt_cat(out, size, &o, lit + (lit[1] == '$'),
+		    2 - (lit[1] == '$'));
+		lit++;
+		continue;
+	    }
+	    lpc_fmt_cat(out, size, &o, lit, 1);
+	}
+	lpc_fmt_cat(out, size, &o, "\"", 1);
+    }
+    if (!any)
+	lpc_fmt_cat(out, size, &o, " \"\"", 3);
+    lpc_fmt_cat(out, size, &o, "}'", 2);
+}
+
+static int
+lpc_run_format(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_format *fmt = st->priv;
+    int i;
+
+    for (i = 0; i < b->nlines; i++)
+	lpc_format_apply(fmt, b, b->lines[i].p, b->lines[i].len);
+    lpc_batch_commit(b);
+    return LPC_MORE;
+}
+
+static void
+lpc_fini_format(struct lpc_stage *st)
+{
+    lpc_format_free(st->priv);
+    st->priv = NULL;
+}
+
+static void
+lpc_fini_priv(struct lpc_stage *st)
+{
+    free(st->priv);
+    st->priv = NULL;
+}
+
+/* ORDER (sort) */
+
+struct lpc_order {
+    struct lpc_sortspec spec;
+    struct lpc_sorter *sorter;
+    int started;		// The sorted output is being handed out
+    int inmem;			// Nothing was spilled: lines stay put until fini
+};
+
+static int
+lpc_run_order(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_order *o = st->priv;
+    int i;
+
+    for (i = 0; i < b->nlines; i++)
+	lpc_sorter_add(o->sorter, b->lines[i].p, b->lines[i].len);
+    b->nlines = 0;
+    return LPC_MORE;
+}
+
+// Hand out the sorted lines, about a batch worth per call.
+static int
+lpc_flush_order(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_order *o = st->priv;
+    const char *p;
+    size_t len, n = 0;
+    int rc = LPC_MORE;
+
+    if (!o->started) {
+	o->inmem = lpc_sorter_finish(o->sorter);
+	o->started = 1;
+    }
+    while (n < LPC_BATCHSIZE) {
+	if (!lpc_sorter_next(o->sorter, &p, &len, NULL)) {
+	    rc = LPC_DONE;
+	    break;
+	}
+	if (o->inmem) {		// No need for a copy
+	    lpc_batch_addline(b, p, len);
+	} else {
+	    lpc_batch_put(b, p, len);
+	    lpc_batch_endline(b);
+	}
+	n += len + 1;
+    }
+    if (!o->inmem)
+	lpc_batch_commit(b);
+    return rc;
+}
+
+static void
+lpc_fini_order(struct lpc_stage *st)
+{
+    struct lpc_order *o = st->priv;
+
+    lpc_sorter_free(o->sorter);
+    free(o);
+    st->priv = NULL;
+}
+
+// Threads to sort runs with: -j, or as sort(1) does, the CPUs up to 8.
+static int
+lpc_sort_threads()
+{
+    long ncpu;
+
+    if (lpc_ctx.jobs > 0)
+	return lpc_ctx.jobs;
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    return ncpu < 1 ? 1 : ncpu > 8 ? 8 : ncpu;
+}
+
+static struct lpc_sorter *
+lpc_order_sorter(struct lpc_sortspec *spec)
+{
+    return lpc_sorter_new(spec,
+	lpc_ctx.sortmem ? lpc_ctx.sortmem : LPC_SORTMEM, lpc_sort_threads(),
+	0);
+}
+
+// --state: the lines so far, in order, each after a 1. A 0 ends them.
+static int
+lpc_load_order(struct lpc_stage *st, struct lpc_state *s)
+{
+    struct lpc_order *o = st->priv;
+    const char *p;
+    size_t len;
+
+    while (lpc_state_getlong(s) == 1) {
+	p = lpc_state_getstr(s, &len);
+	lpc_sorter_add(o->sorter, p, len);
+    }
+    return !s->bad;
+}
+
+static void
+lpc_save_order(struct lpc_stage *st, struct lpc_state *s)
+{
+    struct lpc_order *o = st->priv;
+    const char *p;
+    size_t len;
+    off_t at = ftello(s->fp);
+
+    lpc_sorter_finish(o->sorter);
+    while (lpc_sorter_next(o->sorter, &p, &len, NULL)) {
+	lpc_state_putlong(s, 1);
+	lpc_state_putstr(s, p, len);
+    }
+    lpc_state_putlong(s, 0);
+    // That used the sorter up: the flush to come gets the lines back from the file.
+    lpc_sorter_free(o->sorter);
+    o->sorter = lpc_order_sorter(&o->spec);
+    fseeko(s->fp, at, SEEK_SET);
+    lpc_load_order(st, s);
+    fseeko(s->fp, 0, SEEK_END);
+}
+
+/* Set st up to sort natively. Returns 0 if the blade's options are beyond us, or
+ * sort(1) would collate by locale: the blade runs in the shell then.
+ */
+static int
+lpc_order_init(struct lpc_stage *st, const char *flags)
+{
+    struct lpc_sortspec spec;
+    struct lpc_order *o;
+
+    if (!lpc_sort_clocale() || !lpc_sortspec_parse(&spec, flags))
+	return 0;
+    o = calloc(1, sizeof(struct lpc_order));
+    o->spec = spec;
+    o->sorter = lpc_order_sorter(&o->spec);
+    st->run = lpc_run_order;
+    st->flush = lpc_flush_order;
+    st->fini = lpc_fini_order;
+    st->save = lpc_save_order;
+    st->load = lpc_load_order;
+    st->priv = o;
+    return 1;
+}
+
+/* UNIQUE (uniq) */
+
+// One line of uniq's output, for a group of 'count' equal lines
+static void
+lpc_uniq_emit(struct lpc_batch *b, const struct lpc_uniqspec *up,
+    const char *p, size_t len, long count)
+{
+    char pre[32];
+    int n;
+
+    if (!lpc_uniq_show(up, count))
+	return;
+    if (up->count) {
+	n = snprintf(pre, 32, LPC_UNIQ_FMT, count);
+	lpc_batch_put(b, pre, n);
+    }
+    lpc_batch_put(b, p, len);
+    lpc_batch_endline(b);
+}
+
+struct lpc_uniq {
+    struct lpc_uniqspec spec;
+    const char *hp;		// First line of the current group, in the batch or in 'held'
+    size_t hlen;
+    long count;			// Lines in the group so far, 0 before the first line
+    long shown;			// --state: the group was output with this count last run
+    struct lpc_text held;
+};
+
+/* The current group is over. One that carries on from the last run (--state) was
+ * output at the end of that already: only output it again if it says something new.
+ */
+static void
+lpc_uniq_end(struct lpc_uniq *u, struct lpc_batch *b)
+{
+    if (!u->shown || !lpc_uniq_show(&u->spec, u->shown)
+	|| (u->spec.count && u->count != u->shown))
+	lpc_uniq_emit(b, &u->spec, u->hp, u->hlen, u->count);
+    u->shown = 0;
+}
+
+// uniq on its own: groups are runs of adjacent equal lines.
+static int
+lpc_run_uniq(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_uniq *u = st->priv;
+    int i;
+
+    for (i = 0; i < b->nlines; i++) {
+	if (u->count && b->lines[i].len == u->hlen
+	    && !memcmp(b->lines[i].p, u->hp, u->hlen)) {
+	    u->count++;
+	    continue;
+	}
+	if (u->count)
+	    lpc_uniq_end(u, b);
+	u->hp = b->lines[i].p;
+	u->hlen = b->lines[i].len;
+	u->count = 1;
+    }
+    // The group may go on in the next batch, and this one is about to be reused.
+    if (u->count && u->hp != u->held.p) {
+	u->held.len = 0;
+	lpc_text_reserve(&u->held, u->hlen + 1);
+	memcpy(u->held.p, u->hp, u->hlen);
+	u->hp = u->held.p;
+    }
+    lpc_batch_commit(b);
+    return LPC_MORE;
+}
+
+static int
+lpc_flush_uniq(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_uniq *u = st->priv;
+
+    if (u->count)
+	lpc_uniq_end(u, b);
+    u->count = 0;
+    lpc_batch_commit(b);
+    return LPC_DONE;
+}
+
+// --state: the group at the end of the input, which the flush is about to output
+static void
+lpc_save_uniq(struct lpc_stage *st, struct lpc_state *s)
+{
+    struct lpc_uniq *u = st->priv;
+
+    lpc_state_putlong(s, u->count);
+    lpc_state_putstr(s, u->count ? u->hp : "", u->count ? u->hlen : 0);
+}
+
+static int
+lpc_load_uniq(struct lpc_stage *st, struct lpc_state *s)
+{
+    struct lpc_uniq *u = st->priv;
+    const char *p;
+    size_t len;
+
+    u->count = u->shown = lpc_state_getlong(s);
+    p = lpc_state_getstr(s, &len);
+    u->held.len = 0;
+    lpc_text_reserve(&u->held, len + 1);
+    memcpy(u->held.p, p, len);
+    u->hp = u->held.p;
+    u->hlen = len;
+    return !s->bad && u->count >= 0;
+}
+
+static void
+lpc_fini_uniq(struct lpc_stage *st)
+{
+    struct lpc_uniq *u = st->priv;
+
+    free(u->held.p);
+    free(u);
+    st->priv = NULL;
+}
+
+static int
+lpc_uniq_init(struct lpc_stage *st, const char *flags)
+{
+    struct lpc_uniq *u;
+
+    u = calloc(1, sizeof(struct lpc_uniq));
+    if (!lpc_uniqspec_parse(&u->spec, flags)) {
+	free(u);
+	return 0;
+    }
+    st->run = lpc_run_uniq;
+    st->flush = lpc_flush_uniq;
+    st->fini = lpc_fini_uniq;
+    st->save = lpc_save_uniq;
+    st->load = lpc_load_uniq;
+    st->priv = u;
+    return 1;
+}
+
+/* ORDER then UNIQUE (sort | uniq): every line equal to another ends up next to it
+ * after the sort, so counting the distinct lines in a hash table and sorting only
+ * those gives the same output.
+ */
+struct lpc_grouped {
+    struct lpc_uniqspec spec;
+    struct lpc_sortspec sort;
+    struct lpc_group *g;
+    int started;		// The output is being handed out
+};
+
+static int
+lpc_run_grouped(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_grouped *gr = st->priv;
+    int i;
+
+    for (i = 0; i < b->nlines; i++)
+	lpc_group_add(gr->g, b->lines[i].p, b->lines[i].len);
+    b->nlines = 0;
+    return LPC_MORE;
+}
+
+static int
+lpc_flush_grouped(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_grouped *gr = st->priv;
+    const char *p;
+    size_t len, n = 0;
+    long count;
+    int rc = LPC_MORE;
+
+    if (!gr->started) {
+	lpc_group_finish(gr->g);
+	gr->started = 1;
+    }
+    while (n < LPC_BATCHSIZE) {
+	if (!lpc_group_next(gr->g, &p, &len, &count)) {
+	    rc = LPC_DONE;
+	    break;
+	}
+	lpc_uniq_emit(b, &gr->spec, p, len, count);
+	n += len + 1;
+    }
+    lpc_batch_commit(b);
+    return rc;
+}
+
+static struct lpc_grouped *
+lpc_grouped_new(struct lpc_uniqspec *spec, struct lpc_sortspec *sort)
+{
+    struct lpc_grouped *gr;
+
+    gr = calloc(1, sizeof(struct lpc_grouped));
+    gr->spec = *spec;
+    gr->sort = *sort;
+    gr->g = lpc_group_new(sort,
+	lpc_ctx.sortmem ? lpc_ctx.sortmem : LPC_SORTMEM, lpc_sort_threads());
+    return gr;
+}
+
+static void
+lpc_clone_grouped(struct lpc_stage *dst, struct lpc_stage *src)
+{
+    struct lpc_grouped *gr = src->priv;
+
+    dst->priv = lpc_grouped_new(&gr->spec, &gr->sort);
+}
+
+// Fold the lines counted over one chunk of the input into dst
+static void
+lpc_merge_grouped(struct lpc_stage *dst, struct lpc_stage *src)
+{
+    struct lpc_grouped *d = dst->priv, *s = src->priv;
+
+    lpc_group_merge(d->g, s->g);
+}
+
+// --state: the distinct lines so far, in order, each after its count. A 0 ends them.
+static int
+lpc_load_grouped(struct lpc_stage *st, struct lpc_state *s)
+{
+    struct lpc_grouped *gr = st->priv;
+    const char *p;
+    size_t len;
+    long count;
+
+    while ((count = lpc_state_getlong(s)) > 0) {
+	p = lpc_state_getstr(s, &len);
+	lpc_group_addcount(gr->g, p, len, count);
+    }
+    return !s->bad && count == 0;
+}
+
+static void
+lpc_save_grouped(struct lpc_stage *st, struct lpc_state *s)
+{
+    struct lpc_grouped *gr = st->priv;
+    const char *p;
+    size_t len;
+    long count;
+    off_t at = ftello(s->fp);
+
+    lpc_group_finish(gr->g);
+    while (lpc_group_next(gr->g, &p, &len, &count)) {
+	lpc_state_putlong(s, count);
+	lpc_state_putstr(s, p, len);
+    }
+    lpc_state_putlong(s, 0);
+    // As for ORDER, the flush gets the lines back from the file.
+    lpc_group_free(gr->g);
+    gr->g = lpc_group_new(&gr->sort,
+	lpc_ctx.sortmem ? lpc_ctx.sortmem : LPC_SORTMEM, lpc_sort_threads());
+    fseeko(s->fp, at, SEEK_SET);
+    lpc_load_grouped(st, s);
+    fseeko(s->fp, 0, SEEK_END);
+}
+
+static void
+lpc_fini_grouped(struct lpc_stage *st)
+{
+    struct lpc_grouped *gr = st->priv;
+
+    lpc_group_free(gr->g);
+    free(gr);
+    st->priv = NULL;
+}
+
+/* te is an ORDER blade, with sort options 'flags'. If a UNIQUE blade (or a uniq
+ * command) follows it, and both can run natively, set st up to do the two of them by
+ * hash aggregation.
+ */
+static int
+lpc_grouped_init(struct lpc_stage *st, struct toolelement *te,
+    const char *flags)
+{
+    struct toolelement *next = TAILQ_NEXT(te, entries);
+    struct lpc_uniqspec spec;
+    struct lpc_sortspec sort;
+    struct lpc_subst sb;
+    int ok;
+
+    if (!next)
+	return 0;
+    if (next->ttype == BLACKBOX) {
+	ok = lpc_subst_parse(next->pattern, &sb) == LPC_SUB_BLADE
+	    && sb.ttype == UNIQUE && lpc_uniqspec_parse(&spec, sb.pattern);
+	lpc_subst_free(&sb);
+    } else {
+	ok = next->ttype == UNIQUE
+	    && lpc_uniqspec_parse(&spec, next->pattern);
+    }
+    if (!ok || !lpc_sort_clocale() || !lpc_sortspec_parse(&sort, flags))
+	return 0;
+    // With -s, lines that differ but compare equal keep their input order, and
+    // equal lines may not end up next to each other.
+    if (sort.stable)
+	return 0;
+    st->run = lpc_run_grouped;
+    st->flush = lpc_flush_grouped;
+    st->clone = lpc_clone_grouped;
+    st->merge = lpc_merge_grouped;
+    st->fini = lpc_fini_grouped;
+    st->save = lpc_save_grouped;
+    st->load = lpc_load_grouped;
+    st->priv = lpc_grouped_new(&spec, &sort);
+    st->nblades = 2;
+    return 1;
+}
+
+/* Cloning, for executors that run a stage on several threads at once.
+ * Regexes are compiled again for each copy: glibc serializes regexec() calls that
+ * share a regex_t.
+ */
+
+static void
+lpc_clone_grep(struct lpc_stage *dst, struct lpc_stage *src)
+{
+    int rc;
+
+    dst->re = malloc(sizeof(regex_t));
+    rc = regcomp(dst->re, src->blade->pattern, REG_EXTENDED);
+    if (rc) {
+	fprintf(stderr, "Regex compile failed %s = %d\n", src->blade->pattern,
+	    rc);
+	exit(-1);
+    }
+    dst->ownre = 1;
+}
+
+static void
+lpc_clone_fused(struct lpc_stage *dst, struct lpc_stage *src)
+{
+    dst->priv = lpc_matcher_clone(src->priv);
+}
+
+static void
+lpc_fini_fused(struct lpc_stage *st)
+{
+    lpc_matcher_free(st->priv);
+    st->priv = NULL;
+}
+
+static void
+lpc_clone_summarize(struct lpc_stage *dst, struct lpc_stage *src)
+{
+    dst->priv = calloc(1, sizeof(struct lpc_wcount));
+}
+
+static void
+lpc_clone_format(struct lpc_stage *dst, struct lpc_stage *src)
+{
+    struct lpc_format *fmt = src->priv;
+
+    dst->priv = lpc_format_new(fmt->src);
+}
+
+// Make an independent copy of src, with fresh state. src must have a clone function.
+void
+lpc_stage_clone(struct lpc_stage *dst, struct lpc_stage *src)
+{
+    memcpy(dst, src, sizeof(struct lpc_stage));
+    dst->priv = NULL;
+    memset(&dst->scratch, 0, sizeof(struct lpc_text));
+    dst->ownre = 0;
+    src->clone(dst, src);
+}
+
+void
+lpc_stage_free(struct lpc_stage *st)
+{
+    if (st->fini)
+	st->fini(st);
+    if (st->ownre) {
+	regfree(st->re);
+	free(st->re);
+    }
+    free(st->scratch.p);
+    st->scratch.p = NULL;
+}
+
+/* Compilation */
+
+// Append the shell text for one blade to the tail pipeline (BLADECACHE bytes)
+void
+lpc_tailtext(char *tail, struct toolelement *te)
+{
+    char blade[BLADECACHE];
+    char *cp;
+
+    memset(blade, 0, BLADECACHE);
+    lpc_pipe_transition(PIPE, te->ttype, te->pattern, blade, 0);
+    cp = blade;
+    if (tail[0] == '\0') {	// The first blade isn't preceded by a pipe
+	while (*cp == ' ' || *cp == '|')
+	    cp++;
+    }
+    strlcat(tail, cp, BLADECACHE);
+}
+
+/* Set st up to run the blade te natively, grouping it with the blade after it where
+ * that helps (if 'group'). A BLACKBOX blade runs natively if lpc_subst_parse()
+ * recognizes its command. Returns the number of blades the stage covers, 0 if te has
+ * to go to the shell.
+ */
+static int
+lpc_stage_init(struct lpc_stage *st, struct toolelement *te, int group)
+{
+    struct lpc_subst sb;
+    Tooltype ttype = te->ttype;
+    const char *patt = te->pattern;
+    int n = 1;
+
+    memset(st, 0, sizeof(struct lpc_stage));
+    memset(&sb, 0, sizeof(struct lpc_subst));
+    st->ttype = te->ttype;
+    st->blade = te;
+    if (ttype == BLACKBOX) {
+	switch (lpc_subst_parse(te->pattern, &sb)) {
+	case LPC_SUB_NONE:
+	    return 0;
+	case LPC_SUB_BLADE:	// Runs as the blade type that does the same
+	    st->ttype = ttype = sb.ttype;
+	    patt = sb.pattern;
+	    break;
+	default:
+	    n = lpc_subst_init(st, &sb);
+	    lpc_subst_free(&sb);
+	    st->nblades = n;
+	    return n;
+	}
+    }
+    switch (ttype) {
+    case INCLUDE:
+	st->run = lpc_run_include;
+	st->clone = lpc_clone_grep;
+	st->re = lpc_blade_re(te);
+	break;
+    case EXCLUDE:
+	st->run = lpc_run_exclude;
+	st->clone = lpc_clone_grep;
+	st->re = lpc_blade_re(te);
+	break;
+    case SUMMARIZE:
+	st->run = lpc_run_summarize;
+	st->flush = lpc_flush_summarize;
+	st->clone = lpc_clone_summarize;
+	st->merge = lpc_merge_summarize;
+	st->save = lpc_save_summarize;
+	st->load = lpc_load_summarize;
+	st->fini = lpc_fini_priv;
+	st->priv = calloc(1, sizeof(struct lpc_wcount));
+	break;
+    case FORMAT:
+	st->run = lpc_run_format;
+	st->clone = lpc_clone_format;
+	st->fini = lpc_fini_format;
+	st->priv = lpc_format_new(patt);
+	break;
+    case ORDER:
+	if (group && lpc_grouped_init(st, te, patt)) {	// sort | uniq
+	    n = 2;
+	    break;
+	}
+	if (!lpc_order_init(st, patt))
+	    n = 0;
+	break;
+    case UNIQUE:
+	if (!lpc_uniq_init(st, patt))
+	    n = 0;
+	break;
+    case BLACKBOX:		// pipecut has no implementation - hand the rest to /bin/sh
+    default:
+	n = 0;
+	break;
+    }
+    lpc_subst_free(&sb);
+    st->nblades = n;
+    return n;
+}
+
+// Build the stage list for the toolset 'blades' (in filter mode, a plan made from it).
+void
+lpc_compile(struct lpc_pipeline *pl, struct tailhead *blades)
+{
+    struct toolelement *te;
+    struct lpc_stage *st;
+    int n = 0, skip = 0, run;
+
+    memset(pl, 0, sizeof(struct lpc_pipeline));
+    TAILQ_FOREACH(te, blades, entries) {
+	n++;
+    }
+    pl->stages = calloc(n + 1, sizeof(struct lpc_stage));
+
+    TAILQ_FOREACH(te, blades, entries) {
+	if (skip) {		// Folded into the previous stage
+	    skip--;
+	    continue;
+	}
+	if (pl->tail[0] == '\0' && (te->ttype == STDIN || te->ttype == CAT
+		|| te->ttype == TNONE))
+	    continue;		// The source is handled by the executor
+	st = &pl->stages[pl->nstages];
+	if (pl->tail[0] != '\0') {	// Already handing off to the shell
+	    n = 0;
+	} else if ((run = lpc_matchrun(te)) > 1) {
+	    st->ttype = te->ttype;
+	    st->blade = te;
+	    st->run = lpc_run_fused;
+	    st->clone = lpc_clone_fused;
+	    st->fini = lpc_fini_fused;
+	    st->priv = lpc_matcher_new(te, run);
+	    st->nblades = n = run;
+	} else {
+	    n = lpc_stage_init(st, te, 1);
+	}
+	if (lpc_ctx.debug && te->ttype == BLACKBOX)
+	    fprintf(stderr, "pipecut: BLACKBOX \"%s\" %s\n", te->pattern,
+		n ? "runs natively" : "runs in the shell");
+	if (!n) {
+	    lpc_tailtext(pl->tail, te);
+	    continue;
+	}
+	skip = n - 1;
+	pl->nstages++;
+    }
+}
+
+// Set st up to run one blade natively, on its own. Returns 0 if it can't.
+int
+lpc_blade_stage(struct lpc_stage *st, struct toolelement *te)
+{
+    return lpc_stage_init(st, te, 0);
+}
+
+/* Run st over lines, and pass every line it outputs to fn, the end of input
+ * included. For the UI, which works on a page of text at a time.
+ */
+void
+lpc_stage_lines(struct lpc_stage *st, struct lpc_span *lines, int n,
+    void (*fn) (void *, const char *, size_t), void *arg)
+{
+    struct lpc_batch b;
+    int i, rc;
+
+    lpc_batch_init(&b);
+    for (i = 0; i < n; i++)
+	lpc_batch_addline(&b, lines[i].p, lines[i].len);
+    st->run(st, &b);
+    for (i = 0; i < b.nlines; i++)
+	fn(arg, b.lines[i].p, b.lines[i].len);
+    while (st->flush) {
+	lpc_batch_clear(&b);
+	rc = st->flush(st, &b);
+	for (i = 0; i < b.nlines; i++)
+	    fn(arg, b.lines[i].p, b.lines[i].len);
+	if (rc != LPC_MORE)
+	    break;
+    }
+    lpc_batch_free(&b);
+}
+
+void
+lpc_release(struct lpc_pipeline *pl)
+{
+    int i;
+
+    for (i = 0; i < pl->nstages; i++)
+	lpc_stage_free(&pl->stages[i]);
+    free(pl->stages);
+    pl->stages = NULL;
+    pl->nstages = 0;
+}
+
+/* Execution */
+
+/* Pass a batch through stages [from, nstages). Returns LPC_DONE if a stage is finished,
+ * and notes in pl->done that the stages up to it need no more input.
+ */
+int
+lpc_runstages(struct lpc_pipeline *pl, int from, struct lpc_batch *b)
+{
+    int i, rc = LPC_MORE;
+
+    for (i = from; i < pl->nstages; i++) {
+	if (pl->stages[i].run(&pl->stages[i], b) == LPC_DONE) {
+	    rc = LPC_DONE;
+	    if (pl->done < i + 1)
+		pl->done = i + 1;
+	}
+    }
+    return rc;
+}
+
+/* Mapping */
+
+static void
+lpc_map_unmap(struct lpc_map *m)
+{
+    if (m->p)
+	munmap((void *)m->p, m->len);
+    m->p = NULL;
+    m->len = 0;
+}
+
+// (Re)map the whole of m->fd at its current size. Returns 0 on failure.
+static int
+lpc_map_map(struct lpc_map *m)
+{
+    struct stat sb;
+    void *p;
+
+    lpc_map_unmap(m);
+    if (fstat(m->fd, &sb) != 0 || !S_ISREG(sb.st_mode))
+	return 0;
+    m->dev = sb.st_dev;
+    m->ino = sb.st_ino;
+    if (sb.st_size == 0)	// Nothing to map, but nothing to read either
+	return 1;
+    if ((off_t)(size_t)sb.st_size != sb.st_size)	// Too big for our address space
+	return 0;
+    p = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, m->fd, 0);
+    if (p == MAP_FAILED)
+	return 0;
+#ifdef MADV_SEQUENTIAL
+    madvise(p, sb.st_size, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+    madvise(p, sb.st_size, MADV_WILLNEED);
+#endif
+    m->p = p;
+    m->len = sb.st_size;
+    return 1;
+}
+
+// Map an open regular file. Returns 0 if it can't be mapped (read it instead).
+int
+lpc_map_fd(struct lpc_map *m, int fd)
+{
+    memset(m, 0, sizeof(struct lpc_map));
+    m->fd = fd;
+    if (!lpc_map_map(m)) {
+	m->fd = -1;
+	return 0;
+    }
+    return 1;
+}
+
+/* Map the file at path, for the session. If m already maps that path, only refresh it.
+ * Returns 0 if it can't be mapped.
+ */
+int
+lpc_map_file(struct lpc_map *m, const char *path)
+{
+    struct stat sb;
+    int fd;
+
+    if (m->path && !strcmp(m->path, path) && stat(path, &sb) == 0
+	&& sb.st_dev == m->dev && sb.st_ino == m->ino)
+	return lpc_map_refresh(m) >= 0;
+    lpc_map_close(m);		// A different file, or it was replaced under us
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+	return 0;
+    if (!lpc_map_fd(m, fd)) {
+	close(fd);
+	return 0;
+    }
+    m->ownfd = 1;
+    m->path = strdup(path);
+    return 1;
+}
+
+// Map again if the file changed size. Returns 1 if it did, 0 if not, -1 on failure.
+int
+lpc_map_refresh(struct lpc_map *m)
+{
+    struct stat sb;
+
+    if (m->fd < 0 || fstat(m->fd, &sb) != 0)
+	return -1;
+    if ((size_t)sb.st_size == m->len)
+	return 0;
+    if (!lpc_map_map(m)) {
+	lpc_map_close(m);
+	return -1;
+    }
+    return 1;
+}
+
+void
+lpc_map_close(struct lpc_map *m)
+{
+    lpc_map_unmap(m);
+    if (m->ownfd && m->fd >= 0)
+	close(m->fd);
+    free(m->path);
+    memset(m, 0, sizeof(struct lpc_map));
+    m->fd = -1;
+}
+
+/* Reading */
+
+void
+lpc_reader_init(struct lpc_reader *rd, int fd)
+{
+    off_t off;
+
+    memset(rd, 0, sizeof(struct lpc_reader));
+    rd->fd = fd;
+    if (lpc_map_fd(&rd->map, fd)) {
+	off = lseek(fd, 0, SEEK_CUR);	// Start where the fd is positioned, as read() would
+	if (off <= 0 && lpc_gz_magic(rd->map.p, rd->map.len)) {
+	    rd->gz = malloc(sizeof(struct lpc_gzstream));
+	    lpc_gzs_init(rd->gz, rd->map.p, rd->map.len, NULL);
+	    return;
+	}
+	rd->mapped = 1;
+	rd->pos = off > 0 ? off : 0;
+    }
+}
+
+// read(2) from the source, decompressing it if it is gzip'd
+ssize_t
+lpc_reader_read(struct lpc_reader *rd, char *buf, size_t len)
+{
+    if (rd->gz)
+	return lpc_gzs_read(rd->gz, buf, len);
+    return read(rd->fd, buf, len);
+}
+
+void
+lpc_reader_free(struct lpc_reader *rd)
+{
+    if (rd->gz) {
+	lpc_gzs_end(rd->gz);
+	free(rd->gz);
+	rd->gz = NULL;
+	lpc_map_close(&rd->map);
+    }
+    if (rd->mapped)
+	lpc_map_close(&rd->map);
+    free(rd->carry.p);
+    rd->carry.p = NULL;
+}
+
+// The next batch from a mapped file: about LPC_BATCHSIZE bytes, rounded up to a line.
+static int
+lpc_reader_nextmapped(struct lpc_reader *rd, struct lpc_batch *b)
+{
+    const char *bol, *end, *mend, *nl;
+
+    lpc_batch_clear(b);
+    if (rd->pos >= rd->map.len)
+	return 0;
+    bol = rd->map.p + rd->pos;
+    mend = rd->map.p + rd->map.len;
+    end = (mend - bol > LPC_BATCHSIZE) ? bol + LPC_BATCHSIZE : mend;
+    if (end < mend) {
+	nl = memchr(end - 1, '\n', mend - end + 1);
+	end = nl ? nl + 1 : mend;
+    }
+    rd->pos = end - rd->map.p;
+    bol = lpc_batch_index(b, bol, end);
+    if (bol < end) {		// Last line, without a '\n'
+	lpc_batch_addline(b, bol, end - bol);
+	b->noeol = 1;
+    }
+    return 1;
+}
+
+// Read the next batch of complete lines. Returns 0 at end of input.
+int
+lpc_reader_next(struct lpc_reader *rd, struct lpc_batch *b)
+{
+    const char *bol, *end;
+    ssize_t n;
+
+    if (rd->mapped)
+	return lpc_reader_nextmapped(rd, b);
+    lpc_batch_clear(b);
+    b->in.len = 0;
+    if (rd->carry.len) {	// The partial last line of the previous batch
+	lpc_text_reserve(&b->in, rd->carry.len);
+	memcpy(b->in.p, rd->carry.p, rd->carry.len);
+	b->in.len = rd->carry.len;
+	rd->carry.len = 0;
+    }
+    while (!rd->eof) {
+	lpc_text_reserve(&b->in, LPC_BATCHSIZE);
+	n = lpc_reader_read(rd, b->in.p + b->in.len, LPC_BATCHSIZE);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0) {
+	    rd->eof = 1;
+	    break;
+	}
+	b->in.len += n;
+	// Stop once we have at least one full line
+	if (memchr(b->in.p + b->in.len - n, '\n', n))
+	    break;
+    }
+    if (b->in.len == 0)
+	return 0;
+
+    bol = lpc_batch_index(b, b->in.p, b->in.p + b->in.len);
+    end = b->in.p + b->in.len;
+    if (bol < end) {
+	if (rd->eof) {		// Last line, without a '\n'
+	    lpc_batch_addline(b, bol, end - bol);
+	    b->noeol = 1;
+	} else {
+	    lpc_text_reserve(&rd->carry, end - bol);
+	    memcpy(rd->carry.p, bol, end - bol);
+	    rd->carry.len = end - bol;
+	}
+    }
+    return 1;
+}
+
+/* End of input: let each stateful stage in [from, nstages) emit, and pass its output
+ * downstream. A flush hook fills one batch per call, and returns LPC_MORE while it has
+ * more to come. A stage stops emitting once a stage after it is done (sort | head).
+ */
+int
+lpc_flushstages(struct lpc_pipeline *pl, int from, struct lpc_batch *b,
+    FILE *out)
+{
+    int i, rc;
+
+    for (i = from; i < pl->nstages; i++) {
+	if (!pl->stages[i].flush || i + 1 < pl->done)
+	    continue;
+	do {
+	    lpc_batch_clear(b);
+	    rc = pl->stages[i].flush(&pl->stages[i], b);
+	    lpc_runstages(pl, i + 1, b);
+	    if (lpc_batch_write(b, out) < 0)
+		return -1;
+	} while (rc == LPC_MORE && i + 1 >= pl->done);
+    }
+    return 0;
+}
+
+// Run the compiled stages over fd. Returns 0 on success, -1 on a write error.
+int
+lpc_execute(struct lpc_pipeline *pl, int infd, FILE *out)
+{
+    struct lpc_reader rd;
+    struct lpc_batch b;
+    int rc = 0, done;
+
+    lpc_reader_init(&rd, infd);
+    lpc_batch_init(&b);
+    if (pl->nstages > 0 && pl->stages[0].ttype == SUMMARIZE) {
+	lpc_summarize_raw(&pl->stages[0], &rd);
+	goto FLUSH;
+    }
+    while (lpc_reader_next(&rd, &b)) {
+	done = lpc_runstages(pl, 0, &b);
+	if (lpc_batch_write(&b, out) < 0) {
+	    rc = -1;
+	    goto OUT;
+	}
+	if (done == LPC_DONE)	// The rest of the input would go nowhere
+	    break;
+    }
+
+  FLUSH:
+    rc = lpc_flushstages(pl, 0, &b, out);
+  OUT:
+    if (fflush(out) == EOF)
+	rc = -1;
+    lpc_batch_free(&b);
+    lpc_reader_free(&rd);
+    return rc;
+}
+
+int
+lpc_isregular(int fd)
+{
+    struct stat sb;
+
+    return fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode);
+}
+
+// The name of the file open on fd, where the system will tell us. NULL if not.
+const char *
+lpc_fdpath(int fd, char *buf, size_t size)
+{
+#ifdef __linux__
+    char link[64];
+    ssize_t n;
+
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    n = readlink(link, buf, size - 1);
+    if (n > 0 && buf[0] == '/') {
+	buf[n] = '\0';
+	return buf;
+    }
+#endif
+    return NULL;
+}
+
+/* Check the input files named on the command line before starting on any of them:
+ * they must all be readable, and with -O, no two may have the same output file, and
+ * none may be its own output file.
+ */
+static void
+lpc_filecheck(char **files, int nfiles, const char *outdir)
+{
+    struct stat sb, osb;
+    char opath[PATH_MAX], other[PATH_MAX];
+    int i, j;
+
+    if (outdir && (stat(outdir, &sb) != 0 || !S_ISDIR(sb.st_mode))) {
+	fprintf(stderr, "Pipecut Error: %s is not a directory\n", outdir);
+	exit(-1);
+    }
+    for (i = 0; i < nfiles; i++) {
+	if (access(files[i], R_OK) != 0 || stat(files[i], &sb) != 0) {
+	    fprintf(stderr, "Pipecut Error: could not open %s: %s\n",
+		files[i], strerror(errno));
+	    exit(-1);
+	}
+	if (!outdir)
+	    continue;
+	if (!lpc_outpath(outdir, files[i], opath, sizeof(opath))) {
+	    fprintf(stderr, "Pipecut Error: output path for %s is too long\n",
+		files[i]);
+	    exit(-1);
+	}
+	if (stat(opath, &osb) == 0 && osb.st_dev == sb.st_dev
+	    && osb.st_ino == sb.st_ino) {
+	    fprintf(stderr, "Pipecut Error: %s would overwrite its input\n",
+		opath);
+	    exit(-1);
+	}
+	for (j = 0; j < i; j++) {
+	    lpc_outpath(outdir, files[j], other, sizeof(other));
+	    if (!strcmp(opath, other)) {
+		fprintf(stderr, "Pipecut Error: %s and %s would both be written "
+		    "to %s\n", files[j], files[i], opath);
+		exit(-1);
+	    }
+	}
+    }
+}
+
+/* A single input file named on the command line: make it stdin, and with -O, make
+ * its output file stdout, so that it runs just as 'pipecut -t name < file' would.
+ */
+void
+lpc_filterfile(const char *path, const char *outdir)
+{
+    char opath[PATH_MAX];
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+	fprintf(stderr, "Pipecut Error: could not open %s: %s\n", path,
+	    strerror(errno));
+	exit(-1);
+    }
+    dup2(fd, fileno(stdin));
+    close(fd);
+    if (!outdir)
+	return;
+    lpc_outpath(outdir, path, opath, sizeof(opath));
+    if (!freopen(opath, "w", stdout)) {
+	fprintf(stderr, "Pipecut Error: could not write %s: %s\n", opath,
+	    strerror(errno));
+	exit(-1);
+    }
+}
+
+// Filter mode (-t): run the loaded toolset over stdin, writing to stdout.
+void
+lpc_filterrun()
+{
+    struct lpc_plan plan;
+
+    lpc_plan_build(&plan, &head, LPC_PLAN_NATIVE);
+    lpc_filterplan(&plan, NULL);
+    lpc_plan_free(&plan);
+}
+
+/* Run a plan made from the loaded toolset, as lpc_filterrun() does. pl is the plan
+ * compiled already (by the --serve parent, so its children don't each compile it), or
+ * NULL to compile it here.
+ */
+void
+lpc_filterplan(struct lpc_plan *plan, struct lpc_pipeline *pl)
+{
+    struct lpc_pipeline own;
+    FILE *out = stdout;
+    lpc_jitfn jit;
+    int rc;
+
+    lpc_filecheck(lpc_ctx.files, lpc_ctx.nfiles, lpc_ctx.outdir);
+    if (lpc_ctx.nfiles > 1) {
+	signal(SIGPIPE, SIG_IGN);
+	rc = lpc_execute_files(&plan->blades, lpc_ctx.files, lpc_ctx.nfiles,
+	    lpc_ctx.jobs, lpc_ctx.outdir, stdout);
+	if (rc < 0 && !lpc_output_gone(stdout)) {
+	    fprintf(stderr, "Pipecut Error: write error: %s\n",
+		strerror(errno));
+	    exit(-1);
+	}
+	return;
+    }
+    if (lpc_ctx.nfiles == 1)
+	lpc_filterfile(lpc_ctx.files[0], lpc_ctx.outdir);
+    if (!pl) {
+	lpc_compile(&own, &plan->blades);
+	pl = &own;
+    }
+    if (pl->tail[0] != '\0') {
+	if (lpc_ctx.debug)
+	    fprintf(stderr, "Handing off to the shell: %s\n", pl->tail);
+	fflush(stdout);
+	out = popen(pl->tail, "w");
+	if (!out) {
+	    fprintf(stderr, "Pipecut Error: could not start %s\n", pl->tail);
+	    exit(-1);
+	}
+    }
+    /* When the reader goes away (| head), a write fails with EPIPE and we stop, rather
+     * than being killed part way through. The shell tail, started above, keeps the
+     * default.
+     */
+    signal(SIGPIPE, SIG_IGN);
+    if (lpc_ctx.statefile)
+	rc = lpc_execute_state(pl, TAILQ_EMPTY(&head) ? &plan->blades : &head,
+	    fileno(stdin), out, lpc_ctx.statefile);	// -f has no toolset, only the plan
+    else if (lpc_ctx.jobs > 1 && lpc_isregular(fileno(stdin)))
+	rc = lpc_execute_chunked(pl, fileno(stdin), out, lpc_ctx.jobs);
+    else if (lpc_ctx.jit && (jit = lpc_jit_load(pl, &plan->blades)))
+	rc = lpc_jit_execute(jit, fileno(stdin), out);
+    else if (lpc_ctx.pipelined)
+	rc = lpc_execute_pipelined(pl, fileno(stdin), out);
+    else
+	rc = lpc_execute(pl, fileno(stdin), out);
+    if (rc < 0 && out == stdout && !lpc_output_gone(out)) {
+	fprintf(stderr, "Pipecut Error: write error: %s\n", strerror(errno));
+	exit(-1);
+    }
+    if (out != stdout)
+	pclose(out);
+    lpc_release(pl);
+}
@@ -0,0 +1,260 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* libpipecut native execution engine.
+ *
+ * In filter mode (-t) the toolset used to be turned into a shell pipeline and handed
+ * to system(). The engine below runs the blades in-process instead: input is read in
+ * fixed size batches, each batch is split into lines, and the lines are handed from
+ * stage to stage without being copied. Only BLACKBOX blades (and anything after the
+ * first one) still go out to /bin/sh.
+ */
+
+#ifndef PCEXEC_H
+#define PCEXEC_H
+
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#define LPC_BATCHSIZE (256 * 1024)	// Bytes read from the source per batch
+
+// wc(1), wc -l and uniq -c output formats. We want to be byte-for-byte identical to the shell pipeline.
+#ifdef __linux__
+#define LPC_WC_FMT "%7ld %7ld %7ld\n"	// GNU coreutils, reading a pipe
+#define LPC_WCL_FMT "%ld"
+#define LPC_UNIQ_FMT "%7ld "
+#else
+#define LPC_WC_FMT " %7ld %7ld %7ld\n"	// BSD
+#define LPC_WCL_FMT " %7ld"
+#define LPC_UNIQ_FMT "%4ld "
+#endif
+
+/* Return codes from stage functions. A run hook that returns LPC_DONE (head -n) wants
+ * no more input, and so nothing upstream of it needs any either: the executors stop
+ * reading, and skip the flush of the stages before it.
+ */
+#define LPC_MORE 0			// Keep feeding input
+#define LPC_DONE 1			// Stage needs no further input
+
+// One line of text. The '\n' is not part of the span.
+struct lpc_span {
+    const char *p;
+    size_t len;
+};
+
+// Growable text buffer
+struct lpc_text {
+    char *p;
+    size_t len;
+    size_t cap;
+};
+
+/* A batch of lines travelling through the native pipeline.
+ * Filtering stages drop entries from 'lines' in place. Transforming stages build their
+ * output in 'tmp' via lpc_batch_put()/lpc_batch_endline() and swap it in with
+ * lpc_batch_commit(), so the lines always point into either 'in' or 'own'.
+ */
+struct lpc_batch {
+    struct lpc_text in;		// Raw bytes from the source
+    struct lpc_text own;	// Text produced by a transforming stage
+    struct lpc_text tmp;	// Scratch for the next transforming stage
+    struct lpc_span *lines;
+    int nlines;
+    int linecap;
+    struct lpc_span *olines;	// Under construction (offsets into tmp)
+    int nolines;
+    int olinecap;
+    size_t olinestart;
+    int noeol;			// The last line had no trailing '\n' (end of input only)
+    int last;			// End of stream marker (threaded executors)
+};
+
+/* A read-only mapping of a regular file. Lines are handed out as spans straight from
+ * the mapping, with no copy. lpc_map_refresh() maps again only if the file changed size.
+ */
+struct lpc_map {
+    int fd;
+    int ownfd;			// We opened fd (lpc_map_file), so we close it
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    const char *p;		// NULL for an empty file
+    size_t len;
+};
+
+// Source of batches: an fd, and the partial line left over from the previous read.
+// Regular files are mapped instead of read, and 'pos' walks the mapping. A gzip'd
+// file is decompressed from its mapping as it's read.
+struct lpc_reader {
+    int fd;
+    int eof;
+    struct lpc_text carry;
+    int mapped;
+    struct lpc_map map;
+    size_t pos;
+    struct lpc_gzstream *gz;
+};
+
+/* A compiled FORMAT pattern: a list of parts, each literal text, the end of an output
+ * line, or a field of the input line. pcEmit.c generates code from the parts.
+ */
+#define LPC_FMT_TEXT -1			// Literal text
+#define LPC_FMT_EOL -2			// A '\n' in the text: the output line ends here
+#define LPC_FMT_NF -3			// $NF
+
+struct lpc_fmtpart {
+    int what;			// A field number, or one of LPC_FMT_*
+    size_t off;			// LPC_FMT_TEXT: where in 'text', and how long
+    size_t len;
+};
+
+struct lpc_format {
+    char *src;			// The pattern, for copies
+    struct lpc_fmtpart *parts;
+    int nparts;
+    char *text;			// The unescaped literals
+    int maxfield;		// Fields each line is split into (0 none, -1 all)
+    struct lpc_span *fields;	// Scratch for the split
+    int fieldcap;
+};
+
+// Decompression of a gzip'd source (pcGzip.h)
+struct lpc_gzstream;
+
+// Bounded single-producer/single-consumer queue of batches between two threads.
+struct lpc_ring;
+
+// What a stage has built up, as written to and read from a --state file (pcState.h)
+struct lpc_state;
+
+// A toolset rewritten for running (pcPlan.h)
+struct lpc_plan;
+
+struct lpc_stage;
+typedef int (*lpc_stagefn) (struct lpc_stage *, struct lpc_batch *);
+
+// One executable step, compiled from a blade.
+struct lpc_stage {
+    Tooltype ttype;
+    struct toolelement *blade;
+    lpc_stagefn run;		// Called for every batch
+    lpc_stagefn flush;		// End of input: fills a batch, LPC_MORE until done (may be NULL)
+    void (*fini) (struct lpc_stage *);	// Release priv (may be NULL)
+    void (*clone) (struct lpc_stage *, struct lpc_stage *);	// NULL if it can't run on several threads
+    void (*merge) (struct lpc_stage *, struct lpc_stage *);	// Fold a partial state in (stateful stages)
+    void (*save) (struct lpc_stage *, struct lpc_state *);	// Write the state out, before the flush (stateful stages)
+    int (*load) (struct lpc_stage *, struct lpc_state *);	// Read it back in. 0 if it doesn't parse
+    void *priv;
+    regex_t *re;		// INCLUDE/EXCLUDE: the blade's preg, or a private copy
+    int ownre;
+    int nblades;		// Blades folded into this stage
+    struct lpc_text scratch;	// NUL terminated copy of a line, where regexec needs one
+};
+
+// A toolset compiled for native execution.
+struct lpc_pipeline {
+    struct lpc_stage *stages;
+    int nstages;
+    int done;			// Stages before this one get no more input (serial executors)
+    char tail[BLADECACHE];	// Shell text for the blades from the first BLACKBOX on
+};
+
+// Buffers and batches
+void lpc_text_reserve(struct lpc_text *t, size_t need);
+void lpc_batch_init(struct lpc_batch *b);
+void lpc_batch_free(struct lpc_batch *b);
+void lpc_batch_clear(struct lpc_batch *b);
+void lpc_batch_addline(struct lpc_batch *b, const char *p, size_t len);
+const char *lpc_batch_index(struct lpc_batch *b, const char *bol,
+    const char *end);
+void lpc_batch_put(struct lpc_batch *b, const char *p, size_t len);
+void lpc_batch_endline(struct lpc_batch *b);
+void lpc_batch_commit(struct lpc_batch *b);
+int lpc_batch_write(struct lpc_batch *b, FILE *out);
+int lpc_output_gone(FILE *out);
+
+// Mapping
+int lpc_map_fd(struct lpc_map *m, int fd);
+int lpc_map_file(struct lpc_map *m, const char *path);
+int lpc_map_refresh(struct lpc_map *m);
+void lpc_map_close(struct lpc_map *m);
+
+// Reading
+void lpc_reader_init(struct lpc_reader *rd, int fd);
+ssize_t lpc_reader_read(struct lpc_reader *rd, char *buf, size_t len);
+int lpc_reader_next(struct lpc_reader *rd, struct lpc_batch *b);
+void lpc_reader_free(struct lpc_reader *rd);
+
+// Compile / run / release
+void lpc_compile(struct lpc_pipeline *pl, struct tailhead *blades);
+void lpc_tailtext(char *tail, struct toolelement *te);
+int lpc_blade_stage(struct lpc_stage *st, struct toolelement *te);
+void lpc_stage_lines(struct lpc_stage *st, struct lpc_span *lines, int n,
+    void (*fn) (void *, const char *, size_t), void *arg);
+void lpc_stage_clone(struct lpc_stage *dst, struct lpc_stage *src);
+void lpc_stage_free(struct lpc_stage *st);
+int lpc_runstages(struct lpc_pipeline *pl, int from, struct lpc_batch *b);
+int lpc_flushstages(struct lpc_pipeline *pl, int from, struct lpc_batch *b,
+    FILE *out);
+int lpc_execute(struct lpc_pipeline *pl, int infd, FILE *out);
+void lpc_release(struct lpc_pipeline *pl);
+void lpc_filterrun();
+void lpc_filterplan(struct lpc_plan *plan, struct lpc_pipeline *pl);
+void lpc_filterfile(const char *path, const char *outdir);
+int lpc_isregular(int fd);
+const char *lpc_fdpath(int fd, char *buf, size_t size);
+
+// Threaded executors (pcPar.c)
+struct lpc_ring *lpc_ring_new(unsigned int size);
+void lpc_ring_free(struct lpc_ring *r);
+void lpc_ring_push(struct lpc_ring *r, struct lpc_batch *b);
+struct lpc_batch *lpc_ring_pop(struct lpc_ring *r);
+int lpc_execute_pipelined(struct lpc_pipeline *pl, int infd, FILE *out);
+int lpc_execute_chunked(struct lpc_pipeline *pl, int infd, FILE *out,
+    int jobs);
+int lpc_execute_files(struct tailhead *blades, char **files, int nfiles,
+    int jobs, const char *outdir, FILE *out);
+int lpc_outpath(const char *dir, const char *path, char *buf, size_t size);
+FILE *lpc_shell_to(const char *cmd, int fd, pid_t *pid);
+
+// Helpers shared with the UI
+regex_t *lpc_blade_re(struct toolelement *te);
+int lpc_regexec_span(regex_t *re, const char *p, size_t len,
+    struct lpc_text *scratch);
+int lpc_regmatch_span(regex_t *re, const char *p, size_t len, size_t nmatch,
+    regmatch_t *pm, struct lpc_text *scratch);
+size_t lpc_awkunescape(char *dst, const char *src);
+struct lpc_format *lpc_format_new(const char *patt);
+void lpc_format_free(struct lpc_format *fmt);
+void lpc_format_apply(struct lpc_format *fmt, struct lpc_batch *b,
+    const char *p, size_t len);
+void lpc_format_awk(const char *patt, char *out, size_t size);
+
+#endif
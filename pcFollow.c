@@ -0,0 +1,178 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Following a growing source. See pcFollow.h. */
+
+#include <poll.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "pipecut.h"
+#include "pcExec.h"
+#include "pcFollow.h"
+#include "pcGzip.h"
+
+// Open path for following, from the start of the line LPC_FOLLOWBACK bytes before its end.
+// Returns 0 if it isn't a regular file we can read.
+int
+lpc_follow_open(struct lpc_follow *fw, const char *path)
+{
+    struct stat sb;
+    char c;
+
+    memset(fw, 0, sizeof(struct lpc_follow));
+    fw->wfd = -1;
+    if ((fw->fd = open(path, O_RDONLY)) < 0)
+	return 0;
+    if (fstat(fw->fd, &sb) != 0 || !S_ISREG(sb.st_mode)
+	|| lpc_gz_fd(fw->fd)) {	// What's appended to a gzip'd file isn't text
+	close(fw->fd);
+	return 0;
+    }
+    if (sb.st_size > LPC_FOLLOWBACK) {
+	fw->pos = sb.st_size - LPC_FOLLOWBACK;
+	fw->skip = pread(fw->fd, &c, 1, fw->pos - 1) == 1 && c != '\n';
+    }
+#ifdef __linux__
+    fw->wfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fw->wfd >= 0 && inotify_add_watch(fw->wfd, path, IN_MODIFY) < 0) {
+	close(fw->wfd);
+	fw->wfd = -1;
+    }
+#endif
+    return 1;
+}
+
+// Bytes in the file we haven't read yet (negative if it was truncated)
+static off_t
+lpc_follow_pending(struct lpc_follow *fw)
+{
+    struct stat sb;
+
+    if (fstat(fw->fd, &sb) != 0)
+	return 0;
+    return sb.st_size - fw->pos;
+}
+
+/* Wait until the file has grown (returns 1) or kfd is readable (returns 0). A key
+ * comes first, so the UI stays responsive while a busy log keeps us reading.
+ */
+int
+lpc_follow_wait(struct lpc_follow *fw, int kfd)
+{
+    struct pollfd pfd[2];
+    char ev[4096];
+    int n, timeout;
+
+    while (1) {
+	pfd[0].fd = kfd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = fw->wfd;
+	pfd[1].events = POLLIN;
+	pfd[0].revents = pfd[1].revents = 0;
+	if (lpc_follow_pending(fw) != 0)
+	    timeout = 0;	// Left over from the last round
+	else
+	    timeout = fw->wfd >= 0 ? -1 : LPC_FOLLOWPOLL;
+	n = poll(pfd, fw->wfd >= 0 ? 2 : 1, timeout);
+	if (n < 0 && errno != EINTR)
+	    return 0;
+	if (pfd[0].revents)
+	    return 0;
+	if (pfd[1].revents) {	// We only need to know that something happened
+	    while (read(fw->wfd, ev, sizeof(ev)) > 0) ;
+	}
+	if (lpc_follow_pending(fw) != 0)
+	    return 1;
+    }
+}
+
+/* Read what was appended since the last call, at most a batch of it, into b. Returns
+ * 0 when there was nothing new. b may hold no lines (a partial line came in).
+ */
+int
+lpc_follow_read(struct lpc_follow *fw, struct lpc_batch *b)
+{
+    const char *bol, *end, *nl;
+    off_t avail;
+    ssize_t n;
+
+    lpc_batch_clear(b);
+    b->in.len = 0;
+    avail = lpc_follow_pending(fw);
+    if (avail < 0) {		// Truncated: start again from the top, as tail -f does
+	fw->pos = 0;
+	fw->skip = 0;
+	fw->carry.len = 0;
+	avail = lpc_follow_pending(fw);
+    }
+    if (avail == 0)
+	return 0;
+    if (avail > LPC_BATCHSIZE)
+	avail = LPC_BATCHSIZE;
+
+    lpc_text_reserve(&b->in, fw->carry.len + avail);
+    memcpy(b->in.p, fw->carry.p, fw->carry.len);
+    b->in.len = fw->carry.len;
+    fw->carry.len = 0;
+    n = pread(fw->fd, b->in.p + b->in.len, avail, fw->pos);
+    if (n <= 0)
+	return 0;
+    fw->pos += n;
+    b->in.len += n;
+
+    bol = b->in.p;
+    end = b->in.p + b->in.len;
+    if (fw->skip) {
+	if (!(nl = memchr(bol, '\n', end - bol)))
+	    return 1;
+	bol = nl + 1;
+	fw->skip = 0;
+    }
+    bol = lpc_batch_index(b, bol, end);
+    if (bol < end) {
+	lpc_text_reserve(&fw->carry, end - bol);
+	memcpy(fw->carry.p, bol, end - bol);
+	fw->carry.len = end - bol;
+    }
+    return 1;
+}
+
+void
+lpc_follow_close(struct lpc_follow *fw)
+{
+    if (fw->wfd >= 0)
+	close(fw->wfd);
+    close(fw->fd);
+    free(fw->carry.p);
+    memset(fw, 0, sizeof(struct lpc_follow));
+    fw->wfd = -1;
+}
@@ -0,0 +1,60 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Following a growing source, for the UI's follow mode ('F').
+ *
+ * lpc_follow_open() starts near the end of a file and watches it for appends: with
+ * inotify on Linux, elsewhere by polling its size. lpc_follow_wait() sleeps until the
+ * file grows or the terminal has a key for us. lpc_follow_read() returns the lines
+ * completed since the last call, one batch at a time, and holds back a partial last
+ * line until its '\n' arrives. Only those lines then go through the toolset.
+ */
+
+#ifndef PCFOLLOW_H
+#define PCFOLLOW_H
+
+#define LPC_FOLLOWBACK (256 * 1024)	// Bytes before the end to start from
+#define LPC_FOLLOWPOLL 250		// Milliseconds between size checks, without inotify
+
+struct lpc_follow {
+    int fd;			// The source
+    int wfd;			// inotify instance, or -1
+    off_t pos;			// First byte not yet read
+    int skip;			// Drop up to the first '\n' (we started mid-line)
+    struct lpc_text carry;	// Partial last line
+};
+
+int lpc_follow_open(struct lpc_follow *fw, const char *path);
+int lpc_follow_wait(struct lpc_follow *fw, int kfd);
+int lpc_follow_read(struct lpc_follow *fw, struct lpc_batch *b);
+void lpc_follow_close(struct lpc_follow *fw);
+
+#endif
@@ -0,0 +1,405 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Compressed (gzip) sources. See pcGzip.h. */
+
+#include <stdint.h>
+
+#include "pipecut.h"
+#include "pcGzip.h"
+
+#define LPC_GZFEED (1 << 30)		// Input handed to zlib at once (avail_in is 32 bits)
+#define LPC_GZMAGIC "pipecut gzidx 1"
+
+// The sidecar index: this header, then for each point a lpc_gzrec and its window.
+struct lpc_gzhead {
+    char magic[16];
+    int64_t csize;		// The compressed file it was made for
+    int64_t mtime;
+    int64_t ino;
+    int64_t usize;
+    int64_t npts;
+};
+
+struct lpc_gzrec {
+    int64_t out;
+    int64_t in;
+    int32_t bits;
+    int32_t wsize;
+};
+
+int
+lpc_gz_magic(const void *p, size_t len)
+{
+    const unsigned char *u = p;
+
+    return len >= 3 && u[0] == 0x1f && u[1] == 0x8b && u[2] == 8;
+}
+
+// Does the file open on fd start like a gzip file?
+int
+lpc_gz_fd(int fd)
+{
+    unsigned char m[3];
+
+    return pread(fd, m, 3, 0) == 3 && lpc_gz_magic(m, 3);
+}
+
+/* Streams */
+
+static void
+lpc_gzs_feed(struct lpc_gzstream *s)
+{
+    size_t rem = s->len - (s->zs.next_in - s->p);
+
+    if (s->zs.avail_in == 0)
+	s->zs.avail_in = rem > LPC_GZFEED ? LPC_GZFEED : rem;
+}
+
+// Start decompressing the file p, at the seek point pt (NULL for the top).
+void
+lpc_gzs_init(struct lpc_gzstream *s, const void *p, size_t len,
+    struct lpc_gzpoint *pt)
+{
+    memset(s, 0, sizeof(struct lpc_gzstream));
+    s->p = p;
+    s->len = len;
+    s->zs.next_in = (unsigned char *)s->p + (pt ? pt->in : 0);
+    lpc_gzs_feed(s);
+    if (!pt || pt->wsize < 0) {
+	inflateInit2(&s->zs, 31);	// A gzip header comes first
+	s->out = pt ? pt->out : 0;
+	return;
+    }
+    inflateInit2(&s->zs, -15);
+    if (pt->bits)
+	inflatePrime(&s->zs, pt->bits, s->p[pt->in - 1] >> (8 - pt->bits));
+    inflateSetDictionary(&s->zs, pt->window, pt->wsize);
+    s->out = pt->out;
+    s->raw = 1;
+}
+
+static void
+lpc_gz_addpoint(struct lpc_gz *gz, off_t out, off_t in, int bits,
+    z_stream *zs)
+{
+    struct lpc_gzpoint *pt;
+    uInt n = LPC_GZWINDOW;
+
+    if (gz->npts == gz->ptcap) {
+	gz->ptcap = gz->ptcap ? gz->ptcap * 2 : 64;
+	gz->pts = realloc(gz->pts, gz->ptcap * sizeof(struct lpc_gzpoint));
+    }
+    pt = &gz->pts[gz->npts++];
+    pt->out = out;
+    pt->in = in;
+    pt->bits = bits;
+    pt->wsize = -1;
+    pt->window = NULL;
+    if (zs) {
+	pt->window = malloc(LPC_GZWINDOW);
+	inflateGetDictionary(zs, pt->window, &n);
+	pt->wsize = n;
+    }
+}
+
+// End of a gzip member. Another may follow it.
+static void
+lpc_gzs_member(struct lpc_gzstream *s)
+{
+    const unsigned char *np = s->zs.next_in;
+    size_t rem = s->len - (np - s->p);
+
+    if (s->raw) {		// Started at a seek point: the trailer is ours to skip
+	if (rem < 8) {
+	    s->eof = 1;
+	    return;
+	}
+	np += 8;
+	rem -= 8;
+    }
+    if (!lpc_gz_magic(np, rem)) {
+	s->eof = 1;
+	return;
+    }
+    if (s->index)
+	lpc_gz_addpoint(s->index, s->out, np - s->p, 0, NULL);
+    inflateReset2(&s->zs, 31);
+    s->raw = 0;
+    s->zs.next_in = (unsigned char *)np;
+    s->zs.avail_in = 0;
+    lpc_gzs_feed(s);
+}
+
+/* Decompress up to len bytes into buf. Returns fewer only at the end of the file. A
+ * corrupt file is fatal; a truncated one just ends early, as with zcat.
+ */
+size_t
+lpc_gzs_read(struct lpc_gzstream *s, char *buf, size_t len)
+{
+    unsigned char *o = (unsigned char *)buf;
+    size_t n;
+    int rc;
+
+    while (!s->eof && len > 0) {
+	lpc_gzs_feed(s);
+	s->zs.next_out = o;
+	s->zs.avail_out = len > LPC_GZFEED ? LPC_GZFEED : len;
+	rc = inflate(&s->zs, s->index ? Z_BLOCK : Z_NO_FLUSH);
+	n = s->zs.next_out - o;
+	o += n;
+	len -= n;
+	s->out += n;
+	if (rc == Z_STREAM_END) {
+	    lpc_gzs_member(s);
+	    continue;
+	}
+	if (rc == Z_BUF_ERROR && s->zs.avail_in == 0) {	// Truncated
+	    s->eof = 1;
+	    break;
+	}
+	if (rc != Z_OK && rc != Z_BUF_ERROR) {
+	    fprintf(stderr, "Pipecut Error: corrupt gzip data: %s\n",
+		s->zs.msg ? s->zs.msg : "inflate failed");
+	    exit(-1);
+	}
+	// Between two blocks, and not in the last one: a place to start from later.
+	if (s->index && (s->zs.data_type & 128) && !(s->zs.data_type & 64)
+	    && s->out - s->last >= LPC_GZSPAN) {
+	    lpc_gz_addpoint(s->index, s->out, s->zs.next_in - s->p,
+		s->zs.data_type & 7, &s->zs);
+	    s->last = s->out;
+	}
+    }
+    return o - (unsigned char *)buf;
+}
+
+void
+lpc_gzs_end(struct lpc_gzstream *s)
+{
+    inflateEnd(&s->zs);
+}
+
+/* The index */
+
+static void
+lpc_gz_freepts(struct lpc_gz *gz)
+{
+    int i;
+
+    for (i = 0; i < gz->npts; i++)
+	free(gz->pts[i].window);
+    free(gz->pts);
+    gz->pts = NULL;
+    gz->npts = gz->ptcap = 0;
+}
+
+static void
+lpc_gz_build(struct lpc_gz *gz)
+{
+    struct lpc_gzstream s;
+    char *buf = malloc(LPC_GZSPAN);
+
+    lpc_gz_addpoint(gz, 0, 0, 0, NULL);
+    lpc_gzs_init(&s, gz->p, gz->len, NULL);
+    s.index = gz;
+    while (lpc_gzs_read(&s, buf, LPC_GZSPAN) == LPC_GZSPAN) ;
+    gz->usize = s.out;
+    lpc_gzs_end(&s);
+    free(buf);
+}
+
+static int
+lpc_gz_load(struct lpc_gz *gz, const char *idx, struct stat *sb)
+{
+    struct lpc_gzhead h;
+    struct lpc_gzrec r;
+    struct lpc_gzpoint *pt;
+    struct stat isb;
+    FILE *fp;
+    int64_t i;
+    int ok = 0;
+
+    if (!(fp = fopen(idx, "r")))
+	return 0;
+    /* A damaged index is just rebuilt. Every point is a record in the file, and at a
+     * place of its own in the compressed text, so npts can't be more than either
+     * holds. The points go in order of both offsets, for lpc_gz_pread()'s search (a
+     * gzip member that's empty starts where the one before it ended).
+     */
+    if (fstat(fileno(fp), &isb) != 0 || fread(&h, sizeof(h), 1, fp) != 1
+	|| memcmp(h.magic, LPC_GZMAGIC, sizeof(LPC_GZMAGIC))
+	|| h.csize != (int64_t)gz->len || h.mtime != (int64_t)sb->st_mtime
+	|| h.ino != (int64_t)sb->st_ino || h.usize < 0 || h.npts < 1
+	|| h.npts > h.csize + 1 || h.npts > INT_MAX
+	|| h.npts > (isb.st_size - (off_t)sizeof(h)) / (off_t)sizeof(r))
+	goto OUT;
+    if (!(gz->pts = calloc(h.npts, sizeof(struct lpc_gzpoint))))
+	goto OUT;
+    gz->ptcap = h.npts;
+    for (i = 0; i < h.npts; i++) {
+	pt = &gz->pts[gz->npts];
+	if (fread(&r, sizeof(r), 1, fp) != 1 || r.wsize > LPC_GZWINDOW
+	    || r.in < 0 || r.in > h.csize || r.bits < 0 || r.bits > 7
+	    || r.out < 0 || r.out > h.usize || (i == 0 && r.out != 0)
+	    || (i > 0 && (r.out < pt[-1].out || r.in < pt[-1].in)))
+	    goto OUT;
+	gz->npts++;
+	pt->out = r.out;
+	pt->in = r.in;
+	pt->bits = r.bits;
+	pt->wsize = r.wsize;
+	if (r.wsize >= 0) {
+	    if (!(pt->window = malloc(LPC_GZWINDOW))
+		|| fread(pt->window, 1, r.wsize, fp) != (size_t)r.wsize)
+		goto OUT;
+	}
+    }
+    gz->usize = h.usize;
+    ok = 1;
+  OUT:
+    fclose(fp);
+    if (!ok)
+	lpc_gz_freepts(gz);
+    return ok;
+}
+
+// Write the index out. It's only a cache, so failing to is no error.
+static void
+lpc_gz_save(struct lpc_gz *gz, const char *idx, struct stat *sb)
+{
+    struct lpc_gzhead h;
+    struct lpc_gzrec r;
+    struct lpc_gzpoint *pt;
+    char tmp[PATH_MAX];
+    FILE *fp = NULL;
+    int i, fd = -1;
+
+    /* Next to the archive, which may be in a directory others can write (/tmp,
+     * /var/log): under a name of mkstemp()'s, never through a link someone put there.
+     */
+    if (snprintf(tmp, PATH_MAX, "%s.XXXXXX", idx) >= PATH_MAX
+	|| (fd = mkstemp(tmp)) == -1 || fchmod(fd, 0644) != 0
+	|| !(fp = fdopen(fd, "w"))) {
+	if (lpc_ctx.debug)
+	    fprintf(stderr, "pipecut: not saving %s: %s\n", idx,
+		strerror(errno));
+	if (fd != -1) {
+	    close(fd);
+	    unlink(tmp);
+	}
+	return;
+    }
+    memset(&h, 0, sizeof(h));
+    strcpy(h.magic, LPC_GZMAGIC);
+    h.csize = gz->len;
+    h.mtime = sb->st_mtime;
+    h.ino = sb->st_ino;
+    h.usize = gz->usize;
+    h.npts = gz->npts;
+    fwrite(&h, sizeof(h), 1, fp);
+    for (i = 0; i < gz->npts; i++) {
+	pt = &gz->pts[i];
+	memset(&r, 0, sizeof(r));
+	r.out = pt->out;
+	r.in = pt->in;
+	r.bits = pt->bits;
+	r.wsize = pt->wsize;
+	fwrite(&r, sizeof(r), 1, fp);
+	if (pt->wsize > 0)
+	    fwrite(pt->window, 1, pt->wsize, fp);
+    }
+    if (ferror(fp) || fclose(fp) != 0 || rename(tmp, idx) != 0)
+	unlink(tmp);
+}
+
+/* Get ready to read the gzip file mapped at p (of the file at path, which may be
+ * NULL) from anywhere. Returns 0 if it isn't a gzip file.
+ */
+int
+lpc_gz_open(struct lpc_gz *gz, const void *p, size_t len, const char *path)
+{
+    struct stat sb;
+    char idx[PATH_MAX];
+
+    memset(gz, 0, sizeof(struct lpc_gz));
+    if (!lpc_gz_magic(p, len))
+	return 0;
+    gz->p = p;
+    gz->len = len;
+    if (path && (stat(path, &sb) != 0
+	    || snprintf(idx, PATH_MAX, "%s%s", path, LPC_GZSUFFIX) >= PATH_MAX))
+	path = NULL;
+    if (path && lpc_gz_load(gz, idx, &sb))
+	return 1;
+    lpc_gz_build(gz);
+    if (path)
+	lpc_gz_save(gz, idx, &sb);
+    return 1;
+}
+
+/* Read up to len bytes of the uncompressed text, from offset off. Returns fewer only
+ * at the end of it. Safe to call from several threads at once.
+ */
+ssize_t
+lpc_gz_pread(struct lpc_gz *gz, char *buf, size_t len, off_t off)
+{
+    struct lpc_gzstream s;
+    char skip[64 * 1024];
+    size_t n;
+    int lo = 0, hi = gz->npts - 1, mid;
+
+    if (off >= gz->usize || gz->npts == 0)
+	return 0;
+    while (lo < hi) {		// The last point at or before off
+	mid = (lo + hi + 1) / 2;
+	if (gz->pts[mid].out <= off)
+	    lo = mid;
+	else
+	    hi = mid - 1;
+    }
+    lpc_gzs_init(&s, gz->p, gz->len, &gz->pts[lo]);
+    while (s.out < off) {
+	n = off - s.out < (off_t)sizeof(skip) ? off - s.out : sizeof(skip);
+	if (lpc_gzs_read(&s, skip, n) < n)
+	    break;
+    }
+    n = s.out == off ? lpc_gzs_read(&s, buf, len) : 0;
+    lpc_gzs_end(&s);
+    return n;
+}
+
+void
+lpc_gz_close(struct lpc_gz *gz)
+{
+    lpc_gz_freepts(gz);
+    memset(gz, 0, sizeof(struct lpc_gz));
+}
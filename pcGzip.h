@@ -0,0 +1,98 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Compressed (gzip) sources.
+ *
+ * A gzip file can only be decompressed from the top, so paging through one, or
+ * splitting it among threads, needs places in the middle to start from. The first
+ * time a file is opened, one pass over it records a seek point about every
+ * LPC_GZSPAN bytes of output: a deflate block boundary, and the 32K window of output
+ * before it that the block may refer back to. The points are kept in a sidecar index
+ * (FILE.pcidx) when the file's directory is writable, and in memory otherwise.
+ * lpc_gz_pread() then reads from any offset in the uncompressed text by decompressing
+ * from the point before it.
+ *
+ * Concatenated gzip members (cat a.gz b.gz) read as one text, as with zcat.
+ */
+
+#ifndef PCGZIP_H
+#define PCGZIP_H
+
+#include <zlib.h>
+
+#define LPC_GZSPAN (1024 * 1024)	// Uncompressed bytes between seek points
+#define LPC_GZWINDOW 32768		// deflate's window
+#define LPC_GZSUFFIX ".pcidx"		// Sidecar index
+
+// A place decompression can start from
+struct lpc_gzpoint {
+    off_t out;			// Offset in the uncompressed text
+    off_t in;			// Offset of the first whole byte of input
+    int bits;			// Bits of the byte before 'in' that are still to be read
+    int wsize;			// Bytes of window; -1 where a gzip member starts
+    unsigned char *window;
+};
+
+// A gzip file, mapped, and its seek points
+struct lpc_gz {
+    const unsigned char *p;
+    size_t len;
+    off_t usize;		// Uncompressed size
+    struct lpc_gzpoint *pts;
+    int npts;
+    int ptcap;
+};
+
+// Decompression from the top, or from a seek point
+struct lpc_gzstream {
+    z_stream zs;
+    const unsigned char *p;
+    size_t len;
+    off_t out;			// Uncompressed bytes so far
+    int raw;			// Started at a seek point: no gzip header or trailer
+    int eof;
+    struct lpc_gz *index;	// Record seek points here while reading, if not NULL
+    off_t last;			// Where the last point was recorded
+};
+
+int lpc_gz_magic(const void *p, size_t len);
+int lpc_gz_fd(int fd);
+int lpc_gz_open(struct lpc_gz *gz, const void *p, size_t len,
+    const char *path);
+ssize_t lpc_gz_pread(struct lpc_gz *gz, char *buf, size_t len, off_t off);
+void lpc_gz_close(struct lpc_gz *gz);
+
+void lpc_gzs_init(struct lpc_gzstream *s, const void *p, size_t len,
+    struct lpc_gzpoint *pt);
+size_t lpc_gzs_read(struct lpc_gzstream *s, char *buf, size_t len);
+void lpc_gzs_end(struct lpc_gzstream *s);
+
+#endif
@@ -0,0 +1,238 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Filter runs compiled to machine code. See pcJit.h. */
+
+#include <dlfcn.h>
+#include <stdint.h>
+#include <sys/utsname.h>
+
+#include "pipecut.h"
+#include "pcEmit.h"
+#include "pcExec.h"
+#include "pcJit.h"
+
+#define LPC_JITSYM "pipecut_jit"
+
+// FNV-1a, 64 bit
+static uint64_t
+lpc_jit_hash(uint64_t h, const char *p, size_t len)
+{
+    while (len--) {
+	h ^= (unsigned char)*p++;
+	h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// The cache directory, made if need be. 0 if there's none to be had.
+static int
+lpc_jit_dir(char *buf, size_t size)
+{
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char *slash;
+    int n;
+
+    if (xdg && *xdg == '/')	// Relative ones are to be ignored
+	n = snprintf(buf, size, "%s/pipecut", xdg);
+    else if (home && *home)
+	n = snprintf(buf, size, "%s/.cache/pipecut", home);
+    else
+	return 0;
+    if (n < 0 || (size_t)n >= size)
+	return 0;
+    if (mkdir(buf, 0700) == 0 || errno == EEXIST)
+	return 1;
+    if (errno != ENOENT)
+	return 0;
+    slash = strrchr(buf, '/');	// ~/.cache may not be there yet either
+    *slash = '\0';
+    n = mkdir(buf, 0700);
+    *slash = '/';
+    if (n == -1 && errno != EEXIST)
+	return 0;
+    return mkdir(buf, 0700) == 0 || errno == EEXIST;
+}
+
+/* Build src into the shared object so, with $CC or cc. Its messages only show with
+ * -d: a compiler that can't build the program just means the engine runs the toolset.
+ */
+static int
+lpc_jit_cc(const char *src, const char *so)
+{
+    pid_t pid;
+    int status, fd;
+
+    pid = fork();
+    if (pid == -1)
+	return 0;
+    if (pid == 0) {
+	if ((fd = open("/dev/null", O_RDWR)) != -1) {
+	    dup2(fd, 0);
+	    dup2(lpc_ctx.debug ? 2 : fd, 1);	// Never into the filter's output
+	    if (!lpc_ctx.debug)
+		dup2(fd, 2);
+	}
+	// Through the shell, for CC="ccache cc"
+	execl("/bin/sh", "sh", "-c", "exec ${CC:-cc} \"$@\"", "sh", "-O2",
+	    "-shared", "-fPIC", "-o", so, src, (char *)NULL);
+	_exit(127);
+    }
+    while (waitpid(pid, &status, 0) == -1) {
+	if (errno != EINTR)
+	    return 0;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Write text to a new source file in dir, and build it into so
+static int
+lpc_jit_build(const char *dir, uint64_t h, const char *text, size_t len,
+    const char *so)
+{
+    char src[PATH_MAX], tmp[PATH_MAX];
+    size_t off = 0;
+    ssize_t n;
+    int fd, ok;
+
+    // Built under a name of its own, and renamed: another pipecut may be at it too
+    snprintf(src, sizeof(src), "%s/%016llx-XXXXXX.c", dir,
+	(unsigned long long)h);
+    if ((fd = mkstemps(src, 2)) == -1)
+	return 0;
+    while (off < len) {
+	if ((n = write(fd, text + off, len - off)) == -1 && errno != EINTR)
+	    break;
+	if (n > 0)
+	    off += n;
+    }
+    close(fd);
+    snprintf(tmp, sizeof(tmp), "%.*s.so", (int)strlen(src) - 2, src);
+    if (lpc_ctx.debug)
+	fprintf(stderr, "pipecut: --jit: compiling %s\n", src);
+    ok = off == len && lpc_jit_cc(src, tmp) && rename(tmp, so) == 0;
+    if (!ok)
+	unlink(tmp);
+    unlink(src);
+    return ok;
+}
+
+/* The compiled toolset for pl, as made from the plan's blades. NULL if the engine is
+ * to run it after all.
+ */
+lpc_jitfn
+lpc_jit_load(struct lpc_pipeline *pl, struct tailhead *blades)
+{
+    char dir[PATH_MAX - 32], so[PATH_MAX];	// dir leaves room for the names
+    char tail[BLADECACHE];
+    const char *cc = getenv("CC");
+    struct utsname un;
+    lpc_jitfn fn;
+    void *dl, *sym;
+    uint64_t h;
+    char *text;
+    size_t len;
+    FILE *fp;
+
+    if (pl->nstages > 0 && pl->stages[0].ttype == SUMMARIZE) {
+	// It counts the raw input, which beats a loop over the lines
+	if (lpc_ctx.debug)
+	    fprintf(stderr, "pipecut: --jit: the engine counts the input\n");
+	return NULL;
+    }
+    if (!(fp = open_memstream(&text, &len)))
+	return NULL;
+    lpc_emit_plan(blades, "", LPC_LANG_C, LPC_EMIT_LIB, fp, tail);
+    if (fclose(fp) == EOF) {
+	free(text);
+	return NULL;
+    }
+    if (strcmp(tail, pl->tail)) {
+	if (lpc_ctx.debug)
+	    fprintf(stderr, "pipecut: --jit: the engine runs more of it\n");
+	free(text);
+	return NULL;
+    }
+    // The source, and whatever else makes another object of it
+    h = lpc_jit_hash(0xcbf29ce484222325ULL, text, len);
+    h = lpc_jit_hash(h, PIPECUT_VERSION, strlen(PIPECUT_VERSION));
+    if (cc)
+	h = lpc_jit_hash(h, cc, strlen(cc) + 1);
+    if (uname(&un) == 0)
+	h = lpc_jit_hash(h, un.machine, strlen(un.machine));
+    if (!lpc_jit_dir(dir, sizeof(dir))) {
+	free(text);
+	return NULL;
+    }
+    snprintf(so, sizeof(so), "%s/%016llx.so", dir, (unsigned long long)h);
+    if (access(so, R_OK) == -1 && !lpc_jit_build(dir, h, text, len, so)) {
+	if (lpc_ctx.debug)
+	    fprintf(stderr, "pipecut: --jit: no compiled toolset\n");
+	free(text);
+	return NULL;
+    }
+    free(text);
+    if (!(dl = dlopen(so, RTLD_NOW | RTLD_LOCAL))) {
+	if (lpc_ctx.debug)
+	    fprintf(stderr, "pipecut: --jit: %s\n", dlerror());
+	return NULL;
+    }
+    if (!(sym = dlsym(dl, LPC_JITSYM))) {
+	dlclose(dl);
+	return NULL;
+    }
+    memcpy(&fn, &sym, sizeof(fn));	// ISO C has no object to function pointer cast
+    if (lpc_ctx.debug)
+	fprintf(stderr, "pipecut: --jit: running %s\n", so);
+    return fn;
+}
+
+static ssize_t
+lpc_jit_read(void *arg, char *buf, size_t len)
+{
+    return lpc_reader_read(arg, buf, len);
+}
+
+// Run fn over infd (decompressed, if it's gzip'd), as lpc_execute() would
+int
+lpc_jit_execute(lpc_jitfn fn, int infd, FILE *out)
+{
+    struct lpc_reader rd;
+    int rc;
+
+    if (fflush(out) == EOF)
+	return -1;
+    lpc_reader_init(&rd, infd);
+    rc = fn(lpc_jit_read, &rd, fileno(out));
+    lpc_reader_free(&rd);
+    return rc;
+}
@@ -0,0 +1,55 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Filter runs compiled to machine code (--jit).
+ *
+ * With --jit, filter mode generates the toolset as C (pcEmit.c), has cc(1) build it
+ * into a shared object, and loads that with dlopen(3) to run in place of the engine.
+ * The object is cached, under $XDG_CACHE_HOME/pipecut or ~/.cache/pipecut, by a hash
+ * of the generated source, so a toolset is only compiled again once it changes. If
+ * there is no compiler, the build fails, or the generated code would run less of the
+ * toolset than the engine does, the engine runs it, as without --jit. So it does a
+ * toolset that starts with SUMMARIZE, which the engine counts straight from the
+ * input, and one with ORDER, which it sorts on every core. --jit stands in for the
+ * serial executor only: -j on a regular file, -P, --state and several files still
+ * run in the engine.
+ */
+
+#ifndef PCJIT_H
+#define PCJIT_H
+
+// The shared object's entry point: pipecut_jit()
+typedef int (*lpc_jitfn) (ssize_t (*rd) (void *, char *, size_t), void *arg,
+    int fd);
+
+lpc_jitfn lpc_jit_load(struct lpc_pipeline *pl, struct tailhead *blades);
+int lpc_jit_execute(lpc_jitfn fn, int infd, FILE *out);
+
+#endif
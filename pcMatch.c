@@ -0,0 +1,585 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Fused INCLUDE/EXCLUDE matching. See pcMatch.h for the overview. */
+
+#include "pipecut.h"
+#include "pcExec.h"
+#include "pcMatch.h"
+#include "pcScan.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Number of adjacent INCLUDE/EXCLUDE blades starting at te (at most LPC_MAXRUN).
+int
+lpc_matchrun(struct toolelement *te)
+{
+    int n = 0;
+
+    while (te && (te->ttype == INCLUDE || te->ttype == EXCLUDE)
+	&& n < LPC_MAXRUN) {
+	n++;
+	te = TAILQ_NEXT(te, entries);
+    }
+    return n;
+}
+
+/* If pat is a plain string as far as an ERE is concerned, copy it (unescaped) to lit
+ * and return its length. Otherwise return -1.
+ */
+int
+lpc_plainstring(const char *pat, char *lit)
+{
+    char *d = lit;
+
+    if (*pat == '\0')		// Matches everything. Leave it to regexec.
+	return -1;
+    for (; *pat; pat++) {
+	if (strchr(".[()*+?{|^$", *pat))
+	    return -1;
+	if (*pat == '\\') {
+	    pat++;
+	    // \. \* etc are literal. \w \1 and friends are not, nor are the GNU
+	    // anchors \< \> \` \', which match between characters.
+	    if (*pat == '\0' || isalnum((unsigned char)*pat)
+		|| strchr("<>`'", *pat))
+		return -1;
+	}
+	*d++ = *pat;
+    }
+    *d = '\0';
+    return d - lit;
+}
+
+// Index of the character after the group or bracket expression that starts at pat[i]
+static int
+lpc_skipgroup(const char *pat, int i)
+{
+    int depth = 0;
+
+    do {
+	switch (pat[i]) {
+	case '\\':
+	    if (pat[i + 1])
+		i++;
+	    break;
+	case '[':
+	    i++;
+	    if (pat[i] == '^')
+		i++;
+	    if (pat[i] == ']')	// A leading ] is part of the set
+		i++;
+	    while (pat[i] && pat[i] != ']') {
+		if (pat[i] == '[' && pat[i + 1] && strchr(":.=", pat[i + 1])) {
+		    i += 2;	// [:alpha:] and friends
+		    while (pat[i] && !(pat[i] == ']' && strchr(":.=", pat[i - 1])))
+			i++;
+		}
+		if (pat[i])
+		    i++;
+	    }
+	    break;
+	case '(':
+	    depth++;
+	    break;
+	case ')':
+	    depth--;
+	    break;
+	}
+	if (pat[i])
+	    i++;
+    } while (depth > 0 && pat[i]);
+    return i;
+}
+
+/* Find the longest string that every match of the ERE pat must contain. It is copied
+ * to lit (at least strlen(pat)+1 bytes) and its length returned, or 0 if there is
+ * nothing usable. Conservative: groups, sets and anything optional end a run, and an
+ * alternation at the top level means there is no single required string.
+ */
+int
+lpc_reqlit(const char *pat, char *lit)
+{
+    char run[LPC_MAXLIT];
+    int rl = 0, best = 0;
+    int i = 0;
+    char c;
+
+    while (pat[i]) {
+	c = pat[i];
+	if (c == '|')
+	    return 0;
+	if (c == '[' || c == '(') {
+	    i = lpc_skipgroup(pat, i);
+	    goto ENDRUN;
+	}
+	if (c == '{') {		// Bound on whatever came before
+	    while (pat[i] && pat[i] != '}')
+		i++;
+	    if (pat[i])
+		i++;
+	    goto ENDRUN;
+	}
+	if (strchr(".^$*+?)", c)) {
+	    i++;
+	    goto ENDRUN;
+	}
+	if (c == '\\') {
+	    c = pat[i + 1];
+	    // \w \1 ..., and the anchors \< \> \` \', which match no character
+	    if (c == '\0' || isalnum((unsigned char)c) || strchr("<>`'", c)) {
+		i += c ? 2 : 1;
+		goto ENDRUN;
+	    }
+	    i++;
+	}
+	i++;
+	if (c == '\n')
+	    return 0;
+	// A quantified character is optional, except with +
+	if (pat[i] == '*' || pat[i] == '?' || pat[i] == '{')
+	    goto ENDRUN;
+	if (rl < LPC_MAXLIT)
+	    run[rl++] = c;
+	if (pat[i] != '+')
+	    continue;
+      ENDRUN:
+	if (rl > best) {
+	    memcpy(lit, run, rl);
+	    best = rl;
+	}
+	rl = 0;
+    }
+    if (rl > best) {
+	memcpy(lit, run, rl);
+	best = rl;
+    }
+    if (best < LPC_MINLIT)
+	return 0;
+    lit[best] = '\0';
+    return best;
+}
+
+/* Substring search. With SSE2, 16 candidate positions are tested at a time by
+ * comparing the first and last bytes of the needle, and only positions where both
+ * agree are checked with memcmp.
+ */
+const char *
+lpc_memmem(const char *h, size_t hlen, const char *n, size_t nlen)
+{
+    const char *ep, *cp;
+
+    if (nlen == 0)
+	return h;
+    if (nlen > hlen)
+	return NULL;
+    if (nlen == 1)
+	return memchr(h, n[0], hlen);
+#ifdef __SSE2__
+    {
+	const __m128i first = _mm_set1_epi8(n[0]);
+	const __m128i last = _mm_set1_epi8(n[nlen - 1]);
+	__m128i bf, bl;
+	unsigned int mask;
+	size_t i;
+
+	for (i = 0; i + nlen + 15 <= hlen; i += 16) {
+	    bf = _mm_loadu_si128((const __m128i *)(h + i));
+	    bl = _mm_loadu_si128((const __m128i *)(h + i + nlen - 1));
+	    mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(bf, first),
+		    _mm_cmpeq_epi8(bl, last)));
+	    while (mask) {
+		cp = h + i + __builtin_ctz(mask);
+		if (memcmp(cp + 1, n + 1, nlen - 2) == 0)
+		    return cp;
+		mask &= mask - 1;
+	    }
+	}
+	h += i;
+	hlen -= i;
+    }
+#endif
+    ep = h + hlen - nlen;
+    while (h <= ep) {
+	cp = memchr(h, n[0], ep - h + 1);
+	if (!cp)
+	    return NULL;
+	if (memcmp(cp + 1, n + 1, nlen - 1) == 0)
+	    return cp;
+	h = cp + 1;
+    }
+    return NULL;
+}
+
+static int
+lpc_hasbackref(const char *pat)
+{
+    for (; *pat; pat++) {
+	if (*pat == '\\' && pat[1]) {
+	    if (pat[1] >= '1' && pat[1] <= '9')
+		return 1;
+	    pat++;
+	}
+    }
+    return 0;
+}
+
+// Build the Aho-Corasick automaton for the literal patterns
+static void
+lpc_ac_build(struct lpc_matcher *m, char **lits, int *litlen)
+{
+    int32_t *fail, *queue;
+    int maxstates = 1;
+    int i, j, c, s, t, qh, qt;
+
+    for (i = 0; i < m->npat; i++) {
+	if (litlen[i] > 0)
+	    maxstates += litlen[i];
+    }
+    m->delta = malloc((size_t)maxstates * 256 * sizeof(int32_t));
+    m->out = calloc(maxstates, sizeof(uint64_t));
+    fail = calloc(maxstates, sizeof(int32_t));
+    queue = malloc(maxstates * sizeof(int32_t));
+    if (!m->delta || !m->out || !fail || !queue) {
+	fprintf(stderr, "Pipecut Error: out of memory\n");
+	exit(-1);
+    }
+    memset(m->delta, 0xff, (size_t)maxstates * 256 * sizeof(int32_t));	// -1: no edge yet
+    m->nstates = 1;
+
+    // The trie
+    for (i = 0; i < m->npat; i++) {
+	if (litlen[i] <= 0)
+	    continue;
+	s = 0;
+	for (j = 0; j < litlen[i]; j++) {
+	    c = (unsigned char)lits[i][j];
+	    if (m->delta[s * 256 + c] < 0)
+		m->delta[s * 256 + c] = m->nstates++;
+	    s = m->delta[s * 256 + c];
+	}
+	m->out[s] |= (uint64_t)1 << i;
+    }
+
+    // Failure links, folded into the transitions breadth first
+    qh = qt = 0;
+    for (c = 0; c < 256; c++) {
+	t = m->delta[c];
+	if (t < 0) {
+	    m->delta[c] = 0;
+	} else {
+	    fail[t] = 0;
+	    queue[qt++] = t;
+	}
+    }
+    while (qh < qt) {
+	s = queue[qh++];
+	for (c = 0; c < 256; c++) {
+	    t = m->delta[s * 256 + c];
+	    if (t < 0) {
+		m->delta[s * 256 + c] = m->delta[fail[s] * 256 + c];
+	    } else {
+		fail[t] = m->delta[fail[s] * 256 + c];
+		m->out[t] |= m->out[fail[t]];
+		queue[qt++] = t;
+	    }
+	}
+    }
+    free(fail);
+    free(queue);
+}
+
+// Join the EXCLUDE regexes into one alternation
+static void
+lpc_exre_build(struct lpc_matcher *m)
+{
+    struct lpc_text alt;
+    int i, nex = 0, allpre = 1;
+
+    m->exremask = 0;
+    for (i = 0; i < m->npat; i++) {
+	if (m->pat[i].literal || m->pat[i].include)
+	    continue;
+	if (lpc_hasbackref(m->pat[i].blade->pattern))	// Group numbers would shift
+	    return;
+	if (m->pat[i].prefilter)
+	    m->exremask |= (uint64_t)1 << i;
+	else
+	    allpre = 0;
+	nex++;
+    }
+    if (!allpre)
+	m->exremask = 0;
+    if (nex < 2)
+	return;
+
+    memset(&alt, 0, sizeof(struct lpc_text));
+    for (i = 0; i < m->npat; i++) {
+	if (m->pat[i].literal || m->pat[i].include)
+	    continue;
+	lpc_text_reserve(&alt, strlen(m->pat[i].blade->pattern) + 4);
+	alt.len += sprintf(alt.p + alt.len, "%s(%s)", alt.len ? "|" : "",
+	    m->pat[i].blade->pattern);
+    }
+    if (regcomp(&m->exre, alt.p, REG_EXTENDED | REG_NOSUB) == 0)
+	m->hasexre = 1;
+    free(alt.p);
+}
+
+// Compile the n INCLUDE/EXCLUDE blades starting at first into one matcher.
+struct lpc_matcher *
+lpc_matcher_new(struct toolelement *first, int n)
+{
+    struct lpc_matcher *m;
+    struct toolelement *te = first;
+    char *lits[LPC_MAXRUN];
+    int litlen[LPC_MAXRUN];
+    int i, nlit = 0;
+
+    m = calloc(1, sizeof(struct lpc_matcher));
+    m->npat = n;
+    for (i = 0; i < n; i++, te = TAILQ_NEXT(te, entries)) {
+	m->pat[i].blade = te;
+	m->pat[i].include = (te->ttype == INCLUDE);
+	m->pat[i].re = NULL;	// lpc_mre()
+	lits[i] = malloc(strlen(te->pattern) + 1);
+	litlen[i] = lpc_plainstring(te->pattern, lits[i]);
+	if (litlen[i] > 0) {
+	    m->pat[i].literal = 1;
+	    if (m->pat[i].include)
+		m->inmask |= (uint64_t)1 << i;
+	    else
+		m->exmask |= (uint64_t)1 << i;
+	    nlit++;
+	} else if (te->reqlit) {
+	    // Not a plain string, but the automaton can still rule it out
+	    memcpy(lits[i], te->reqlit, te->reqlitlen);
+	    litlen[i] = te->reqlitlen;
+	    m->pat[i].prefilter = 1;
+	    nlit++;
+	}
+    }
+    if (nlit)
+	lpc_ac_build(m, lits, litlen);
+    for (i = 0; i < n; i++)
+	free(lits[i]);
+    lpc_exre_build(m);
+    return m;
+}
+
+// A copy for another thread: the automaton is shared, the regexes are compiled again.
+struct lpc_matcher *
+lpc_matcher_clone(struct lpc_matcher *m)
+{
+    struct lpc_matcher *c;
+    int i;
+
+    c = malloc(sizeof(struct lpc_matcher));
+    memcpy(c, m, sizeof(struct lpc_matcher));
+    memset(&c->scratch, 0, sizeof(struct lpc_text));
+    c->shared = 1;
+    c->ownre = 1;
+    for (i = 0; i < c->npat; i++)
+	c->pat[i].re = NULL;	// lpc_mre()
+    c->hasexre = 0;
+    lpc_exre_build(c);
+    return c;
+}
+
+void
+lpc_matcher_free(struct lpc_matcher *m)
+{
+    int i;
+
+    if (!m)
+	return;
+    if (m->ownre) {
+	for (i = 0; i < m->npat; i++) {
+	    if (!m->pat[i].re)
+		continue;
+	    regfree(m->pat[i].re);
+	    free(m->pat[i].re);
+	}
+    }
+    if (m->hasexre)
+	regfree(&m->exre);
+    if (!m->shared) {
+	free(m->delta);
+	free(m->out);
+    }
+    free(m->scratch.p);
+    free(m);
+}
+
+/* Pattern i's regex, compiled when it's first needed: the blade's own, or for a clone
+ * a private copy.
+ */
+static regex_t *
+lpc_mre(struct lpc_matcher *m, int i)
+{
+    int rc;
+
+    if (m->pat[i].re)
+	return m->pat[i].re;
+    if (!m->ownre)
+	return m->pat[i].re = lpc_blade_re(m->pat[i].blade);
+    m->pat[i].re = malloc(sizeof(regex_t));
+    rc = regcomp(m->pat[i].re, m->pat[i].blade->pattern, REG_EXTENDED);
+    if (rc) {
+	fprintf(stderr, "Regex compile failed %s = %d\n",
+	    m->pat[i].blade->pattern, rc);
+	exit(-1);
+    }
+    return m->pat[i].re;
+}
+
+// A regex whose required literal is missing from the line can't match it
+#define LPC_PREMISS(m, i, hit) ((m)->pat[i].prefilter && !(((hit) >> (i)) & 1))
+
+static int
+lpc_mregexec(struct lpc_matcher *m, regex_t *re, const char *p, size_t len,
+    const char *what)
+{
+    int rc;
+
+    rc = lpc_regexec_span(re, p, len, &m->scratch);
+    if (rc != REG_OK && rc != REG_NOMATCH) {
+	fprintf(stderr, "Regex execution failed on %s = %d\n", what, rc);
+	exit(-1);
+    }
+    return rc == REG_OK;
+}
+
+/* Returns the index of the first blade in the run that drops the line, or npat if
+ * the line gets through all of them. Without needidx, any value < npat means dropped,
+ * which lets us stop early and use the joined EXCLUDE regex.
+ */
+int
+lpc_matcher_exec(struct lpc_matcher *m, const char *p, size_t len,
+    int needidx)
+{
+    const unsigned char *cp = (const unsigned char *)p;
+    const unsigned char *ep = cp + len;
+    uint64_t hit = 0;
+    int32_t s = 0;
+    int i, matched, exany = -1;
+
+    if (m->nstates) {
+	while (cp < ep) {
+	    s = m->delta[s * 256 + *cp++];
+	    hit |= m->out[s];
+	}
+    }
+
+    if (!needidx) {
+	if ((hit & m->exmask) || (hit & m->inmask) != m->inmask)
+	    return 0;
+	if (m->hasexre && (!m->exremask || (hit & m->exremask))
+	    && lpc_mregexec(m, &m->exre, p, len, "joined exclusions"))
+	    return 0;
+	for (i = 0; i < m->npat; i++) {
+	    if (m->pat[i].literal || (!m->pat[i].include && m->hasexre))
+		continue;
+	    if (LPC_PREMISS(m, i, hit))
+		matched = 0;
+	    else
+		matched = lpc_mregexec(m, lpc_mre(m, i), p, len,
+		    m->pat[i].blade->pattern);
+	    if (matched != m->pat[i].include)
+		return i;
+	}
+	return m->npat;
+    }
+
+    for (i = 0; i < m->npat; i++) {
+	if (m->pat[i].literal) {
+	    matched = (hit >> i) & 1;
+	} else if (LPC_PREMISS(m, i, hit)) {
+	    matched = 0;
+	} else if (!m->pat[i].include && m->hasexre) {
+	    // One regexec tells us whether any exclusion can match at all
+	    if (exany < 0)
+		exany = lpc_mregexec(m, &m->exre, p, len, "joined exclusions");
+	    matched = exany ? lpc_mregexec(m, lpc_mre(m, i), p, len,
+		m->pat[i].blade->pattern) : 0;
+	} else {
+	    matched = lpc_mregexec(m, lpc_mre(m, i), p, len,
+		m->pat[i].blade->pattern);
+	}
+	if (matched != m->pat[i].include)
+	    return i;
+    }
+    return m->npat;
+}
+
+/* UI cache regeneration: fill the caches of the n blades starting at first from 'in'
+ * in one pass. A line goes into the cache of every blade before the one that drops it.
+ */
+void
+lpc_match_caches(struct toolelement *first, int n, char *in)
+{
+    struct lpc_matcher *m;
+    struct toolelement *bl[LPC_MAXRUN];
+    size_t pos[LPC_MAXRUN];
+    int full[LPC_MAXRUN];
+    struct lpc_span *lines = NULL;
+    int linecap = 0;
+    int i, k, f, nlines;
+
+    m = lpc_matcher_new(first, n);
+    for (i = 0; i < n; i++) {
+	bl[i] = i ? TAILQ_NEXT(bl[i - 1], entries) : first;
+	bl[i]->haseffect = 0;
+	pos[i] = 0;
+	full[i] = 0;
+    }
+    nlines = lpc_splitlines(in, &lines, &linecap);
+    for (i = 0; i < nlines; i++) {
+	f = lpc_matcher_exec(m, lines[i].p, lines[i].len, 1);
+	for (k = 0; k < f; k++) {
+	    /* Like appendLine, a cache ends at the first line that does not fit. */
+	    if (full[k] || pos[k] + lines[i].len + 2 > BLADECACHE) {
+		full[k] = 1;
+		continue;
+	    }
+	    memcpy(bl[k]->cache + pos[k], lines[i].p, lines[i].len);
+	    pos[k] += lines[i].len;
+	    bl[k]->cache[pos[k]++] = '\n';
+	}
+	if (f < n)
+	    bl[f]->haseffect = 1;
+    }
+    for (i = 0; i < n; i++)
+	bl[i]->cache[pos[i]] = '\0';
+    free(lines);
+    lpc_matcher_free(m);
+}
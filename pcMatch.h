@@ -0,0 +1,97 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Fused matching for runs of adjacent INCLUDE/EXCLUDE blades.
+ *
+ * A toolset built up with 'x' is often a long list of egrep -v blades. Rather than
+ * running regexec once per blade per line, a run of up to LPC_MAXRUN filter blades is
+ * compiled into one matcher:
+ *  - patterns that are plain strings go into one Aho-Corasick automaton, which finds
+ *    all of them in a single pass over the line and reports which ones matched
+ *  - the remaining EXCLUDE regexes are joined into one alternation, so a line that
+ *    survives costs one regexec for all of them
+ *  - the remaining INCLUDE regexes are still run one by one (all of them must match)
+ *
+ * Most regexes also contain a string that every match must include ("sshd[" in
+ * "sshd\[[0-9]+\]"). lpc_newIN()/lpc_newEX() extract it when the blade is created, and
+ * regexec is only called on lines where that string was found first.
+ */
+
+#ifndef PCMATCH_H
+#define PCMATCH_H
+
+#include <stdint.h>
+
+#define LPC_MAXRUN 64			// Blades per fused run (one bit each)
+#define LPC_MAXLIT 256			// Longest required literal we keep
+#define LPC_MINLIT 2			// Shorter literals don't pay for the extra scan
+
+struct lpc_mpat {
+    struct toolelement *blade;
+    int include;		// INCLUDE (1) or EXCLUDE (0)
+    int literal;		// Resolved by the automaton alone
+    int prefilter;		// The automaton also holds the blade's required literal
+    regex_t *re;		// NULL until first needed
+};
+
+struct lpc_matcher {
+    int npat;
+    struct lpc_mpat pat[LPC_MAXRUN];
+    int ownre;			// The regexes are private copies (see lpc_matcher_clone)
+    int shared;			// The automaton belongs to another matcher
+
+    // Aho-Corasick automaton over the literal patterns, as a full DFA
+    int nstates;
+    int32_t *delta;		// nstates * 256 transitions
+    uint64_t *out;		// Patterns that end in each state
+    uint64_t inmask;		// Literal INCLUDE patterns
+    uint64_t exmask;		// Literal EXCLUDE patterns
+
+    // All EXCLUDE regexes as one alternation (when there are two or more)
+    regex_t exre;
+    int hasexre;
+    uint64_t exremask;		// Required literals of those regexes, if they all have one
+
+    struct lpc_text scratch;
+};
+
+int lpc_plainstring(const char *pat, char *lit);
+int lpc_reqlit(const char *pat, char *lit);
+const char *lpc_memmem(const char *h, size_t hlen, const char *n,
+    size_t nlen);
+int lpc_matchrun(struct toolelement *te);
+struct lpc_matcher *lpc_matcher_new(struct toolelement *first, int n);
+struct lpc_matcher *lpc_matcher_clone(struct lpc_matcher *m);
+void lpc_matcher_free(struct lpc_matcher *m);
+int lpc_matcher_exec(struct lpc_matcher *m, const char *p, size_t len,
+    int needidx);
+void lpc_match_caches(struct toolelement *first, int n, char *in);
+
+#endif
@@ -0,0 +1,901 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Threaded executors for the native engine.
+ *
+ * Pipelined (-P): one thread reads, one thread per stage, and the calling thread
+ * writes. Neighbours are connected by bounded lock-free SPSC rings of batches, so a
+ * slow stage stalls its producers instead of letting batches pile up. Empty batches
+ * go back from the writer to the reader through one more ring.
+ *
+ * Chunked (-j N, regular files only): the file is cut into large chunks at line
+ * boundaries. N workers run the leading stateless stages (INCLUDE, EXCLUDE, FORMAT)
+ * over whole chunks, each with its own copy of the stages. If the first stateful stage
+ * can merge partial states (SUMMARIZE), every chunk also gets its own partial state,
+ * which is folded into the real one in file order. Chunk results are reassembled in
+ * file order by the calling thread, which runs whatever is left of the toolset.
+ *
+ * Files (-t name file1 file2 ...): each file is run through the toolset on its own,
+ * with a pipeline of its own, by a pool of -j workers. Output is put back in argument
+ * order through temporary files, or with -O DIR goes to a file per input.
+ */
+
+#include <stdatomic.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+
+#include "pipecut.h"
+#include "pcExec.h"
+#include "pcGzip.h"
+
+#define LPC_RINGSIZE 8			// Batches in flight between two stages (power of 2)
+#define LPC_CACHELINE 64
+
+struct lpc_ring {
+    struct lpc_batch **slot;
+    unsigned int mask;
+    char pad0[LPC_CACHELINE];
+    atomic_uint head;		// Only written by the producer
+    char pad1[LPC_CACHELINE];
+    atomic_uint tail;		// Only written by the consumer
+    char pad2[LPC_CACHELINE];
+};
+
+struct lpc_ring *
+lpc_ring_new(unsigned int size)
+{
+    struct lpc_ring *r;
+    unsigned int n = 1;
+
+    while (n < size)
+	n <<= 1;
+    r = calloc(1, sizeof(struct lpc_ring));
+    r->slot = calloc(n, sizeof(struct lpc_batch *));
+    if (!r->slot) {
+	fprintf(stderr, "Pipecut Error: out of memory\n");
+	exit(-1);
+    }
+    r->mask = n - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    return r;
+}
+
+void
+lpc_ring_free(struct lpc_ring *r)
+{
+    free(r->slot);
+    free(r);
+}
+
+// Back off while the other side catches up: spin, then yield, then sleep.
+static void
+lpc_ring_wait(int *spins)
+{
+    struct timespec ts;
+
+    (*spins)++;
+    if (*spins < 100)
+	return;
+    if (*spins < 1000) {
+	sched_yield();
+	return;
+    }
+    ts.tv_sec = 0;
+    ts.tv_nsec = 50000;
+    nanosleep(&ts, NULL);
+}
+
+// Blocks while the ring is full.
+void
+lpc_ring_push(struct lpc_ring *r, struct lpc_batch *b)
+{
+    unsigned int h;
+    int spins = 0;
+
+    h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    while (h - atomic_load_explicit(&r->tail, memory_order_acquire) > r->mask)
+	lpc_ring_wait(&spins);
+    r->slot[h & r->mask] = b;
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+// Blocks while the ring is empty.
+struct lpc_batch *
+lpc_ring_pop(struct lpc_ring *r)
+{
+    struct lpc_batch *b;
+    unsigned int t;
+    int spins = 0;
+
+    t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    while (atomic_load_explicit(&r->head, memory_order_acquire) == t)
+	lpc_ring_wait(&spins);
+    b = r->slot[t & r->mask];
+    atomic_store_explicit(&r->tail, t + 1, memory_order_release);
+    return b;
+}
+
+/* Pipelined executor */
+
+struct lpc_pipectx;
+
+struct lpc_worker {
+    pthread_t tid;
+    struct lpc_pipectx *px;
+    int idx;			// Stage index
+    struct lpc_stage *st;
+    struct lpc_ring *in;
+    struct lpc_ring *out;
+};
+
+struct lpc_pipectx {
+    struct lpc_reader rd;
+    struct lpc_ring **rings;	// rings[i] feeds stage i, rings[nstages] feeds the writer
+    struct lpc_ring *freering;	// Writer -> reader (then -> stages, as they flush)
+    atomic_int cancel;		// Set when the output goes away
+    atomic_int done;		// Stages before this one get no more input (see LPC_DONE)
+    atomic_int nbatches;	// Batches allocated, so we can free them all at the end
+};
+
+static struct lpc_batch *
+lpc_newbatch(struct lpc_pipectx *px)
+{
+    struct lpc_batch *b;
+
+    b = malloc(sizeof(struct lpc_batch));
+    lpc_batch_init(b);
+    atomic_fetch_add(&px->nbatches, 1);
+    return b;
+}
+
+// Stage n-1 is done: the stages before n need no more input.
+static void
+lpc_pipe_done(struct lpc_pipectx *px, int n)
+{
+    int cur = atomic_load(&px->done);
+
+    while (cur < n && !atomic_compare_exchange_weak(&px->done, &cur, n));
+}
+
+static void *
+lpc_reader_thread(void *arg)
+{
+    struct lpc_worker *w = arg;
+    struct lpc_pipectx *px = w->px;
+    struct lpc_batch *b;
+
+    while (1) {
+	b = lpc_ring_pop(px->freering);
+	if (atomic_load(&px->cancel) || atomic_load(&px->done)
+	    || !lpc_reader_next(&px->rd, b)) {
+	    lpc_batch_clear(b);
+	    b->last = 1;
+	    lpc_ring_push(w->out, b);
+	    break;
+	}
+	lpc_ring_push(w->out, b);
+    }
+    return NULL;
+}
+
+static void *
+lpc_stage_thread(void *arg)
+{
+    struct lpc_worker *w = arg;
+    struct lpc_pipectx *px = w->px;
+    struct lpc_batch *b, *fb;
+    int last;
+
+    while (1) {
+	b = lpc_ring_pop(w->in);
+	last = b->last;
+	if (atomic_load(&px->cancel) || w->idx + 1 < atomic_load(&px->done))
+	    lpc_batch_clear(b);	// Input in flight when a stage after us finished
+	else if (w->st->run(w->st, b) == LPC_DONE)
+	    lpc_pipe_done(px, w->idx + 1);
+	if (last && w->st->flush && !atomic_load(&px->cancel)
+	    && w->idx + 1 >= atomic_load(&px->done)) {
+	    // The end of stream marker carries on after our final output.
+	    b->last = 0;
+	    lpc_ring_push(w->out, b);
+	    /* The reader is finished with the free ring, and so is any stage upstream
+	     * of us, so our output batches can come from there.
+	     */
+	    fb = lpc_ring_pop(px->freering);
+	    lpc_batch_clear(fb);
+	    while (w->st->flush(w->st, fb) == LPC_MORE
+		&& !atomic_load(&px->cancel)
+		&& w->idx + 1 >= atomic_load(&px->done)) {
+		lpc_ring_push(w->out, fb);
+		fb = lpc_ring_pop(px->freering);
+		lpc_batch_clear(fb);
+	    }
+	    fb->last = 1;
+	    lpc_ring_push(w->out, fb);
+	    break;
+	}
+	lpc_ring_push(w->out, b);	// b belongs to the next thread now
+	if (last)
+	    break;
+    }
+    return NULL;
+}
+
+// Run the compiled stages over fd, one thread per stage. Returns 0, or -1 on a write error.
+int
+lpc_execute_pipelined(struct lpc_pipeline *pl, int infd, FILE *out)
+{
+    struct lpc_pipectx px;
+    struct lpc_worker *w;
+    struct lpc_batch *b;
+    int i, n, last, rc = 0;
+    int pool = LPC_RINGSIZE * (pl->nstages + 1);
+
+    memset(&px, 0, sizeof(struct lpc_pipectx));
+    lpc_reader_init(&px.rd, infd);
+    atomic_init(&px.cancel, 0);
+    atomic_init(&px.done, 0);
+    atomic_init(&px.nbatches, 0);
+    px.rings = calloc(pl->nstages + 1, sizeof(struct lpc_ring *));
+    for (i = 0; i <= pl->nstages; i++)
+	px.rings[i] = lpc_ring_new(LPC_RINGSIZE);
+    // Room for the whole pool, so returning never blocks.
+    px.freering = lpc_ring_new(pool);
+    for (i = 0; i < pool; i++)
+	lpc_ring_push(px.freering, lpc_newbatch(&px));
+
+    w = calloc(pl->nstages + 1, sizeof(struct lpc_worker));
+    w[0].px = &px;
+    w[0].out = px.rings[0];
+    if (pthread_create(&w[0].tid, NULL, lpc_reader_thread, &w[0])) {
+	fprintf(stderr, "Pipecut Error: could not start reader thread\n");
+	exit(-1);
+    }
+    for (i = 0; i < pl->nstages; i++) {
+	w[i + 1].px = &px;
+	w[i + 1].idx = i;
+	w[i + 1].st = &pl->stages[i];
+	w[i + 1].in = px.rings[i];
+	w[i + 1].out = px.rings[i + 1];
+	if (pthread_create(&w[i + 1].tid, NULL, lpc_stage_thread, &w[i + 1])) {
+	    fprintf(stderr, "Pipecut Error: could not start stage thread\n");
+	    exit(-1);
+	}
+    }
+
+    // We're the writer.
+    do {
+	b = lpc_ring_pop(px.rings[pl->nstages]);
+	last = b->last;
+	if (!atomic_load(&px.cancel) && lpc_batch_write(b, out) < 0) {
+	    atomic_store(&px.cancel, 1);
+	    rc = -1;
+	}
+	b->last = 0;
+	lpc_ring_push(px.freering, b);
+    } while (!last);
+    if (fflush(out) == EOF)
+	rc = -1;
+
+    for (i = 0; i <= pl->nstages; i++)
+	pthread_join(w[i].tid, NULL);
+
+    // Every batch has found its way back to the free ring.
+    n = atomic_load(&px.nbatches);
+    for (i = 0; i < n; i++) {
+	b = lpc_ring_pop(px.freering);
+	lpc_batch_free(b);
+	free(b);
+    }
+    for (i = 0; i <= pl->nstages; i++)
+	lpc_ring_free(px.rings[i]);
+    lpc_ring_free(px.freering);
+    free(px.rings);
+    free(w);
+    lpc_reader_free(&px.rd);
+    return rc;
+}
+
+/* Chunked executor */
+
+#define LPC_CHUNKMAX (8 * 1024 * 1024)
+#define LPC_CHUNKMIN (256 * 1024)
+
+struct lpc_chunkslot {
+    struct lpc_batch b;
+    struct lpc_stage partial;	// Per-chunk state of the reducing stage
+    int ready;
+};
+
+struct lpc_chunkctx {
+    struct lpc_pipeline *pl;
+    int fd;
+    int mapped;			// Chunks come straight from the mapping, not pread()
+    struct lpc_map map;
+    struct lpc_gz gz;		// A gzip'd file: chunks are decompressed from its seek points
+    off_t *bounds;		// Where each chunk starts (gzip), or NULL for k * chunksize
+    off_t size;
+    off_t chunksize;
+    long nchunks;
+    int nparallel;		// Stages [0, nparallel) run in the workers
+    int reduce;			// Index of the mergeable stage, or -1
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    long next;			// Next chunk to hand to a worker
+    long consumed;		// Chunks the writer is done with
+    int window;			// Chunks in flight
+    struct lpc_chunkslot *slots;
+    int cancel;
+};
+
+struct lpc_chunkworker {
+    pthread_t tid;
+    struct lpc_chunkctx *cx;
+    struct lpc_stage *stages;	// Private copies of stages [0, nparallel)
+};
+
+static void
+lpc_pread_all(struct lpc_chunkctx *cx, struct lpc_text *t, size_t len,
+    off_t off)
+{
+    ssize_t n;
+
+    lpc_text_reserve(t, len);
+    while (len > 0) {
+	if (cx->gz.p)
+	    n = lpc_gz_pread(&cx->gz, t->p + t->len, len, off);
+	else
+	    n = pread(cx->fd, t->p + t->len, len, off);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    break;
+	t->len += n;
+	off += n;
+	len -= n;
+    }
+}
+
+/* Load the lines of chunk k. A line belongs to the chunk its first byte is in, so we
+ * read one byte before the chunk to see whether a line starts right at its beginning,
+ * and read on past the end until the last line is complete.
+ */
+static void
+lpc_loadchunk(struct lpc_chunkctx *cx, long k, struct lpc_batch *b)
+{
+    off_t s, e, off;
+    const char *bol, *end, *nl;
+    size_t skip = 0;
+
+    lpc_batch_clear(b);
+    b->in.len = 0;
+    if (cx->bounds) {
+	s = cx->bounds[k];
+	e = cx->bounds[k + 1];
+    } else {
+	s = k * cx->chunksize;
+	e = s + cx->chunksize;
+    }
+    if (e > cx->size)
+	e = cx->size;
+    if (cx->mapped) {
+	bol = cx->map.p + s;
+	end = cx->map.p + e;
+	if (k > 0 && bol[-1] != '\n') {	// Skip the tail of a line that belongs to chunk k-1
+	    nl = memchr(bol, '\n', cx->size - s);
+	    if (!nl || nl + 1 >= end)
+		return;
+	    bol = nl + 1;
+	}
+	if (e < cx->size && end[-1] != '\n') {	// Finish the last line
+	    nl = memchr(end, '\n', cx->size - e);
+	    end = nl ? nl + 1 : cx->map.p + cx->size;
+	}
+	goto INDEX;
+    }
+    off = (k == 0) ? s : s - 1;
+    lpc_pread_all(cx, &b->in, e - off, off);
+    if (k > 0) {
+	if (b->in.len == 0)
+	    return;
+	if (b->in.p[0] != '\n') {	// Skip the tail of a line that belongs to chunk k-1
+	    nl = memchr(b->in.p, '\n', b->in.len);
+	    if (!nl) {
+		b->in.len = 0;
+		return;
+	    }
+	    skip = nl - b->in.p;
+	}
+	skip++;
+    }
+    if (b->in.len > skip && b->in.p[b->in.len - 1] != '\n') {
+	// Finish the last line
+	off = e;
+	while (off < cx->size) {
+	    size_t before = b->in.len;
+
+	    lpc_pread_all(cx, &b->in, 64 * 1024, off);
+	    if (b->in.len == before)
+		break;
+	    off += b->in.len - before;
+	    nl = memchr(b->in.p + before, '\n', b->in.len - before);
+	    if (nl) {
+		b->in.len = nl - b->in.p + 1;
+		break;
+	    }
+	}
+    }
+    bol = b->in.p + skip;
+    end = b->in.p + b->in.len;
+  INDEX:
+    bol = lpc_batch_index(b, bol, end);
+    if (bol < end) {		// Unterminated last line of the file
+	lpc_batch_addline(b, bol, end - bol);
+	b->noeol = 1;
+    }
+}
+
+static void *
+lpc_chunk_thread(void *arg)
+{
+    struct lpc_chunkworker *w = arg;
+    struct lpc_chunkctx *cx = w->cx;
+    struct lpc_chunkslot *slot;
+    long k;
+    int i;
+
+    while (1) {
+	pthread_mutex_lock(&cx->lock);
+	k = cx->next++;
+	while (!cx->cancel && k < cx->nchunks && k >= cx->consumed + cx->window)
+	    pthread_cond_wait(&cx->cond, &cx->lock);
+	if (cx->cancel || k >= cx->nchunks) {
+	    pthread_mutex_unlock(&cx->lock);
+	    break;
+	}
+	pthread_mutex_unlock(&cx->lock);
+
+	slot = &cx->slots[k % cx->window];
+	lpc_loadchunk(cx, k, &slot->b);
+	for (i = 0; i < cx->nparallel; i++)
+	    w->stages[i].run(&w->stages[i], &slot->b);
+	if (cx->reduce >= 0) {
+	    lpc_stage_clone(&slot->partial, &cx->pl->stages[cx->reduce]);
+	    slot->partial.run(&slot->partial, &slot->b);
+	}
+
+	pthread_mutex_lock(&cx->lock);
+	slot->ready = 1;
+	pthread_cond_broadcast(&cx->cond);
+	pthread_mutex_unlock(&cx->lock);
+    }
+    return NULL;
+}
+
+// Run the compiled stages over the regular file fd with 'jobs' workers.
+int
+lpc_execute_chunked(struct lpc_pipeline *pl, int infd, FILE *out, int jobs)
+{
+    struct lpc_chunkctx cx;
+    struct lpc_chunkworker *w;
+    struct lpc_chunkslot *slot;
+    struct lpc_stage *st;
+    struct lpc_batch b;
+    struct stat sb;
+    char path[PATH_MAX];
+    long k;
+    int i, j, serial, rc = 0, done = LPC_MORE;
+
+    memset(&cx, 0, sizeof(struct lpc_chunkctx));
+    fstat(infd, &sb);
+    cx.pl = pl;
+    cx.fd = infd;
+    cx.size = sb.st_size;
+    if (lpc_map_fd(&cx.map, infd)) {
+	cx.mapped = 1;
+	cx.size = cx.map.len;
+	if (lpc_gz_magic(cx.map.p, cx.map.len)) {
+	    lpc_gz_open(&cx.gz, cx.map.p, cx.map.len, lpc_fdpath(infd, path,
+		    sizeof(path)));
+	    cx.mapped = 0;
+	    cx.size = cx.gz.usize;
+	}
+    }
+    cx.chunksize = cx.size / (jobs * 4) + 1;
+    if (cx.chunksize > LPC_CHUNKMAX)
+	cx.chunksize = LPC_CHUNKMAX;
+    if (cx.chunksize < LPC_CHUNKMIN)
+	cx.chunksize = LPC_CHUNKMIN;
+    cx.nchunks = (cx.size + cx.chunksize - 1) / cx.chunksize;
+    if (cx.gz.p) {
+	/* Start each chunk one byte past a seek point, so the byte before it (see
+	 * lpc_loadchunk) is the first one decompressed.
+	 */
+	cx.bounds = malloc((cx.gz.npts + 2) * sizeof(off_t));
+	cx.bounds[0] = 0;
+	cx.nchunks = 0;
+	for (i = 0; i < cx.gz.npts; i++)
+	    if (cx.gz.pts[i].out + 1 - cx.bounds[cx.nchunks] >= cx.chunksize
+		&& cx.gz.pts[i].out + 1 < cx.size)
+		cx.bounds[++cx.nchunks] = cx.gz.pts[i].out + 1;
+	cx.bounds[++cx.nchunks] = cx.size;
+	if (cx.size == 0)
+	    cx.nchunks = 0;
+    }
+    cx.window = jobs * 2;
+    cx.reduce = -1;
+
+    // Split the toolset: a stateless prefix, then maybe one stage with mergeable state.
+    for (i = 0; i < pl->nstages; i++) {
+	st = &pl->stages[i];
+	if (!st->clone || st->flush)
+	    break;
+    }
+    cx.nparallel = i;
+    if (i < pl->nstages && pl->stages[i].clone && pl->stages[i].merge)
+	cx.reduce = i++;
+    serial = i;			// First stage run by the writer
+
+    cx.slots = calloc(cx.window, sizeof(struct lpc_chunkslot));
+    for (i = 0; i < cx.window; i++)
+	lpc_batch_init(&cx.slots[i].b);
+    pthread_mutex_init(&cx.lock, NULL);
+    pthread_cond_init(&cx.cond, NULL);
+
+    w = calloc(jobs, sizeof(struct lpc_chunkworker));
+    for (j = 0; j < jobs; j++) {
+	w[j].cx = &cx;
+	w[j].stages = calloc(cx.nparallel + 1, sizeof(struct lpc_stage));
+	for (i = 0; i < cx.nparallel; i++)
+	    lpc_stage_clone(&w[j].stages[i], &pl->stages[i]);
+	if (pthread_create(&w[j].tid, NULL, lpc_chunk_thread, &w[j])) {
+	    fprintf(stderr, "Pipecut Error: could not start worker thread\n");
+	    exit(-1);
+	}
+    }
+
+    // Reassemble in file order.
+    for (k = 0; k < cx.nchunks; k++) {
+	slot = &cx.slots[k % cx.window];
+	pthread_mutex_lock(&cx.lock);
+	while (!slot->ready)
+	    pthread_cond_wait(&cx.cond, &cx.lock);
+	pthread_mutex_unlock(&cx.lock);
+
+	if (cx.reduce >= 0) {
+	    pl->stages[cx.reduce].merge(&pl->stages[cx.reduce], &slot->partial);
+	    lpc_stage_free(&slot->partial);
+	} else if (rc == 0) {
+	    done = lpc_runstages(pl, serial, &slot->b);
+	    if (lpc_batch_write(&slot->b, out) < 0)
+		rc = -1;
+	}
+
+	pthread_mutex_lock(&cx.lock);
+	slot->ready = 0;
+	cx.consumed++;
+	if (rc < 0 || done == LPC_DONE)	// Later chunks would go nowhere
+	    cx.cancel = 1;
+	pthread_cond_broadcast(&cx.cond);
+	pthread_mutex_unlock(&cx.lock);
+	if (cx.cancel)
+	    break;
+    }
+    for (j = 0; j < jobs; j++)
+	pthread_join(w[j].tid, NULL);
+
+    // Whatever is still stateful finishes serially.
+    if (rc == 0) {
+	lpc_batch_init(&b);
+	rc = lpc_flushstages(pl, cx.reduce >= 0 ? cx.reduce : serial, &b, out);
+	lpc_batch_free(&b);
+    }
+    if (fflush(out) == EOF)
+	rc = -1;
+    if (cx.gz.p) {
+	lpc_gz_close(&cx.gz);
+	lpc_map_close(&cx.map);
+    }
+    free(cx.bounds);
+    if (cx.mapped)
+	lpc_map_close(&cx.map);
+
+    for (j = 0; j < jobs; j++) {
+	for (i = 0; i < cx.nparallel; i++)
+	    lpc_stage_free(&w[j].stages[i]);
+	free(w[j].stages);
+    }
+    free(w);
+    for (i = 0; i < cx.window; i++) {
+	if (cx.slots[i].ready && cx.reduce >= 0)	// Abandoned after a write error
+	    lpc_stage_free(&cx.slots[i].partial);
+	lpc_batch_free(&cx.slots[i].b);
+    }
+    free(cx.slots);
+    pthread_mutex_destroy(&cx.lock);
+    pthread_cond_destroy(&cx.cond);
+    return rc;
+}
+
+/* File pool executor */
+
+struct lpc_filejob {
+    const char *path;
+    FILE *out;			// Its output, until the writer copies it out in order
+    int rc;
+    int ready;
+};
+
+struct lpc_filepool {
+    struct tailhead *blades;
+    const char *outdir;		// -O: each file's output goes to its own file
+    struct lpc_filejob *jobs;
+    int njobs;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int next;			// Next file to hand to a worker
+    int consumed;		// Files the writer is done with
+    int window;			// Files in flight
+    int cancel;
+};
+
+static pthread_mutex_t lpc_forklock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Start the shell tail cmd with its output going to fd. Like popen(), but the pipe is
+ * made and marked close-on-exec under a lock, so that a tail started by another
+ * worker meanwhile doesn't hold our pipe open and keep us from seeing EOF.
+ */
+FILE *
+lpc_shell_to(const char *cmd, int fd, pid_t *pid)
+{
+    int p[2];
+
+    pthread_mutex_lock(&lpc_forklock);
+    if (pipe(p) < 0) {
+	pthread_mutex_unlock(&lpc_forklock);
+	return NULL;
+    }
+    fcntl(p[0], F_SETFD, FD_CLOEXEC);
+    fcntl(p[1], F_SETFD, FD_CLOEXEC);
+    if ((*pid = fork()) == 0) {
+	dup2(p[0], 0);		// dup2() clears close-on-exec
+	dup2(fd, 1);
+	signal(SIGPIPE, SIG_DFL);
+	execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+	_exit(127);
+    }
+    pthread_mutex_unlock(&lpc_forklock);
+    close(p[0]);
+    if (*pid < 0) {
+	close(p[1]);
+	return NULL;
+    }
+    return fdopen(p[1], "w");
+}
+
+// Run the toolset over one file, with a pipeline of its own, writing to out.
+static int
+lpc_runfile(struct tailhead *blades, const char *path, FILE *out)
+{
+    struct lpc_pipeline pl;
+    FILE *dst = out;
+    pid_t pid = -1;
+    int fd, rc, status;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+	fprintf(stderr, "Pipecut Error: could not open %s: %s\n", path,
+	    strerror(errno));
+	exit(-1);
+    }
+    lpc_compile(&pl, blades);
+    if (pl.tail[0] != '\0') {
+	fflush(out);
+	dst = lpc_shell_to(pl.tail, fileno(out), &pid);
+	if (!dst) {
+	    fprintf(stderr, "Pipecut Error: could not start %s\n", pl.tail);
+	    exit(-1);
+	}
+    }
+    rc = lpc_execute(&pl, fd, dst);
+    if (dst != out) {
+	fclose(dst);
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+	    ;
+    }
+    lpc_release(&pl);
+    close(fd);
+    return rc;
+}
+
+/* Where -O DIR puts the output for path: DIR/basename, less any .gz, since what's
+ * written is the text. Returns 0 if it doesn't fit.
+ */
+int
+lpc_outpath(const char *dir, const char *path, char *buf, size_t size)
+{
+    const char *base = strrchr(path, '/');
+    size_t n;
+
+    base = base ? base + 1 : path;
+    n = strlen(base);
+    if (n > 3 && !strcmp(base + n - 3, ".gz"))
+	n -= 3;
+    return snprintf(buf, size, "%s/%.*s", dir, (int)n, base) < (int)size;
+}
+
+static void
+lpc_runjob(struct lpc_filepool *fp, struct lpc_filejob *job)
+{
+    char path[PATH_MAX];
+
+    if (!fp->outdir) {
+	job->rc = lpc_runfile(fp->blades, job->path, job->out);
+	return;
+    }
+    lpc_outpath(fp->outdir, job->path, path, sizeof(path));
+    if (!(job->out = fopen(path, "w"))) {
+	fprintf(stderr, "Pipecut Error: could not write %s: %s\n", path,
+	    strerror(errno));
+	exit(-1);
+    }
+    job->rc = lpc_runfile(fp->blades, job->path, job->out);
+    if (fclose(job->out) == EOF || job->rc < 0) {
+	fprintf(stderr, "Pipecut Error: could not write %s: %s\n", path,
+	    strerror(errno));
+	exit(-1);
+    }
+    job->out = NULL;
+}
+
+static void *
+lpc_file_thread(void *arg)
+{
+    struct lpc_filepool *fp = arg;
+    struct lpc_filejob *job;
+    int k;
+
+    while (1) {
+	pthread_mutex_lock(&fp->lock);
+	k = fp->next++;
+	while (!fp->cancel && k < fp->njobs && k >= fp->consumed + fp->window)
+	    pthread_cond_wait(&fp->cond, &fp->lock);
+	if (fp->cancel || k >= fp->njobs) {
+	    pthread_mutex_unlock(&fp->lock);
+	    break;
+	}
+	pthread_mutex_unlock(&fp->lock);
+
+	job = &fp->jobs[k];
+	if (!fp->outdir && !(job->out = tmpfile())) {
+	    fprintf(stderr, "Pipecut Error: could not create a temporary file: "
+		"%s\n", strerror(errno));
+	    exit(-1);
+	}
+	lpc_runjob(fp, job);
+
+	pthread_mutex_lock(&fp->lock);
+	job->ready = 1;
+	pthread_cond_broadcast(&fp->cond);
+	pthread_mutex_unlock(&fp->lock);
+    }
+    return NULL;
+}
+
+// Copy what a worker wrote for one file to out
+static int
+lpc_copyout(FILE *from, FILE *out)
+{
+    char buf[64 * 1024];
+    size_t n;
+
+    if (fflush(from) == EOF || fseeko(from, 0, SEEK_SET) != 0)
+	return -1;
+    while ((n = fread(buf, 1, sizeof(buf), from)) > 0)
+	if (fwrite(buf, 1, n, out) != n)
+	    return -1;
+    return ferror(from) ? -1 : 0;
+}
+
+/* Run the toolset over each of files, on 'jobs' workers, each file on its own as if it
+ * were the only input. Output goes to out in the order the files were given, or with
+ * outdir, to a file of the same name in outdir.
+ */
+int
+lpc_execute_files(struct tailhead *blades, char **files, int nfiles,
+    int jobs, const char *outdir, FILE *out)
+{
+    struct lpc_filepool fp;
+    struct lpc_filejob *job;
+    pthread_t *tids;
+    int j, k, rc = 0;
+
+    memset(&fp, 0, sizeof(struct lpc_filepool));
+    fp.blades = blades;
+    fp.outdir = outdir;
+    fp.njobs = nfiles;
+    fp.jobs = calloc(nfiles, sizeof(struct lpc_filejob));
+    for (k = 0; k < nfiles; k++)
+	fp.jobs[k].path = files[k];
+
+    if (jobs <= 1) {		// No workers, and nothing to put back in order
+	for (k = 0; k < nfiles && rc == 0; k++) {
+	    fp.jobs[k].out = out;
+	    lpc_runjob(&fp, &fp.jobs[k]);
+	    rc = fp.jobs[k].rc;
+	}
+	free(fp.jobs);
+	return rc;
+    }
+
+    fp.window = jobs * 2;
+    pthread_mutex_init(&fp.lock, NULL);
+    pthread_cond_init(&fp.cond, NULL);
+    tids = calloc(jobs, sizeof(pthread_t));
+    for (j = 0; j < jobs; j++)
+	pthread_create(&tids[j], NULL, lpc_file_thread, &fp);
+
+    for (k = 0; k < nfiles; k++) {
+	job = &fp.jobs[k];
+	pthread_mutex_lock(&fp.lock);
+	while (!job->ready)
+	    pthread_cond_wait(&fp.cond, &fp.lock);
+	pthread_mutex_unlock(&fp.lock);
+
+	if (!outdir) {
+	    if (job->rc < 0 || lpc_copyout(job->out, out) < 0)
+		rc = -1;
+	    fclose(job->out);
+	    job->out = NULL;
+	}
+	pthread_mutex_lock(&fp.lock);
+	fp.consumed++;
+	if (rc < 0)		// Later files would go nowhere
+	    fp.cancel = 1;
+	pthread_cond_broadcast(&fp.cond);
+	pthread_mutex_unlock(&fp.lock);
+	if (fp.cancel)
+	    break;
+    }
+    for (j = 0; j < jobs; j++)
+	pthread_join(tids[j], NULL);
+    if (fflush(out) == EOF)
+	rc = -1;
+
+    for (k = 0; k < nfiles; k++)
+	if (fp.jobs[k].out)	// Abandoned after a write error
+	    fclose(fp.jobs[k].out);
+    free(fp.jobs);
+    free(tids);
+    pthread_mutex_destroy(&fp.lock);
+    pthread_cond_destroy(&fp.cond);
+    return rc;
+}
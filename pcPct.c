@@ -0,0 +1,218 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Compiled toolsets. See pcPct.h. */
+
+#include <stdint.h>
+
+#include "pipecut.h"
+#include "pcExec.h"
+#include "pcPct.h"
+#include "pcPlan.h"
+
+/* The file: the header, an array of blades, then the strings, each NUL terminated.
+ * Offsets into the strings are from the start of the string area.
+ */
+struct lpc_pcthdr {
+    char magic[8];		// LPC_PCTMAGIC
+    uint32_t version;		// LPC_PCTVERSION
+    uint32_t order;		// LPC_PCTORDER
+    uint32_t size;		// Of the whole file
+    uint32_t nblades;
+    uint32_t strings;		// Offset of the string area
+    uint32_t nameoff;		// The toolset's name
+};
+
+struct lpc_pctblade {
+    uint32_t ttype;
+    uint32_t pattoff;
+    uint32_t pattlen;
+    uint32_t litoff;		// INCLUDE/EXCLUDE: the required literal
+    uint32_t litlen;		// 0 if there isn't one
+};
+
+static uint32_t
+lpc_pct_str(struct lpc_text *t, const char *p, size_t len)
+{
+    uint32_t off = t->len;
+
+    lpc_text_reserve(t, len + 1);
+    memcpy(t->p + t->len, p, len);
+    t->p[t->len + len] = '\0';
+    t->len += len + 1;
+    return off;
+}
+
+// Whether the string at off, len bytes long, is inside the string area
+static int
+lpc_pct_strok(const char *str, size_t size, uint32_t off, uint32_t len)
+{
+    return off < size && len < size - off && str[off + len] == '\0';
+}
+
+static void
+lpc_pct_bad(const char *path, const char *why)
+{
+    fprintf(stderr, "Pipecut Error: %s %s\n", path, why);
+    exit(-1);
+}
+
+// --compile: plan the toolset 'blades' (called name), and write the plan to path.
+void
+lpc_pct_write(struct tailhead *blades, const char *name, const char *path)
+{
+    struct lpc_plan plan;
+    struct lpc_pcthdr h;
+    struct lpc_pctblade *pb;
+    struct toolelement *te;
+    struct lpc_text str;
+    char tmp[PATH_MAX];
+    FILE *fp;
+    int n = 0, i = 0, bad;
+
+    lpc_plan_build(&plan, blades, LPC_PLAN_NATIVE);
+    TAILQ_FOREACH(te, &plan.blades, entries) {
+	if (te->ttype == INCLUDE || te->ttype == EXCLUDE)
+	    lpc_blade_re(te);	// A regex that doesn't compile fails here, not in every run
+	n++;
+    }
+    pb = calloc(n + 1, sizeof(struct lpc_pctblade));
+    memset(&str, 0, sizeof(struct lpc_text));
+    memset(&h, 0, sizeof(struct lpc_pcthdr));
+    memcpy(h.magic, LPC_PCTMAGIC, sizeof(h.magic));
+    h.version = LPC_PCTVERSION;
+    h.order = LPC_PCTORDER;
+    h.nblades = n;
+    h.nameoff = lpc_pct_str(&str, name, strlen(name));
+    TAILQ_FOREACH(te, &plan.blades, entries) {
+	pb[i].ttype = te->ttype;
+	pb[i].pattlen = strlen(te->pattern);
+	pb[i].pattoff = lpc_pct_str(&str, te->pattern, pb[i].pattlen);
+	if (te->reqlit) {
+	    pb[i].litlen = te->reqlitlen;
+	    pb[i].litoff = lpc_pct_str(&str, te->reqlit, te->reqlitlen);
+	}
+	i++;
+    }
+    h.strings = sizeof(struct lpc_pcthdr) + n * sizeof(struct lpc_pctblade);
+    h.size = h.strings + str.len;
+
+    // Written aside and renamed into place, so a running -f never sees half a file
+    snprintf(tmp, PATH_MAX, "%s.tmp", path);
+    if (!(fp = fopen(tmp, "w"))) {
+	fprintf(stderr, "Pipecut Error: could not create %s: %s\n", tmp,
+	    strerror(errno));
+	exit(-1);
+    }
+    bad = fwrite(&h, sizeof(h), 1, fp) != 1
+	|| fwrite(pb, sizeof(struct lpc_pctblade), n, fp) != (size_t)n
+	|| fwrite(str.p, 1, str.len, fp) != str.len;
+    if (fclose(fp) != 0 || bad) {
+	fprintf(stderr, "Pipecut Error: could not write %s: %s\n", tmp,
+	    strerror(errno));
+	unlink(tmp);
+	exit(-1);
+    }
+    if (rename(tmp, path) != 0) {
+	fprintf(stderr, "Pipecut Error: could not rename %s to %s: %s\n", tmp,
+	    path, strerror(errno));
+	unlink(tmp);
+	exit(-1);
+    }
+    if (lpc_ctx.debug)
+	fprintf(stderr, "pipecut: wrote %s: %d blades, %u bytes\n", path, n,
+	    h.size);
+    free(str.p);
+    free(pb);
+    lpc_plan_free(&plan);
+}
+
+/* -f: read the plan back into pn, as lpc_plan_build() would have made it. Sets
+ * lpc_ctx.filter to the toolset's name.
+ */
+void
+lpc_pct_load(struct lpc_plan *pn, const char *path)
+{
+    const struct lpc_pcthdr *h;
+    const struct lpc_pctblade *pb;
+    struct toolelement *te;
+    struct lpc_map m;
+    const char *str;
+    size_t size;
+    uint32_t i;
+
+    memset(&m, 0, sizeof(struct lpc_map));
+    if (!lpc_map_file(&m, path)) {
+	fprintf(stderr, "Pipecut Error: could not open %s: %s\n", path,
+	    strerror(errno));
+	exit(-1);
+    }
+    h = (const struct lpc_pcthdr *)m.p;
+    if (m.len < sizeof(struct lpc_pcthdr)
+	|| memcmp(h->magic, LPC_PCTMAGIC, sizeof(h->magic)))
+	lpc_pct_bad(path, "is not a compiled toolset");
+    if (h->version != LPC_PCTVERSION || h->order != LPC_PCTORDER)
+	lpc_pct_bad(path,
+	    "was compiled by another pipecut, or for another machine: compile it again");
+    if (h->size != m.len || h->strings > m.len || h->strings
+	!= sizeof(struct lpc_pcthdr) + (size_t)h->nblades
+	* sizeof(struct lpc_pctblade))
+	lpc_pct_bad(path, "is damaged");
+    pb = (const struct lpc_pctblade *)(h + 1);
+    str = m.p + h->strings;
+    size = m.len - h->strings;
+    if (h->nameoff >= size || !memchr(str + h->nameoff, '\0', size - h->nameoff))
+	lpc_pct_bad(path, "is damaged");
+
+    TAILQ_INIT(&pn->blades);
+    pn->target = LPC_PLAN_NATIVE;
+    pn->nnotes = 0;
+    for (i = 0; i < h->nblades; i++) {
+	if (pb[i].ttype > UNIQUE
+	    || !lpc_pct_strok(str, size, pb[i].pattoff, pb[i].pattlen)
+	    || (pb[i].litlen
+		&& !lpc_pct_strok(str, size, pb[i].litoff, pb[i].litlen)))
+	    lpc_pct_bad(path, "is damaged");
+	te = calloc(1, sizeof(struct toolelement));
+	te->ttype = pb[i].ttype;
+	te->enabled = 1;
+	te->haseffect = 1;
+	te->pattern = malloc(pb[i].pattlen + pb[i].litlen + 2);
+	memcpy(te->pattern, str + pb[i].pattoff, pb[i].pattlen + 1);
+	if (pb[i].litlen) {	// Shares pattern's allocation, as from lpc_newIN()
+	    te->reqlit = te->pattern + pb[i].pattlen + 1;
+	    memcpy(te->reqlit, str + pb[i].litoff, pb[i].litlen + 1);
+	    te->reqlitlen = pb[i].litlen;
+	}
+	TAILQ_INSERT_TAIL(&pn->blades, te, entries);
+    }
+    lpc_ctx.filter = strdup(str + h->nameoff);
+    lpc_map_close(&m);
+}
@@ -0,0 +1,59 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Compiled toolsets (--compile NAME -o FILE, then -f FILE).
+ *
+ * Filter mode starts by opening ~/.pipecut.db, checking its tables, querying the
+ * toolset and its blades, and planning it. --compile does all of that once, and writes
+ * the plan out; -f maps the file and has the plan, without sqlite or the planner. The
+ * required literal of every INCLUDE/EXCLUDE blade, which the fused matcher builds its
+ * prefilter from, is stored with it. A regex_t can't be written out, but plan blades
+ * only compile their regex when a stage first uses it, and many never do: plain strings
+ * go to the automaton, and the joined alternation covers a run of EXCLUDEs.
+ *
+ * The file is for the machine, and the pipecut, that made it: native byte order, and
+ * blade types as numbers. A file from anywhere else is refused, not misread.
+ */
+
+#ifndef PCPCT_H
+#define PCPCT_H
+
+#define LPC_PCTMAGIC "pipecut\0"		// 8 bytes
+#define LPC_PCTVERSION 1		// Bump when the layout or Tooltype changes
+#define LPC_PCTORDER 0x01020304		// As written by the maker
+
+struct lpc_plan;
+
+void lpc_pct_write(struct tailhead *blades, const char *name,
+    const char *path);
+void lpc_pct_load(struct lpc_plan *pn, const char *path);
+
+#endif
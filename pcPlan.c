@@ -0,0 +1,411 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Toolset planner. See pcPlan.h. */
+
+#include "pipecut.h"
+#include "pcDB.h"
+#include "pcExec.h"
+#include "pcMatch.h"
+#include "pcPlan.h"
+#include "pcSort.h"
+#include "pcSubst.h"
+
+/* Blades */
+
+// A blade that belongs to a plan. INCLUDE/EXCLUDE get their required literal, as
+// lpc_newIN()/lpc_newEX() would, and their regex when first run (lpc_blade_re()).
+// Nothing goes on the toolset.
+static struct toolelement *
+lpc_plan_blade(Tooltype ttype, const char *patt)
+{
+    struct toolelement *te;
+    size_t nlen = strlen(patt) + 1;
+
+    te = calloc(1, sizeof(struct toolelement));
+    te->ttype = ttype;
+    te->enabled = 1;
+    te->haseffect = 1;
+    te->pattern = malloc(nlen * 2);	// Room for the required literal too
+    memcpy(te->pattern, patt, nlen);
+    if (ttype == INCLUDE || ttype == EXCLUDE) {
+	te->reqlit = te->pattern + nlen;
+	te->reqlitlen = lpc_reqlit(patt, te->reqlit);
+	if (te->reqlitlen == 0)
+	    te->reqlit = NULL;
+    }
+    return te;
+}
+
+static void
+lpc_plan_bladefree(struct toolelement *te)
+{
+    if (te->hasre)
+	regfree(&te->preg);
+    free(te->pattern);
+    free(te);
+}
+
+/* te's blade type, or for a BLACKBOX command that runs as a blade type (sort, uniq,
+ * wc, awk print), that type. The blade's pattern goes to patt, without leading blanks.
+ * 'kind' gets what lpc_subst_parse() made of a BLACKBOX command.
+ */
+static Tooltype
+lpc_plan_kind(struct toolelement *te, char *patt, size_t size, int *kind)
+{
+    struct lpc_subst sb;
+    Tooltype ttype = te->ttype;
+    const char *cp = te->pattern ? te->pattern : "";
+
+    *kind = LPC_SUB_NONE;
+    if (ttype == BLACKBOX) {
+	*kind = lpc_subst_parse(cp, &sb);
+	if (*kind == LPC_SUB_BLADE) {
+	    ttype = sb.ttype;
+	    cp = sb.pattern;
+	}
+    }
+    while (isspace((unsigned char)*cp))
+	cp++;
+    strlcpy(patt, cp, size);
+    if (*kind != LPC_SUB_NONE)
+	lpc_subst_free(&sb);
+    return ttype;
+}
+
+// The shell text for one blade, without the pipe in front of it
+static void
+lpc_plan_desc(struct toolelement *te, char *out, size_t size)
+{
+    char blade[BLADECACHE];
+    char *cp;
+    size_t len;
+
+    memset(blade, 0, BLADECACHE);
+    lpc_pipe_transition(PIPE, te->ttype, te->pattern, blade, 0);
+    cp = blade;
+    while (*cp == ' ' || *cp == '|')
+	cp++;
+    len = strlen(cp);
+    while (len && cp[len - 1] == ' ')
+	cp[--len] = '\0';
+    strlcpy(out, cp, size);
+}
+
+/* Rewrites */
+
+static void
+lpc_plan_note(struct lpc_plan *pn, const char *fmt, struct toolelement *a,
+    struct toolelement *b)
+{
+    char da[LPC_PLANNOTE / 3], db[LPC_PLANNOTE / 3];	// Long blades are cut short
+
+    if (pn->nnotes == LPC_PLANNOTES)
+	return;
+    lpc_plan_desc(a, da, sizeof(da));
+    lpc_plan_desc(b, db, sizeof(db));
+    snprintf(pn->notes[pn->nnotes++], LPC_PLANNOTE, fmt, da, db);
+}
+
+// Put the blade 'by' where a and b (a's successor) are
+static void
+lpc_plan_replace(struct lpc_plan *pn, struct toolelement *a,
+    struct toolelement *b, struct toolelement *by)
+{
+    TAILQ_INSERT_BEFORE(a, by, entries);
+    TAILQ_REMOVE(&pn->blades, a, entries);
+    TAILQ_REMOVE(&pn->blades, b, entries);
+    lpc_plan_bladefree(a);
+    lpc_plan_bladefree(b);
+}
+
+static void
+lpc_plan_drop(struct lpc_plan *pn, struct toolelement *te)
+{
+    TAILQ_REMOVE(&pn->blades, te, entries);
+    lpc_plan_bladefree(te);
+}
+
+// An ERE that can go into an alternation with others as it is
+static int
+lpc_plan_joinable(const char *patt)
+{
+    const char *cp;
+
+    if (*patt == '\0')
+	return 0;
+    for (cp = patt; *cp; cp++) {
+	if (*cp == '\\' && cp[1] != '\0') {
+	    if (isdigit((unsigned char)cp[1]))	// Backreferences are numbered
+		return 0;
+	    cp++;
+	}
+    }
+    return 1;
+}
+
+/* Apply the first rewrite that fits the blade a and its successor b: one that is good
+ * for any target, or else one just for 'target'. Returns 1 if the plan changed.
+ */
+static int
+lpc_plan_pair(struct lpc_plan *pn, struct toolelement *a,
+    struct toolelement *b, int target)
+{
+    char pa[BLADECACHE], pb[BLADECACHE], np[BLADECACHE];
+    struct lpc_sortspec sa, sb;
+    regex_t re;
+    Tooltype ka, kb;
+    int suba, subb;
+
+    ka = lpc_plan_kind(a, pa, sizeof(pa), &suba);
+    kb = lpc_plan_kind(b, pb, sizeof(pb), &subb);
+
+    // A plain cat in the middle of a pipeline copies its input through unchanged
+    if (suba == LPC_SUB_CAT && !strcmp(pa, "cat")) {
+	lpc_plan_note(pn, "dropped \"%s\" ahead of \"%s\"", a, b);
+	lpc_plan_drop(pn, a);
+	return 1;
+    }
+
+    /* A filter after a sort goes ahead of it, so the sort sees fewer lines. Sorting
+     * doesn't change which lines a filter keeps, and the lines a sort can't tell apart
+     * keep their order either way, as sort(1) is stable.
+     */
+    if (ka == ORDER && (kb == INCLUDE || kb == EXCLUDE)
+	&& lpc_sortspec_parse(&sa, pa)) {
+	lpc_plan_note(pn, "moved \"%2$s\" ahead of \"%1$s\"", a, b);
+	TAILQ_REMOVE(&pn->blades, b, entries);
+	TAILQ_INSERT_BEFORE(a, b, entries);
+	return 1;
+    }
+
+    // The same filter twice
+    if ((ka == INCLUDE || ka == EXCLUDE) && ka == kb && !strcmp(pa, pb)) {
+	lpc_plan_note(pn, "dropped \"%2$s\", which repeats \"%1$s\"", a, b);
+	lpc_plan_drop(pn, b);
+	return 1;
+    }
+
+    /* A sort undoes the one before it, unless it is -s and keeps some of that order.
+     * Sorting twice the same way is the same as sorting once.
+     */
+    if (ka == ORDER && kb == ORDER && lpc_sortspec_parse(&sa, pa)
+	&& lpc_sortspec_parse(&sb, pb) && (!strcmp(pa, pb) || (!sb.stable
+		&& lpc_sort_clocale()))) {
+	lpc_plan_note(pn, "dropped \"%s\", as \"%s\" sorts again", a, b);
+	lpc_plan_drop(pn, a);
+	return 1;
+    }
+
+    // A plain uniq leaves no adjacent duplicates for a second one to remove
+    if (ka == UNIQUE && kb == UNIQUE && pa[0] == '\0' && pb[0] == '\0') {
+	lpc_plan_note(pn, "dropped \"%2$s\", which repeats \"%1$s\"", a, b);
+	lpc_plan_drop(pn, b);
+	return 1;
+    }
+
+    if (target != LPC_PLAN_SHELL)
+	return 0;
+
+    /* Adjacent egrep -v blades become one, with their patterns as alternatives. '|'
+     * binds loosest in an ERE, so neither needs parentheses.
+     */
+    if (ka == EXCLUDE && kb == EXCLUDE && lpc_plan_joinable(pa)
+	&& lpc_plan_joinable(pb)) {
+	if (snprintf(np, sizeof(np), "%s|%s", pa, pb) >= (int)sizeof(np)
+	    || regcomp(&re, np, REG_EXTENDED | REG_NOSUB))
+	    return 0;
+	regfree(&re);
+	lpc_plan_note(pn, "joined \"%s\" and \"%s\"", a, b);
+	lpc_plan_replace(pn, a, b, lpc_plan_blade(EXCLUDE, np));
+	return 1;
+    }
+#ifdef __linux__
+    /* egrep | wc -l: egrep counts the lines itself. GNU wc -l reading a pipe prints the
+     * count unpadded, as grep -c does (BSD wc pads it). GNU grep -vc '' prints nothing.
+     */
+    if ((ka == INCLUDE || ka == EXCLUDE) && subb == LPC_SUB_COUNT
+	&& pa[0] != '\0' && !strchr(pa, '\'')) {
+	if (snprintf(np, sizeof(np), "egrep -%sc '%s'", ka == EXCLUDE ? "v" : "",
+		pa) >= (int)sizeof(np))
+	    return 0;
+	lpc_plan_note(pn, "counted \"%s\" in egrep instead of \"%s\"", a, b);
+	lpc_plan_replace(pn, a, b, lpc_plan_blade(BLACKBOX, np));
+	return 1;
+    }
+#endif
+    return 0;
+}
+
+/* Plans */
+
+// Copy 'blades' into pn, and rewrite the copy for 'target' until no rewrite applies.
+void
+lpc_plan_build(struct lpc_plan *pn, struct tailhead *blades, int target)
+{
+    struct toolelement *te, *copy, *next;
+    int changed, phase;
+
+    TAILQ_INIT(&pn->blades);
+    pn->target = target;
+    pn->nnotes = 0;
+    TAILQ_FOREACH(te, blades, entries) {
+	copy = lpc_plan_blade(te->ttype, te->pattern ? te->pattern : "");
+	TAILQ_INSERT_TAIL(&pn->blades, copy, entries);
+    }
+
+    /* Every rewrite removes a blade or moves a filter towards the front, so this ends.
+     * The rewrites for any target go first, so that duplicates are gone before the
+     * shell's get to join blades.
+     */
+    for (phase = LPC_PLAN_NATIVE; phase <= target; phase++) {
+	do {
+	    changed = 0;
+	    TAILQ_FOREACH(te, &pn->blades, entries) {
+		if (te->ttype == STDIN || te->ttype == CAT
+		    || te->ttype == TNONE)
+		    continue;
+		if (!(next = TAILQ_NEXT(te, entries)))
+		    break;
+		if ((changed = lpc_plan_pair(pn, te, next, phase)))
+		    break;
+	    }
+	} while (changed);
+    }
+}
+
+void
+lpc_plan_free(struct lpc_plan *pn)
+{
+    struct toolelement *te;
+
+    while ((te = TAILQ_FIRST(&pn->blades))) {
+	TAILQ_REMOVE(&pn->blades, te, entries);
+	lpc_plan_bladefree(te);
+    }
+}
+
+// The shell pipeline for 'blades', its source left out
+void
+lpc_plan_text(struct tailhead *blades, char *out, size_t size)
+{
+    struct toolelement *te;
+    char desc[BLADECACHE];
+
+    out[0] = '\0';
+    TAILQ_FOREACH(te, blades, entries) {
+	if (te->ttype == STDIN || te->ttype == CAT || te->ttype == TNONE)
+	    continue;
+	lpc_plan_desc(te, desc, sizeof(desc));
+	if (out[0] != '\0')
+	    strlcat(out, " | ", size);
+	strlcat(out, desc, size);
+    }
+}
+
+/* --explain */
+
+static void
+lpc_plan_list(struct tailhead *blades, FILE *out)
+{
+    struct toolelement *te;
+    char type[32], text[BLADECACHE];
+    int n = 0;
+
+    TAILQ_FOREACH(te, blades, entries) {
+	if (te->ttype == STDIN || te->ttype == CAT || te->ttype == TNONE)
+	    continue;
+	txtFromType(type, te->ttype);
+	fprintf(out, "  %2d  %-10s %s\n", ++n, type, te->pattern);
+    }
+    if (!n)
+	fprintf(out, "  (no blades)\n");
+    lpc_plan_text(blades, text, sizeof(text));
+    fprintf(out, "  sh: %s\n", text[0] ? text : "cat");
+}
+
+static void
+lpc_plan_notes(struct lpc_plan *pn, FILE *out)
+{
+    int i;
+
+    for (i = 0; i < pn->nnotes; i++)
+	fprintf(out, "  %s\n", pn->notes[i]);
+    if (!pn->nnotes)
+	fprintf(out, "  (none)\n");
+}
+
+// Print the toolset, the plans made from it, and how filter mode will run it.
+void
+lpc_plan_explain(struct tailhead *blades, FILE *out)
+{
+    struct lpc_plan native, shell;
+    struct lpc_pipeline pl;
+    struct toolelement *te;
+    char desc[BLADECACHE];
+    int i, j;
+
+    lpc_plan_build(&native, blades, LPC_PLAN_NATIVE);
+    lpc_plan_build(&shell, blades, LPC_PLAN_SHELL);
+
+    fprintf(out, "Toolset %s, as written:\n", lpc_ctx.filter);
+    lpc_plan_list(blades, out);
+    fprintf(out, "\nRewrites:\n");
+    lpc_plan_notes(&native, out);
+    fprintf(out, "\nPlan:\n");
+    lpc_plan_list(&native.blades, out);
+
+    fprintf(out, "\nExecution:\n");
+    lpc_compile(&pl, &native.blades);
+    for (i = 0; i < pl.nstages; i++) {
+	fprintf(out, "  native:");
+	for (j = 0, te = pl.stages[i].blade; j < pl.stages[i].nblades && te;
+	    j++, te = TAILQ_NEXT(te, entries)) {
+	    lpc_plan_desc(te, desc, sizeof(desc));
+	    fprintf(out, "%s %s", j ? " +" : "", desc);
+	}
+	if (pl.stages[i].nblades > 1)
+	    fprintf(out, "  (one stage)");
+	fprintf(out, "\n");
+    }
+    if (pl.tail[0] != '\0')
+	fprintf(out, "  shell:  %s\n", pl.tail);
+    if (!pl.nstages && pl.tail[0] == '\0')
+	fprintf(out, "  input copied to output\n");
+    lpc_release(&pl);
+
+    fprintf(out, "\nRewrites for a script ('!'):\n");
+    lpc_plan_notes(&shell, out);
+    fprintf(out, "\nScript plan:\n");
+    lpc_plan_list(&shell.blades, out);
+
+    lpc_plan_free(&native);
+    lpc_plan_free(&shell);
+}
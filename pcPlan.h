@@ -0,0 +1,68 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Toolset planner.
+ *
+ * A toolset is built up one blade at a time, in whatever order the user thought of
+ * them, so it often does work it doesn't need to: a sort ahead of the greps that throw
+ * most of its lines away, a sort that the next sort undoes, the same egrep -v twice.
+ * lpc_plan_build() copies the toolset and applies rewrites to the copy that leave its
+ * output unchanged, until none applies. The toolset itself (what the UI shows and what
+ * is saved) is never touched.
+ *
+ * Some rewrites only pay off for one way of running the plan. Joining egrep -v blades
+ * into one saves a process in the shell, but the native engine already runs a run of
+ * filter blades as one fused matcher, and one big alternation would lose the literal
+ * prefilters it uses. So the plan is built for a target.
+ */
+
+#ifndef PCPLAN_H
+#define PCPLAN_H
+
+#define LPC_PLAN_NATIVE 0		// For lpc_compile(), in filter mode
+#define LPC_PLAN_SHELL 1		// For the shell text of a generated script
+
+#define LPC_PLANNOTES 64		// Rewrites we keep a description of
+#define LPC_PLANNOTE 512
+
+struct lpc_plan {
+    struct tailhead blades;	// Copies of the toolset's blades, rewritten
+    int target;			// LPC_PLAN_*
+    int nnotes;
+    char notes[LPC_PLANNOTES][LPC_PLANNOTE];	// What was rewritten, for --explain
+};
+
+void lpc_plan_build(struct lpc_plan *pn, struct tailhead *blades, int target);
+void lpc_plan_free(struct lpc_plan *pn);
+void lpc_plan_text(struct tailhead *blades, char *out, size_t size);
+void lpc_plan_explain(struct tailhead *blades, FILE *out);
+
+#endif
@@ -0,0 +1,504 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Vectorized scanning kernels. See pcScan.h. */
+
+#include <stdint.h>
+
+#include "pipecut.h"
+#include "pcExec.h"
+#include "pcScan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LPC_X86 1
+#include <immintrin.h>
+#endif
+
+typedef const char *(*lpc_scanfn) (const char *, const char *,
+    struct lpc_span **, int *, int *);
+typedef void (*lpc_wcfn) (struct lpc_wcount *, const char *, size_t);
+struct lpc_fsplit;
+typedef int (*lpc_fieldfn) (struct lpc_fsplit *, const char *, size_t);
+
+static inline void
+lpc_pushspan(struct lpc_span **lines, int *n, int *cap, const char *p,
+    size_t len)
+{
+    if (*n == *cap) {
+	*cap = *cap ? *cap * 2 : 1024;
+	*lines = realloc(*lines, *cap * sizeof(struct lpc_span));
+	if (!*lines) {
+	    fprintf(stderr, "Pipecut Error: out of memory\n");
+	    exit(-1);
+	}
+    }
+    (*lines)[*n].p = p;
+    (*lines)[*n].len = len;
+    (*n)++;
+}
+
+// Append one line to a growable span array
+void
+lpc_addspan(struct lpc_span **lines, int *n, int *cap, const char *p,
+    size_t len)
+{
+    lpc_pushspan(lines, n, cap, p, len);
+}
+
+/* The kernels. Each appends every '\n' terminated line in [bol, end) and returns the
+ * start of the unterminated rest.
+ */
+
+static const char *
+lpc_scan_scalar(const char *bol, const char *end, struct lpc_span **lines,
+    int *n, int *cap)
+{
+    const char *eol;
+
+    while (bol < end && (eol = memchr(bol, '\n', end - bol))) {
+	lpc_pushspan(lines, n, cap, bol, eol - bol);
+	bol = eol + 1;
+    }
+    return bol;
+}
+
+/* wc. Byte classes: space, word, and (GNU only) neither. */
+
+#define LPC_ISSPACE(c) ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
+#ifdef LPC_WC_GNU
+#define LPC_ISWORD(c) ((c) > ' ' && (c) < 0x7f)
+#else
+#define LPC_ISWORD(c) (!LPC_ISSPACE(c))
+#endif
+
+static void
+lpc_wc_tail(struct lpc_wcount *c, const unsigned char *p, size_t len)
+{
+    const unsigned char *ep = p + len;
+
+    for (; p < ep; p++) {
+	if (*p == '\n')
+	    c->lines++;
+	if (LPC_ISSPACE(*p)) {
+	    c->any = 1;
+	    c->inword = 0;
+	} else if (LPC_ISWORD(*p)) {
+	    if (!c->any)
+		c->startword = 1;
+	    c->any = 1;
+	    if (!c->inword)
+		c->words++;
+	    c->inword = 1;
+	}
+    }
+}
+
+/* Count one 64 byte block, given masks of its newlines, spaces and word characters.
+ * A word starts at a word character whose nearest space-or-word predecessor is a
+ * space. Bytes in neither class are skipped over by letting an addition carry
+ * through them.
+ */
+static inline void
+lpc_wc_block(struct lpc_wcount *c, uint64_t nl, uint64_t sp, uint64_t wd)
+{
+    uint64_t other = ~(sp | wd);
+    uint64_t after = (sp << 1) | (uint64_t)!c->inword;	// Right after a space
+    uint64_t skip = after & other;	// ... but on a byte to skip over
+    uint64_t landed = (other + skip) & ~other;	// Where those carries end up
+    uint64_t m = sp | wd;
+
+    c->lines += __builtin_popcountll(nl);
+    c->words += __builtin_popcountll(wd & (after | landed));
+    if (m) {
+	if (!c->any)
+	    c->startword = (wd & -m) != 0;	// Lowest set bit of m
+	c->any = 1;
+	c->inword = (wd >> (63 - __builtin_clzll(m))) & 1;
+    }
+}
+
+static void
+lpc_wc_scalar(struct lpc_wcount *c, const char *p, size_t len)
+{
+    lpc_wc_tail(c, (const unsigned char *)p, len);
+}
+
+#ifdef LPC_X86
+__attribute__((target("sse2")))
+static void
+lpc_wc_sse2(struct lpc_wcount *c, const char *p, size_t len)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i blank = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i four = _mm_set1_epi8(4);
+#ifdef LPC_WC_GNU
+    const __m128i bang = _mm_set1_epi8('!');
+    const __m128i range = _mm_set1_epi8(0x7e - '!');
+#endif
+    __m128i v, x;
+    uint64_t mnl, msp, mwd;
+    size_t i;
+    int k;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+	mnl = msp = mwd = 0;
+	for (k = 0; k < 4; k++) {
+	    v = _mm_loadu_si128((const __m128i *)(p + i + k * 16));
+	    x = _mm_cmpeq_epi8(v, nl);
+	    mnl |= (uint64_t)(unsigned)_mm_movemask_epi8(x) << (k * 16);
+	    x = _mm_sub_epi8(v, tab);	// \t..\r become 0..4
+	    x = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(x, four), x),
+		_mm_cmpeq_epi8(v, blank));
+	    msp |= (uint64_t)(unsigned)_mm_movemask_epi8(x) << (k * 16);
+#ifdef LPC_WC_GNU
+	    x = _mm_sub_epi8(v, bang);	// '!'..'~' become 0..0x5d
+	    x = _mm_cmpeq_epi8(_mm_min_epu8(x, range), x);
+	    mwd |= (uint64_t)(unsigned)_mm_movemask_epi8(x) << (k * 16);
+#endif
+	}
+#ifndef LPC_WC_GNU
+	mwd = ~msp;
+#endif
+	lpc_wc_block(c, mnl, msp, mwd);
+    }
+    lpc_wc_tail(c, (const unsigned char *)p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void
+lpc_wc_avx2(struct lpc_wcount *c, const char *p, size_t len)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i blank = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i four = _mm256_set1_epi8(4);
+#ifdef LPC_WC_GNU
+    const __m256i bang = _mm256_set1_epi8('!');
+    const __m256i range = _mm256_set1_epi8(0x7e - '!');
+#endif
+    __m256i v, x;
+    uint64_t mnl, msp, mwd;
+    size_t i;
+    int k;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+	mnl = msp = mwd = 0;
+	for (k = 0; k < 2; k++) {
+	    v = _mm256_loadu_si256((const __m256i *)(p + i + k * 32));
+	    x = _mm256_cmpeq_epi8(v, nl);
+	    mnl |= (uint64_t)(uint32_t)_mm256_movemask_epi8(x) << (k * 32);
+	    x = _mm256_sub_epi8(v, tab);
+	    x = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(x, four), x),
+		_mm256_cmpeq_epi8(v, blank));
+	    msp |= (uint64_t)(uint32_t)_mm256_movemask_epi8(x) << (k * 32);
+#ifdef LPC_WC_GNU
+	    x = _mm256_sub_epi8(v, bang);
+	    x = _mm256_cmpeq_epi8(_mm256_min_epu8(x, range), x);
+	    mwd |= (uint64_t)(uint32_t)_mm256_movemask_epi8(x) << (k * 32);
+#endif
+	}
+#ifndef LPC_WC_GNU
+	mwd = ~msp;
+#endif
+	lpc_wc_block(c, mnl, msp, mwd);
+    }
+    lpc_wc_tail(c, (const unsigned char *)p + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static const char *
+lpc_scan_sse2(const char *bol, const char *end, struct lpc_span **lines,
+    int *n, int *cap)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    const char *cp = bol;
+    const char *eol;
+    unsigned int mask;
+
+    for (; cp + 16 <= end; cp += 16) {
+	mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)
+		    cp), nl));
+	while (mask) {
+	    eol = cp + __builtin_ctz(mask);
+	    lpc_pushspan(lines, n, cap, bol, eol - bol);
+	    bol = eol + 1;
+	    mask &= mask - 1;
+	}
+    }
+    while (cp < end && (eol = memchr(cp, '\n', end - cp))) {
+	lpc_pushspan(lines, n, cap, bol, eol - bol);
+	bol = cp = eol + 1;
+    }
+    return bol;
+}
+
+__attribute__((target("avx2")))
+static const char *
+lpc_scan_avx2(const char *bol, const char *end, struct lpc_span **lines,
+    int *n, int *cap)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const char *cp = bol;
+    const char *eol;
+    unsigned int mask;
+
+    for (; cp + 32 <= end; cp += 32) {
+	mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const
+			__m256i *)cp), nl));
+	while (mask) {
+	    eol = cp + __builtin_ctz(mask);
+	    lpc_pushspan(lines, n, cap, bol, eol - bol);
+	    bol = eol + 1;
+	    mask &= mask - 1;
+	}
+    }
+    while (cp < end && (eol = memchr(cp, '\n', end - cp))) {
+	lpc_pushspan(lines, n, cap, bol, eol - bol);
+	bol = cp = eol + 1;
+    }
+    return bol;
+}
+#endif
+
+/* Field splitting, with awk's default FS: fields are runs of anything but blanks
+ * (' ' and '\t'), and blanks at either end of the line are ignored.
+ */
+
+#define LPC_ISBLANK(c) ((c) == ' ' || (c) == '\t')
+
+// Where a split has got to
+struct lpc_fsplit {
+    struct lpc_span **f;
+    int *cap;
+    int n;
+    int max;			// Stop after this many fields (-1: all of them)
+    const char *fs;		// Start of the field we are in, NULL between fields
+};
+
+// Split bytes one at a time. Returns 1 once max fields are in.
+static int
+lpc_fields_tail(struct lpc_fsplit *s, const char *p, const char *ep)
+{
+    for (; p < ep; p++) {
+	if (LPC_ISBLANK(*p)) {
+	    if (s->fs) {
+		lpc_pushspan(s->f, &s->n, s->cap, s->fs, p - s->fs);
+		s->fs = NULL;
+		if (s->n == s->max)
+		    return 1;
+	    }
+	} else if (!s->fs) {
+	    s->fs = p;
+	}
+    }
+    return 0;
+}
+
+/* Split a block of w bytes at p, given the mask of its blanks. Fields start and end
+ * wherever a byte differs from its predecessor, and starts and ends alternate, so one
+ * walk over the changes needs no other test. Returns 1 once max fields are in.
+ */
+static inline int
+lpc_fields_block(struct lpc_fsplit *s, const char *p, uint64_t bl, int w)
+{
+    uint64_t prev = (bl << 1) | (uint64_t)(s->fs == NULL);
+    uint64_t t = bl ^ prev;
+    const char *q;
+
+    if (w < 64)
+	t &= ((uint64_t)1 << w) - 1;
+    while (t) {
+	q = p + __builtin_ctzll(t);
+	t &= t - 1;
+	if (!s->fs) {
+	    s->fs = q;
+	    continue;
+	}
+	lpc_pushspan(s->f, &s->n, s->cap, s->fs, q - s->fs);
+	s->fs = NULL;
+	if (s->n == s->max)
+	    return 1;
+    }
+    return 0;
+}
+
+static int
+lpc_fields_scalar(struct lpc_fsplit *s, const char *p, size_t len)
+{
+    return lpc_fields_tail(s, p, p + len);
+}
+
+#ifdef LPC_X86
+__attribute__((target("sse2")))
+static int
+lpc_fields_sse2(struct lpc_fsplit *s, const char *p, size_t len)
+{
+    const __m128i blank = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    __m128i v;
+    uint64_t bl;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+	v = _mm_loadu_si128((const __m128i *)(p + i));
+	bl = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v,
+		    blank), _mm_cmpeq_epi8(v, tab)));
+	if (lpc_fields_block(s, p + i, bl, 16))
+	    return 1;
+    }
+    return lpc_fields_tail(s, p + i, p + len);
+}
+
+__attribute__((target("avx2")))
+static int
+lpc_fields_avx2(struct lpc_fsplit *s, const char *p, size_t len)
+{
+    const __m256i blank = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    __m256i v;
+    uint64_t bl;
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+	v = _mm256_loadu_si256((const __m256i *)(p + i));
+	bl = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v,
+		    blank), _mm256_cmpeq_epi8(v, tab)));
+	if (lpc_fields_block(s, p + i, bl, 32))
+	    return 1;
+    }
+    return lpc_fields_sse2(s, p + i, len - i);
+}
+#endif
+
+/* Dispatch */
+
+static struct {
+    const char *name;
+    lpc_scanfn scan;
+    lpc_wcfn wc;
+    lpc_fieldfn fields;
+} lpc_kernel = { "scalar", lpc_scan_scalar, lpc_wc_scalar, lpc_fields_scalar };
+
+static pthread_once_t lpc_kernel_once = PTHREAD_ONCE_INIT;
+
+static void
+lpc_kernel_pick()
+{
+    const char *want = getenv("PIPECUT_SIMD");
+
+#ifdef LPC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")
+	&& (!want || !strcmp(want, "avx2"))) {
+	lpc_kernel.name = "avx2";
+	lpc_kernel.scan = lpc_scan_avx2;
+	lpc_kernel.wc = lpc_wc_avx2;
+	lpc_kernel.fields = lpc_fields_avx2;
+    } else if (__builtin_cpu_supports("sse2")
+	&& (!want || strcmp(want, "scalar"))) {
+	lpc_kernel.name = "sse2";
+	lpc_kernel.scan = lpc_scan_sse2;
+	lpc_kernel.wc = lpc_wc_sse2;
+	lpc_kernel.fields = lpc_fields_sse2;
+    }
+#endif
+}
+
+// Name of the kernel in use
+const char *
+lpc_scan_kernel()
+{
+    pthread_once(&lpc_kernel_once, lpc_kernel_pick);
+    return lpc_kernel.name;
+}
+
+// Index the '\n' terminated lines in [bol, end). Returns the start of the unterminated rest.
+const char *
+lpc_scanlines(const char *bol, const char *end, struct lpc_span **lines,
+    int *n, int *cap)
+{
+    pthread_once(&lpc_kernel_once, lpc_kernel_pick);
+    return lpc_kernel.scan(bol, end, lines, n, cap);
+}
+
+// Index a NUL terminated buffer (the UI caches). The last line need not end in '\n'.
+int
+lpc_splitlines(const char *buf, struct lpc_span **lines, int *cap)
+{
+    const char *end = buf + strlen(buf);
+    const char *bol;
+    int n = 0;
+
+    bol = lpc_scanlines(buf, end, lines, &n, cap);
+    if (bol < end)
+	lpc_pushspan(lines, &n, cap, bol, end - bol);
+    return n;
+}
+
+// Add the wc counts of p to c, carrying on from where c left off.
+void
+lpc_wc_scan(struct lpc_wcount *c, const char *p, size_t len)
+{
+    pthread_once(&lpc_kernel_once, lpc_kernel_pick);
+    c->bytes += len;
+    lpc_kernel.wc(c, p, len);
+}
+
+// Fold the counts of the text that follows dst's into dst.
+void
+lpc_wc_merge(struct lpc_wcount *dst, const struct lpc_wcount *src)
+{
+    dst->lines += src->lines;
+    dst->words += src->words;
+    dst->bytes += src->bytes;
+    if (!src->any)
+	return;
+    if (dst->inword && src->startword)	// One word, cut in two
+	dst->words--;
+    if (!dst->any)
+	dst->startword = src->startword;
+    dst->any = 1;
+    dst->inword = src->inword;
+}
+
+/* Split the line p into awk fields, stopping after max of them (-1 for all). Returns
+ * the number found; with max = -1 that is NF.
+ */
+int
+lpc_fields(const char *p, size_t len, struct lpc_span **f, int *cap, int max)
+{
+    struct lpc_fsplit s = { f, cap, 0, max, NULL };
+
+    pthread_once(&lpc_kernel_once, lpc_kernel_pick);
+    if (!lpc_kernel.fields(&s, p, len) && s.fs)
+	lpc_pushspan(f, &s.n, cap, s.fs, p + len - s.fs);
+    return s.n;
+}
@@ -0,0 +1,78 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Vectorized scanning kernels.
+ *
+ * Finding line boundaries is the innermost loop of everything pipecut does, in filter
+ * mode and in the UI alike. lpc_scanlines() builds the line index for a buffer in one
+ * pass, 16 (SSE2) or 32 (AVX2) bytes at a time. The kernel is picked once at run time
+ * from what the CPU supports, so one binary runs everywhere. PIPECUT_SIMD=scalar, sse2
+ * or avx2 in the environment overrides the choice (for testing).
+ *
+ * lpc_wc_scan() is wc(1) in the same style: 64 bytes at a time are classified into
+ * bitmasks, and word starts are found with a few integer operations on the masks.
+ * lpc_fields() splits a line into awk fields the same way, from a mask of its blanks.
+ */
+
+#ifndef PCSCAN_H
+#define PCSCAN_H
+
+/* wc(1) word rules. GNU wc in the C locale: a word is a run of printable non-space
+ * characters, and other non-space bytes (controls, bytes >= 0x80) neither start nor
+ * end one. BSD wc: anything that isn't isspace() is part of a word.
+ */
+#ifdef __linux__
+#define LPC_WC_GNU 1
+#endif
+
+/* Running wc(1) counts. Counts over consecutive pieces of a text can be scanned one
+ * after the other, or scanned independently and merged with lpc_wc_merge().
+ */
+struct lpc_wcount {
+    long lines;
+    long words;
+    long bytes;
+    int any;			// Saw a space or word character
+    int startword;		// The first of those was a word character
+    int inword;			// The last of those was a word character
+};
+
+void lpc_addspan(struct lpc_span **lines, int *n, int *cap, const char *p,
+    size_t len);
+const char *lpc_scanlines(const char *bol, const char *end,
+    struct lpc_span **lines, int *n, int *cap);
+int lpc_splitlines(const char *buf, struct lpc_span **lines, int *cap);
+const char *lpc_scan_kernel();
+void lpc_wc_scan(struct lpc_wcount *c, const char *p, size_t len);
+void lpc_wc_merge(struct lpc_wcount *dst, const struct lpc_wcount *src);
+int lpc_fields(const char *p, size_t len, struct lpc_span **f, int *cap,
+    int max);
+
+#endif
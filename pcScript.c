@@ -0,0 +1,1163 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* The script languages of --emit: awk, perl and python. See pcEmit.h. */
+
+#include "pipecut.h"
+#include "pcDB.h"
+#include "pcEmit.h"
+#include "pcExec.h"
+#include "pcMatch.h"
+#include "pcScan.h"
+#include "pcSort.h"
+#include "pcSubst.h"
+
+/* The scripts' fixed parts */
+
+#ifdef LPC_WC_GNU
+static const char lpc_perl_words[] =
+    "\n"
+    "# wc(1)'s words: runs of printable characters, which other bytes don't break\n"
+    "sub words {\n"
+    "    (my $t = $_[0]) =~ tr/\\x00-\\x08\\x0e-\\x1f\\x7f-\\xff//d;\n"
+    "    my $n = () = $t =~ /[\\x21-\\x7e]+/g;\n"
+    "    return $n;\n"
+    "}\n";
+
+static const char lpc_python_words[] =
+    "\n"
+    "# wc(1)'s words: runs of printable characters, which other bytes don't break\n"
+    "WORDS = re.compile(rb'[\\x21-\\x7e]+').findall\n"
+    "OTHER = bytes(range(0, 9)) + bytes(range(14, 32)) + bytes(range(127, 256))\n"
+    "\n"
+    "\n"
+    "def words(l):\n"
+    "    return len(WORDS(l.translate(None, OTHER)))\n";
+#else
+static const char lpc_perl_words[] =
+    "\n"
+    "# wc(1)'s words: runs of anything but white space\n"
+    "sub words {\n"
+    "    my $n = () = $_[0] =~ /[^\\t-\\r ]+/g;\n"
+    "    return $n;\n"
+    "}\n";
+
+static const char lpc_python_words[] =
+    "\n"
+    "# wc(1)'s words: runs of anything but white space\n"
+    "WORDS = re.compile(rb'[^\\t-\\r ]+').findall\n"
+    "\n"
+    "\n"
+    "def words(l):\n"
+    "    return len(WORDS(l))\n";
+#endif
+
+/* sort(1) in the C locale, as pcSort.c compares lines. A spec is [tab (undef for
+ * blanks), reverse, stable, keys], and a key [start field, start character, end field
+ * (-1 for the end of the line), end character, b on each, n, f, r]. Lines are sorted
+ * as [their keys, the line, its index].
+ */
+static const char lpc_perl_sort[] =
+    "\n"
+    "# sort(1) in the C locale, as pipecut compares lines\n"
+    "sub skipblanks {\n"
+    "    pos($_[0]) = $_[1];\n"
+    "    $_[0] =~ /\\G[ \\t]*/g;\n"
+    "    return pos($_[0]);\n"
+    "}\n"
+    "\n"
+    "sub skipfield {\n"
+    "    pos($_[0]) = $_[1];\n"
+    "    $_[0] =~ /\\G[ \\t]*[^ \\t]*/g;\n"
+    "    return pos($_[0]);\n"
+    "}\n"
+    "\n"
+    "sub begfield {\n"
+    "    my ($tab, $k, $s) = @_;\n"
+    "    my ($p, $lim, $w) = (0, length($s), $k->[0]);\n"
+    "\n"
+    "    while ($p < $lim && $w) {\n"
+    "        $w--;\n"
+    "        if (defined($tab)) {\n"
+    "            my $i = index($s, $tab, $p);\n"
+    "            $p = $i < 0 ? $lim : $i + 1;\n"
+    "        } else {\n"
+    "            $p = skipfield($s, $p);\n"
+    "        }\n"
+    "    }\n"
+    "    $p = skipblanks($s, $p) if $k->[4];\n"
+    "    return $lim - $p < $k->[1] ? $lim : $p + $k->[1];\n"
+    "}\n"
+    "\n"
+    "sub limfield {\n"
+    "    my ($tab, $k, $s) = @_;\n"
+    "    my ($p, $lim, $w, $c) = (0, length($s), $k->[2], $k->[3]);\n"
+    "\n"
+    "    $w++ if $c == 0;\n"
+    "    while ($p < $lim && $w) {\n"
+    "        $w--;\n"
+    "        if (defined($tab)) {\n"
+    "            my $i = index($s, $tab, $p);\n"
+    "            $p = $i < 0 ? $lim : $i;\n"
+    "            $p++ if $p < $lim && ($w || $c);\n"
+    "        } else {\n"
+    "            $p = skipfield($s, $p);\n"
+    "        }\n"
+    "    }\n"
+    "    if ($c) {\n"
+    "        $p = skipblanks($s, $p) if $k->[5];\n"
+    "        $p = $lim - $p < $c ? $lim : $p + $c;\n"
+    "    }\n"
+    "    return $p;\n"
+    "}\n"
+    "\n"
+    "# A line's keys, ready to compare. sort -n's are [negative, integer, fraction].\n"
+    "sub sortkeys {\n"
+    "    my ($spec, $s) = @_;\n"
+    "    my @keys;\n"
+    "\n"
+    "    for my $k (@{$spec->[3]}) {\n"
+    "        my $t = begfield($spec->[0], $k, $s);\n"
+    "        my $e = $k->[2] < 0 ? length($s) : limfield($spec->[0], $k, $s);\n"
+    "        $e = $t if $e < $t;\n"
+    "        my $v = substr($s, $t, $e - $t);\n"
+    "        if ($k->[6]) {\n"
+    "            $v =~ /^[ \\t]*(-?)0*([0-9]*)(?:\\.([0-9]*))?/;\n"
+    "            my ($neg, $i, $f) = ($1, $2, defined($3) ? $3 : \"\");\n"
+    "            $f =~ s/0+\\z//;\n"
+    "            $v = [$neg ne \"\" && ($i ne \"\" || $f ne \"\") ? 1 : 0, $i, $f];\n"
+    "        } elsif ($k->[7]) {\n"
+    "            $v =~ tr/a-z/A-Z/;\n"
+    "        }\n"
+    "        push(@keys, $v);\n"
+    "    }\n"
+    "    return \\@keys;\n"
+    "}\n"
+    "\n"
+    "sub numcmp {\n"
+    "    my ($x, $y) = @_;\n"
+    "\n"
+    "    return $x->[0] ? -1 : 1 if $x->[0] != $y->[0];\n"
+    "    my $d = length($x->[1]) <=> length($y->[1]) || $x->[1] cmp $y->[1]\n"
+    "        || $x->[2] cmp $y->[2];\n"
+    "    return $x->[0] ? -$d : $d;\n"
+    "}\n"
+    "\n"
+    "sub sortcmp {\n"
+    "    my ($spec, $x, $y) = @_;\n"
+    "    my $keys = $spec->[3];\n"
+    "\n"
+    "    for my $j (0 .. $#$keys) {\n"
+    "        my $k = $keys->[$j];\n"
+    "        my $d = $k->[6] ? numcmp($x->[0][$j], $y->[0][$j])\n"
+    "            : $x->[0][$j] cmp $y->[0][$j];\n"
+    "        return $k->[8] ? -$d : $d if $d;\n"
+    "    }\n"
+    "    if (!$spec->[2]) {\n"
+    "        my $d = $x->[1] cmp $y->[1];\n"
+    "        return $spec->[1] ? -$d : $d if $d;\n"
+    "    }\n"
+    "    return $x->[2] <=> $y->[2];\n"
+    "}\n";
+
+static const char lpc_python_sort[] =
+    "\n"
+    "# sort(1) in the C locale, as pipecut compares lines\n"
+    "NUMBER = re.compile(rb'[ \\t]*(-?)0*([0-9]*)(?:\\.([0-9]*))?').match\n"
+    "\n"
+    "\n"
+    "def skipblanks(s, p, lim):\n"
+    "    while p < lim and s[p] in (32, 9):\n"
+    "        p += 1\n"
+    "    return p\n"
+    "\n"
+    "\n"
+    "def skipfield(s, p, lim):\n"
+    "    p = skipblanks(s, p, lim)\n"
+    "    while p < lim and s[p] not in (32, 9):\n"
+    "        p += 1\n"
+    "    return p\n"
+    "\n"
+    "\n"
+    "def begfield(tab, k, s):\n"
+    "    p, lim, w = 0, len(s), k[0]\n"
+    "    while p < lim and w:\n"
+    "        w -= 1\n"
+    "        if tab is not None:\n"
+    "            i = s.find(tab, p)\n"
+    "            p = lim if i < 0 else i + 1\n"
+    "        else:\n"
+    "            p = skipfield(s, p, lim)\n"
+    "    if k[4]:\n"
+    "        p = skipblanks(s, p, lim)\n"
+    "    return lim if lim - p < k[1] else p + k[1]\n"
+    "\n"
+    "\n"
+    "def limfield(tab, k, s):\n"
+    "    p, lim, w, c = 0, len(s), k[2], k[3]\n"
+    "    if c == 0:\n"
+    "        w += 1\n"
+    "    while p < lim and w:\n"
+    "        w -= 1\n"
+    "        if tab is not None:\n"
+    "            i = s.find(tab, p)\n"
+    "            p = lim if i < 0 else i\n"
+    "            if p < lim and (w or c):\n"
+    "                p += 1\n"
+    "        else:\n"
+    "            p = skipfield(s, p, lim)\n"
+    "    if c:\n"
+    "        if k[5]:\n"
+    "            p = skipblanks(s, p, lim)\n"
+    "        p = lim if lim - p < c else p + c\n"
+    "    return p\n"
+    "\n"
+    "\n"
+    "# A line's keys, ready to compare. sort -n's are (negative, integer, fraction).\n"
+    "def sortkeys(spec, s):\n"
+    "    keys = []\n"
+    "    for k in spec[3]:\n"
+    "        t = begfield(spec[0], k, s)\n"
+    "        e = len(s) if k[2] is None else max(limfield(spec[0], k, s), t)\n"
+    "        v = s[t:e]\n"
+    "        if k[6]:\n"
+    "            m = NUMBER(v)\n"
+    "            i, f = m.group(2), (m.group(3) or b'').rstrip(b'0')\n"
+    "            v = (bool(m.group(1)) and bool(i or f), i, f)\n"
+    "        elif k[7]:\n"
+    "            v = v.upper()\n"
+    "        keys.append(v)\n"
+    "    return keys\n"
+    "\n"
+    "\n"
+    "def cmp(x, y):\n"
+    "    return (x > y) - (x < y)\n"
+    "\n"
+    "\n"
+    "def numcmp(x, y):\n"
+    "    if x[0] != y[0]:\n"
+    "        return -1 if x[0] else 1\n"
+    "    d = cmp(len(x[1]), len(y[1])) or cmp(x[1], y[1]) or cmp(x[2], y[2])\n"
+    "    return -d if x[0] else d\n"
+    "\n"
+    "\n"
+    "def sortcmp(spec, x, y):\n"
+    "    for k, a, b in zip(spec[3], x[0], y[0]):\n"
+    "        d = numcmp(a, b) if k[6] else cmp(a, b)\n"
+    "        if d:\n"
+    "            return -d if k[8] else d\n"
+    "    if not spec[2]:\n"
+    "        d = cmp(x[1], y[1])\n"
+    "        if d:\n"
+    "            return -d if spec[1] else d\n"
+    "    return cmp(x[2], y[2])\n";
+
+/* Writing the script */
+
+/* p as a string literal: "..." for awk and perl, b'...' for python. Anything but
+ * printable ASCII is escaped, and so is a ' in awk, whose program goes to the shell
+ * in single quotes.
+ */
+static void
+lpc_script_str(FILE *out, int lang, const char *p, size_t len)
+{
+    const char *special = lang == LPC_LANG_PERL ? "\"\\$@" : "\"\\";
+    unsigned char c;
+    size_t i;
+
+    if (lang == LPC_LANG_PYTHON)
+	special = "'\\";
+    fputs(lang == LPC_LANG_PYTHON ? "b'" : "\"", out);
+    for (i = 0; i < len; i++) {
+	c = p[i];
+	if (c < ' ' || c > '~' || (c == '\'' && lang == LPC_LANG_AWK))
+	    fprintf(out, lang == LPC_LANG_AWK ? "\\%03o" : "\\x%02x", c);
+	else if (strchr(special, c))
+	    fprintf(out, "\\%c", c);
+	else
+	    fputc(c, out);
+    }
+    fputs(lang == LPC_LANG_PYTHON ? "'" : "\"", out);
+}
+
+// Text for a comment: one line, printable, and no ' in awk
+static void
+lpc_script_comment(FILE *out, int lang, const char *p)
+{
+    for (; *p; p++) {
+	if (*p < ' ' || *p > '~' || (*p == '\'' && lang == LPC_LANG_AWK))
+	    fputc('?', out);
+	else
+	    fputc(*p, out);
+    }
+}
+
+// The blade that step k runs, for a comment
+static void
+lpc_script_steptext(struct lpc_emitter *em, int k)
+{
+    char type[32];
+
+    txtFromType(type, em->steps[k].ttype);
+    fprintf(em->out, "%s ", type);
+    lpc_script_comment(em->out, em->lang, em->steps[k].pattern);
+    fprintf(em->out, "\n");
+}
+
+// A character of a regex that stands for itself, in an awk /regex/
+static void
+lpc_script_awkchar(FILE *out, unsigned char c)
+{
+    if (c == '/')
+	fputs("\\/", out);
+    else if (c < ' ' || c > '~' || c == '\'')
+	fprintf(out, "\\%03o", c);
+    else
+	fputc(c, out);
+}
+
+// A character of a bracket expression
+static void
+lpc_script_setchar(FILE *out, int lang, unsigned char c)
+{
+    if (lang == LPC_LANG_AWK) {
+	if (c == '\\')
+	    fputs("\\\\", out);
+	else
+	    lpc_script_awkchar(out, c);
+    } else if (c < 0x80 && ispunct(c))
+	fprintf(out, "\\%c", c);
+    else
+	fputc(c, out);
+}
+
+// [:name:] in a python bracket expression, which has no classes
+static void
+lpc_script_class(FILE *out, const char *name, size_t len)
+{
+    static const char *classes[][2] = {
+	{"alpha", "a-zA-Z"}, {"digit", "0-9"}, {"alnum", "0-9a-zA-Z"},
+	{"upper", "A-Z"}, {"lower", "a-z"}, {"xdigit", "0-9A-Fa-f"},
+	{"space", "\\ \t-\r"}, {"blank", "\\ \t"},
+	{"punct", "\\!-\\/\\:-\\@\\[-\\`\\{-\\~"}, {"print", "\\ -\\~"},
+	{"graph", "\\!-\\~"}, {"cntrl", "\\x00-\\x1f\\x7f"},
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+	if (strlen(classes[i][0]) == len && !strncmp(name, classes[i][0], len))
+	    fputs(classes[i][1], out);
+    }
+}
+
+/* The bracket expression at p, in lang. Returns the ']' that ends it, or NULL if it
+ * doesn't end.
+ */
+static const char *
+lpc_script_bracket(FILE *out, int lang, const char *p)
+{
+    const char *q = p + 1, *e;
+    int first = 1;
+
+    fputc('[', out);
+    if (*q == '^')
+	fputc(*q++, out);
+    for (; *q && (*q != ']' || first); first = 0) {
+	if (q[0] == '[' && q[1] && strchr(":.=", q[1])) {
+	    for (e = q + 2; *e && !(e[0] == q[1] && e[1] == ']'); e++)
+		;
+	    if (!*e)
+		return NULL;
+	    if (q[1] != ':')	// [.c.] and [=c=]: in the C locale, only c
+		lpc_script_setchar(out, lang, q[2]);
+	    else if (lang == LPC_LANG_PYTHON)
+		lpc_script_class(out, q + 2, e - q - 2);
+	    else
+		fprintf(out, "%.*s", (int)(e + 2 - q), q);
+	    q = e + 2;
+	    continue;
+	}
+	lpc_script_setchar(out, lang, *q);
+	if (q[1] == '-' && q[2] && q[2] != ']') {
+	    fputc('-', out);
+	    lpc_script_setchar(out, lang, q[2]);
+	    q += 2;
+	}
+	q++;
+    }
+    if (!*q)
+	return NULL;
+    fputc(']', out);
+    return q;
+}
+
+// The ']' that ends the bracket expression at p, or NULL if it doesn't end
+static const char *
+lpc_script_bracketend(const char *p)
+{
+    const char *q = p + 1;
+
+    if (*q == '^')
+	q++;
+    if (*q == ']')
+	q++;
+    for (; *q && *q != ']'; q++) {
+	if (q[0] == '[' && q[1] && strchr(":.=", q[1])) {
+	    for (p = q + 2; *p && !(p[0] == q[1] && p[1] == ']'); p++)
+		;
+	    if (!*p)
+		return NULL;
+	    q = p + 1;
+	}
+    }
+    return *q ? q : NULL;
+}
+
+/* 1 if the ERE re can be written for awk. POSIX awk has no back-references, and none
+ * of the GNU escapes that match a place between characters (\< \> \b \B). A pattern
+ * that pipecut takes as a plain string is fine: that's an index().
+ */
+int
+lpc_script_awkre(const char *re)
+{
+    const char *p, *e;
+    char *lit = malloc(strlen(re) + 1);
+    int plain = (lpc_plainstring(re, lit) > 0);
+
+    free(lit);
+    if (plain)
+	return 1;
+    for (p = re; *p; p++) {
+	if (*p == '[' && (e = lpc_script_bracketend(p)))
+	    p = e;
+	else if (*p == '\\' && p[1]) {
+	    p++;
+	    if (strchr("bB<>", *p) || isdigit((unsigned char)*p))
+		return 0;
+	}
+    }
+    return 1;
+}
+
+/* An ERE, as lang's regular expressions have it. They agree on most of it: what
+ * differs is inside brackets, where a '\' is just a '\' in an ERE, and the GNU escapes
+ * (\< \> \w ...), which regcomp() takes. awk gets \w and \s as brackets, and has
+ * lpc_script_awkre() turn away the rest.
+ */
+static void
+lpc_script_re(FILE *out, int lang, const char *re)
+{
+    const char *p, *e;
+
+    for (p = re; *p; p++) {
+	if (*p == '[' && (e = lpc_script_bracket(out, lang, p))) {
+	    p = e;
+	    continue;
+	}
+	if (*p == '{' && p[1] == ',') {	// {,n}
+	    fputs("{0", out);
+	    continue;
+	}
+	if (*p != '\\' || !p[1]) {
+	    if (lang == LPC_LANG_AWK)
+		lpc_script_awkchar(out, *p);
+	    else
+		fputc(*p, out);
+	    continue;
+	}
+	p++;
+	if (lang == LPC_LANG_AWK) {	// POSIX awk: none of the GNU escapes
+	    if (*p == 'w' || *p == 'W')
+		fputs(*p == 'w' ? "[[:alnum:]_]" : "[^[:alnum:]_]", out);
+	    else if (*p == 's' || *p == 'S')
+		fputs(*p == 's' ? "[[:space:]]" : "[^[:space:]]", out);
+	    else if (*p == '`' || *p == '\'')	// The line is the whole buffer
+		fputc(*p == '`' ? '^' : '$', out);
+	    else if (*p == '/')
+		fputs("\\/", out);
+	    else if ((unsigned char)*p < 0x80 && ispunct((unsigned char)*p))
+		fprintf(out, "\\%c", *p);
+	    else
+		lpc_script_awkchar(out, *p);
+	} else if (*p == '<')
+	    fputs("\\b(?=\\w)", out);
+	else if (*p == '>')
+	    fputs("\\b(?<=\\w)", out);
+	else if (*p == '`')
+	    fputs("\\A", out);
+	else if (*p == '\'')
+	    fputs(lang == LPC_LANG_PERL ? "\\z" : "\\Z", out);
+	else if (strchr("wWsSbB", *p) || isdigit((unsigned char)*p)
+	    || ((unsigned char)*p < 0x80 && ispunct((unsigned char)*p)))
+	    fprintf(out, "\\%c", *p);
+	else
+	    fputc(*p, out);	// \n and the like are just the letter to regcomp()
+    }
+}
+
+// The regex for step k, as a string literal for perl or python
+static void
+lpc_script_restr(struct lpc_emitter *em, int k)
+{
+    char *text;
+    size_t len;
+    FILE *fp;
+
+    if (!(fp = open_memstream(&text, &len))) {
+	fprintf(stderr, "Pipecut Error: out of memory\n");
+	exit(-1);
+    }
+    lpc_script_re(fp, em->lang, em->steps[k].pattern);
+    fclose(fp);
+    lpc_script_str(em->out, em->lang, text, len);
+    free(text);
+}
+
+// awk, perl and python printf formats take no 'l'
+static void
+lpc_script_fmt(struct lpc_emitter *em, const char *fmt)
+{
+    char buf[64];
+    char *d = buf;
+
+    for (; *fmt && d < buf + sizeof(buf) - 1; fmt++) {
+	if (*fmt != 'l' || em->lang != LPC_LANG_AWK)
+	    *d++ = *fmt;
+    }
+    lpc_script_str(em->out, em->lang, buf, d - buf);
+}
+
+/* FORMAT: the expression for an output line, parts [i, j) */
+static void
+lpc_script_fmtexpr(struct lpc_emitter *em, struct lpc_format *fmt, int i,
+    int j)
+{
+    static const char *join[] = {" ", " . ", ", "};	// awk, perl, python
+    struct lpc_fmtpart *fp;
+    FILE *out = em->out;
+    int lang = em->lang, n;
+
+    if (i == j) {
+	fputs(lang == LPC_LANG_PYTHON ? "b''" : "\"\"", out);
+	return;
+    }
+    if (lang == LPC_LANG_PYTHON && j - i > 1)
+	fputs("b''.join((", out);
+    for (n = i; n < j; n++) {
+	fp = &fmt->parts[n];
+	if (n > i)
+	    fputs(join[lang - LPC_LANG_AWK], out);
+	if (fp->what == LPC_FMT_TEXT)
+	    lpc_script_str(out, lang, fmt->text + fp->off, fp->len);
+	else if (fp->what == 0)
+	    fputs(lang == LPC_LANG_PERL ? "$l" : "l", out);
+	else if (lang == LPC_LANG_AWK && fp->what == LPC_FMT_NF)
+	    fputs("$NF", out);
+	else if (lang == LPC_LANG_AWK)	// awk is what FORMAT means
+	    fprintf(out, "$%d", fp->what);
+	else if (fp->what == LPC_FMT_NF)
+	    fputs(lang == LPC_LANG_PERL ? "(@f ? $f[-1] : $l)"
+		: "(f[-1] if f else l)", out);
+	else if (lang == LPC_LANG_PERL)
+	    fprintf(out, "($f[%d] // \"\")", fp->what - 1);
+	else
+	    fprintf(out, "(f[%d] if len(f) > %d else b'')", fp->what - 1,
+		fp->what - 1);
+    }
+    if (lang == LPC_LANG_PYTHON && j - i > 1)
+	fputs("))", out);
+}
+
+/* awk */
+
+// s<k>(l): the stage for step k, and e<k>() at the end of input
+static void
+lpc_script_awkstage(struct lpc_emitter *em, int k)
+{
+    struct lpc_estep *sp = &em->steps[k];
+    struct lpc_format *fmt;
+    FILE *out = em->out;
+    char *lit;
+    int i, j, n;
+
+    switch (sp->ttype) {
+    case INCLUDE:
+    case EXCLUDE:
+	fprintf(out, "function s%d(l) {\n", k);
+	if (sp->needre) {
+	    fprintf(out, "    if (l %s /", sp->ttype == INCLUDE ? "!~" : "~");
+	    lpc_script_re(out, em->lang, sp->pattern);
+	    fprintf(out, "/)\n");
+	} else {
+	    lit = malloc(strlen(sp->pattern) + 1);
+	    n = lpc_plainstring(sp->pattern, lit);
+	    fprintf(out, "    if (%sindex(l, ", sp->ttype == INCLUDE ? "!" : "");
+	    lpc_script_str(out, em->lang, lit, n);
+	    fprintf(out, "))\n");
+	    free(lit);
+	}
+	fprintf(out, "        return\n    s%d(l)\n}\n", k + 1);
+	break;
+    case FORMAT:
+	fmt = lpc_format_new(sp->pattern);
+	fprintf(out, "function s%d(l,    o) {\n", k);
+	if (fmt->maxfield)
+	    fprintf(out, "    $0 = l\n");
+	// Each output line, before any goes on: the next stage may set $0
+	for (i = j = n = 0; i <= fmt->nparts; i++) {
+	    if (i < fmt->nparts && fmt->parts[i].what != LPC_FMT_EOL)
+		continue;
+	    fprintf(out, "    o[%d] = ", n++);
+	    lpc_script_fmtexpr(em, fmt, j, i);
+	    fprintf(out, "\n");
+	    j = i + 1;
+	}
+	for (i = 0; i < n; i++)
+	    fprintf(out, "    s%d(o[%d])\n", k + 1, i);
+	fprintf(out, "}\n");
+	lpc_format_free(fmt);
+	break;
+    case UNIQUE:
+	fprintf(out, "function g%d() {\n", k);
+	if (sp->uniq->dups)
+	    fprintf(out, "    if (n%d == 1)\n        return\n", k);
+	if (sp->uniq->uniqs)
+	    fprintf(out, "    if (n%d > 1)\n        return\n", k);
+	if (sp->uniq->count) {
+	    fprintf(out, "    s%d(sprintf(", k + 1);
+	    lpc_script_fmt(em, LPC_UNIQ_FMT);
+	    fprintf(out, ", n%d) u%d)\n}\n\n", k, k);
+	} else
+	    fprintf(out, "    s%d(u%d)\n}\n\n", k + 1, k);
+	fprintf(out, "function s%d(l) {\n"
+	    "    if (n%d && l \"\" == u%d) {\n        n%d++\n        return\n    }\n"
+	    "    if (n%d)\n        g%d()\n    u%d = l \"\"\n    n%d = 1\n}\n\n",
+	    k, k, k, k, k, k, k, k);
+	fprintf(out, "function e%d() {\n    if (done <= %d && n%d)\n"
+	    "        g%d()\n    e%d()\n}\n", k, k + 1, k, k, k + 1);
+	break;
+    case BLACKBOX:
+	if (sp->kind == LPC_SUB_HEAD) {
+	    fprintf(out, "function s%d(l) {\n"
+		"    if (h%d > 0) {\n        h%d--\n        s%d(l)\n    }\n"
+		"    if (h%d == 0 && done < %d)\n        done = %d\n}\n", k, k, k,
+		k + 1, k, k + 1, k + 1);
+	} else {		// wc -l
+	    fprintf(out, "function s%d(l) {\n    c%d++\n}\n\n", k, k);
+	    fprintf(out, "function e%d() {\n    if (done <= %d)\n"
+		"        s%d(sprintf(", k, k + 1, k + 1);
+	    lpc_script_fmt(em, LPC_WCL_FMT);
+	    fprintf(out, ", c%d))\n    e%d()\n}\n", k, k + 1);
+	}
+	break;
+    default:
+	break;
+    }
+    if (sp->ttype != UNIQUE && !(sp->ttype == BLACKBOX
+	    && sp->kind == LPC_SUB_COUNT))
+	fprintf(out, "\nfunction e%d() {\n    e%d()\n}\n", k, k + 1);
+}
+
+/* A sh script around one awk. Its input lines all end up terminated, as every
+ * toolset it runs starts with a blade that terminates them (pcEmit.c).
+ */
+static void
+lpc_script_awk(struct lpc_emitter *em, const char *name)
+{
+    FILE *out = em->out;
+    int k, heads = 0;
+
+    fprintf(out, "#!/bin/sh\n# pipecut toolset ");
+    lpc_script_comment(out, em->lang, name);
+    fprintf(out, ", as a single awk: stdin to stdout, as pipecut -t\n"
+	"# would. Generated by pipecut --emit awk.\n");
+    // Nothing for awk to do. The tail reads a pipe, as it does in the shell pipeline:
+    // wc(1) pads its counts for a pipe, and not for a file.
+    if (em->nsteps == 0) {
+	fprintf(out, "%s%s\n", em->tail[0] ? "cat | " : "exec cat",
+	    em->tail);
+	return;
+    }
+    if (em->tail[0])
+	fprintf(out, "# From blade %d on, the toolset runs in the shell.\n",
+	    em->nsteps);
+    fprintf(out, "%sawk '\n", em->tail[0] ? "" : "exec ");
+    for (k = 0; k < em->nsteps; k++) {
+	if (em->steps[k].ttype == BLACKBOX && em->steps[k].kind == LPC_SUB_HEAD) {
+	    fprintf(out, "%s    h%d = %ld\n", heads++ ? "" : "BEGIN {\n", k,
+		em->steps[k].count);
+	}
+    }
+    if (heads)
+	fprintf(out, "}\n\n");
+    for (k = 0; k < em->nsteps; k++) {
+	fprintf(out, "# %d: ", k);
+	lpc_script_steptext(em, k);
+	lpc_script_awkstage(em, k);
+	fprintf(out, "\n");
+    }
+    fprintf(out, "function s%d(l) {\n    print l\n}\n\n"
+	"function e%d() {\n}\n\n"
+	"{\n    if (done)\n        exit\n    s0($0)\n}\n\n"
+	"END {\n    e0()\n}'", em->nsteps, em->nsteps);
+    if (em->tail[0])
+	fprintf(out, " | %s", em->tail);
+    fprintf(out, "\n");
+}
+
+/* perl and python */
+
+// A sort spec as a perl array or python tuple (see lpc_perl_sort)
+static void
+lpc_script_sortspec(struct lpc_emitter *em, int k)
+{
+    const struct lpc_sortspec *sort = em->steps[k].sort;
+    const struct lpc_sortkey *key;
+    FILE *out = em->out;
+    int py = (em->lang == LPC_LANG_PYTHON), i;
+    char tab;
+
+    fprintf(out, py ? "spec%d = (" : "my $spec%d = [", k);
+    if (sort->tab >= 0) {
+	tab = sort->tab;
+	lpc_script_str(out, em->lang, &tab, 1);
+    } else
+	fputs(py ? "None" : "undef", out);
+    fprintf(out, ", %d, %d, %s", sort->reverse, sort->stable, py ? "(" : "[");
+    for (i = 0; i < sort->nkeys; i++) {
+	key = &sort->keys[i];
+	fprintf(out, "%s%s%zu, %zu, ", i ? ", " : "", py ? "(" : "[",
+	    key->sword, key->schar);
+	if (key->eword == SIZE_MAX)
+	    fputs(py ? "None" : "-1", out);
+	else
+	    fprintf(out, "%zu", key->eword);
+	fprintf(out, ", %zu, %d, %d, %d, %d, %d%s", key->echar,
+	    key->skipsblanks, key->skipeblanks, key->numeric, key->fold,
+	    key->reverse, py ? ")" : "]");
+    }
+    if (py && sort->nkeys == 1)
+	fputs(",", out);
+    fprintf(out, py ? "))\n" : "]];\n");
+}
+
+static void
+lpc_script_perlstage(struct lpc_emitter *em, int k)
+{
+    struct lpc_estep *sp = &em->steps[k];
+    struct lpc_format *fmt;
+    FILE *out = em->out;
+    char *lit;
+    int i, j, n;
+
+    switch (sp->ttype) {
+    case INCLUDE:
+    case EXCLUDE:
+	fprintf(out, "sub s%d {\n", k);
+	if (sp->needre) {
+	    fprintf(out, "    return if $_[0] %s $re%d;\n",
+		sp->ttype == INCLUDE ? "!~" : "=~", k);
+	} else {
+	    lit = malloc(strlen(sp->pattern) + 1);
+	    n = lpc_plainstring(sp->pattern, lit);
+	    fprintf(out, "    return if index($_[0], ");
+	    lpc_script_str(out, em->lang, lit, n);
+	    fprintf(out, ") %s 0;\n", sp->ttype == INCLUDE ? "<" : ">=");
+	    free(lit);
+	}
+	fprintf(out, "    $noeol = 0;\n    s%d($_[0]);\n}\n", k + 1);
+	break;
+    case FORMAT:
+	fmt = lpc_format_new(sp->pattern);
+	fprintf(out, "sub s%d {\n    my ($l) = @_;\n", k);
+	if (fmt->maxfield)
+	    fprintf(out, "    my @f = $l =~ /[^ \\t]+/g;\n");
+	fprintf(out, "\n    $noeol = 0;\n");
+	for (i = j = n = 0; i <= fmt->nparts; i++) {
+	    if (i < fmt->nparts && fmt->parts[i].what != LPC_FMT_EOL)
+		continue;
+	    fprintf(out, "    s%d(", k + 1);
+	    lpc_script_fmtexpr(em, fmt, j, i);
+	    fprintf(out, ");\n");
+	    j = i + 1;
+	}
+	fprintf(out, "}\n");
+	lpc_format_free(fmt);
+	break;
+    case SUMMARIZE:
+	fprintf(out, "my @w%d = (0, 0, 0);	# Lines, words, bytes\n\n"
+	    "sub s%d {\n    $w%d[1] += words($_[0]);\n"
+	    "    $w%d[2] += length($_[0]);\n"
+	    "    unless ($noeol) {		# wc only counts newlines\n"
+	    "        $w%d[0]++;\n        $w%d[2]++;\n    }\n}\n\n", k, k, k, k, k,
+	    k);
+	fprintf(out, "sub e%d {\n    if ($done <= %d) {\n"
+	    "        my $b = sprintf(", k, k + 1);
+	lpc_script_fmt(em, LPC_WC_FMT);
+	fprintf(out, ", @w%d);\n\n        chomp($b);\n        $noeol = 0;\n"
+	    "        s%d($b);\n    }\n    e%d();\n}\n", k, k + 1, k + 1);
+	break;
+    case UNIQUE:
+	fprintf(out, "my ($u%d, $n%d) = (\"\", 0);	# The current group's line, "
+	    "and how many times it came\n\nsub g%d {\n", k, k, k);
+	if (sp->uniq->dups)
+	    fprintf(out, "    return if $n%d == 1;\n", k);
+	if (sp->uniq->uniqs)
+	    fprintf(out, "    return if $n%d > 1;\n", k);
+	fprintf(out, "    $noeol = 0;\n");
+	if (sp->uniq->count) {
+	    fprintf(out, "    s%d(sprintf(", k + 1);
+	    lpc_script_fmt(em, LPC_UNIQ_FMT);
+	    fprintf(out, ", $n%d) . $u%d);\n}\n\n", k, k);
+	} else
+	    fprintf(out, "    s%d($u%d);\n}\n\n", k + 1, k);
+	fprintf(out, "sub s%d {\n"
+	    "    if ($n%d && $_[0] eq $u%d) {\n        $n%d++;\n        return;\n"
+	    "    }\n    g%d() if $n%d;\n    ($u%d, $n%d) = ($_[0], 1);\n}\n\n",
+	    k, k, k, k, k, k, k, k);
+	fprintf(out, "sub e%d {\n    g%d() if $done <= %d && $n%d;\n"
+	    "    e%d();\n}\n", k, k, k + 1, k, k + 1);
+	break;
+    case ORDER:
+	lpc_script_sortspec(em, k);
+	fprintf(out, "my @a%d;\n\nsub s%d {\n"
+	    "    push(@a%d, [sortkeys($spec%d, $_[0]), $_[0], scalar(@a%d)]);\n"
+	    "}\n\n", k, k, k, k, k);
+	fprintf(out, "sub e%d {\n    if ($done <= %d) {\n        $noeol = 0;\n"
+	    "        for my $r (sort { sortcmp($spec%d, $a, $b) } @a%d) {\n"
+	    "            last if $done > %d;\n            s%d($r->[1]);\n"
+	    "        }\n    }\n    e%d();\n}\n", k, k + 1, k, k, k + 1, k + 1,
+	    k + 1);
+	break;
+    case BLACKBOX:
+	if (sp->kind == LPC_SUB_HEAD) {
+	    fprintf(out, "my $h%d = %ld;\n\nsub s%d {\n"
+		"    if ($h%d > 0) {\n        $h%d--;\n        s%d($_[0]);\n    }\n"
+		"    $done = %d if $h%d == 0 && $done < %d;\n}\n", k, sp->count,
+		k, k, k, k + 1, k + 1, k, k + 1);
+	} else {		// wc -l
+	    fprintf(out, "my $c%d = 0;\n\nsub s%d {\n"
+		"    $c%d++ unless $noeol;\n}\n\n", k, k, k);
+	    fprintf(out, "sub e%d {\n    if ($done <= %d) {\n"
+		"        $noeol = 0;\n        s%d(sprintf(", k, k + 1, k + 1);
+	    lpc_script_fmt(em, LPC_WCL_FMT);
+	    fprintf(out, ", $c%d));\n    }\n    e%d();\n}\n", k, k + 1);
+	}
+	break;
+    default:
+	break;
+    }
+    if (sp->ttype == INCLUDE || sp->ttype == EXCLUDE || sp->ttype == FORMAT
+	|| (sp->ttype == BLACKBOX && sp->kind == LPC_SUB_HEAD))
+	fprintf(out, "\nsub e%d {\n    e%d();\n}\n", k, k + 1);
+}
+
+static void
+lpc_script_perl(struct lpc_emitter *em, const char *name)
+{
+    FILE *out = em->out;
+    int k;
+
+    fprintf(out, "#!/usr/bin/env perl\n# pipecut toolset ");
+    lpc_script_comment(out, em->lang, name);
+    fprintf(out, ", as a single perl: stdin to stdout, as pipecut -t\n"
+	"# would. Generated by pipecut --emit perl.\n");
+    if (em->tail[0]) {
+	fprintf(out, "# From blade %d on, the toolset runs in /bin/sh:\n#     ",
+	    em->nsteps);
+	lpc_script_comment(out, em->lang, em->tail);
+	fprintf(out, "\n");
+    }
+    fprintf(out, "use strict;\n\n");
+    if (em->tail[0]) {
+	fprintf(out, "my $TAIL = ");
+	lpc_script_str(out, em->lang, em->tail, strlen(em->tail));
+	fprintf(out, ";\n");
+    }
+    fprintf(out, "my $noeol = 0;		# The line is the input's last, and had no "
+	"\"\\n\"\nmy $done = 0;		# Stages before this one (from 1) want no "
+	"more input\nmy $out = \\*STDOUT;	# Or the shell running the rest\n");
+    for (k = 0; k < em->nsteps; k++) {
+	if (em->steps[k].needre) {
+	    fprintf(out, "my $re%d = ", k);
+	    lpc_script_restr(em, k);
+	    fprintf(out, ";\n$re%d = qr/(?:$re%d)/;\n", k, k);
+	}
+    }
+    if (em->uses & LPC_EUSE_WC)
+	fputs(lpc_perl_words, out);
+    if (em->uses & LPC_EUSE_SORT)
+	fputs(lpc_perl_sort, out);
+    for (k = 0; k < em->nsteps; k++) {
+	fprintf(out, "\n# %d: ", k);
+	lpc_script_steptext(em, k);
+	lpc_script_perlstage(em, k);
+    }
+    fprintf(out, "\n# %d: the output\nsub s%d {\n"
+	"    print {$out} $noeol ? $_[0] : \"$_[0]\\n\"%s;\n}\n\nsub e%d {\n}\n\n",
+	em->nsteps, em->nsteps, em->tail[0] ? " or $done = ~0" : "", em->nsteps);
+    fprintf(out, "binmode(STDIN);\n");
+    // As in the C program, a shell that stops reading stops us, and its status is ours.
+    if (em->tail[0])
+	fprintf(out, "open($out, \"|-\", $TAIL) or die \"$0: could not start "
+	    "$TAIL\\n\";\n$SIG{PIPE} = 'IGNORE';\n");
+    fprintf(out, "binmode($out);\n"
+	"while (!$done && defined(my $l = <STDIN>)) {\n"
+	"    $noeol = 1 unless chomp($l);\n    s0($l);\n}\ne0();\n");
+    if (em->tail[0])
+	fprintf(out, "close($out);\nexit($? & 127 ? 128 + ($? & 127) : $? >> 8);\n");
+    else
+	fprintf(out, "close(STDOUT) or die \"$0: write error: $!\\n\";\n");
+}
+
+// The globals a python stage assigns to
+static void
+lpc_script_global(struct lpc_emitter *em, const char *names)
+{
+    fprintf(em->out, "    global %s\n", names);
+}
+
+static void
+lpc_script_pythonstage(struct lpc_emitter *em, int k)
+{
+    struct lpc_estep *sp = &em->steps[k];
+    struct lpc_format *fmt;
+    FILE *out = em->out;
+    char names[64];
+    char *lit;
+    int i, j, n;
+
+    switch (sp->ttype) {
+    case INCLUDE:
+    case EXCLUDE:
+	fprintf(out, "def s%d(l):\n", k);
+	lpc_script_global(em, "noeol");
+	if (sp->needre) {
+	    fprintf(out, "    if %sre%d.search(l):\n",
+		sp->ttype == INCLUDE ? "not " : "", k);
+	} else {
+	    lit = malloc(strlen(sp->pattern) + 1);
+	    n = lpc_plainstring(sp->pattern, lit);
+	    fprintf(out, "    if ");
+	    lpc_script_str(out, em->lang, lit, n);
+	    fprintf(out, " %sin l:\n", sp->ttype == INCLUDE ? "not " : "");
+	    free(lit);
+	}
+	fprintf(out, "        return\n    noeol = False\n    s%d(l)\n", k + 1);
+	break;
+    case FORMAT:
+	fmt = lpc_format_new(sp->pattern);
+	fprintf(out, "def s%d(l):\n", k);
+	lpc_script_global(em, "noeol");
+	if (fmt->maxfield)
+	    fprintf(out, "    f = FIELDS(l)\n");
+	fprintf(out, "    noeol = False\n");
+	for (i = j = n = 0; i <= fmt->nparts; i++) {
+	    if (i < fmt->nparts && fmt->parts[i].what != LPC_FMT_EOL)
+		continue;
+	    fprintf(out, "    s%d(", k + 1);
+	    lpc_script_fmtexpr(em, fmt, j, i);
+	    fprintf(out, ")\n");
+	    j = i + 1;
+	}
+	lpc_format_free(fmt);
+	break;
+    case SUMMARIZE:
+	fprintf(out, "w%d = [0, 0, 0]  # Lines, words, bytes\n\n\n"
+	    "def s%d(l):\n    w%d[1] += words(l)\n    w%d[2] += len(l)\n"
+	    "    if not noeol:  # wc only counts newlines\n"
+	    "        w%d[0] += 1\n        w%d[2] += 1\n\n\n", k, k, k, k, k, k);
+	fprintf(out, "def e%d():\n", k);
+	lpc_script_global(em, "noeol");
+	fprintf(out, "    if done <= %d:\n        noeol = False\n        s%d((",
+	    k + 1, k + 1);
+	lpc_script_fmt(em, LPC_WC_FMT);
+	fprintf(out, " %% tuple(w%d))[:-1])\n    e%d()\n", k, k + 1);
+	break;
+    case UNIQUE:
+	fprintf(out, "u%d = b''  # The current group's line\n"
+	    "n%d = 0  # How many times it came\n\n\ndef g%d():\n", k, k, k);
+	lpc_script_global(em, "noeol");
+	if (sp->uniq->dups)
+	    fprintf(out, "    if n%d == 1:\n        return\n", k);
+	if (sp->uniq->uniqs)
+	    fprintf(out, "    if n%d > 1:\n        return\n", k);
+	fprintf(out, "    noeol = False\n");
+	if (sp->uniq->count) {
+	    fprintf(out, "    s%d(", k + 1);
+	    lpc_script_fmt(em, LPC_UNIQ_FMT);
+	    fprintf(out, " %% n%d + u%d)\n\n\n", k, k);
+	} else
+	    fprintf(out, "    s%d(u%d)\n\n\n", k + 1, k);
+	fprintf(out, "def s%d(l):\n", k);
+	snprintf(names, sizeof(names), "u%d, n%d", k, k);
+	lpc_script_global(em, names);
+	fprintf(out, "    if n%d and l == u%d:\n        n%d += 1\n        return\n"
+	    "    if n%d:\n        g%d()\n    u%d = l\n    n%d = 1\n\n\n", k, k, k,
+	    k, k, k, k);
+	fprintf(out, "def e%d():\n    if done <= %d and n%d:\n        g%d()\n"
+	    "    e%d()\n", k, k + 1, k, k, k + 1);
+	break;
+    case ORDER:
+	lpc_script_sortspec(em, k);
+	fprintf(out, "a%d = []\n\n\ndef s%d(l):\n"
+	    "    a%d.append((sortkeys(spec%d, l), l, len(a%d)))\n\n\n", k, k, k,
+	    k, k);
+	fprintf(out, "def e%d():\n", k);
+	lpc_script_global(em, "noeol");
+	fprintf(out, "    if done <= %d:\n"
+	    "        a%d.sort(key=cmp_to_key(lambda x, y: sortcmp(spec%d, x, y)))\n"
+	    "        noeol = False\n        for r in a%d:\n"
+	    "            if done > %d:\n                break\n"
+	    "            s%d(r[1])\n    e%d()\n", k + 1, k, k, k, k + 1, k + 1,
+	    k + 1);
+	break;
+    case BLACKBOX:
+	if (sp->kind == LPC_SUB_HEAD) {
+	    fprintf(out, "h%d = %ld\n\n\ndef s%d(l):\n", k, sp->count, k);
+	    snprintf(names, sizeof(names), "h%d, done", k);
+	    lpc_script_global(em, names);
+	    fprintf(out, "    if h%d > 0:\n        h%d -= 1\n        s%d(l)\n"
+		"    if h%d == 0 and done < %d:\n        done = %d\n", k, k, k + 1,
+		k, k + 1, k + 1);
+	} else {		// wc -l
+	    fprintf(out, "c%d = 0\n\n\ndef s%d(l):\n", k, k);
+	    snprintf(names, sizeof(names), "c%d", k);
+	    lpc_script_global(em, names);
+	    fprintf(out, "    if not noeol:\n        c%d += 1\n\n\ndef e%d():\n",
+		k, k);
+	    lpc_script_global(em, "noeol");
+	    fprintf(out, "    if done <= %d:\n        noeol = False\n"
+		"        s%d(", k + 1, k + 1);
+	    lpc_script_fmt(em, LPC_WCL_FMT);
+	    fprintf(out, " %% c%d)\n    e%d()\n", k, k + 1);
+	}
+	break;
+    default:
+	break;
+    }
+    if (sp->ttype == INCLUDE || sp->ttype == EXCLUDE || sp->ttype == FORMAT
+	|| (sp->ttype == BLACKBOX && sp->kind == LPC_SUB_HEAD))
+	fprintf(out, "\n\ndef e%d():\n    e%d()\n", k, k + 1);
+}
+
+static void
+lpc_script_python(struct lpc_emitter *em, const char *name)
+{
+    FILE *out = em->out;
+    const char *ind;
+    int k;
+
+    fprintf(out, "#!/usr/bin/env python3\n# pipecut toolset ");
+    lpc_script_comment(out, em->lang, name);
+    fprintf(out, ", as a single python: stdin to stdout, as pipecut -t\n"
+	"# would. Generated by pipecut --emit python.\n");
+    if (em->tail[0]) {
+	fprintf(out, "# From blade %d on, the toolset runs in /bin/sh:\n#     ",
+	    em->nsteps);
+	lpc_script_comment(out, em->lang, em->tail);
+	fprintf(out, "\n");
+    }
+    fprintf(out, "\nimport re\nimport signal\n");
+    if (em->tail[0])
+	fprintf(out, "import subprocess\n");
+    fprintf(out, "import sys\n");
+    if (em->uses & LPC_EUSE_SORT)
+	fprintf(out, "from functools import cmp_to_key\n");
+    fprintf(out, "\n");
+    if (em->tail[0]) {
+	fprintf(out, "TAIL = ");
+	lpc_script_str(out, em->lang, em->tail, strlen(em->tail));
+	fprintf(out, "\n");
+    }
+    fprintf(out, "noeol = False  # The line is the input's last, and had no "
+	"b'\\n'\ndone = 0  # Stages before this one (from 1) want no more "
+	"input\n");
+    for (k = 0; k < em->nsteps; k++) {
+	if (em->steps[k].needre) {
+	    fprintf(out, "re%d = re.compile(", k);
+	    lpc_script_restr(em, k);
+	    fprintf(out, ")\n");
+	}
+    }
+    if (em->uses & LPC_EUSE_FIELDS)
+	fprintf(out, "FIELDS = re.compile(rb'[^ \\t]+').findall\n");
+    if (em->uses & LPC_EUSE_WC)
+	fputs(lpc_python_words, out);
+    if (em->uses & LPC_EUSE_SORT)
+	fputs(lpc_python_sort, out);
+    for (k = 0; k < em->nsteps; k++) {
+	fprintf(out, "\n\n# %d: ", k);
+	lpc_script_steptext(em, k);
+	lpc_script_pythonstage(em, k);
+    }
+    fprintf(out, "\n\n# %d: the output\ndef s%d(l):\n"
+	"    write(l if noeol else l + b'\\n')\n\n\ndef e%d():\n    pass\n\n\n",
+	em->nsteps, em->nsteps, em->nsteps);
+    /* As in the C program, a shell that stops reading stops us, and its status is
+     * ours. python ignores SIGPIPE, and Popen gives the shell the default back. */
+    if (em->tail[0]) {
+	fprintf(out, "shell = subprocess.Popen(TAIL, shell=True, "
+	    "stdin=subprocess.PIPE)\nout = shell.stdin\nwrite = out.write\n"
+	    "try:\n");
+	ind = "    ";
+    } else {
+	fprintf(out, "signal.signal(signal.SIGPIPE, signal.SIG_DFL)\n"
+	    "out = sys.stdout.buffer\nwrite = out.write\n");
+	ind = "";
+    }
+    fprintf(out, "%sfor l in sys.stdin.buffer:\n"
+	"%s    if done:\n%s        break\n"
+	"%s    if l[-1:] == b'\\n':\n%s        l = l[:-1]\n"
+	"%s    else:\n%s        noeol = True\n%s    s0(l)\n%se0()\n%sout.close()\n",
+	ind, ind, ind, ind, ind, ind, ind, ind, ind, ind);
+    if (em->tail[0])
+	fprintf(out, "except BrokenPipeError:\n    try:\n        out.close()\n"
+	    "    except BrokenPipeError:\n        pass\nrc = shell.wait()\n"
+	    "sys.exit(128 - rc if rc < 0 else rc)\n");
+}
+
+// --emit awk, perl or python
+void
+lpc_script(struct lpc_emitter *em, const char *name)
+{
+    switch (em->lang) {
+    case LPC_LANG_AWK:
+	lpc_script_awk(em, name);
+	break;
+    case LPC_LANG_PERL:
+	lpc_script_perl(em, name);
+	break;
+    default:
+	lpc_script_python(em, name);
+	break;
+    }
+}
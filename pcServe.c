@@ -0,0 +1,687 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Filter server and its clients. See pcServe.h. */
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "pipecut.h"
+#include "pcDB.h"
+#include "pcExec.h"
+#include "pcPct.h"
+#include "pcPlan.h"
+#include "pcServe.h"
+#include "pcShare.h"
+#include "pcSubst.h"
+
+// A toolset, loaded, planned and compiled
+struct lpc_cached {
+    char *name;
+    struct tailhead blades;	// As loaded, for --explain and --state
+    struct lpc_plan plan;
+    struct lpc_pipeline pl;	// The plan, compiled with no -j or -S
+    int compiled;		// pl is (not if a regex is bad: the child reports that)
+};
+
+// A client whose request is being run
+struct lpc_conn {
+    int fd;
+    pid_t pid;			// Its own process group
+    int gone;			// The client hung up, and the child has been told to stop
+};
+
+static struct lpc_cached *lpc_cache[LPC_SERVECACHE];
+static int lpc_ncache;
+static struct lpc_conn lpc_conns[LPC_SERVECONNS];
+static int lpc_nconns;
+static int lpc_listenfd = -1;
+static int lpc_sigpipe[2] = { -1, -1 };	// The signal handler wakes poll() up through this
+static volatile sig_atomic_t lpc_quit;
+
+// Our own connection to ~/.pipecut.db, to see when it changes
+static sqlite3 *lpc_watchdb;
+static dev_t lpc_watchdev;
+static ino_t lpc_watchino;
+static int lpc_watchver;
+
+static void
+lpc_serve_error(const char *what, const char *path)
+{
+    fprintf(stderr, "Pipecut Error: %s %s: %s\n", what, path, strerror(errno));
+    exit(-1);
+}
+
+/* The cache */
+
+static void
+lpc_serve_drop(struct lpc_cached *c)
+{
+    struct toolelement *te;
+
+    while ((te = TAILQ_FIRST(&c->blades))) {
+	TAILQ_REMOVE(&c->blades, te, entries);
+	if ((te->ttype == INCLUDE || te->ttype == EXCLUDE) && te->hasre)
+	    regfree(&te->preg);
+	free(te->pattern);
+	free(te);
+    }
+    if (c->compiled)
+	lpc_release(&c->pl);
+    lpc_plan_free(&c->plan);
+    free(c->name);
+    free(c);
+}
+
+/* Whether ~/.pipecut.db has changed since the last call: another connection committed
+ * to it (PRAGMA data_version), or it's another file now.
+ */
+static int
+lpc_serve_dbchanged()
+{
+    char path[PATH_MAX];
+    const char *home = getenv("HOME");
+    struct stat sb;
+    sqlite3_stmt *st;
+    int changed = 0;
+    int ver = -1;
+
+    snprintf(path, sizeof(path), "%s/.pipecut.db", home ? home : "");
+    if (stat(path, &sb) == -1) {
+	if (lpc_watchdb)
+	    sqlite3_close(lpc_watchdb);
+	lpc_watchdb = NULL;
+	return 1;
+    }
+    if (lpc_watchdb && (sb.st_dev != lpc_watchdev || sb.st_ino != lpc_watchino)) {
+	sqlite3_close(lpc_watchdb);
+	lpc_watchdb = NULL;
+    }
+    if (!lpc_watchdb) {
+	if (sqlite3_open_v2(path, &lpc_watchdb, SQLITE_OPEN_READONLY,
+		NULL) != SQLITE_OK) {
+	    sqlite3_close(lpc_watchdb);
+	    lpc_watchdb = NULL;
+	    return 1;
+	}
+	lpc_watchdev = sb.st_dev;
+	lpc_watchino = sb.st_ino;
+	changed = 1;		// data_version only compares within one connection
+    }
+    if (sqlite3_prepare_v2(lpc_watchdb, "PRAGMA data_version;", -1, &st,
+	    NULL) == SQLITE_OK) {
+	if (sqlite3_step(st) == SQLITE_ROW)
+	    ver = sqlite3_column_int(st, 0);
+	sqlite3_finalize(st);
+    }
+    if (ver != lpc_watchver)
+	changed = 1;
+    lpc_watchver = ver;
+    return changed;
+}
+
+/* Whether every regex lpc_compile() would compile for the blades does. It exits on one
+ * that doesn't, which in the server is for the child to do, and tell its client.
+ */
+static int
+lpc_serve_regexok(struct tailhead *blades)
+{
+    struct toolelement *te;
+    struct lpc_subst sb;
+    regex_t re;
+    int ttype, bad = 0;
+
+    TAILQ_FOREACH(te, blades, entries) {
+	ttype = te->ttype;
+	if (ttype == BLACKBOX) {	// One that stands in for a blade type runs as it
+	    memset(&sb, 0, sizeof(sb));
+	    if (lpc_subst_parse(te->pattern, &sb) == LPC_SUB_BLADE)
+		ttype = sb.ttype;
+	    lpc_subst_free(&sb);
+	}
+	if ((ttype != INCLUDE && ttype != EXCLUDE) || te->hasre)
+	    continue;
+	if (regcomp(&re, te->pattern, REG_EXTENDED))
+	    bad = 1;
+	else
+	    regfree(&re);
+    }
+    return !bad;
+}
+
+/* The toolset called name, loaded, planned and compiled: from the cache, or from the DB. NULL
+ * for several toolsets (a shared scan loads its own), or one that doesn't exist (the
+ * child reports it to the client).
+ */
+static struct lpc_cached *
+lpc_serve_lookup(char *name)
+{
+    struct lpc_cached *c;
+    struct toolelement *te, *next;
+    size_t sortmem = lpc_ctx.sortmem;
+    int i, jobs = lpc_ctx.jobs;
+
+    if (lpc_serve_dbchanged()) {
+	if (lpc_ctx.debug && lpc_ncache)
+	    fprintf(stderr, "pipecut: ~/.pipecut.db changed, dropping %d toolsets\n",
+		lpc_ncache);
+	while (lpc_ncache)
+	    lpc_serve_drop(lpc_cache[--lpc_ncache]);
+    }
+    if (name[0] == '\0' || strchr(name, ','))
+	return NULL;		// -f, or a shared scan
+    for (i = 0; i < lpc_ncache; i++) {
+	if (!strcmp(lpc_cache[i]->name, name))
+	    return lpc_cache[i];
+    }
+    if (!pc_toolsetExists(name))
+	return NULL;
+    if (lpc_ncache == LPC_SERVECACHE) {	// Make room: the oldest goes
+	lpc_serve_drop(lpc_cache[0]);
+	memmove(lpc_cache, lpc_cache + 1, --lpc_ncache * sizeof(lpc_cache[0]));
+    }
+    if (lpc_ctx.debug)
+	fprintf(stderr, "pipecut: loading toolset %s\n", name);
+    c = malloc(sizeof(*c));
+    c->name = strdup(name);
+    TAILQ_INIT(&c->blades);
+    TAILQ_INIT(&head);
+    lpc_ctx.filter = name;
+    lpc_ctx.filtermode = 1;	// Don't compile the regexes yet: a bad one would exit
+    pc_loadToolset(2);		// 2 for filter mode
+    closeDB();
+    lpc_ctx.filtermode = 0;
+    lpc_ctx.filter = NULL;
+    TAILQ_FOREACH_SAFE(te, &head, entries, next) {
+	TAILQ_REMOVE(&head, te, entries);
+	TAILQ_INSERT_TAIL(&c->blades, te, entries);
+    }
+    lpc_plan_build(&c->plan, &c->blades, LPC_PLAN_NATIVE);
+    /* Compiled here, so each child inherits the regexes and the fused matchers through
+     * fork(). The sort stages are sized by -j and -S: a request that gives either
+     * compiles its own copy (the regexes are still only compiled here).
+     */
+    if ((c->compiled = lpc_serve_regexok(&c->plan.blades))) {
+	lpc_ctx.jobs = lpc_ctx.sortmem = 0;
+	lpc_compile(&c->pl, &c->plan.blades);
+	// A fused matcher compiles its regexes when it first needs them
+	TAILQ_FOREACH(te, &c->plan.blades, entries) {
+	    if (te->ttype == INCLUDE || te->ttype == EXCLUDE)
+		lpc_blade_re(te);
+	}
+    }
+    lpc_ctx.jobs = jobs;
+    lpc_ctx.sortmem = sortmem;
+    lpc_cache[lpc_ncache++] = c;
+    return c;
+}
+
+/* Requests */
+
+/* Read a request from a client: its command line into buf, and its descriptors into
+ * fds. Returns the length of the command line, or -1 if it isn't a request.
+ */
+static ssize_t
+lpc_serve_recv(int fd, char *buf, size_t size, int fds[LPC_SERVEFDS])
+{
+    union {
+	struct cmsghdr h;
+	char b[CMSG_SPACE(LPC_SERVEFDS * sizeof(int))];
+    } cm;
+    struct msghdr mh;
+    struct iovec iov;
+    struct cmsghdr *ch;
+    size_t got, hlen = 0, need = 0;
+    ssize_t r;
+    char *nl, *end;
+    int i, nfds = 0;
+
+    for (i = 0; i < LPC_SERVEFDS; i++)
+	fds[i] = -1;
+    memset(&mh, 0, sizeof(mh));
+    iov.iov_base = buf;
+    iov.iov_len = size;
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cm.b;
+    mh.msg_controllen = sizeof(cm.b);
+    r = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+    if (r <= 0)
+	return -1;
+    for (ch = CMSG_FIRSTHDR(&mh); ch; ch = CMSG_NXTHDR(&mh, ch)) {
+	if (ch->cmsg_level != SOL_SOCKET || ch->cmsg_type != SCM_RIGHTS)
+	    continue;
+	nfds = (ch->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	if (nfds > LPC_SERVEFDS)
+	    nfds = LPC_SERVEFDS;
+	memcpy(fds, CMSG_DATA(ch), nfds * sizeof(int));
+    }
+    if (nfds != LPC_SERVEFDS || (mh.msg_flags & MSG_CTRUNC))
+	goto bad;
+
+    // "pipecut serve 1 <length>\n", then the command line
+    got = r;
+    for (;;) {
+	if (!hlen && (nl = memchr(buf, '\n', got))) {
+	    if (strncmp(buf, LPC_SERVEMAGIC " ", sizeof(LPC_SERVEMAGIC)))
+		goto bad;
+	    need = strtoul(buf + sizeof(LPC_SERVEMAGIC), &end, 10);
+	    hlen = nl + 1 - buf;
+	    if (end != nl || need == 0 || need > size - hlen)
+		goto bad;
+	}
+	if (hlen && got >= hlen + need)
+	    break;
+	if (got == size)
+	    goto bad;
+	r = read(fd, buf + got, size - got);
+	if (r <= 0)
+	    goto bad;
+	got += r;
+    }
+    if (got != hlen + need || buf[got - 1] != '\0')
+	goto bad;
+    memmove(buf, buf + hlen, need);
+    return need;
+
+  bad:
+    for (i = 0; i < nfds; i++)
+	close(fds[i]);
+    return -1;
+}
+
+// The child: run the client's command line on its descriptors, as pipecut -t would.
+static void
+lpc_serve_child(struct lpc_cached *c, int fds[LPC_SERVEFDS], int argc,
+    char *argv[])
+{
+    struct toolelement *te, *next;
+    struct lpc_plan plan;
+    int i;
+
+    setpgid(0, 0);
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    close(lpc_listenfd);
+    close(lpc_sigpipe[0]);
+    close(lpc_sigpipe[1]);
+    for (i = 0; i < lpc_nconns; i++)
+	close(lpc_conns[i].fd);
+    for (i = 0; i < 3; i++)
+	dup2(fds[i], i);
+    if (fchdir(fds[3]) == -1) {
+	fprintf(stderr, "Pipecut Error: can't change to the client's directory: %s\n",
+	    strerror(errno));
+	exit(-1);
+    }
+    for (i = 0; i < LPC_SERVEFDS; i++) {
+	if (fds[i] > 2)
+	    close(fds[i]);
+    }
+
+    // The client's options, in place of ours
+    lpc_ctx.debug = lpc_ctx.explain = lpc_ctx.pipelined = lpc_ctx.jobs = 0;
+    lpc_ctx.sortmem = lpc_ctx.jit = 0;
+    lpc_ctx.statefile = lpc_ctx.outdir = lpc_ctx.outputs = NULL;
+    lpc_ctx.serve = lpc_ctx.connect = lpc_ctx.pctfile = lpc_ctx.compile = NULL;
+    lpc_ctx.filter = lpc_ctx.emit = lpc_ctx.bench = NULL;
+    lpc_ctx.files = NULL;
+    lpc_ctx.nfiles = 0;
+#ifdef __GLIBC__
+    optind = 0;
+#else
+    optreset = 1;
+    optind = 1;
+#endif
+    pc_parseargs(argc, argv);
+    lpc_ctx.connect = NULL;
+
+    if (strchr(lpc_ctx.filter, ',')) {
+	lpc_sharerun();		// Several toolsets, over one read of the input
+	exit(0);
+    }
+    TAILQ_INIT(&head);
+    if (lpc_ctx.pctfile) {
+	lpc_pct_load(&plan, lpc_ctx.pctfile);
+	if (lpc_ctx.explain)
+	    lpc_plan_explain(&plan.blades, stdout);
+	else
+	    lpc_filterplan(&plan, NULL);
+	exit(0);
+    }
+    if (!c) {
+	pc_loadToolset(2);	// Reports a missing toolset
+	if (lpc_ctx.explain)
+	    lpc_plan_explain(&head, stdout);
+	else
+	    lpc_filterrun();
+	exit(0);
+    }
+    TAILQ_FOREACH_SAFE(te, &c->blades, entries, next) {
+	TAILQ_REMOVE(&c->blades, te, entries);
+	TAILQ_INSERT_TAIL(&head, te, entries);
+    }
+    if (lpc_ctx.explain)
+	lpc_plan_explain(&head, stdout);
+    else
+	lpc_filterplan(&c->plan, c->compiled && !lpc_ctx.jobs
+	    && !lpc_ctx.sortmem ? &c->pl : NULL);
+    exit(0);
+}
+
+// Take a request, and start a child on it
+static void
+lpc_serve_accept()
+{
+    static char req[LPC_SERVEREQ];
+    struct timeval tv = { LPC_SERVEWAIT, 0 };
+    struct lpc_cached *c;
+    int fds[LPC_SERVEFDS];
+    char **argv;
+    ssize_t len;
+    pid_t pid = -1;
+    int fd, argc, i;
+
+    if ((fd = accept(lpc_listenfd, NULL, NULL)) == -1)
+	return;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if ((len = lpc_serve_recv(fd, req, sizeof(req), fds)) == -1) {
+	if (lpc_ctx.debug)
+	    fprintf(stderr, "pipecut: dropped a bad request\n");
+	close(fd);
+	return;
+    }
+
+    // The toolset name, then the client's argv
+    argc = -1;
+    for (i = 0; i < len; i++)
+	argc += req[i] == '\0';
+    argv = malloc((argc + 1) * sizeof(char *));
+    argv[0] = req + strlen(req) + 1;
+    for (i = 1; i < argc; i++)
+	argv[i] = argv[i - 1] + strlen(argv[i - 1]) + 1;
+    argv[argc] = NULL;
+    if (lpc_ctx.debug)
+	fprintf(stderr, "pipecut: request for %s\n", req);
+
+    c = argc > 0 ? lpc_serve_lookup(req) : NULL;
+    fflush(NULL);
+    if (argc > 0 && (pid = fork()) == 0)
+	lpc_serve_child(c, fds, argc, argv);
+    for (i = 0; i < LPC_SERVEFDS; i++)
+	close(fds[i]);
+    free(argv);
+    if (argc <= 0 || pid == -1) {
+	if (argc > 0)
+	    fprintf(stderr, "Pipecut Error: fork: %s\n", strerror(errno));
+	send(fd, "255\n", 4, MSG_NOSIGNAL);
+	close(fd);
+	return;
+    }
+    setpgid(pid, pid);		// As the child does; whichever runs first
+    lpc_conns[lpc_nconns].fd = fd;
+    lpc_conns[lpc_nconns].pid = pid;
+    lpc_conns[lpc_nconns].gone = 0;
+    lpc_nconns++;
+}
+
+// Tell the clients of finished children how they finished
+static void
+lpc_serve_reap()
+{
+    char msg[32];
+    pid_t pid;
+    int st, i, rc;
+
+    while ((pid = waitpid(-1, &st, WNOHANG)) > 0) {
+	for (i = 0; i < lpc_nconns && lpc_conns[i].pid != pid; i++) ;
+	if (i == lpc_nconns)
+	    continue;
+	rc = WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+	snprintf(msg, sizeof(msg), "%d\n", rc);
+	send(lpc_conns[i].fd, msg, strlen(msg), MSG_NOSIGNAL);
+	close(lpc_conns[i].fd);
+	lpc_conns[i] = lpc_conns[--lpc_nconns];
+    }
+}
+
+static void
+lpc_serve_signal(int sig)
+{
+    int saved = errno;
+    ssize_t r;
+
+    if (sig != SIGCHLD)
+	lpc_quit = 1;
+    r = write(lpc_sigpipe[1], "", 1);
+    (void)r;
+    errno = saved;
+}
+
+static int
+lpc_serve_listen(const char *path)
+{
+    struct sockaddr_un sa;
+    struct stat sb;
+    mode_t mask;
+    int fd, rc;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (strlcpy(sa.sun_path, path, sizeof(sa.sun_path)) >= sizeof(sa.sun_path)) {
+	fprintf(stderr, "Pipecut Error: socket path too long: %s\n", path);
+	exit(-1);
+    }
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+	lpc_serve_error("can't create a socket for", path);
+
+    // A socket left behind by a server that's gone is reused; a live one isn't.
+    if (lstat(path, &sb) == 0) {
+	if (!S_ISSOCK(sb.st_mode)) {
+	    fprintf(stderr, "Pipecut Error: %s exists, and isn't a socket\n",
+		path);
+	    exit(-1);
+	}
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0) {
+	    fprintf(stderr, "Pipecut Error: already serving on %s\n", path);
+	    exit(-1);
+	}
+	close(fd);
+	unlink(path);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+	    lpc_serve_error("can't create a socket for", path);
+    }
+    mask = umask(077);		// Only we get to run filters as us
+    rc = bind(fd, (struct sockaddr *)&sa, sizeof(sa));
+    umask(mask);
+    if (rc == -1 || listen(fd, LPC_SERVECONNS) == -1)
+	lpc_serve_error("can't listen on", path);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+// --serve: take requests on the socket at path until we're told to stop
+void
+lpc_serve(const char *path)
+{
+    struct pollfd pfd[LPC_SERVECONNS + 2];
+    char drain[64];
+    int n, i;
+
+    lpc_listenfd = lpc_serve_listen(path);
+    if (pipe(lpc_sigpipe) == -1)
+	lpc_serve_error("can't make a pipe for", path);
+    for (i = 0; i < 2; i++) {
+	fcntl(lpc_sigpipe[i], F_SETFD, FD_CLOEXEC);
+	fcntl(lpc_sigpipe[i], F_SETFL, O_NONBLOCK);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGCHLD, lpc_serve_signal);
+    signal(SIGTERM, lpc_serve_signal);
+    signal(SIGINT, lpc_serve_signal);
+    if (lpc_ctx.debug)
+	fprintf(stderr, "pipecut: serving on %s\n", path);
+
+    while (!lpc_quit) {
+	pfd[0].fd = lpc_sigpipe[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd = lpc_nconns < LPC_SERVECONNS ? lpc_listenfd : -1;
+	pfd[1].events = POLLIN;
+	for (i = 0; i < lpc_nconns; i++) {	// A client only sends its request
+	    pfd[i + 2].fd = lpc_conns[i].gone ? -1 : lpc_conns[i].fd;
+	    pfd[i + 2].events = POLLIN;
+	}
+	n = lpc_nconns;
+	if (poll(pfd, n + 2, -1) == -1) {
+	    if (errno == EINTR)
+		continue;
+	    lpc_serve_error("poll failed on", path);
+	}
+	for (i = 0; i < n; i++) {	// so anything more means it hung up
+	    if (pfd[i + 2].revents) {
+		if (lpc_ctx.debug)
+		    fprintf(stderr, "pipecut: client gone, stopping %d\n",
+			(int)lpc_conns[i].pid);
+		kill(-lpc_conns[i].pid, SIGTERM);
+		lpc_conns[i].gone = 1;
+	    }
+	}
+	if (pfd[0].revents) {
+	    while (read(lpc_sigpipe[0], drain, sizeof(drain)) > 0) ;
+	    lpc_serve_reap();
+	}
+	if (!lpc_quit && (pfd[1].revents & POLLIN))
+	    lpc_serve_accept();
+    }
+
+    for (i = 0; i < lpc_nconns; i++)
+	kill(-lpc_conns[i].pid, SIGTERM);
+    unlink(path);
+    exit(0);
+}
+
+/* The client */
+
+// --connect: hand our command line and descriptors to the server, and wait for it to finish
+int
+lpc_connect(const char *path, int argc, char *argv[])
+{
+    static char req[LPC_SERVEREQ + 64];
+    union {
+	struct cmsghdr h;
+	char b[CMSG_SPACE(LPC_SERVEFDS * sizeof(int))];
+    } cm;
+    struct sockaddr_un sa;
+    struct msghdr mh;
+    struct iovec iov;
+    struct cmsghdr *ch;
+    int fds[LPC_SERVEFDS];
+    char reply[32];
+    size_t len, hlen, sent;
+    ssize_t r;
+    int fd, i;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (strlcpy(sa.sun_path, path, sizeof(sa.sun_path)) >= sizeof(sa.sun_path)) {
+	fprintf(stderr, "Pipecut Error: socket path too long: %s\n", path);
+	exit(-1);
+    }
+
+    // The toolset name, then our argv, each NUL terminated
+    len = strlen(lpc_ctx.filter) + 1;
+    for (i = 0; i < argc; i++)
+	len += strlen(argv[i]) + 1;
+    if (len > LPC_SERVEREQ) {
+	fprintf(stderr, "Pipecut Error: command line too long for %s\n", path);
+	exit(-1);
+    }
+    hlen = snprintf(req, sizeof(req), LPC_SERVEMAGIC " %zu\n", len);
+    len = hlen;
+    memcpy(req + len, lpc_ctx.filter, strlen(lpc_ctx.filter) + 1);
+    len += strlen(lpc_ctx.filter) + 1;
+    for (i = 0; i < argc; i++) {
+	memcpy(req + len, argv[i], strlen(argv[i]) + 1);
+	len += strlen(argv[i]) + 1;
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+	lpc_serve_error("can't create a socket for", path);
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1)
+	lpc_serve_error("can't connect to", path);
+    fds[0] = 0;
+    fds[1] = 1;
+    fds[2] = 2;
+    if ((fds[3] = open(".", O_RDONLY | O_DIRECTORY)) == -1)
+	lpc_serve_error("can't open", ".");
+
+    memset(&mh, 0, sizeof(mh));
+    iov.iov_base = req;
+    iov.iov_len = len;
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cm.b;
+    mh.msg_controllen = sizeof(cm.b);
+    ch = CMSG_FIRSTHDR(&mh);
+    ch->cmsg_level = SOL_SOCKET;
+    ch->cmsg_type = SCM_RIGHTS;
+    ch->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(ch), fds, sizeof(fds));
+    if ((r = sendmsg(fd, &mh, MSG_NOSIGNAL)) == -1)
+	lpc_serve_error("can't send the request to", path);
+    for (sent = r; sent < len; sent += r) {
+	if ((r = send(fd, req + sent, len - sent, MSG_NOSIGNAL)) == -1)
+	    lpc_serve_error("can't send the request to", path);
+    }
+    close(fds[3]);
+
+    // The server answers with the exit status when the filter is done
+    len = 0;
+    while (len < sizeof(reply) - 1 && !memchr(reply, '\n', len)) {
+	if ((r = read(fd, reply + len, sizeof(reply) - 1 - len)) == -1
+	    && errno == EINTR)
+	    continue;
+	if (r <= 0)
+	    break;
+	len += r;
+    }
+    close(fd);
+    if (!memchr(reply, '\n', len)) {
+	fprintf(stderr, "Pipecut Error: the server on %s went away\n", path);
+	return 255;
+    }
+    reply[len] = '\0';
+    return atoi(reply);
+}
@@ -0,0 +1,62 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Filter server (--serve SOCKET) and its clients (--connect SOCKET).
+ *
+ * A pipecut -t that filters a few lines spends most of its time getting started:
+ * opening the database, checking its schema, loading the toolset and compiling its
+ * regular expressions. A server does that once per toolset and keeps the result:
+ * the blades, the plan, and the plan compiled (regexes, fused matchers), which each
+ * child inherits through fork(). It's dropped when ~/.pipecut.db changes.
+ *
+ * A client connects to the server's Unix socket and sends its command line, its
+ * stdin, stdout and stderr, and its working directory, as file descriptors. The server
+ * forks, and the child runs the filter straight on the client's descriptors, so a
+ * regular file is still mapped rather than copied through the socket, -j still splits
+ * it, and relative paths (files, -O, -o, --state) mean what they do for the client.
+ * When the child is done, the server sends the client its exit status. A client that
+ * goes away (^C) takes its child with it.
+ */
+
+#ifndef PCSERVE_H
+#define PCSERVE_H
+
+#define LPC_SERVEMAGIC "pipecut serve 1"
+#define LPC_SERVEREQ (64 * 1024)	// Largest request: the client's command line
+#define LPC_SERVECONNS 64		// Requests being run at once
+#define LPC_SERVECACHE 32		// Toolsets kept loaded
+#define LPC_SERVEFDS 4			// stdin, stdout, stderr and the working directory
+#define LPC_SERVEWAIT 5			// Seconds a client gets to send its request
+
+void lpc_serve(const char *path) __attribute__ ((noreturn));
+int lpc_connect(const char *path, int argc, char *argv[]);
+
+#endif
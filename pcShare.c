@@ -0,0 +1,422 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Shared scans of several toolsets. See pcShare.h. */
+
+#include "pipecut.h"
+#include "pcExec.h"
+#include "pcPlan.h"
+#include "pcShare.h"
+
+// A run of blades common to every toolset under it
+struct lpc_snode {
+    struct lpc_plan seg;	// Only the blades are used
+    struct lpc_pipeline pl;
+    struct lpc_snode *kids[LPC_SHAREMAX];
+    int nkids;
+    int outs[LPC_SHAREMAX];	// Toolsets that end here
+    int nouts;
+    int stopped;		// The stages need no more input (head -n)
+    struct lpc_batch copy;	// Lines fanned out to us, when we can't have the parent's batch
+    struct lpc_batch flush;
+};
+
+struct lpc_share {
+    int n;
+    char *names[LPC_SHAREMAX];
+    char *paths[LPC_SHAREMAX];	// -o, "-" for stdout
+    struct lpc_plan plans[LPC_SHAREMAX];
+    struct toolelement **blades[LPC_SHAREMAX];	// Each plan's blades, less the source
+    int nblades[LPC_SHAREMAX];
+    FILE *out[LPC_SHAREMAX];
+    FILE *dst[LPC_SHAREMAX];	// out, or the pipe to a shell tail writing to it
+    pid_t pid[LPC_SHAREMAX];
+    int gone[LPC_SHAREMAX];	// Nobody reads the output any more
+    struct lpc_snode *root;
+};
+
+/* Building the tree */
+
+// Whether a run of blades can be shared: it's native, so no shell tail starts in it.
+static int
+lpc_share_native(struct toolelement *te)
+{
+    struct lpc_stage st;
+
+    if (te->ttype == BLACKBOX || !lpc_blade_stage(&st, te))
+	return 0;
+    lpc_stage_free(&st);
+    return 1;
+}
+
+static int
+lpc_share_same(struct toolelement *a, struct toolelement *b)
+{
+    return a->ttype == b->ttype && !strcmp(a->pattern, b->pattern)
+	&& lpc_share_native(a);
+}
+
+/* The node for the toolsets in set, whose first 'depth' blades are already done by the
+ * nodes above. It takes the blades they all have next, then splits them up by the
+ * blade that follows.
+ */
+static struct lpc_snode *
+lpc_share_build(struct lpc_share *sh, int *set, int nset, int depth)
+{
+    struct lpc_snode *node;
+    struct toolelement *te;
+    int left[LPC_SHAREMAX], sub[LPC_SHAREMAX];
+    int first = set[0], len, nleft = 0, nsub, i, j;
+
+    node = calloc(1, sizeof(struct lpc_snode));
+    TAILQ_INIT(&node->seg.blades);
+    for (len = 0; depth + len < sh->nblades[first]; len++) {
+	te = sh->blades[first][depth + len];
+	for (i = 1; i < nset; i++)
+	    if (depth + len >= sh->nblades[set[i]]
+		|| !lpc_share_same(te, sh->blades[set[i]][depth + len]))
+		break;
+	if (i < nset)
+	    break;
+    }
+    for (i = 0; i < len; i++) {	// The first toolset's copy of the blades becomes ours
+	te = sh->blades[first][depth + i];
+	TAILQ_REMOVE(&sh->plans[first].blades, te, entries);
+	TAILQ_INSERT_TAIL(&node->seg.blades, te, entries);
+    }
+    if (lpc_ctx.debug && nset > 1 && len > 0)
+	fprintf(stderr, "pipecut: %d blade(s) run once for %d toolsets\n",
+	    len, nset);
+    depth += len;
+
+    for (i = 0; i < nset; i++) {
+	if (depth >= sh->nblades[set[i]])
+	    node->outs[node->nouts++] = set[i];
+	else
+	    left[nleft++] = set[i];
+    }
+    while (nleft > 0) {		// Group the rest by their next blade
+	te = sh->blades[left[0]][depth];
+	sub[0] = left[0];
+	nsub = 1;
+	for (i = 1, j = 0; i < nleft; i++) {
+	    if (lpc_share_same(te, sh->blades[left[i]][depth]))
+		sub[nsub++] = left[i];
+	    else
+		left[j++] = left[i];
+	}
+	nleft = j;
+	node->kids[node->nkids++] = lpc_share_build(sh, sub, nsub, depth);
+    }
+    lpc_compile(&node->pl, &node->seg.blades);
+    lpc_batch_init(&node->copy);
+    lpc_batch_init(&node->flush);
+    return node;
+}
+
+static void
+lpc_share_free(struct lpc_snode *node)
+{
+    int i;
+
+    for (i = 0; i < node->nkids; i++)
+	lpc_share_free(node->kids[i]);
+    lpc_release(&node->pl);
+    lpc_plan_free(&node->seg);
+    lpc_batch_free(&node->copy);
+    lpc_batch_free(&node->flush);
+    free(node);
+}
+
+// --explain: the tree, one node a line
+static void
+lpc_share_print(struct lpc_share *sh, struct lpc_snode *node, int depth,
+    FILE *out)
+{
+    char text[BLADECACHE];
+    int i;
+
+    lpc_plan_text(&node->seg.blades, text, sizeof(text));
+    fprintf(out, "  %*s%s", depth * 2, "", text[0] ? text : "(input)");
+    for (i = 0; i < node->nouts; i++)
+	fprintf(out, "%s%s", i ? ", " : "  -> ", sh->names[node->outs[i]]);
+    fprintf(out, "\n");
+    for (i = 0; i < node->nkids; i++)
+	lpc_share_print(sh, node->kids[i], depth + 1, out);
+}
+
+/* Running the tree */
+
+// Whether anything under node still wants input
+static int
+lpc_share_wants(struct lpc_share *sh, struct lpc_snode *node)
+{
+    int i;
+
+    if (node->stopped)
+	return 0;
+    for (i = 0; i < node->nouts; i++)
+	if (!sh->gone[node->outs[i]])
+	    return 1;
+    for (i = 0; i < node->nkids; i++)
+	if (lpc_share_wants(sh, node->kids[i]))
+	    return 1;
+    return 0;
+}
+
+static void lpc_share_feed(struct lpc_share *sh, struct lpc_snode *node,
+    struct lpc_batch *b);
+
+/* Hand what node's stages made of a batch on: to the toolsets that end here, and to
+ * every node below. The last of those may have the batch itself; the others get a
+ * copy of its lines.
+ */
+static void
+lpc_share_deliver(struct lpc_share *sh, struct lpc_snode *node,
+    struct lpc_batch *b)
+{
+    struct lpc_snode *kid;
+    int i, k, t;
+
+    for (i = 0; i < node->nouts; i++) {
+	t = node->outs[i];
+	if (sh->gone[t] || lpc_batch_write(b, sh->dst[t]) == 0)
+	    continue;
+	if (!lpc_output_gone(sh->dst[t])) {
+	    fprintf(stderr, "Pipecut Error: could not write %s: %s\n",
+		sh->paths[t], strerror(errno));
+	    exit(-1);
+	}
+	sh->gone[t] = 1;
+    }
+    for (k = 0; k < node->nkids; k++) {
+	kid = node->kids[k];
+	if (!lpc_share_wants(sh, kid))
+	    continue;
+	if (k == node->nkids - 1) {
+	    lpc_share_feed(sh, kid, b);
+	    continue;
+	}
+	lpc_batch_clear(&kid->copy);
+	for (i = 0; i < b->nlines; i++)
+	    lpc_batch_addline(&kid->copy, b->lines[i].p, b->lines[i].len);
+	kid->copy.noeol = b->noeol;
+	lpc_share_feed(sh, kid, &kid->copy);
+    }
+}
+
+static void
+lpc_share_feed(struct lpc_share *sh, struct lpc_snode *node,
+    struct lpc_batch *b)
+{
+    if (lpc_runstages(&node->pl, 0, b) == LPC_DONE)
+	node->stopped = 1;
+    lpc_share_deliver(sh, node, b);
+}
+
+// End of input: flush node's stages, as lpc_flushstages() does, then the nodes below.
+static void
+lpc_share_finish(struct lpc_share *sh, struct lpc_snode *node)
+{
+    struct lpc_pipeline *pl = &node->pl;
+    int i, rc;
+
+    for (i = 0; i < pl->nstages; i++) {
+	if (!pl->stages[i].flush || i + 1 < pl->done)
+	    continue;
+	do {
+	    lpc_batch_clear(&node->flush);
+	    rc = pl->stages[i].flush(&pl->stages[i], &node->flush);
+	    lpc_runstages(pl, i + 1, &node->flush);
+	    lpc_share_deliver(sh, node, &node->flush);
+	} while (rc == LPC_MORE && i + 1 >= pl->done);
+    }
+    for (i = 0; i < node->nkids; i++)
+	lpc_share_finish(sh, node->kids[i]);
+}
+
+// Start the shell tails, in the nodes (always leaves) that have one.
+static void
+lpc_share_tails(struct lpc_share *sh, struct lpc_snode *node)
+{
+    int i, t;
+
+    for (i = 0; i < node->nkids; i++)
+	lpc_share_tails(sh, node->kids[i]);
+    if (node->pl.tail[0] == '\0')
+	return;
+    t = node->outs[0];
+    if (lpc_ctx.debug)
+	fprintf(stderr, "Handing off to the shell: %s\n", node->pl.tail);
+    fflush(sh->out[t]);
+    if (!(sh->dst[t] = lpc_shell_to(node->pl.tail, fileno(sh->out[t]),
+		&sh->pid[t]))) {
+	fprintf(stderr, "Pipecut Error: could not start %s\n", node->pl.tail);
+	exit(-1);
+    }
+}
+
+/* Setting up */
+
+// Split a comma separated list in place
+static int
+lpc_share_split(char *list, char **v, const char *what)
+{
+    char *cp;
+    int n = 0;
+
+    while ((cp = strsep(&list, ",")) != NULL) {
+	if (n == LPC_SHAREMAX) {
+	    fprintf(stderr, "Pipecut Error: more than %d %s\n", LPC_SHAREMAX,
+		what);
+	    exit(-1);
+	}
+	v[n++] = cp;
+    }
+    return n;
+}
+
+// Load toolset i, and plan it. The toolset itself isn't needed after that.
+static void
+lpc_share_load(struct lpc_share *sh, int i)
+{
+    struct toolelement *te, *next;
+    int n = 0;
+
+    TAILQ_INIT(&head);
+    lpc_ctx.filter = sh->names[i];
+    pc_loadToolset(2);		// 2 for filter mode
+    if (lpc_ctx.explain)
+	lpc_plan_explain(&head, stdout);
+    lpc_plan_build(&sh->plans[i], &head, LPC_PLAN_NATIVE);
+    TAILQ_FOREACH_SAFE(te, &head, entries, next) {
+	TAILQ_REMOVE(&head, te, entries);
+	free(te->pattern);
+	free(te);
+    }
+
+    TAILQ_FOREACH(te, &sh->plans[i].blades, entries) {
+	n++;
+    }
+    sh->blades[i] = calloc(n + 1, sizeof(struct toolelement *));
+    TAILQ_FOREACH(te, &sh->plans[i].blades, entries) {
+	if (te->ttype != STDIN && te->ttype != CAT && te->ttype != TNONE)
+	    sh->blades[i][sh->nblades[i]++] = te;
+    }
+}
+
+static void
+lpc_share_open(struct lpc_share *sh, int i)
+{
+    int j;
+
+    for (j = 0; j < i; j++) {
+	if (!strcmp(sh->paths[i], sh->paths[j])) {
+	    fprintf(stderr, "Pipecut Error: %s and %s both write to %s\n",
+		sh->names[j], sh->names[i], sh->paths[i]);
+	    exit(-1);
+	}
+    }
+    if (!strcmp(sh->paths[i], "-"))
+	sh->out[i] = stdout;
+    else if (!(sh->out[i] = fopen(sh->paths[i], "w"))) {
+	fprintf(stderr, "Pipecut Error: could not write %s: %s\n",
+	    sh->paths[i], strerror(errno));
+	exit(-1);
+    }
+    sh->dst[i] = sh->out[i];
+}
+
+/* Filter mode with several toolsets (-t a,b,c): read the input once, and write what
+ * each toolset makes of it to its -o file.
+ */
+void
+lpc_sharerun()
+{
+    struct lpc_share *sh;
+    struct lpc_reader rd;
+    struct lpc_batch b;
+    int set[LPC_SHAREMAX], i, status;
+
+    sh = calloc(1, sizeof(struct lpc_share));
+    sh->n = lpc_share_split(strdup(lpc_ctx.filter), sh->names, "toolsets");
+    if (!lpc_ctx.explain && (!lpc_ctx.outputs
+	    || lpc_share_split(strdup(lpc_ctx.outputs), sh->paths,
+		"outputs") != sh->n)) {
+	fprintf(stderr, "Pipecut Error: -o needs one output for each of the "
+	    "%d toolsets\n", sh->n);
+	exit(-1);
+    }
+    for (i = 0; i < sh->n; i++) {
+	lpc_share_load(sh, i);
+	set[i] = i;
+    }
+    sh->root = lpc_share_build(sh, set, sh->n, 0);
+    if (lpc_ctx.explain) {
+	fprintf(stdout, "Shared scan:\n");
+	lpc_share_print(sh, sh->root, 0, stdout);
+	return;
+    }
+    for (i = 0; i < sh->n; i++)
+	lpc_share_open(sh, i);
+    if (lpc_ctx.nfiles == 1)
+	lpc_filterfile(lpc_ctx.files[0], NULL);
+    signal(SIGPIPE, SIG_IGN);
+    lpc_share_tails(sh, sh->root);
+
+    lpc_reader_init(&rd, fileno(stdin));
+    lpc_batch_init(&b);
+    while (lpc_share_wants(sh, sh->root) && lpc_reader_next(&rd, &b))
+	lpc_share_feed(sh, sh->root, &b);
+    lpc_share_finish(sh, sh->root);
+    lpc_batch_free(&b);
+    lpc_reader_free(&rd);
+
+    for (i = 0; i < sh->n; i++) {
+	if (sh->dst[i] != sh->out[i]) {
+	    fclose(sh->dst[i]);
+	    while (waitpid(sh->pid[i], &status, 0) < 0 && errno == EINTR)
+		;
+	}
+	if ((sh->out[i] == stdout ? fflush(stdout) : fclose(sh->out[i])) == EOF
+	    && !sh->gone[i]) {
+	    fprintf(stderr, "Pipecut Error: could not write %s: %s\n",
+		sh->paths[i], strerror(errno));
+	    exit(-1);
+	}
+    }
+    lpc_share_free(sh->root);
+    for (i = 0; i < sh->n; i++) {
+	lpc_plan_free(&sh->plans[i]);
+	free(sh->blades[i]);
+    }
+    free(sh);
+}
@@ -0,0 +1,1362 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Native sort(1). See pcSort.h. */
+
+#include "pipecut.h"
+#include "pcExec.h"
+#include "pcScan.h"
+#include "pcSort.h"
+
+#define LPC_SORTBLOCK (1024 * 1024)	// Arena block for the run in memory
+#define LPC_SORTMIN 16384		// Fewer lines than this per thread aren't worth a thread
+#define LPC_ISBLANK(c) ((c) == ' ' || (c) == '\t')
+#define LPC_ISDIGIT(c) ((unsigned)((c) - '0') < 10)
+
+static void *
+lpc_sort_realloc(void *p, size_t n)
+{
+    if (!(p = realloc(p, n ? n : 1))) {
+	fprintf(stderr, "Pipecut Error: out of memory\n");
+	exit(-1);
+    }
+    return p;
+}
+
+/* Options */
+
+// Sorting natively is only right where sort(1) collates bytes.
+int
+lpc_sort_clocale()
+{
+    const char *l;
+
+    if (!(l = getenv("LC_ALL")) || !*l)
+	if (!(l = getenv("LC_COLLATE")) || !*l)
+	    l = getenv("LANG");
+    return !l || !*l || !strcmp(l, "C") || !strcmp(l, "POSIX")
+	|| !strncmp(l, "C.", 2);
+}
+
+/* Split the blade's options into words, the way /bin/sh would. Returns 0 for
+ * anything needing more of a shell than quotes (redirections, expansions, ...).
+ * BLACKBOX commands are split with this too (pcSubst.c).
+ */
+int
+lpc_sort_words(const char *s, char *buf, char **argv, int max)
+{
+    int argc = 0, quote;
+
+    while (*s) {
+	if (isspace((unsigned char)*s)) {
+	    s++;
+	    continue;
+	}
+	if (argc == max)
+	    return 0;
+	argv[argc++] = buf;
+	while (*s && !isspace((unsigned char)*s)) {
+	    if (*s == '\'' || *s == '"') {
+		quote = *s++;
+		while (*s && *s != quote) {
+		    if (quote == '"' && *s == '\\' && s[1]
+			&& strchr("\"\\$`", s[1]))
+			s++;
+		    else if (quote == '"' && (*s == '$' || *s == '`'))
+			return 0;
+		    *buf++ = *s++;
+		}
+		if (!*s)
+		    return 0;
+		s++;
+	    } else if (*s == '\\' && s[1]) {
+		*buf++ = s[1];
+		s += 2;
+	    } else if (strchr("|&;<>()$`*?[#~{", *s)) {
+		return 0;
+	    } else {
+		*buf++ = *s++;
+	    }
+	}
+	*buf++ = '\0';
+    }
+    argv[argc] = NULL;
+    return argc + 1;
+}
+
+// Field and character counts in -k. Returns NULL if there isn't one.
+static const char *
+lpc_sort_count(const char *s, size_t *v)
+{
+    if (!LPC_ISDIGIT(*s))
+	return NULL;
+    for (*v = 0; LPC_ISDIGIT(*s); s++) {
+	if (*v > (SIZE_MAX - 9) / 10)
+	    return NULL;
+	*v = *v * 10 + (*s - '0');
+    }
+    return s;
+}
+
+// The letters after a position in -k. Returns NULL on one we don't implement.
+static const char *
+lpc_sort_ordering(const char *s, struct lpc_sortkey *k, int end)
+{
+    for (;; s++) {
+	switch (*s) {
+	case 'b':
+	    if (end)
+		k->skipeblanks = 1;
+	    else
+		k->skipsblanks = 1;
+	    break;
+	case 'f':
+	    k->fold = 1;
+	    break;
+	case 'n':
+	    k->numeric = 1;
+	    break;
+	case 'r':
+	    k->reverse = 1;
+	    break;
+	default:
+	    return s;
+	}
+    }
+}
+
+// -k POS1[,POS2]. Returns 0 if sort(1) would refuse it, or we can't do it.
+static int
+lpc_sort_keyspec(struct lpc_sortkey *k, const char *s)
+{
+    memset(k, 0, sizeof(struct lpc_sortkey));
+    if (!(s = lpc_sort_count(s, &k->sword)) || !k->sword--)
+	return 0;
+    if (*s == '.' && (!(s = lpc_sort_count(s + 1, &k->schar))
+	    || !k->schar--))
+	return 0;
+    s = lpc_sort_ordering(s, k, 0);
+    k->eword = SIZE_MAX;
+    if (*s == ',') {
+	if (!(s = lpc_sort_count(s + 1, &k->eword)) || !k->eword--)
+	    return 0;
+	if (*s == '.' && !(s = lpc_sort_count(s + 1, &k->echar)))
+	    return 0;
+	s = lpc_sort_ordering(s, k, 1);
+    }
+    return *s == '\0';
+}
+
+// A key with no ordering options of its own takes the global ones (as in sort(1)).
+static int
+lpc_sort_plainkey(const struct lpc_sortkey *k)
+{
+    return !(k->skipsblanks || k->skipeblanks || k->numeric || k->fold
+	|| k->reverse);
+}
+
+/* Compile the options of an ORDER blade (-n -r -b -f -s -t X -k POS1[,POS2]).
+ * Returns 0 if there's anything else in there, and the blade should go to sort(1).
+ */
+int
+lpc_sortspec_parse(struct lpc_sortspec *sp, const char *flags)
+{
+    struct lpc_sortkey g, *k;
+    char *buf, *argv[64], *cp;
+    const char *arg;
+    int argc, i, rc = 0;
+
+    memset(sp, 0, sizeof(struct lpc_sortspec));
+    memset(&g, 0, sizeof(struct lpc_sortkey));
+    g.eword = SIZE_MAX;
+    sp->tab = -1;
+    buf = lpc_sort_realloc(NULL, strlen(flags) * 2 + 2);
+    if (!(argc = lpc_sort_words(flags, buf, argv, 63)))
+	goto OUT;
+    for (i = 0; argv[i]; i++) {
+	cp = argv[i];
+	if (cp[0] != '-' || cp[1] == '\0' || cp[1] == '-')
+	    goto OUT;		// Files, long options: sort(1)'s business
+	for (cp++; *cp; cp++) {
+	    switch (*cp) {
+	    case 'b':
+		g.skipsblanks = g.skipeblanks = 1;
+		continue;
+	    case 'f':
+		g.fold = 1;
+		continue;
+	    case 'n':
+		g.numeric = 1;
+		continue;
+	    case 'r':
+		g.reverse = sp->reverse = 1;
+		continue;
+	    case 's':
+		sp->stable = 1;
+		continue;
+	    case 't':
+	    case 'k':
+		if (!(arg = cp[1] ? cp + 1 : argv[++i]))
+		    goto OUT;
+		if (*cp == 't') {
+		    if (strlen(arg) != 1)
+			goto OUT;
+		    sp->tab = (unsigned char)arg[0];
+		} else {
+		    if (sp->nkeys == LPC_MAXKEYS
+			|| !lpc_sort_keyspec(&sp->keys[sp->nkeys], arg))
+			goto OUT;
+		    sp->nkeys++;
+		}
+		break;
+	    default:
+		goto OUT;
+	    }
+	    break;		// The rest of the word was the argument
+	}
+    }
+
+    for (i = 0; i < sp->nkeys; i++) {
+	k = &sp->keys[i];
+	if (lpc_sort_plainkey(k)) {
+	    k->skipsblanks = g.skipsblanks;
+	    k->skipeblanks = g.skipeblanks;
+	    k->numeric = g.numeric;
+	    k->fold = g.fold;
+	    k->reverse = g.reverse;
+	}
+    }
+    // Without -k, options other than -r make the whole line a key.
+    if (sp->nkeys == 0 && (g.skipsblanks || g.numeric || g.fold))
+	sp->keys[sp->nkeys++] = g;
+    rc = 1;
+  OUT:
+    free(buf);
+    return rc;
+}
+
+// sort -S: a size in KiB, or with a b, K, M, G or T suffix. Returns 0 if it isn't one.
+size_t
+lpc_sort_parsesize(const char *s)
+{
+    size_t v;
+    int shift = 10;
+
+    if (!(s = lpc_sort_count(s, &v)))
+	return 0;
+    switch (*s) {
+    case '\0':
+	break;
+    case 'b':
+	shift = 0;
+	break;
+    case 'k':
+    case 'K':
+	break;
+    case 'M':
+	shift = 20;
+	break;
+    case 'G':
+	shift = 30;
+	break;
+    case 'T':
+	shift = 40;
+	break;
+    default:
+	return 0;
+    }
+    if (*s && s[1])
+	return 0;
+    if (v > (SIZE_MAX >> shift))
+	return SIZE_MAX;
+    return v << shift;
+}
+
+/* Comparison */
+
+// Start of a key (GNU sort's begfield)
+static const char *
+lpc_begfield(const struct lpc_sortspec *sp, const struct lpc_sortkey *k,
+    const char *p, const char *lim)
+{
+    size_t sword = k->sword;
+
+    if (sp->tab >= 0) {
+	while (p < lim && sword--) {
+	    while (p < lim && (unsigned char)*p != sp->tab)
+		p++;
+	    if (p < lim)
+		p++;
+	}
+    } else {
+	while (p < lim && sword--) {
+	    while (p < lim && LPC_ISBLANK(*p))
+		p++;
+	    while (p < lim && !LPC_ISBLANK(*p))
+		p++;
+	}
+    }
+    if (k->skipsblanks)
+	while (p < lim && LPC_ISBLANK(*p))
+	    p++;
+    return (size_t)(lim - p) < k->schar ? lim : p + k->schar;
+}
+
+// End of a key (GNU sort's limfield)
+static const char *
+lpc_limfield(const struct lpc_sortspec *sp, const struct lpc_sortkey *k,
+    const char *p, const char *lim)
+{
+    size_t eword = k->eword, echar = k->echar;
+
+    if (echar == 0)
+	eword++;		// The whole of the end field
+    if (sp->tab >= 0) {
+	while (p < lim && eword--) {
+	    while (p < lim && (unsigned char)*p != sp->tab)
+		p++;
+	    if (p < lim && (eword || echar))
+		p++;
+	}
+    } else {
+	while (p < lim && eword--) {
+	    while (p < lim && LPC_ISBLANK(*p))
+		p++;
+	    while (p < lim && !LPC_ISBLANK(*p))
+		p++;
+	}
+    }
+    if (echar != 0) {
+	if (k->skipeblanks)
+	    while (p < lim && LPC_ISBLANK(*p))
+		p++;
+	p = (size_t)(lim - p) < echar ? lim : p + echar;
+    }
+    return p;
+}
+
+// A number as sort -n reads it: blanks, an optional '-', digits, and a fraction.
+struct lpc_sortnum {
+    int neg;
+    const char *ip;		// Integer digits, without leading zeros
+    size_t ilen;
+    const char *fp;		// Fraction digits, without trailing zeros
+    size_t flen;
+};
+
+static void
+lpc_sort_number(struct lpc_sortnum *n, const char *p, const char *lim)
+{
+    const char *q;
+
+    while (p < lim && LPC_ISBLANK(*p))
+	p++;
+    n->neg = (p < lim && *p == '-');
+    if (n->neg)
+	p++;
+    while (p < lim && *p == '0')
+	p++;
+    for (n->ip = p; p < lim && LPC_ISDIGIT(*p); p++) ;
+    n->ilen = p - n->ip;
+    n->fp = p;
+    n->flen = 0;
+    if (p < lim && *p == '.') {
+	for (n->fp = ++p; p < lim && LPC_ISDIGIT(*p); p++) ;
+	for (q = p; q > n->fp && q[-1] == '0'; q--) ;
+	n->flen = q - n->fp;
+    }
+    if (n->ilen == 0 && n->flen == 0)
+	n->neg = 0;		// -0, and anything that isn't a number, are 0
+}
+
+static int
+lpc_sort_numcmp(const char *a, const char *alim, const char *b,
+    const char *blim)
+{
+    struct lpc_sortnum x, y;
+    int diff;
+
+    lpc_sort_number(&x, a, alim);
+    lpc_sort_number(&y, b, blim);
+    if (x.neg != y.neg)
+	return x.neg ? -1 : 1;
+    if (x.ilen != y.ilen)
+	diff = x.ilen < y.ilen ? -1 : 1;
+    else if (!(diff = memcmp(x.ip, y.ip, x.ilen))) {
+	diff = memcmp(x.fp, y.fp, x.flen < y.flen ? x.flen : y.flen);
+	if (!diff)
+	    diff = x.flen < y.flen ? -1 : x.flen != y.flen;
+    }
+    return x.neg ? -diff : diff;
+}
+
+static int
+lpc_sort_foldcmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+    size_t i, n = alen < blen ? alen : blen;
+    int diff;
+
+    for (i = 0; i < n; i++) {
+	diff = toupper((unsigned char)a[i]) - toupper((unsigned char)b[i]);
+	if (diff)
+	    return diff;
+    }
+    return alen < blen ? -1 : alen != blen;
+}
+
+static int
+lpc_sort_memcmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+    int diff;
+
+    diff = memcmp(a, b, alen < blen ? alen : blen);
+    if (!diff)
+	diff = alen < blen ? -1 : alen != blen;
+    return diff;
+}
+
+// Where key k of a line starts and ends
+static void
+lpc_sort_keypos(const struct lpc_sortspec *sp, const struct lpc_sortkey *k,
+    const char *p, size_t len, const char **kb, const char **kl)
+{
+    *kb = lpc_begfield(sp, k, p, p + len);
+    *kl = k->eword == SIZE_MAX ? p + len : lpc_limfield(sp, k, p, p + len);
+    if (*kl < *kb)		// A key ending before it starts is empty
+	*kl = *kb;
+}
+
+static int
+lpc_sort_keycmp(const struct lpc_sortkey *k, const char *ta, const char *la,
+    const char *tb, const char *lb)
+{
+    int diff;
+
+    if (k->numeric)
+	diff = lpc_sort_numcmp(ta, la, tb, lb);
+    else if (k->fold)
+	diff = lpc_sort_foldcmp(ta, la - ta, tb, lb - tb);
+    else
+	diff = lpc_sort_memcmp(ta, la - ta, tb, lb - tb);
+    return k->reverse ? -diff : diff;
+}
+
+// Keys [from, nkeys), then the last resort comparison
+static int
+lpc_sort_cmpfrom(const struct lpc_sortspec *sp, int from, const char *a,
+    size_t alen, const char *b, size_t blen)
+{
+    const char *ta, *la, *tb, *lb;
+    int i, diff;
+
+    for (i = from; i < sp->nkeys; i++) {
+	lpc_sort_keypos(sp, &sp->keys[i], a, alen, &ta, &la);
+	lpc_sort_keypos(sp, &sp->keys[i], b, blen, &tb, &lb);
+	if ((diff = lpc_sort_keycmp(&sp->keys[i], ta, la, tb, lb)))
+	    return diff;
+    }
+    if (sp->stable)
+	return 0;
+    // Last resort: the whole line, byte by byte
+    diff = lpc_sort_memcmp(a, alen, b, blen);
+    return sp->reverse ? -diff : diff;
+}
+
+// Order two lines (without their '\n') as sort(1) would. Returns <0, 0 or >0.
+int
+lpc_sort_compare(const struct lpc_sortspec *sp, const char *a, size_t alen,
+    const char *b, size_t blen)
+{
+    return lpc_sort_cmpfrom(sp, 0, a, alen, b, blen);
+}
+
+/* Sorting lines in memory */
+
+// A line being sorted. Where its first key lies is worked out once, as sort(1) does.
+struct lpc_sortrec {
+    const char *p;
+    size_t len;
+    const char *kb;
+    const char *kl;
+};
+
+static inline int
+lpc_sort_reccmp(const struct lpc_sortspec *sp, const struct lpc_sortrec *x,
+    const struct lpc_sortrec *y)
+{
+    int diff;
+
+    if (sp->nkeys == 0)
+	return lpc_sort_cmpfrom(sp, 0, x->p, x->len, y->p, y->len);
+    if ((diff = lpc_sort_keycmp(&sp->keys[0], x->kb, x->kl, y->kb, y->kl)))
+	return diff;
+    return lpc_sort_cmpfrom(sp, 1, x->p, x->len, y->p, y->len);
+}
+
+// Stable merge of two sorted runs. out may be where r is, as long as l is elsewhere.
+static void
+lpc_sort_merge(const struct lpc_sortspec *sp, const struct lpc_sortrec *l,
+    size_t nl, const struct lpc_sortrec *r, size_t nr,
+    struct lpc_sortrec *out)
+{
+    while (nl && nr) {
+	if (lpc_sort_reccmp(sp, r, l) < 0) {
+	    *out++ = *r++;
+	    nr--;
+	} else {
+	    *out++ = *l++;
+	    nl--;
+	}
+    }
+    while (nl--)
+	*out++ = *l++;
+    if (out != r)
+	while (nr--)
+	    *out++ = *r++;
+}
+
+// Stable merge sort of a[0..n), with tmp as scratch of the same size
+static void
+lpc_sort_msort(const struct lpc_sortspec *sp, struct lpc_sortrec *a,
+    struct lpc_sortrec *tmp, size_t n)
+{
+    struct lpc_sortrec x;
+    size_t h, i, j;
+
+    if (n <= 8) {
+	for (i = 1; i < n; i++) {
+	    x = a[i];
+	    for (j = i; j > 0 && lpc_sort_reccmp(sp, &a[j - 1], &x) > 0; j--)
+		a[j] = a[j - 1];
+	    a[j] = x;
+	}
+	return;
+    }
+    h = n / 2;
+    lpc_sort_msort(sp, a, tmp, h);
+    lpc_sort_msort(sp, a + h, tmp + h, n - h);
+    if (lpc_sort_reccmp(sp, &a[h - 1], &a[h]) <= 0)
+	return;			// Already in order
+    memcpy(tmp, a, h * sizeof(struct lpc_sortrec));
+    lpc_sort_merge(sp, tmp, h, a + h, n - h, a);
+}
+
+// Work for one thread of lpc_sort_spans(): sort a part, or merge two sorted parts.
+struct lpc_sortjob {
+    pthread_t tid;
+    const struct lpc_sortspec *sp;
+    struct lpc_sortrec *a;	// Part to sort, or the first of two parts to merge
+    struct lpc_sortrec *b;	// Scratch, or the second part
+    size_t na;
+    size_t nb;
+    struct lpc_sortrec *out;	// NULL to sort
+};
+
+static void *
+lpc_sort_job(void *arg)
+{
+    struct lpc_sortjob *j = arg;
+
+    if (j->out)
+	lpc_sort_merge(j->sp, j->a, j->na, j->b, j->nb, j->out);
+    else
+	lpc_sort_msort(j->sp, j->a, j->b, j->na);
+    return NULL;
+}
+
+// Run jobs [0, n) on threads, the first on this one.
+static void
+lpc_sort_runjobs(struct lpc_sortjob *j, int n)
+{
+    int i;
+
+    for (i = 1; i < n; i++)
+	if (pthread_create(&j[i].tid, NULL, lpc_sort_job, &j[i])) {
+	    fprintf(stderr, "Pipecut Error: could not start sort thread\n");
+	    exit(-1);
+	}
+    lpc_sort_job(&j[0]);
+    for (i = 1; i < n; i++)
+	pthread_join(j[i].tid, NULL);
+}
+
+/* Stable sort of lines[0..n) on up to 'threads' threads: each sorts a part, then the
+ * parts are merged pairwise, the pairs of each round again in parallel.
+ */
+void
+lpc_sort_spans(const struct lpc_sortspec *sp, struct lpc_span *lines, int n,
+    int threads)
+{
+    struct lpc_sortrec *rec, *tmp, *src, *dst, *t;
+    struct lpc_sortjob *j;
+    size_t *off;
+    int nparts, i, nj;
+
+    if (n < 2)
+	return;
+    rec = lpc_sort_realloc(NULL, 2 * (size_t)n * sizeof(struct lpc_sortrec));
+    tmp = rec + n;
+    for (i = 0; i < n; i++) {
+	rec[i].p = lines[i].p;
+	rec[i].len = lines[i].len;
+	if (sp->nkeys)
+	    lpc_sort_keypos(sp, &sp->keys[0], rec[i].p, rec[i].len,
+		&rec[i].kb, &rec[i].kl);
+    }
+    nparts = threads;
+    if (nparts > n / LPC_SORTMIN)
+	nparts = n / LPC_SORTMIN;
+    if (nparts <= 1) {
+	lpc_sort_msort(sp, rec, tmp, n);
+	src = rec;
+	goto OUT;
+    }
+    j = calloc(nparts, sizeof(struct lpc_sortjob));
+    off = calloc(nparts + 1, sizeof(size_t));
+    for (i = 0; i <= nparts; i++)
+	off[i] = (size_t)n * i / nparts;
+    for (i = 0; i < nparts; i++) {
+	j[i].sp = sp;
+	j[i].a = rec + off[i];
+	j[i].b = tmp + off[i];
+	j[i].na = off[i + 1] - off[i];
+    }
+    lpc_sort_runjobs(j, nparts);
+
+    // Merge rounds, back and forth between rec and tmp
+    src = rec;
+    dst = tmp;
+    while (nparts > 1) {
+	for (i = 0, nj = 0; i + 1 < nparts; i += 2, nj++) {
+	    j[nj].a = src + off[i];
+	    j[nj].na = off[i + 1] - off[i];
+	    j[nj].b = src + off[i + 1];
+	    j[nj].nb = off[i + 2] - off[i + 1];
+	    j[nj].out = dst + off[i];
+	}
+	if (i < nparts)		// Odd one out is carried over as it is
+	    memcpy(dst + off[i], src + off[i],
+		(off[i + 1] - off[i]) * sizeof(struct lpc_sortrec));
+	lpc_sort_runjobs(j, nj);
+	for (i = 0; 2 * i <= nparts; i++)
+	    off[i] = off[2 * i < nparts ? 2 * i : nparts];
+	off[(nparts + 1) / 2] = n;
+	nparts = (nparts + 1) / 2;
+	t = src;
+	src = dst;
+	dst = t;
+    }
+    free(off);
+    free(j);
+  OUT:
+    for (i = 0; i < n; i++) {
+	lines[i].p = src[i].p;
+	lines[i].len = src[i].len;
+    }
+    free(rec);
+}
+
+/* External sorting */
+
+#define LPC_SORTLINE (sizeof(struct lpc_span) + 2 * sizeof(struct lpc_sortrec))
+
+// Bytes of arena for lines held in memory
+struct lpc_sortblk {
+    struct lpc_sortblk *next;
+    size_t len;
+    size_t cap;
+    char p[];
+};
+
+// Room for len bytes in the arena at *blk. *used counts what the arena takes.
+static char *
+lpc_sortblk_alloc(struct lpc_sortblk **blk, size_t len, size_t *used)
+{
+    struct lpc_sortblk *bp;
+    size_t cap;
+    char *p;
+
+    if (!(bp = *blk) || bp->cap - bp->len < len) {
+	cap = len > LPC_SORTBLOCK ? len : LPC_SORTBLOCK;
+	bp = lpc_sort_realloc(NULL, sizeof(struct lpc_sortblk) + cap);
+	bp->len = 0;
+	bp->cap = cap;
+	bp->next = *blk;
+	*blk = bp;
+	*used += sizeof(struct lpc_sortblk);
+    }
+    p = bp->p + bp->len;
+    bp->len += len;
+    *used += len;
+    return p;
+}
+
+static void
+lpc_sortblk_free(struct lpc_sortblk **blk)
+{
+    struct lpc_sortblk *bp;
+
+    while ((bp = *blk)) {
+	*blk = bp->next;
+	free(bp);
+    }
+}
+
+/* One sorted input to a merge: a spilled run, or the run in memory.
+ * In a counting sorter each line carries a count: in memory it sits just before the
+ * line's bytes, and in a spilled run it's written in front of the line, in decimal.
+ */
+struct lpc_sortsrc {
+    FILE *fp;			// NULL for the run in memory
+    char *buf;
+    size_t bufcap;
+    struct lpc_span *lines;	// The run in memory
+    int nlines;
+    int pos;
+    int counted;
+    struct lpc_span cur;	// The line at the front
+    long count;			// ... and its count
+};
+
+struct lpc_sortmerge {
+    struct lpc_sortsrc *src;
+    int nsrc;
+    int *heap;			// Sources with lines left, smallest front line first
+    int nheap;
+    int pending;		// Source whose front line was handed out last, or -1
+};
+
+struct lpc_sorter {
+    struct lpc_sortspec spec;
+    size_t budget;
+    int threads;
+    int counted;		// Lines carry counts (lpc_sorter_addcount)
+    struct lpc_sortblk *blk;	// Arena for the run in memory
+    size_t used;		// Memory held by the run in memory
+    struct lpc_span *lines;	// The run in memory
+    int nlines;
+    int linecap;
+    FILE **runs;		// Spilled runs, oldest first
+    int nruns;
+    int pos;			// Next line to hand out, when nothing was spilled
+    struct lpc_sortmerge m;
+    int merging;
+};
+
+static FILE *
+lpc_sort_tmpfile()
+{
+    char path[PATH_MAX];
+    const char *dir;
+    FILE *fp = NULL;
+    int fd;
+
+    if (!(dir = getenv("TMPDIR")) || !*dir)
+	dir = "/tmp";
+    snprintf(path, PATH_MAX, "%s/pipecutXXXXXX", dir);
+    if ((fd = mkstemp(path)) >= 0) {
+	unlink(path);		// It goes away when we close it
+	fp = fdopen(fd, "w+");
+    }
+    if (!fp) {
+	fprintf(stderr,
+	    "Pipecut Error: could not create a temporary file in %s: %s\n",
+	    dir, strerror(errno));
+	exit(-1);
+    }
+    return fp;
+}
+
+static void
+lpc_sort_writeline(FILE *fp, int counted, const char *p, size_t len,
+    long count)
+{
+    if ((counted && fprintf(fp, "%ld ", count) < 0)
+	|| fwrite(p, 1, len, fp) != len || putc('\n', fp) == EOF) {
+	fprintf(stderr, "Pipecut Error: could not write temporary file: %s\n",
+	    strerror(errno));
+	exit(-1);
+    }
+}
+
+// The count in front of a line in memory
+static long
+lpc_sort_memcount(const char *p)
+{
+    long count;
+
+    memcpy(&count, p - sizeof(long), sizeof(long));
+    return count;
+}
+
+// Advance a source to its next line. Returns 0 when it's used up.
+static int
+lpc_sortsrc_next(struct lpc_sortsrc *s)
+{
+    ssize_t n;
+    char *cp;
+
+    if (!s->fp) {
+	if (s->pos == s->nlines)
+	    return 0;
+	s->cur = s->lines[s->pos++];
+	s->count = s->counted ? lpc_sort_memcount(s->cur.p) : 1;
+	return 1;
+    }
+    if ((n = getline(&s->buf, &s->bufcap, s->fp)) <= 0) {
+	if (ferror(s->fp)) {
+	    fprintf(stderr,
+		"Pipecut Error: could not read temporary file: %s\n",
+		strerror(errno));
+	    exit(-1);
+	}
+	return 0;
+    }
+    s->cur.p = s->buf;
+    s->cur.len = n - 1;		// Every line was written with its '\n'
+    s->count = 1;
+    if (s->counted) {
+	s->count = strtol(s->buf, &cp, 10);
+	cp++;
+	s->cur.len -= cp - s->buf;
+	s->cur.p = cp;
+    }
+    return 1;
+}
+
+#define LPC_SPANCMP(sp, x, y) lpc_sort_compare(sp, (x).p, (x).len, (y).p, (y).len)
+
+// Heap order: by line, and by source for equal lines so that the sort stays stable.
+static int
+lpc_sortmerge_less(const struct lpc_sortspec *sp, struct lpc_sortmerge *m,
+    int x, int y)
+{
+    int diff;
+
+    diff = LPC_SPANCMP(sp, m->src[x].cur, m->src[y].cur);
+    return diff < 0 || (diff == 0 && x < y);
+}
+
+static void
+lpc_sortmerge_down(const struct lpc_sortspec *sp, struct lpc_sortmerge *m,
+    int i)
+{
+    int c, t;
+
+    while ((c = 2 * i + 1) < m->nheap) {
+	if (c + 1 < m->nheap
+	    && lpc_sortmerge_less(sp, m, m->heap[c + 1], m->heap[c]))
+	    c++;
+	if (!lpc_sortmerge_less(sp, m, m->heap[c], m->heap[i]))
+	    break;
+	t = m->heap[i];
+	m->heap[i] = m->heap[c];
+	m->heap[c] = t;
+	i = c;
+    }
+}
+
+// Start merging the sources, which are in input order.
+static void
+lpc_sortmerge_init(const struct lpc_sortspec *sp, struct lpc_sortmerge *m,
+    struct lpc_sortsrc *src, int nsrc)
+{
+    int i;
+
+    m->src = src;
+    m->nsrc = nsrc;
+    m->heap = lpc_sort_realloc(NULL, nsrc * sizeof(int));
+    m->nheap = 0;
+    m->pending = -1;
+    for (i = 0; i < nsrc; i++) {
+	if (src[i].fp)
+	    rewind(src[i].fp);
+	if (lpc_sortsrc_next(&src[i]))
+	    m->heap[m->nheap++] = i;
+    }
+    for (i = m->nheap / 2 - 1; i >= 0; i--)
+	lpc_sortmerge_down(sp, m, i);
+}
+
+// The next line of the merge, valid until the following call. Returns 0 at the end.
+static int
+lpc_sortmerge_next(const struct lpc_sortspec *sp, struct lpc_sortmerge *m,
+    struct lpc_span *line, long *count)
+{
+    if (m->pending >= 0) {
+	if (!lpc_sortsrc_next(&m->src[m->pending]))
+	    m->heap[0] = m->heap[--m->nheap];
+	lpc_sortmerge_down(sp, m, 0);
+	m->pending = -1;
+    }
+    if (m->nheap == 0)
+	return 0;
+    m->pending = m->heap[0];
+    *line = m->src[m->pending].cur;
+    *count = m->src[m->pending].count;
+    return 1;
+}
+
+static void
+lpc_sortmerge_free(struct lpc_sortmerge *m)
+{
+    int i;
+
+    for (i = 0; i < m->nsrc; i++) {
+	free(m->src[i].buf);
+	if (m->src[i].fp)
+	    fclose(m->src[i].fp);
+    }
+    free(m->src);
+    free(m->heap);
+    memset(m, 0, sizeof(struct lpc_sortmerge));
+}
+
+/* Hand the spilled runs over to a merge, plus the run in memory if memrun. They're
+ * the merge's to close now.
+ */
+static void
+lpc_sorter_startmerge(struct lpc_sorter *s, struct lpc_sortmerge *m,
+    int memrun)
+{
+    struct lpc_sortsrc *src;
+    int i;
+
+    src = calloc(s->nruns + 1, sizeof(struct lpc_sortsrc));
+    for (i = 0; i < s->nruns; i++) {
+	src[i].fp = s->runs[i];
+	src[i].counted = s->counted;
+    }
+    if (memrun) {
+	src[i].lines = s->lines;
+	src[i].nlines = s->nlines;
+	src[i].counted = s->counted;
+	i++;
+    }
+    s->nruns = 0;
+    lpc_sortmerge_init(&s->spec, m, src, i);
+}
+
+// Too many spilled runs to keep open: merge them into one.
+static void
+lpc_sorter_compact(struct lpc_sorter *s)
+{
+    struct lpc_sortmerge m;
+    struct lpc_span line;
+    long count;
+    FILE *fp;
+
+    fp = lpc_sort_tmpfile();
+    lpc_sorter_startmerge(s, &m, 0);
+    while (lpc_sortmerge_next(&s->spec, &m, &line, &count))
+	lpc_sort_writeline(fp, s->counted, line.p, line.len, count);
+    lpc_sortmerge_free(&m);
+    s->runs[s->nruns++] = fp;
+}
+
+static void
+lpc_sorter_clearrun(struct lpc_sorter *s)
+{
+    lpc_sortblk_free(&s->blk);
+    s->nlines = 0;
+    s->used = 0;
+}
+
+// The run in memory has filled the budget: sort it, and write it out.
+static void
+lpc_sorter_spill(struct lpc_sorter *s)
+{
+    struct lpc_span *l;
+    FILE *fp;
+    int i;
+
+    if (s->nruns == LPC_SORTFILES)
+	lpc_sorter_compact(s);
+    lpc_sort_spans(&s->spec, s->lines, s->nlines, s->threads);
+    fp = lpc_sort_tmpfile();
+    for (i = 0; i < s->nlines; i++) {
+	l = &s->lines[i];
+	lpc_sort_writeline(fp, s->counted, l->p, l->len,
+	    s->counted ? lpc_sort_memcount(l->p) : 1);
+    }
+    if (fflush(fp) == EOF) {
+	fprintf(stderr, "Pipecut Error: could not write temporary file: %s\n",
+	    strerror(errno));
+	exit(-1);
+    }
+    s->runs[s->nruns++] = fp;
+    lpc_sorter_clearrun(s);
+}
+
+struct lpc_sorter *
+lpc_sorter_new(const struct lpc_sortspec *sp, size_t budget, int threads,
+    int counted)
+{
+    struct lpc_sorter *s;
+
+    s = calloc(1, sizeof(struct lpc_sorter));
+    s->spec = *sp;
+    s->budget = budget;
+    s->threads = threads;
+    s->counted = counted;
+    s->runs = calloc(LPC_SORTFILES, sizeof(FILE *));
+    return s;
+}
+
+// Take a copy of a line, with its count in a counting sorter.
+void
+lpc_sorter_addcount(struct lpc_sorter *s, const char *p, size_t len,
+    long count)
+{
+    size_t hdr = s->counted ? sizeof(long) : 0;
+    char *cp;
+
+    // Each line costs its bytes, its span, and two records while it's sorted.
+    if (s->used + hdr + len + LPC_SORTLINE > s->budget && s->nlines)
+	lpc_sorter_spill(s);
+    cp = lpc_sortblk_alloc(&s->blk, hdr + len, &s->used);
+    memcpy(cp, &count, hdr);
+    memcpy(cp + hdr, p, len);
+    lpc_addspan(&s->lines, &s->nlines, &s->linecap, cp + hdr, len);
+    s->used += LPC_SORTLINE;
+}
+
+void
+lpc_sorter_add(struct lpc_sorter *s, const char *p, size_t len)
+{
+    lpc_sorter_addcount(s, p, len, 1);
+}
+
+/* End of input. Returns 1 if every line is still in memory, so that the lines
+ * lpc_sorter_next() hands out stay put until lpc_sorter_free(). Otherwise each is
+ * only good until the next call.
+ */
+int
+lpc_sorter_finish(struct lpc_sorter *s)
+{
+    lpc_sort_spans(&s->spec, s->lines, s->nlines, s->threads);
+    s->pos = 0;
+    if (s->nruns == 0)
+	return 1;
+    lpc_sorter_startmerge(s, &s->m, 1);
+    s->merging = 1;
+    return 0;
+}
+
+// The next line in order, and its count (may be NULL). Returns 0 when there are no more.
+int
+lpc_sorter_next(struct lpc_sorter *s, const char **p, size_t *len,
+    long *count)
+{
+    struct lpc_span line;
+    long n = 1;
+
+    if (s->merging) {
+	if (!lpc_sortmerge_next(&s->spec, &s->m, &line, &n))
+	    return 0;
+    } else {
+	if (s->pos == s->nlines)
+	    return 0;
+	line = s->lines[s->pos++];
+	if (s->counted)
+	    n = lpc_sort_memcount(line.p);
+    }
+    *p = line.p;
+    *len = line.len;
+    if (count)
+	*count = n;
+    return 1;
+}
+
+void
+lpc_sorter_free(struct lpc_sorter *s)
+{
+    int i;
+
+    if (s->merging)
+	lpc_sortmerge_free(&s->m);
+    for (i = 0; i < s->nruns; i++)
+	fclose(s->runs[i]);
+    lpc_sorter_clearrun(s);
+    free(s->runs);
+    free(s->lines);
+    free(s);
+}
+
+/* uniq(1) */
+
+// Options of a UNIQUE blade (-c -d -u). Returns 0 for anything else.
+int
+lpc_uniqspec_parse(struct lpc_uniqspec *up, const char *flags)
+{
+    char *buf, *argv[64], *cp;
+    int i, rc = 0;
+
+    memset(up, 0, sizeof(struct lpc_uniqspec));
+    buf = lpc_sort_realloc(NULL, strlen(flags) * 2 + 2);
+    if (!lpc_sort_words(flags, buf, argv, 63))
+	goto OUT;
+    for (i = 0; argv[i]; i++) {
+	cp = argv[i];
+	if (cp[0] != '-' || cp[1] == '\0')
+	    goto OUT;
+	for (cp++; *cp; cp++) {
+	    if (*cp == 'c')
+		up->count = 1;
+	    else if (*cp == 'd')
+		up->dups = 1;
+	    else if (*cp == 'u')
+		up->uniqs = 1;
+	    else
+		goto OUT;
+	}
+    }
+    rc = 1;
+  OUT:
+    free(buf);
+    return rc;
+}
+
+// Does a group of 'count' equal lines make it to the output?
+int
+lpc_uniq_show(const struct lpc_uniqspec *up, long count)
+{
+    return !(up->dups && count == 1) && !(up->uniqs && count > 1);
+}
+
+/* Hash aggregation: sort | uniq without the sort.
+ *
+ * Distinct lines are counted in an open addressing hash table. Only they are sorted
+ * at the end, by a counting lpc_sorter. If the table outgrows its half of the memory
+ * budget, it is emptied into the sorter, which spills as it needs to; the same line
+ * can then come out of the sorter more than once, but always in a row.
+ */
+
+#define LPC_GROUPMIN 1024		// Initial table size (power of 2)
+
+struct lpc_hent {
+    uint64_t hash;
+    const char *p;		// NULL for an empty slot
+    size_t len;
+    long count;
+};
+
+struct lpc_group {
+    struct lpc_sortspec spec;
+    size_t budget;
+    int threads;
+    struct lpc_hent *tab;
+    size_t mask;
+    size_t n;			// Slots in use
+    struct lpc_sortblk *blk;	// Arena for the lines in the table
+    size_t used;		// Memory held by the table
+    struct lpc_sorter *sorter;	// Created when first needed
+    struct lpc_text cur;	// The line lpc_group_next() handed out
+    int more;			// There is a line looked ahead at
+    const char *np;		// ... which is this
+    size_t nlen;
+    long ncount;
+};
+
+static uint64_t
+lpc_hash(const char *p, size_t len)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len, v;
+
+    for (; len >= 8; p += 8, len -= 8) {
+	memcpy(&v, p, 8);
+	h = (h ^ v) * 0xff51afd7ed558ccdULL;
+	h ^= h >> 32;
+    }
+    v = 0;
+    memcpy(&v, p, len);
+    h = (h ^ v) * 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 29;
+    h *= 0xff51afd7ed558ccdULL;
+    return h ^ (h >> 32);
+}
+
+static void
+lpc_group_alloc(struct lpc_group *g, size_t size)
+{
+    g->tab = calloc(size, sizeof(struct lpc_hent));
+    if (!g->tab) {
+	fprintf(stderr, "Pipecut Error: out of memory\n");
+	exit(-1);
+    }
+    g->mask = size - 1;
+    g->n = 0;
+    g->used = size * sizeof(struct lpc_hent);
+}
+
+struct lpc_group *
+lpc_group_new(const struct lpc_sortspec *sp, size_t budget, int threads)
+{
+    struct lpc_group *g;
+
+    g = calloc(1, sizeof(struct lpc_group));
+    g->spec = *sp;
+    g->budget = budget;
+    g->threads = threads;
+    lpc_group_alloc(g, LPC_GROUPMIN);
+    return g;
+}
+
+// Double the table
+static void
+lpc_group_grow(struct lpc_group *g)
+{
+    struct lpc_hent *old = g->tab;
+    size_t i, k, size = g->mask + 1, used = g->used, n = g->n;
+
+    lpc_group_alloc(g, size * 2);
+    for (i = 0; i < size; i++) {
+	if (!old[i].p)
+	    continue;
+	for (k = old[i].hash & g->mask; g->tab[k].p; k = (k + 1) & g->mask) ;
+	g->tab[k] = old[i];
+    }
+    g->used += used - size * sizeof(struct lpc_hent);
+    g->n = n;
+    free(old);
+}
+
+// Move the table's lines into the sorter, and start the table afresh.
+static void
+lpc_group_drain(struct lpc_group *g)
+{
+    size_t i;
+
+    if (!g->sorter)
+	g->sorter = lpc_sorter_new(&g->spec, g->budget / 2, g->threads, 1);
+    for (i = 0; i <= g->mask; i++)
+	if (g->tab[i].p)
+	    lpc_sorter_addcount(g->sorter, g->tab[i].p, g->tab[i].len,
+		g->tab[i].count);
+    free(g->tab);
+    lpc_sortblk_free(&g->blk);
+    lpc_group_alloc(g, LPC_GROUPMIN);
+}
+
+// Count 'count' more of a line.
+void
+lpc_group_addcount(struct lpc_group *g, const char *p, size_t len,
+    long count)
+{
+    struct lpc_hent *e;
+    uint64_t h;
+    size_t k;
+
+    h = lpc_hash(p, len);
+    for (k = h & g->mask; (e = &g->tab[k])->p; k = (k + 1) & g->mask) {
+	if (e->hash == h && e->len == len && !memcmp(e->p, p, len)) {
+	    e->count += count;
+	    return;
+	}
+    }
+    e->hash = h;
+    e->len = len;
+    e->count = count;
+    e->p = lpc_sortblk_alloc(&g->blk, len ? len : 1, &g->used);
+    memcpy((char *)e->p, p, len);
+    if (++g->n * 2 > g->mask + 1)
+	lpc_group_grow(g);
+    if (g->used > g->budget / 2)
+	lpc_group_drain(g);
+}
+
+void
+lpc_group_add(struct lpc_group *g, const char *p, size_t len)
+{
+    lpc_group_addcount(g, p, len, 1);
+}
+
+// Fold the lines counted by src (e.g. over one chunk of the input) into g.
+void
+lpc_group_merge(struct lpc_group *g, struct lpc_group *src)
+{
+    const char *p;
+    size_t i, len;
+    long count;
+
+    for (i = 0; i <= src->mask; i++)
+	if (src->tab[i].p)
+	    lpc_group_addcount(g, src->tab[i].p, src->tab[i].len,
+		src->tab[i].count);
+    if (src->sorter) {
+	lpc_sorter_finish(src->sorter);
+	while (lpc_sorter_next(src->sorter, &p, &len, &count))
+	    lpc_group_addcount(g, p, len, count);
+    }
+}
+
+// End of input: sort the distinct lines.
+void
+lpc_group_finish(struct lpc_group *g)
+{
+    lpc_group_drain(g);
+    lpc_sorter_finish(g->sorter);
+    g->more = lpc_sorter_next(g->sorter, &g->np, &g->nlen, &g->ncount);
+}
+
+/* The next distinct line in sort order, and how often it turned up. It's good until
+ * the next call. Returns 0 when there are no more.
+ */
+int
+lpc_group_next(struct lpc_group *g, const char **p, size_t *len,
+    long *count)
+{
+    if (!g->more)
+	return 0;
+    g->cur.len = 0;
+    lpc_text_reserve(&g->cur, g->nlen);
+    memcpy(g->cur.p, g->np, g->nlen);
+    g->cur.len = g->nlen;
+    *count = g->ncount;
+    // A line spilled more than once comes out of the sorter in a row.
+    while ((g->more = lpc_sorter_next(g->sorter, &g->np, &g->nlen,
+		&g->ncount)) && g->nlen == g->cur.len
+	&& !memcmp(g->np, g->cur.p, g->nlen))
+	*count += g->ncount;
+    *p = g->cur.p;
+    *len = g->cur.len;
+    return 1;
+}
+
+void
+lpc_group_free(struct lpc_group *g)
+{
+    if (g->sorter)
+	lpc_sorter_free(g->sorter);
+    free(g->tab);
+    lpc_sortblk_free(&g->blk);
+    free(g->cur.p);
+    free(g);
+}
@@ -0,0 +1,120 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Native sort(1) for ORDER blades.
+ *
+ * The blade's pattern holds sort's options. The ones understood here (-n -r -b -f -s,
+ * -t X and -k POS1[,POS2]) are compiled into a lpc_sortspec that compares lines
+ * exactly as GNU sort does in the C locale; any other option, or a collating locale,
+ * leaves the blade to /bin/sh.
+ *
+ * A lpc_sorter collects the input into sorted runs. A run is sorted on several threads
+ * once it fills the memory budget, and is spilled to a temporary file; at the end of
+ * input the spilled runs and the one still in memory are merged.
+ *
+ * UNIQUE blades (uniq, uniq -c) compare whole lines, so sort followed by uniq only
+ * needs the distinct lines in order: a lpc_group counts them in a hash table, and sorts
+ * just those at the end.
+ */
+
+#ifndef PCSORT_H
+#define PCSORT_H
+
+#include <stdint.h>
+
+#define LPC_MAXKEYS 16			// -k options per blade
+#define LPC_SORTMEM (256 * 1024 * 1024)	// Default memory budget (-S)
+#define LPC_SORTFILES 32		// Spilled runs merged at once
+
+// One -k key. Fields and characters count from 0.
+struct lpc_sortkey {
+    size_t sword;		// Start field
+    size_t schar;		// Start character within it
+    size_t eword;		// End field, SIZE_MAX for the end of the line
+    size_t echar;		// End character, 0 for the end of the field
+    int skipsblanks;		// b on POS1: skip blanks before the start
+    int skipeblanks;		// b on POS2: skip blanks before the end
+    int numeric;		// n
+    int fold;			// f
+    int reverse;		// r
+};
+
+struct lpc_sortspec {
+    struct lpc_sortkey keys[LPC_MAXKEYS];
+    int nkeys;
+    int tab;			// -t character, or -1 to split fields at blanks
+    int reverse;		// -r, which also reverses the last resort comparison
+    int stable;			// -s: no last resort comparison
+};
+
+// uniq(1) options understood natively
+struct lpc_uniqspec {
+    int count;			// -c
+    int dups;			// -d: only lines that repeat
+    int uniqs;			// -u: only lines that don't
+};
+
+struct lpc_sorter;
+struct lpc_group;
+
+int lpc_sort_clocale();
+int lpc_sort_words(const char *s, char *buf, char **argv, int max);
+int lpc_sortspec_parse(struct lpc_sortspec *sp, const char *flags);
+size_t lpc_sort_parsesize(const char *s);
+int lpc_sort_compare(const struct lpc_sortspec *sp, const char *a,
+    size_t alen, const char *b, size_t blen);
+void lpc_sort_spans(const struct lpc_sortspec *sp, struct lpc_span *lines,
+    int n, int threads);
+
+struct lpc_sorter *lpc_sorter_new(const struct lpc_sortspec *sp,
+    size_t budget, int threads, int counted);
+void lpc_sorter_add(struct lpc_sorter *s, const char *p, size_t len);
+void lpc_sorter_addcount(struct lpc_sorter *s, const char *p, size_t len,
+    long count);
+int lpc_sorter_finish(struct lpc_sorter *s);
+int lpc_sorter_next(struct lpc_sorter *s, const char **p, size_t *len,
+    long *count);
+void lpc_sorter_free(struct lpc_sorter *s);
+
+int lpc_uniqspec_parse(struct lpc_uniqspec *up, const char *flags);
+int lpc_uniq_show(const struct lpc_uniqspec *up, long count);
+
+struct lpc_group *lpc_group_new(const struct lpc_sortspec *sp, size_t budget,
+    int threads);
+void lpc_group_add(struct lpc_group *g, const char *p, size_t len);
+void lpc_group_addcount(struct lpc_group *g, const char *p, size_t len,
+    long count);
+void lpc_group_merge(struct lpc_group *g, struct lpc_group *src);
+void lpc_group_finish(struct lpc_group *g);
+int lpc_group_next(struct lpc_group *g, const char **p, size_t *len,
+    long *count);
+void lpc_group_free(struct lpc_group *g);
+
+#endif
@@ -0,0 +1,299 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Resumable filter runs. See pcState.h. */
+
+#include <stdint.h>
+
+#include "pipecut.h"
+#include "pcExec.h"
+#include "pcGzip.h"
+#include "pcPlan.h"
+#include "pcState.h"
+
+/* Values */
+
+void
+lpc_state_putlong(struct lpc_state *s, long v)
+{
+    fprintf(s->fp, "%ld\n", v);
+}
+
+void
+lpc_state_putstr(struct lpc_state *s, const char *p, size_t len)
+{
+    fprintf(s->fp, "%zu\n", len);
+    fwrite(p, 1, len, s->fp);
+    putc('\n', s->fp);
+}
+
+long
+lpc_state_getlong(struct lpc_state *s)
+{
+    char line[64], *ep;
+    long v;
+
+    if (s->bad || !fgets(line, sizeof(line), s->fp)) {
+	s->bad = 1;
+	return 0;
+    }
+    v = strtol(line, &ep, 10);
+    if (ep == line || *ep != '\n') {
+	s->bad = 1;
+	return 0;
+    }
+    return v;
+}
+
+// A string. It's good until the next call.
+const char *
+lpc_state_getstr(struct lpc_state *s, size_t *len)
+{
+    long n = lpc_state_getlong(s);
+
+    *len = 0;
+    if (n < 0)
+	s->bad = 1;
+    if (s->bad)
+	return "";
+    s->str.len = 0;
+    lpc_text_reserve(&s->str, n + 1);
+    if (fread(s->str.p, 1, n + 1, s->fp) != (size_t)n + 1
+	|| s->str.p[n] != '\n') {
+	s->bad = 1;
+	return "";
+    }
+    *len = n;
+    return s->str.p;
+}
+
+/* The input */
+
+// FNV-1a over the first len bytes of fd, so a file replaced in place is noticed.
+static long
+lpc_state_print(int fd, long len)
+{
+    unsigned char buf[LPC_STATEPRINT];
+    uint64_t h = 0xcbf29ce484222325ULL;
+    ssize_t n, i;
+
+    n = pread(fd, buf, len, 0);
+    for (i = 0; i < n; i++)
+	h = (h ^ buf[i]) * 0x100000001b3ULL;
+    return (long)h;
+}
+
+/* The state file */
+
+/* Restore the stages from the state file at path, if there is one, and return the
+ * offset in the input to carry on from.
+ */
+static off_t
+lpc_state_load(struct lpc_pipeline *pl, const char *path, const char *sig,
+    int infd, struct stat *sb)
+{
+    struct lpc_state s;
+    struct lpc_stage *st;
+    char magic[32];
+    const char *p;
+    size_t len;
+    long dev, ino, off, plen, print;
+    int i;
+
+    memset(&s, 0, sizeof(struct lpc_state));
+    if (!(s.fp = fopen(path, "r"))) {
+	if (errno == ENOENT)	// The first run
+	    return 0;
+	fprintf(stderr, "Pipecut Error: could not read %s: %s\n", path,
+	    strerror(errno));
+	exit(-1);
+    }
+    if (!fgets(magic, sizeof(magic), s.fp) || strcmp(magic, LPC_STATEMAGIC))
+	s.bad = 1;
+    p = lpc_state_getstr(&s, &len);
+    if (!s.bad && (len != strlen(sig) || memcmp(p, sig, len))) {
+	fprintf(stderr,
+	    "Pipecut Error: %s holds the state of another toolset (%.*s)\n",
+	    path, (int)len, p);
+	exit(-1);
+    }
+    dev = lpc_state_getlong(&s);
+    ino = lpc_state_getlong(&s);
+    off = lpc_state_getlong(&s);
+    plen = lpc_state_getlong(&s);
+    print = lpc_state_getlong(&s);
+    if (lpc_state_getlong(&s) != pl->nstages)
+	s.bad = 1;
+    for (i = 0; i < pl->nstages && !s.bad; i++) {
+	st = &pl->stages[i];
+	if (lpc_state_getlong(&s) != st->ttype
+	    || lpc_state_getlong(&s) != (st->save != NULL))
+	    s.bad = 1;
+	else if (st->load && !st->load(st, &s))
+	    s.bad = 1;
+    }
+    if (s.bad || plen < 0 || plen > LPC_STATEPRINT || off < plen) {
+	fprintf(stderr, "Pipecut Error: %s is not a state file for this toolset\n",
+	    path);
+	exit(-1);
+    }
+    fclose(s.fp);
+    free(s.str.p);
+
+    // Where to pick up the input
+    if (dev != (long)sb->st_dev || ino != (long)sb->st_ino) {
+	if (lpc_ctx.debug)
+	    fprintf(stderr, "pipecut: the input was rotated, reading it from the top\n");
+	return 0;
+    }
+    if (off > sb->st_size || lpc_state_print(infd, plen) != print) {
+	if (lpc_ctx.debug)
+	    fprintf(stderr, "pipecut: the input was truncated, reading it from the top\n");
+	return 0;
+    }
+    return off;
+}
+
+// Write the state of the stages, for input read up to 'off', to fp.
+static void
+lpc_state_save(struct lpc_pipeline *pl, FILE *fp, const char *sig, int infd,
+    struct stat *sb, off_t off)
+{
+    struct lpc_state s;
+    struct lpc_stage *st;
+    long plen = off < LPC_STATEPRINT ? off : LPC_STATEPRINT;
+    int i;
+
+    memset(&s, 0, sizeof(struct lpc_state));
+    s.fp = fp;
+    fputs(LPC_STATEMAGIC, fp);
+    lpc_state_putstr(&s, sig, strlen(sig));
+    lpc_state_putlong(&s, (long)sb->st_dev);
+    lpc_state_putlong(&s, (long)sb->st_ino);
+    lpc_state_putlong(&s, (long)off);
+    lpc_state_putlong(&s, plen);
+    lpc_state_putlong(&s, lpc_state_print(infd, plen));
+    lpc_state_putlong(&s, pl->nstages);
+    for (i = 0; i < pl->nstages; i++) {
+	st = &pl->stages[i];
+	lpc_state_putlong(&s, st->ttype);
+	lpc_state_putlong(&s, st->save != NULL);
+	if (st->save)
+	    st->save(st, &s);
+    }
+    free(s.str.p);
+}
+
+/* Executor */
+
+/* Run the compiled stages (of the toolset 'blades') over what infd gained since the
+ * last run recorded in the state file at path, and record this one. Serial: -j and -P
+ * don't apply. Returns 0 on success, -1 on a write error.
+ */
+int
+lpc_execute_state(struct lpc_pipeline *pl, struct tailhead *blades, int infd,
+    FILE *out, const char *path)
+{
+    struct lpc_reader rd;
+    struct lpc_batch b;
+    struct stat sb;
+    char sig[BLADECACHE], tmp[PATH_MAX];
+    size_t held = 0;
+    off_t off;
+    FILE *fp;
+    int rc = 0, done = LPC_MORE;
+
+    if (fstat(infd, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+	fprintf(stderr, "Pipecut Error: --state needs a regular file as input\n");
+	exit(-1);
+    }
+    if (lpc_gz_fd(infd)) {	// Offsets into it don't survive the file growing
+	fprintf(stderr, "Pipecut Error: --state can't follow compressed input\n");
+	exit(-1);
+    }
+    lpc_plan_text(blades, sig, sizeof(sig));
+    off = lpc_state_load(pl, path, sig, infd, &sb);
+    if (lseek(infd, off, SEEK_SET) < 0) {
+	fprintf(stderr, "Pipecut Error: could not seek the input: %s\n",
+	    strerror(errno));
+	exit(-1);
+    }
+
+    lpc_reader_init(&rd, infd);
+    lpc_batch_init(&b);
+    while (lpc_reader_next(&rd, &b)) {
+	if (b.noeol) {		// Still being written, perhaps: next time
+	    held = b.lines[--b.nlines].len;
+	    b.noeol = 0;
+	}
+	done = lpc_runstages(pl, 0, &b);
+	if (lpc_batch_write(&b, out) < 0) {
+	    rc = -1;
+	    goto OUT;
+	}
+	if (done == LPC_DONE)	// Nothing more will get through
+	    break;
+    }
+    if (done == LPC_DONE)
+	off = sb.st_size;
+    else if (rd.mapped)
+	off = rd.pos - held;
+    else
+	off = lseek(infd, 0, SEEK_CUR) - rd.carry.len - held;
+
+    snprintf(tmp, PATH_MAX, "%s.tmp", path);
+    if (!(fp = fopen(tmp, "w+"))) {
+	fprintf(stderr, "Pipecut Error: could not write %s: %s\n", tmp,
+	    strerror(errno));
+	exit(-1);
+    }
+    // The flush hands out what the stages hold, so their state goes first.
+    lpc_state_save(pl, fp, sig, infd, &sb, off);
+    rc = lpc_flushstages(pl, 0, &b, out);
+    if (fflush(out) == EOF)
+	rc = -1;
+    if (ferror(fp) || fclose(fp) != 0) {
+	fprintf(stderr, "Pipecut Error: could not write %s\n", tmp);
+	exit(-1);
+    }
+    // If the output didn't make it, the next run does these lines again.
+    if (rc < 0)
+	unlink(tmp);
+    else if (rename(tmp, path) != 0) {
+	fprintf(stderr, "Pipecut Error: could not rename %s to %s: %s\n", tmp,
+	    path, strerror(errno));
+	exit(-1);
+    }
+  OUT:
+    lpc_batch_free(&b);
+    lpc_reader_free(&rd);
+    return rc;
+}
@@ -0,0 +1,71 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Resumable filter runs (--state FILE).
+ *
+ * A cron job that filters the same growing log every minute shouldn't read it from the
+ * top every time. With --state, filter mode records how far into the input it got, and
+ * what the stateful stages had built up by then: wc's counts, the groups of uniq -c,
+ * the lines a sort holds, where cat -n's numbering is. The next run reads those back
+ * and takes only the bytes appended since. A last line without its '\n' is left for
+ * the next run, as a writer may still be busy with it.
+ *
+ * The input has to be a regular file. If it was rotated (a different file now), or
+ * truncated, or replaced, reading starts from the top again, and the stages carry on
+ * from what they had. Blades that run in the shell only see the new lines.
+ *
+ * The file is text: a header line, then one value per line. Strings are their length
+ * on a line, then the bytes and a '\n'. A run writes FILE.tmp, and renames it over FILE
+ * once its output is out, so a failed run leaves the previous state in place.
+ */
+
+#ifndef PCSTATE_H
+#define PCSTATE_H
+
+#define LPC_STATEMAGIC "pipecut state 1\n"
+#define LPC_STATEPRINT 4096		// Bytes at the top of the input that identify it
+
+struct lpc_state {
+    FILE *fp;
+    int bad;			// A read came up short, or didn't parse
+    struct lpc_text str;	// The string lpc_state_getstr() returned last
+};
+
+// For stage save/load hooks
+void lpc_state_putlong(struct lpc_state *s, long v);
+void lpc_state_putstr(struct lpc_state *s, const char *p, size_t len);
+long lpc_state_getlong(struct lpc_state *s);
+const char *lpc_state_getstr(struct lpc_state *s, size_t *len);
+
+int lpc_execute_state(struct lpc_pipeline *pl, struct tailhead *blades,
+    int infd, FILE *out, const char *path);
+
+#endif
@@ -0,0 +1,980 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Native stand-ins for BLACKBOX commands. See pcSubst.h. */
+
+#include "pipecut.h"
+#include "pcExec.h"
+#include "pcSort.h"
+#include "pcState.h"
+#include "pcSubst.h"
+
+#define LPC_SUBARGS 64			// Words in a command we look at
+#define LPC_CUTMAX 1024			// Highest position a cut list may name, but for "N-"
+#define LPC_TRSET 4096			// Bytes in an expanded tr set
+#define LPC_TAILMAX (1024 * 1024)	// Lines tail -n may hold
+
+#define LPC_ISWORDCHAR(c) (isalnum((unsigned char)(c)) || (c) == '_')
+
+// tail -n N: the last N lines seen, oldest at 'first'
+struct lpc_tail {
+    long count;
+    struct lpc_text *ring;
+    long n;			// Lines held
+    long first;
+    long out;			// Handed out so far, at the end of input
+    int noeol;			// The newest had no '\n'
+};
+
+// cut
+struct lpc_cut {
+    int fields;			// -f, or else -b/-c
+    char delim;			// -d
+    int suppress;		// -s: drop lines with no delimiter in them
+    size_t maxpos;		// Highest position selected, but for openfrom
+    size_t openfrom;		// "N-": every position from N on (0 if none)
+    unsigned char sel[LPC_CUTMAX + 1];	// Positions selected, counting from 1
+};
+
+#define LPC_CUTSEL(c, i) ((i) <= LPC_CUTMAX ? (c)->sel[(i)] \
+    : (c)->openfrom && (i) >= (c)->openfrom)
+
+// tr
+struct lpc_tr {
+    unsigned char map[256];
+    unsigned char del[256];	// -d: bytes dropped
+    unsigned char sq[256];	// -s: bytes squeezed, after mapping
+    int plain;			// Bytes are only mapped, one for one
+    int squeeze;		// Any squeezing at all
+    int last;			// Last byte written (for -s), -1 at the start
+};
+
+/* Parsing */
+
+// A count: digits only, no suffixes. Returns 0 if s isn't one.
+static int
+lpc_subst_count(const char *s, long *v)
+{
+    if (!*s)
+	return 0;
+    for (*v = 0; *s; s++) {
+	if (!isdigit((unsigned char)*s) || *v > (LONG_MAX - 9) / 10)
+	    return 0;
+	*v = *v * 10 + (*s - '0');
+    }
+    return 1;
+}
+
+// head and tail: [-n N | -nN | -N]. tail also takes -n +N.
+static int
+lpc_subst_lines(char **argv, struct lpc_lines *ln, int tail)
+{
+    const char *arg;
+    int i;
+
+    ln->count = 10;
+    ln->from = 0;
+    for (i = 1; argv[i]; i++) {
+	arg = argv[i];
+	if (arg[0] != '-')	// Files
+	    return 0;
+	if (isdigit((unsigned char)arg[1]))
+	    arg++;
+	else if (arg[1] != 'n' || !(arg = arg[2] ? arg + 2 : argv[++i]))
+	    return 0;
+	ln->from = tail && *arg == '+';
+	if (!lpc_subst_count(arg + ln->from, &ln->count))
+	    return 0;
+    }
+    return 1;
+}
+
+// A position in a cut list
+static int
+lpc_cut_pos(const char **s, size_t *v)
+{
+    const char *cp = *s;
+
+    for (*v = 0; isdigit((unsigned char)*cp); cp++) {
+	if (*v > (SIZE_MAX - 9) / 10)
+	    return 0;
+	*v = *v * 10 + (*cp - '0');
+    }
+    if (cp == *s)
+	return 0;
+    *s = cp;
+    return 1;
+}
+
+// N, N-M, N- and -M, separated by commas
+static int
+lpc_cut_list(struct lpc_cut *c, const char *s)
+{
+    size_t lo, hi, i;
+    int n;
+
+    for (;;) {
+	n = lpc_cut_pos(&s, &lo);
+	if (!n)
+	    lo = 1;
+	if (*s == '-') {
+	    s++;
+	    if (!lpc_cut_pos(&s, &hi)) {
+		if (!n)		// A lone '-'
+		    return 0;
+		hi = SIZE_MAX;
+	    }
+	} else if (n) {
+	    hi = lo;
+	} else {
+	    return 0;
+	}
+	if (lo == 0 || hi < lo)
+	    return 0;
+	if (hi == SIZE_MAX) {
+	    if (!c->openfrom || lo < c->openfrom)
+		c->openfrom = lo;
+	} else {
+	    if (hi > LPC_CUTMAX)
+		return 0;
+	    for (i = lo; i <= hi; i++)
+		c->sel[i] = 1;
+	    if (hi > c->maxpos)
+		c->maxpos = hi;
+	}
+	if (*s != ',')
+	    break;
+	s++;
+    }
+    if (*s)
+	return 0;
+    for (i = c->openfrom; c->openfrom && i <= LPC_CUTMAX; i++)
+	c->sel[i] = 1;
+    return 1;
+}
+
+// cut -f LIST [-d C] [-s], cut -b LIST, cut -c LIST
+static int
+lpc_subst_cut(char **argv, struct lpc_cut *c)
+{
+    const char *cp, *arg;
+    int i, lists = 0, delim = 0;
+
+    memset(c, 0, sizeof(struct lpc_cut));
+    c->delim = '\t';
+    for (i = 1; argv[i]; i++) {
+	cp = argv[i];
+	if (cp[0] != '-' || cp[1] == '\0' || cp[1] == '-')
+	    return 0;		// Files, long options
+	for (cp++; *cp; cp++) {
+	    if (*cp == 's') {
+		c->suppress = 1;
+		continue;
+	    }
+	    if (*cp == 'n')	// -b: don't split characters. Bytes are all we see.
+		continue;
+	    if (!strchr("bcdf", *cp) || !(arg = cp[1] ? cp + 1 : argv[++i]))
+		return 0;
+#ifndef __linux__
+	    if (*cp == 'c')	// BSD cut -c counts characters
+		return 0;
+#endif
+	    if (*cp == 'd') {
+		if (strlen(arg) != 1 || *arg == '\n')
+		    return 0;
+		c->delim = *arg;
+		delim = 1;
+	    } else {
+		if (lists++ || !lpc_cut_list(c, arg))
+		    return 0;
+		c->fields = (*cp == 'f');
+	    }
+	    break;
+	}
+    }
+    return lists && (c->fields || (!delim && !c->suppress));
+}
+
+// One character of a tr set, with its escapes
+static int
+lpc_tr_char(const char **sp)
+{
+    const char *s = *sp;
+    int c, n;
+
+    if (*s != '\\' || !s[1]) {
+	*sp = s + 1;
+	return (unsigned char)*s;
+    }
+    s++;
+    switch (*s) {
+    case 'a':
+	c = '\a';
+	break;
+    case 'b':
+	c = '\b';
+	break;
+    case 'f':
+	c = '\f';
+	break;
+    case 'n':
+	c = '\n';
+	break;
+    case 'r':
+	c = '\r';
+	break;
+    case 't':
+	c = '\t';
+	break;
+    case 'v':
+	c = '\v';
+	break;
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+	for (c = 0, n = 0; n < 3 && *s >= '0' && *s <= '7'
+	    && c * 8 + (*s - '0') < 256; n++)
+	    c = c * 8 + (*s++ - '0');
+	*sp = s;
+	return c;
+    default:
+	c = (unsigned char)*s;
+	break;
+    }
+    *sp = s + 1;
+    return c;
+}
+
+// Expand a tr set. Returns its length, or -1 for what we leave to tr ([:alpha:], [x*n] ...).
+static int
+lpc_tr_set(const char *s, unsigned char *set)
+{
+    int n = 0, lo, hi;
+
+    while (*s) {
+	if (*s == '[')
+	    return -1;
+	lo = lpc_tr_char(&s);
+	hi = lo;
+	if (*s == '-' && s[1]) {
+	    s++;
+	    if (*s == '[' || (hi = lpc_tr_char(&s)) < lo)
+		return -1;
+	}
+	for (; lo <= hi; lo++) {
+	    if (n == LPC_TRSET)
+		return -1;
+	    set[n++] = lo;
+	}
+    }
+    return n;
+}
+
+// tr SET1 SET2, tr -d SET1, tr -s SET1 [SET2], tr -ds SET1 SET2
+static int
+lpc_subst_tr(char **argv, struct lpc_tr *t)
+{
+    unsigned char s1[LPC_TRSET], s2[LPC_TRSET];
+    const char *cp;
+    int i, k, d = 0, s = 0, n1, n2 = 0;
+
+    for (i = 1; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+	for (cp = argv[i] + 1; *cp; cp++) {
+	    if (*cp == 'd')
+		d = 1;
+	    else if (*cp == 's')
+		s = 1;
+	    else		// -c, -C, -t, long options
+		return 0;
+	}
+    }
+    if (!argv[i] || (n1 = lpc_tr_set(argv[i++], s1)) <= 0)
+	return 0;
+    if (argv[i] && (n2 = lpc_tr_set(argv[i++], s2)) <= 0)
+	return 0;
+    if (argv[i])
+	return 0;
+    // The combinations tr(1) accepts
+    if (d ? s != (n2 > 0) : !s && !n2)
+	return 0;
+
+    memset(t, 0, sizeof(struct lpc_tr));
+    for (k = 0; k < 256; k++)
+	t->map[k] = k;
+    for (k = 0; k < n1; k++) {
+	if (d)
+	    t->del[s1[k]] = 1;
+	else if (n2)		// SET2 is padded out with its last byte
+	    t->map[s1[k]] = s2[k < n2 ? k : n2 - 1];
+    }
+    if (s) {
+	for (k = 0; k < (n2 ? n2 : n1); k++)
+	    t->sq[n2 ? s2[k] : s1[k]] = 1;
+	t->squeeze = 1;
+    }
+    // Lines may be split, but never joined: that's tr for the shell.
+    if (t->del['\n'] || t->map['\n'] != '\n')
+	return 0;
+    t->plain = !d && !s;
+    for (k = 0; k < 256 && t->plain; k++) {
+	if (k != '\n' && t->map[k] == '\n')
+	    t->plain = 0;
+    }
+    t->last = -1;
+    return 1;
+}
+
+/* awk '{print ...}', where the print list only has fields and strings, as a FORMAT
+ * pattern: '{print $8, $9}' becomes "$8 $9". Returns NULL for any other program.
+ */
+static char *
+lpc_subst_awk(const char *s)
+{
+    char *fmt = malloc(2 * strlen(s) + 3);
+    char *o = fmt;
+    int prev = 0;		// Last in the list: 0 nothing, 1 field $N, 2 other item, 3 comma
+
+#define LPC_SKIPWS(s) while (isspace((unsigned char)*(s))) (s)++
+    LPC_SKIPWS(s);
+    if (*s++ != '{')
+	goto BAD;
+    LPC_SKIPWS(s);
+    if (strncmp(s, "print", 5) || LPC_ISWORDCHAR(s[5]))
+	goto BAD;
+    for (s += 5;;) {
+	LPC_SKIPWS(s);
+	if (*s == ',') {
+	    if (prev == 0 || prev == 3)
+		goto BAD;
+	    *o++ = ' ';		// OFS
+	    prev = 3;
+	    s++;
+	} else if (s[0] == '$' && s[1] == 'N' && s[2] == 'F'
+	    && !LPC_ISWORDCHAR(s[3])) {
+	    o = stpcpy(o, "$NF");
+	    prev = 2;
+	    s += 3;
+	} else if (s[0] == '$' && isdigit((unsigned char)s[1])) {
+	    *o++ = *s++;
+	    while (isdigit((unsigned char)*s))
+		*o++ = *s++;
+	    if (LPC_ISWORDCHAR(*s) || *s == '.')
+		goto BAD;
+	    prev = 1;
+	} else if (*s == '"') {
+	    // After $1, a string starting with a digit would read as part of the number
+	    if (prev == 1 && isdigit((unsigned char)s[1]))
+		goto BAD;
+	    for (s++; *s != '"'; s++) {
+		if (!*s)
+		    goto BAD;
+		if (*s == '\\' && s[1]) {
+		    *o++ = *s++;
+		} else if (*s == '$') {
+		    *o++ = '\\';
+		}
+		*o++ = *s;
+	    }
+	    s++;
+	    prev = 2;
+	} else {
+	    break;
+	}
+    }
+#undef LPC_SKIPWS
+    if (prev == 3)
+	goto BAD;
+    if (prev == 0)		// print on its own prints $0
+	o = stpcpy(o, "$0");
+    while (isspace((unsigned char)*s))
+	s++;
+    if (*s == ';')
+	s++;
+    while (isspace((unsigned char)*s))
+	s++;
+    if (*s++ != '}')
+	goto BAD;
+    while (isspace((unsigned char)*s))
+	s++;
+    if (*s)
+	goto BAD;
+    *o = '\0';
+    return fmt;
+
+  BAD:
+    free(fmt);
+    return NULL;
+}
+
+// The text after the command's name: sort(1) and uniq(1) options, for their own parsers
+static const char *
+lpc_subst_rest(const char *cmd)
+{
+    while (isspace((unsigned char)*cmd))
+	cmd++;
+    while (*cmd && !isspace((unsigned char)*cmd))
+	cmd++;
+    return cmd;
+}
+
+// Recognize a BLACKBOX command. Returns its LPC_SUB_ kind.
+int
+lpc_subst_parse(const char *cmd, struct lpc_subst *sb)
+{
+    char *argv[LPC_SUBARGS + 1];
+    char *buf;
+
+    memset(sb, 0, sizeof(struct lpc_subst));
+    buf = malloc(strlen(cmd) + 1);
+    if (!lpc_sort_words(cmd, buf, argv, LPC_SUBARGS) || !argv[0])
+	goto OUT;
+    if (!strcmp(argv[0], "sort") || !strcmp(argv[0], "uniq")) {
+	sb->kind = LPC_SUB_BLADE;
+	sb->ttype = argv[0][0] == 's' ? ORDER : UNIQUE;
+	sb->pattern = lpc_subst_rest(cmd);
+    } else if (!strcmp(argv[0], "wc") && !argv[1]) {
+	sb->kind = LPC_SUB_BLADE;
+	sb->ttype = SUMMARIZE;
+	sb->pattern = "";
+    } else if (!strcmp(argv[0], "wc") && !strcmp(argv[1], "-l") && !argv[2]) {
+	sb->kind = LPC_SUB_COUNT;
+	sb->spec = calloc(1, sizeof(long));
+    } else if (!strcmp(argv[0], "awk") && argv[1] && !argv[2]) {
+	if ((sb->text = lpc_subst_awk(argv[1]))) {
+	    sb->kind = LPC_SUB_BLADE;
+	    sb->ttype = FORMAT;
+	    sb->pattern = sb->text;
+	}
+    } else if (!strcmp(argv[0], "cat")) {
+	if (!argv[1] || (!strcmp(argv[1], "-n") && !argv[2])) {
+	    sb->kind = LPC_SUB_CAT;
+	    sb->spec = argv[1] ? calloc(1, sizeof(long)) : NULL;
+	}
+    } else if (!strcmp(argv[0], "head") || !strcmp(argv[0], "tail")) {
+	sb->spec = malloc(sizeof(struct lpc_lines));
+	if (lpc_subst_lines(argv, sb->spec, argv[0][0] == 't'))
+	    sb->kind = argv[0][0] == 't' ? LPC_SUB_TAIL : LPC_SUB_HEAD;
+    } else if (!strcmp(argv[0], "cut")) {
+	sb->spec = malloc(sizeof(struct lpc_cut));
+	if (lpc_subst_cut(argv, sb->spec))
+	    sb->kind = LPC_SUB_CUT;
+    } else if (!strcmp(argv[0], "tr")) {
+	sb->spec = malloc(sizeof(struct lpc_tr));
+	if (lpc_subst_tr(argv, sb->spec))
+	    sb->kind = LPC_SUB_TR;
+    }
+  OUT:
+    free(buf);
+    if (sb->kind == LPC_SUB_NONE)
+	lpc_subst_free(sb);
+    return sb->kind;
+}
+
+void
+lpc_subst_free(struct lpc_subst *sb)
+{
+    free(sb->text);
+    free(sb->spec);
+    sb->text = NULL;
+    sb->spec = NULL;
+}
+
+/* Stages */
+
+static int
+lpc_run_cat(struct lpc_stage *st, struct lpc_batch *b)
+{
+    return LPC_MORE;
+}
+
+static int
+lpc_run_catn(struct lpc_stage *st, struct lpc_batch *b)
+{
+    long *line = st->priv;
+    char num[32];
+    int i, n, noeol = b->noeol;
+
+    for (i = 0; i < b->nlines; i++) {
+	n = snprintf(num, 32, "%6ld\t", ++*line);
+	lpc_batch_put(b, num, n);
+	lpc_batch_put(b, b->lines[i].p, b->lines[i].len);
+	lpc_batch_endline(b);
+    }
+    lpc_batch_commit(b);
+    b->noeol = noeol;		// cat doesn't add a missing '\n'
+    return LPC_MORE;
+}
+
+static int
+lpc_run_head(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_lines *ln = st->priv;
+
+    if (b->nlines < ln->count) {
+	ln->count -= b->nlines;
+	return LPC_MORE;
+    }
+    if (b->nlines > ln->count) {	// The last line kept had its '\n'
+	b->nlines = ln->count;
+	b->noeol = 0;
+    }
+    ln->count = 0;
+    return LPC_DONE;
+}
+
+// tail -n +N
+static int
+lpc_run_tailfrom(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_lines *ln = st->priv;
+
+    if (ln->count >= b->nlines) {
+	ln->count -= b->nlines;
+	b->nlines = 0;
+	return LPC_MORE;
+    }
+    if (ln->count) {
+	memmove(b->lines, b->lines + ln->count,
+	    (b->nlines - ln->count) * sizeof(struct lpc_span));
+	b->nlines -= ln->count;
+	ln->count = 0;
+    }
+    return LPC_MORE;
+}
+
+// tail -n N: copy out the lines that may be among the last N
+static int
+lpc_run_tail(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_tail *t = st->priv;
+    struct lpc_text *r;
+    int i;
+
+    i = b->nlines > t->count ? b->nlines - t->count : 0;
+    for (; i < b->nlines; i++) {
+	if (t->n < t->count) {
+	    r = &t->ring[(t->first + t->n++) % t->count];
+	} else {
+	    r = &t->ring[t->first];
+	    t->first = (t->first + 1) % t->count;
+	}
+	r->len = 0;
+	lpc_text_reserve(r, b->lines[i].len + 1);
+	memcpy(r->p, b->lines[i].p, b->lines[i].len);
+	r->len = b->lines[i].len;
+    }
+    if (b->nlines)
+	t->noeol = b->noeol;
+    b->nlines = 0;
+    return LPC_MORE;
+}
+
+static int
+lpc_flush_tail(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_tail *t = st->priv;
+    struct lpc_text *r;
+    size_t n = 0;
+
+    while (t->out < t->n && n < LPC_BATCHSIZE) {
+	r = &t->ring[(t->first + t->out++) % t->count];
+	lpc_batch_addline(b, r->p, r->len);	// Held until fini
+	n += r->len + 1;
+    }
+    if (t->out < t->n)
+	return LPC_MORE;
+    b->noeol = t->n && t->noeol;
+    return LPC_DONE;
+}
+
+static void
+lpc_fini_tail(struct lpc_stage *st)
+{
+    struct lpc_tail *t = st->priv;
+    long i;
+
+    for (i = 0; i < t->count; i++)
+	free(t->ring[i].p);
+    free(t->ring);
+    free(t);
+    st->priv = NULL;
+}
+
+static void
+lpc_cut_fields(struct lpc_cut *c, struct lpc_batch *b, const char *p,
+    size_t len)
+{
+    const char *ep = p + len;
+    const char *dp, *end;
+    size_t i;
+    int any = 0;
+
+    if (!memchr(p, c->delim, len)) {	// Passed through whole, unless -s
+	if (!c->suppress) {
+	    lpc_batch_put(b, p, len);
+	    lpc_batch_endline(b);
+	}
+	return;
+    }
+    for (i = 1;; i++) {
+	dp = memchr(p, c->delim, ep - p);
+	end = dp ? dp : ep;
+	if (LPC_CUTSEL(c, i)) {
+	    if (any)
+		lpc_batch_put(b, &c->delim, 1);
+	    lpc_batch_put(b, p, end - p);
+	    any = 1;
+	}
+	if (!dp || (i >= c->maxpos && !c->openfrom))
+	    break;
+	p = dp + 1;
+    }
+    lpc_batch_endline(b);
+}
+
+static void
+lpc_cut_bytes(struct lpc_cut *c, struct lpc_batch *b, const char *p,
+    size_t len)
+{
+    size_t i = 0, j;
+
+    while (i < len) {
+	if (!LPC_CUTSEL(c, i + 1)) {
+	    if (i >= c->maxpos && !c->openfrom)
+		break;
+	    i++;
+	    continue;
+	}
+	for (j = i + 1; j < len && LPC_CUTSEL(c, j + 1); j++) ;
+	lpc_batch_put(b, p + i, j - i);
+	i = j;
+    }
+    lpc_batch_endline(b);
+}
+
+static int
+lpc_run_cut(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_cut *c = st->priv;
+    int i;
+
+    for (i = 0; i < b->nlines; i++) {
+	if (c->fields)
+	    lpc_cut_fields(c, b, b->lines[i].p, b->lines[i].len);
+	else
+	    lpc_cut_bytes(c, b, b->lines[i].p, b->lines[i].len);
+    }
+    lpc_batch_commit(b);
+    return LPC_MORE;
+}
+
+/* tr never makes a line longer, so each one is written straight into the batch's
+ * scratch text, reserved up front. A byte mapped to '\n' ends an output line there.
+ */
+static int
+lpc_run_tr(struct lpc_stage *st, struct lpc_batch *b)
+{
+    struct lpc_tr *t = st->priv;
+    const unsigned char *p, *ep;
+    char *o;
+    int i, c, noeol = b->noeol;
+
+    for (i = 0; i < b->nlines; i++) {
+	p = (const unsigned char *)b->lines[i].p;
+	ep = p + b->lines[i].len;
+	lpc_text_reserve(&b->tmp, ep - p);
+	o = b->tmp.p + b->tmp.len;
+	if (t->plain) {
+	    for (; p < ep; p++)
+		*o++ = t->map[*p];
+	    b->tmp.len = o - b->tmp.p;
+	    lpc_batch_endline(b);
+	    continue;
+	}
+	for (; p < ep; p++) {
+	    if (t->del[*p])
+		continue;
+	    c = t->map[*p];
+	    if (t->sq[c] && c == t->last)
+		continue;
+	    t->last = c;
+	    if (c != '\n') {
+		*o++ = c;
+		continue;
+	    }
+	    b->tmp.len = o - b->tmp.p;
+	    lpc_batch_endline(b);
+	}
+	b->tmp.len = o - b->tmp.p;
+	if (i == b->nlines - 1 && noeol) {	// No '\n' of its own to write
+	    if (b->tmp.len > b->olinestart)
+		lpc_batch_endline(b);
+	    else
+		noeol = 0;
+	    break;
+	}
+	if (t->sq['\n'] && t->last == '\n')
+	    continue;
+	t->last = '\n';
+	lpc_batch_endline(b);
+    }
+    lpc_batch_commit(b);
+    b->noeol = noeol;
+    return LPC_MORE;
+}
+
+// wc -l: count the '\n's, and print the count at the end of input
+static int
+lpc_run_count(struct lpc_stage *st, struct lpc_batch *b)
+{
+    long *count = st->priv;
+
+    *count += b->nlines - (b->noeol && b->nlines);
+    b->nlines = 0;
+    return LPC_MORE;
+}
+
+static int
+lpc_flush_count(struct lpc_stage *st, struct lpc_batch *b)
+{
+    char num[32];
+
+    lpc_batch_put(b, num, snprintf(num, sizeof(num), LPC_WCL_FMT,
+	    *(long *)st->priv));
+    lpc_batch_endline(b);
+    lpc_batch_commit(b);
+    return LPC_DONE;
+}
+
+static void
+lpc_clone_count(struct lpc_stage *dst, struct lpc_stage *src)
+{
+    dst->priv = calloc(1, sizeof(long));
+}
+
+static void
+lpc_merge_count(struct lpc_stage *dst, struct lpc_stage *src)
+{
+    *(long *)dst->priv += *(long *)src->priv;
+}
+
+static void
+lpc_clone_cat(struct lpc_stage *dst, struct lpc_stage *src)
+{
+}
+
+static void
+lpc_clone_cut(struct lpc_stage *dst, struct lpc_stage *src)
+{
+    dst->priv = malloc(sizeof(struct lpc_cut));
+    memcpy(dst->priv, src->priv, sizeof(struct lpc_cut));
+}
+
+static void
+lpc_clone_tr(struct lpc_stage *dst, struct lpc_stage *src)
+{
+    dst->priv = malloc(sizeof(struct lpc_tr));
+    memcpy(dst->priv, src->priv, sizeof(struct lpc_tr));
+}
+
+/* --state */
+
+// cat -n's line number, wc -l's count
+static void
+lpc_save_long(struct lpc_stage *st, struct lpc_state *s)
+{
+    lpc_state_putlong(s, *(long *)st->priv);
+}
+
+static int
+lpc_load_long(struct lpc_stage *st, struct lpc_state *s)
+{
+    *(long *)st->priv = lpc_state_getlong(s);
+    return !s->bad;
+}
+
+// head -n: lines still to let through. tail -n +N: lines still to skip.
+static void
+lpc_save_lines(struct lpc_stage *st, struct lpc_state *s)
+{
+    struct lpc_lines *ln = st->priv;
+
+    lpc_state_putlong(s, ln->count);
+}
+
+static int
+lpc_load_lines(struct lpc_stage *st, struct lpc_state *s)
+{
+    struct lpc_lines *ln = st->priv;
+
+    ln->count = lpc_state_getlong(s);
+    return !s->bad && ln->count >= 0;
+}
+
+// tail -n N: the lines held, oldest first
+static void
+lpc_save_tail(struct lpc_stage *st, struct lpc_state *s)
+{
+    struct lpc_tail *t = st->priv;
+    struct lpc_text *r;
+    long i;
+
+    lpc_state_putlong(s, t->n);
+    for (i = 0; i < t->n; i++) {
+	r = &t->ring[(t->first + i) % t->count];
+	lpc_state_putstr(s, r->p, r->len);
+    }
+}
+
+static int
+lpc_load_tail(struct lpc_stage *st, struct lpc_state *s)
+{
+    struct lpc_tail *t = st->priv;
+    struct lpc_text *r;
+    const char *p;
+    size_t len;
+    long n = lpc_state_getlong(s);
+
+    if (n < 0 || n > t->count)
+	return 0;
+    for (t->n = 0; t->n < n; t->n++) {
+	p = lpc_state_getstr(s, &len);
+	r = &t->ring[t->n];
+	r->len = 0;
+	lpc_text_reserve(r, len + 1);
+	memcpy(r->p, p, len);
+	r->len = len;
+    }
+    t->first = 0;
+    return !s->bad;
+}
+
+// tr -s: the last byte written, which the next line's first may squeeze into
+static void
+lpc_save_tr(struct lpc_stage *st, struct lpc_state *s)
+{
+    struct lpc_tr *t = st->priv;
+
+    lpc_state_putlong(s, t->last);
+}
+
+static int
+lpc_load_tr(struct lpc_stage *st, struct lpc_state *s)
+{
+    struct lpc_tr *t = st->priv;
+
+    t->last = lpc_state_getlong(s);
+    return !s->bad && t->last >= -1 && t->last < 256;
+}
+
+static void
+lpc_fini_subst(struct lpc_stage *st)
+{
+    free(st->priv);
+    st->priv = NULL;
+}
+
+/* Set st up to run a command lpc_subst_parse() recognized, of a kind with no blade
+ * type of its own. Returns 0 if it can't after all.
+ */
+int
+lpc_subst_init(struct lpc_stage *st, struct lpc_subst *sb)
+{
+    struct lpc_lines *ln = sb->spec;
+    struct lpc_tail *t;
+
+    st->fini = lpc_fini_subst;
+    switch (sb->kind) {
+    case LPC_SUB_CAT:
+	st->run = sb->spec ? lpc_run_catn : lpc_run_cat;
+	st->clone = sb->spec ? NULL : lpc_clone_cat;
+	if (sb->spec) {
+	    st->save = lpc_save_long;
+	    st->load = lpc_load_long;
+	}
+	break;
+    case LPC_SUB_HEAD:
+	st->run = lpc_run_head;
+	st->save = lpc_save_lines;
+	st->load = lpc_load_lines;
+	break;
+    case LPC_SUB_TAIL:
+	if (ln->from) {
+	    st->run = lpc_run_tailfrom;
+	    st->save = lpc_save_lines;
+	    st->load = lpc_load_lines;
+	    ln->count = ln->count > 0 ? ln->count - 1 : 0;	// Lines to skip
+	    break;
+	}
+	if (ln->count > LPC_TAILMAX)
+	    return 0;
+	t = calloc(1, sizeof(struct lpc_tail));
+	t->count = ln->count;
+	t->ring = calloc(t->count + 1, sizeof(struct lpc_text));
+	st->run = lpc_run_tail;
+	st->flush = lpc_flush_tail;
+	st->fini = lpc_fini_tail;
+	st->save = lpc_save_tail;
+	st->load = lpc_load_tail;
+	st->priv = t;
+	return 1;
+    case LPC_SUB_CUT:
+	st->run = lpc_run_cut;
+	st->clone = lpc_clone_cut;
+	break;
+    case LPC_SUB_TR:
+	st->run = lpc_run_tr;
+	if (!((struct lpc_tr *)sb->spec)->squeeze) {	// -s carries over from line to line
+	    st->clone = lpc_clone_tr;
+	    break;
+	}
+	st->save = lpc_save_tr;
+	st->load = lpc_load_tr;
+	break;
+    case LPC_SUB_COUNT:
+	st->run = lpc_run_count;
+	st->flush = lpc_flush_count;
+	st->clone = lpc_clone_count;
+	st->merge = lpc_merge_count;
+	st->save = lpc_save_long;
+	st->load = lpc_load_long;
+	break;
+    default:
+	return 0;
+    }
+    st->priv = sb->spec;
+    sb->spec = NULL;
+    return 1;
+}
@@ -0,0 +1,72 @@
+// # vim: shiftwidth=4 tabstop=4 softtabstop=4 expandtab
+// # indent: -bap -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip -l79 -nbc -ncdb -ndj -ei -nfc1 -nlp -npcs -psl -sc -sob
+// # Gnu indent: -bap -nbad -br -ce -ci4 -cli0 -d0 -di0 -i4 -ip4 -l79 -nbc -ncdb -ndj -nfc1 -nlp -npcs -psl -sc -sob
+/*
+ * Copyright (c) 2015, David William Maxwell david_at_NetBSD_dot_org
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Native stand-ins for common BLACKBOX commands.
+ *
+ * A BLACKBOX blade is a shell command, and costs a fork, an exec and two pipe copies
+ * each time it runs. Most are simple ones: sort -nr, uniq -c, cat -n, head, tail,
+ * cut -d: -f2, tr a-z A-Z, wc -l, awk '{print $1}'. lpc_subst_parse() recognizes those whose
+ * options it fully supports. Some are the same job as a native blade type (sort is
+ * ORDER, awk print is FORMAT), and run as that; the rest get a stage of their own
+ * from lpc_subst_init(). Anything else still goes to the shell.
+ */
+
+#ifndef PCSUBST_H
+#define PCSUBST_H
+
+// What a BLACKBOX command was recognized as
+#define LPC_SUB_NONE 0			// Not at all: run it in the shell
+#define LPC_SUB_BLADE 1			// A native blade type, in 'ttype' and 'pattern'
+#define LPC_SUB_CAT 2			// cat, cat -n
+#define LPC_SUB_HEAD 3			// head -n N
+#define LPC_SUB_TAIL 4			// tail -n N, tail -n +N
+#define LPC_SUB_CUT 5			// cut -f, -b, -c
+#define LPC_SUB_TR 6			// tr [-ds] SET1 [SET2]
+#define LPC_SUB_COUNT 7			// wc -l
+
+struct lpc_subst {
+    int kind;			// LPC_SUB_*
+    Tooltype ttype;		// LPC_SUB_BLADE: the blade type that does the same job
+    const char *pattern;	// ... and its pattern
+    char *text;			// Storage for 'pattern', where it isn't the command's own text
+    void *spec;			// Other kinds: the parsed options, for lpc_subst_init()
+};
+
+// head -n, tail -n
+struct lpc_lines {
+    long count;			// Lines to keep (tail -n +N: lines still to skip)
+    int from;			// tail -n +N: from line N on
+};
+
+int lpc_subst_parse(const char *cmd, struct lpc_subst *sb);
+int lpc_subst_init(struct lpc_stage *st, struct lpc_subst *sb);
+void lpc_subst_free(struct lpc_subst *sb);
+
+#endif
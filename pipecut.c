@@ -65,19 +65,57 @@
 #define Q "";
 //#define Q curs_set(1); refresh();
 
+#include <getopt.h>
+
 #include "pipecut.h"		// libpipecut backend include file
 #include "ipe.h"		// Interactive pipeline editor - front-end include file
+#include "pcBench.h"		// Comparing the backends
 #include "pcDB.h"		// Database routines that will move to the back
+#include "pcEmit.h"		// Code generation
+#include "pcExec.h"		// Native execution engine (filter mode)
+#include "pcFollow.h"		// Following a growing source
+#include "pcGzip.h"		// Compressed sources
+#include "pcMatch.h"		// Fused INCLUDE/EXCLUDE matching
+#include "pcPct.h"		// Compiled toolsets
+#include "pcPlan.h"		// Toolset rewriting
+#include "pcScan.h"		// Vectorized line indexing
+#include "pcServe.h"		// Filter server and its clients
+#include "pcShare.h"		// Several toolsets over one read of the input
+#include "pcSort.h"		// Native sort
 
 struct termios oldt, newt;
 
+// Long options that have no short form
+enum {
+    LPC_OPT_EXPLAIN = 256,
+    LPC_OPT_STATE,
+    LPC_OPT_SERVE,
+    LPC_OPT_CONNECT,
+    LPC_OPT_COMPILE,
+    LPC_OPT_EMIT,
+    LPC_OPT_JIT,
+    LPC_OPT_BENCH,
+};
+
+static struct option lpc_longopts[] = {
+    {"explain", no_argument, NULL, LPC_OPT_EXPLAIN},
+    {"state", required_argument, NULL, LPC_OPT_STATE},
+    {"serve", required_argument, NULL, LPC_OPT_SERVE},
+    {"connect", required_argument, NULL, LPC_OPT_CONNECT},
+    {"compile", required_argument, NULL, LPC_OPT_COMPILE},
+    {"emit", required_argument, NULL, LPC_OPT_EMIT},
+    {"jit", no_argument, NULL, LPC_OPT_JIT},
+    {"bench", required_argument, NULL, LPC_OPT_BENCH},
+    {NULL, 0, NULL, 0}
+};
+
 char lpc_toolcmds[22][20] = {	// XXX Move this to the lpc library sourcee when it splits.
     "NULL '", "' NULL",
     "cat ", "",
     " | ", "",
     "BLACKBOX '", "",
     "egrep -v '", "'",
-    "awk '{print \"", "\\n\"}'",
+    "awk '{print \"", "\"}'",
     "egrep '", "'",
     "wc ", "",
     "sort ", "",
@@ -115,7 +153,23 @@ int parse_from_pipe = 0;
 // libpipecut Functions
 void pc_init(struct pipecut_ctx *ctx);	// Initialize Context
 // Execution of functions
-int pc_wc_w(char *str);		// WC - wordcount words
+static int appendLine(char dst[BLADECACHE], size_t *dlen, const char *p, size_t len);
+static void appendStageLine(void *arg, const char *p, size_t len);
+
+// Where appendStageLine() appends
+struct lineout {
+    char *dst;
+    size_t len;
+    int full;
+};
+static long catPage(struct lpc_map *m, long off, char tmpbuf[BLADECACHE]);
+static long catGzPage(long off, char tmpbuf[BLADECACHE]);
+static struct lpc_map catmap;	// The CAT blade's file, mapped for the session
+static struct lpc_gz catgz;	// Its seek points, if it's gzip'd
+// Follow mode ('F')
+static int nextKey();
+static int followStart();
+static void followStop();
 // Front-end instantiator functions for various blade types 
 void newExclude();
 void newInclude();
@@ -189,8 +243,9 @@ void bladeAction(struct toolelement *blade, char tmpbuf[BLADECACHE]);
  * comparative performance analysis, or maintaining the modifiers in a language-abstract
  * way so that the implementation can migrate between languages as needed.
  *
- * Implemented output formats: shell script
- * Planned output formats: perl, python, C
+ * Implemented output formats: shell script, C, awk, perl, python (--emit)
+ * pipecut --bench runs a toolset in each of them, and in each way pipecut runs it
+ * itself, over a sample, and compares the results.
  *
  * Pipecut can also be run with command line arguments (-t) to execute a pipecut
  * toolset and process
@@ -222,10 +277,12 @@ main(int argc, char *argv[])
     char l3[16384];
     char *cp;
     FILE *fp;
-    int ch;
 
     char lesspipe[BLADECACHE];	// XXX fixed size bad
     int k;
+    int oargc;
+    char **oargv;
+    struct lpc_plan plan;
     lpc_ctx.debug = 0;
 
 /* Handle the case of piped input */
@@ -235,28 +292,11 @@ main(int argc, char *argv[])
 //sleep(10); // Give gdb a chance to attach
 
 // Check command line arguments
-    while ((ch = getopt(argc, argv, "ht:v")) != -1) {
-	switch (ch) {
-
-	case 'h':
-	    usage(NULL);
-	    break;
-	case 't':
-	    lpc_ctx.filtermode = 1;
-	    lpc_ctx.filter = optarg;
-	    break;
-	case 'v':
-	    version();
-	    break;
-	case '?':
-	    usage(NULL);
-	    break;
-	default:
-	    break;
-	}
-    }
-    argc -= optind;
-    argv += optind;
+    oargc = argc;
+    oargv = argv;
+    k = pc_parseargs(argc, argv);
+    argc -= k;
+    argv += k;
 
 /* Would like to check for DB early - but we can't interact with the user until we know
    the mode we're running in. So get past those checks first. */
@@ -284,26 +324,67 @@ main(int argc, char *argv[])
     // Initialize the tool list
     TAILQ_INIT(&head);
 
+    // A server keeps toolsets loaded for its clients; a client hands its job to one.
+    if (lpc_ctx.connect)
+	exit(lpc_connect(lpc_ctx.connect, oargc, oargv));
+    if (lpc_ctx.serve)
+	lpc_serve(lpc_ctx.serve);	// Doesn't return
+
+    // --compile: plan a toolset once, for -f to run without the database
+    if (lpc_ctx.compile) {
+	lpc_ctx.filter = lpc_ctx.compile;
+	pc_loadToolset(2);	// 2 for no curses
+	lpc_pct_write(&head, lpc_ctx.compile, lpc_ctx.outputs);
+	exit(0);
+    }
+    // --emit: the toolset as a program of its own, on stdout
+    if (lpc_ctx.emit) {
+	lpc_ctx.filter = argv[0];
+	pc_loadToolset(2);
+	lpc_emit(&head, lpc_ctx.filter, lpc_ctx.emit, stdout);
+	exit(0);
+    }
+    // --bench: time the toolset over a sample in each backend, and compare the outputs
+    if (lpc_ctx.bench) {
+	lpc_ctx.filter = lpc_ctx.bench;
+	pc_loadToolset(2);
+	exit(lpc_bench(oargv[0], lpc_ctx.bench, argv[0]));
+    }
+    if (lpc_ctx.pctfile) {
+	lpc_pct_load(&plan, lpc_ctx.pctfile);
+	if (lpc_ctx.explain)
+	    lpc_plan_explain(&plan.blades, stdout);
+	else
+	    lpc_filterplan(&plan, NULL);
+	exit(0);
+    }
+
     if (lpc_ctx.filtermode != 1) {
 	uigbl.mainwin = initscr();	// Start curses mode
     }
     initDB(0);			// Setup Database (debugging off)
 
+    // -t, load the toolset, process stdin (a pipe or a redirected file), and exit.
+    // The blades run in-process (pcExec.c); only BLACKBOX blades go through the shell.
+    if (lpc_ctx.filtermode && strchr(lpc_ctx.filter, ',')) {
+	lpc_sharerun();		// Several toolsets, over one read of the input
+	exit(0);
+    }
+    if (lpc_ctx.filtermode) {
+	pc_loadToolset(2);	// 2 for filter mode
+	if (lpc_ctx.explain) {
+	    lpc_plan_explain(&head, stdout);
+	    exit(0);
+	}
+	lpc_filterrun();
+	exit(0);
+    }
+
     if (S_ISFIFO(stats.st_mode)) {
 	if (lpc_ctx.debug)
 	    fprintf(stderr, "stdin is a pipeline\n");
 
-	// Input is a pipeline. Either we're to consume command history, or run as a filter.
-	// -t (lpc_ctx.filtermode) will tell us which.
-
-	if (lpc_ctx.filtermode) {	// -t, load the toolset, process, and exit.
-	    pc_loadToolset(2);	// 2 for filter mode
-	    updateTextPipeline(lpc_ctx.tstext, 0);	// Prep the pipeline from the toolset
-	    lpc_ctx.tstext[0] = ' ';	// XXX Cheesy hack to avoid rewriting the way a blade's text representation is generated
-	    filterrun(lpc_ctx.tstext);
-	    // Doit
-	    exit(0);
-	}
+	// Input is a pipeline, and we're not a filter (-t), so consume command history.
 	//Test that it looks like a command history and consume the last
 	// pipeline
 	while (1) {
@@ -405,7 +486,7 @@ main(int argc, char *argv[])
     // Process Commands - main UI event loop starts here
     keypad(uigbl.mainwin, 1);	// Handle Esc sequences for us, thank you.
     timeout(-1);
-    while ((c = getch()) != 'q') {
+    while ((c = nextKey()) != 'q') {
 	// mvprintw(uigbl.maxy-3,0,"GETCH:%d:",c); // For debugging.
 	if (c == '\x12') {	/* Control-R */
 	    //erase();
@@ -435,6 +516,16 @@ main(int argc, char *argv[])
 	    toggleCurs();
 	    continue;
 	}
+	if (c == 'F') {		// Follow the source as it grows, like less +F
+	    if (uigbl.follow) {
+		followStop();
+		regenCaches();
+	    } else if (!followStart()) {
+		beep();
+	    }
+	    displayfilepage(1, NULL);
+	    continue;
+	}
 	if (c == 'R') {
 	    toggleRe();
 	    displayfilepage(1, NULL);
@@ -503,30 +594,30 @@ main(int argc, char *argv[])
 	    continue;
 	}
 	if (c == 's') {
-	    lpc_newBB("sort");
+	    lpc_newORD("");
 	    displayfilepage(1, NULL);
 	    continue;
 	}
 // XXX TODO     if (c == 't') { pc_newTranslate(); displayfilepage(1,NULL); continue; }
 	if (c == 'u') {
 	    lpc_condprepend("sort");
-	    lpc_newBB("uniq");
+	    lpc_newUNQ("");
 	    displayfilepage(1, NULL);
 	    continue;
 	}
 	if (c == 'U') {
 	    lpc_condprepend("sort");
-	    lpc_newBB("uniq -c");
+	    lpc_newUNQ("-c");
 	    displayfilepage(1, NULL);
 	    continue;
 	}
 	if (c == 'H') {
-	    lpc_newBB("sort -nr");
+	    lpc_newORD("-nr");
 	    displayfilepage(1, NULL);
 	    continue;
 	}
 	if (c == 'A') {
-	    lpc_newBB("awk '{print $8, $9}'");
+	    lpc_newFMT("$8 $9");
 	    displayfilepage(1, NULL);
 	    continue;
 	}
@@ -786,10 +877,16 @@ dumprulefile()
 void
 newSummarize()
 {
-    char *ma;
-
     printw("| wc ");
     refresh();
+    lpc_newSUM();
+    return;
+}
+
+void
+lpc_newSUM()
+{
+    char *ma;
 
 /* Insert the new entry into the toolset list */
     lpc_ctx.n1 = malloc(sizeof(struct toolelement));	/* Insert at the head. */
@@ -1002,13 +1099,19 @@ lpc_newEX(char *excl)
     lpc_ctx.n1 = malloc(sizeof(struct toolelement));	/* Insert at the head. */
     memset(lpc_ctx.n1->cache, 0, BLADECACHE);
     nlen = (strlen(excl) + 1);
-    ma = malloc(nlen);
+    ma = malloc(nlen * 2);	// Room for the required literal too
     lpc_ctx.n1->enabled = 1;
     lpc_ctx.n1->pattern = ma;
     lpc_ctx.n1->ttype = EXCLUDE;
     lpc_ctx.n1->menuptr = NULL;	// We don't use this until the menu is called. NULL it to a known state now.
     strlcpy(lpc_ctx.n1->pattern, excl, nlen);	// Copy excl into new list entry
-    rc = regcomp(&lpc_ctx.n1->preg, excl, REG_EXTENDED);
+    lpc_ctx.n1->reqlit = ma + nlen;
+    lpc_ctx.n1->reqlitlen = lpc_reqlit(excl, lpc_ctx.n1->reqlit);
+    if (lpc_ctx.n1->reqlitlen == 0)
+	lpc_ctx.n1->reqlit = NULL;
+    // In filter mode only the plan made from the toolset runs, and it has its own copy.
+    lpc_ctx.n1->hasre = !lpc_ctx.filtermode;
+    rc = lpc_ctx.n1->hasre ? regcomp(&lpc_ctx.n1->preg, excl, REG_EXTENDED) : 0;
     if (rc) {
 	endwin();
 	printf("Regex compile failed %s = %d\n", excl, rc);
@@ -1037,13 +1140,19 @@ lpc_newIN(char *excl)
     lpc_ctx.n1 = malloc(sizeof(struct toolelement));	/* Insert at the head. */
     memset(lpc_ctx.n1->cache, 0, BLADECACHE);
     nlen = (strlen(excl) + 1);
-    ma = malloc(nlen);
+    ma = malloc(nlen * 2);	// Room for the required literal too
     lpc_ctx.n1->enabled = 1;
     lpc_ctx.n1->pattern = ma;
     lpc_ctx.n1->ttype = INCLUDE;
     lpc_ctx.n1->menuptr = NULL;	// We don't use this until the menu is called. NULL it to a known state now.
     strlcpy(lpc_ctx.n1->pattern, excl, nlen);	// Copy excl into new list entry
-    rc = regcomp(&lpc_ctx.n1->preg, excl, REG_EXTENDED);
+    lpc_ctx.n1->reqlit = ma + nlen;
+    lpc_ctx.n1->reqlitlen = lpc_reqlit(excl, lpc_ctx.n1->reqlit);
+    if (lpc_ctx.n1->reqlitlen == 0)
+	lpc_ctx.n1->reqlit = NULL;
+    // In filter mode only the plan made from the toolset runs, and it has its own copy.
+    lpc_ctx.n1->hasre = !lpc_ctx.filtermode;
+    rc = lpc_ctx.n1->hasre ? regcomp(&lpc_ctx.n1->preg, excl, REG_EXTENDED) : 0;
     if (rc) {
 	endwin();
 	printf("Regex compile failed %s = %d\n", excl, rc);
@@ -1116,11 +1225,8 @@ pc_newSTDIN()
 void
 newAwk()
 {
-    // XXX Needs libpc vs pc split.
     char awk[200];		// XXX Not okay to use fixed length field
     char *cp;
-    char *ma;
-    int nlen;
 
     cp = awk;
     echo();
@@ -1138,6 +1244,67 @@ newAwk()
     noecho();
     printw("\nNew Awk format is:%s\n", awk);
     refresh();
+    lpc_newFMT(awk);
+    return;
+}
+
+void
+lpc_newORD(char *flags)
+{
+    char *ma;
+    int nlen;
+
+/* Insert the new entry into the toolset list */
+    lpc_ctx.n1 = malloc(sizeof(struct toolelement));	/* Insert at the head. */
+    memset(lpc_ctx.n1->cache, 0, BLADECACHE);
+    nlen = (strlen(flags) + 1);
+    ma = malloc(nlen);
+    lpc_ctx.n1->enabled = 1;
+    lpc_ctx.n1->haseffect = 1;
+    lpc_ctx.n1->bladeoffset = 0;
+    lpc_ctx.n1->bladelen = 0;
+    lpc_ctx.n1->pattern = ma;
+    lpc_ctx.n1->ttype = ORDER;
+    lpc_ctx.n1->menuptr = NULL;	// We don't use this until the menu is called. NULL it to a known state now.
+    strlcpy(lpc_ctx.n1->pattern, flags, nlen);	// The pattern holds sort's options
+    TAILQ_INSERT_TAIL(&head, lpc_ctx.n1, entries);
+
+    lpc_ctx.curBlade = lpc_ctx.n1;	// Current Blade follows the newly created Blade.
+
+    return;
+}
+
+void
+lpc_newUNQ(char *flags)
+{
+    char *ma;
+    int nlen;
+
+/* Insert the new entry into the toolset list */
+    lpc_ctx.n1 = malloc(sizeof(struct toolelement));	/* Insert at the head. */
+    memset(lpc_ctx.n1->cache, 0, BLADECACHE);
+    nlen = (strlen(flags) + 1);
+    ma = malloc(nlen);
+    lpc_ctx.n1->enabled = 1;
+    lpc_ctx.n1->haseffect = 1;
+    lpc_ctx.n1->bladeoffset = 0;
+    lpc_ctx.n1->bladelen = 0;
+    lpc_ctx.n1->pattern = ma;
+    lpc_ctx.n1->ttype = UNIQUE;
+    lpc_ctx.n1->menuptr = NULL;	// We don't use this until the menu is called. NULL it to a known state now.
+    strlcpy(lpc_ctx.n1->pattern, flags, nlen);	// The pattern holds uniq's options
+    TAILQ_INSERT_TAIL(&head, lpc_ctx.n1, entries);
+
+    lpc_ctx.curBlade = lpc_ctx.n1;	// Current Blade follows the newly created Blade.
+
+    return;
+}
+
+void
+lpc_newFMT(char *awk)
+{
+    char *ma;
+    int nlen;
 
 /* XXX This check applies in the single-tool case, within a range of toolelements. e.g. don't grep-v the same
    string out twice, with no other changes in betwen.
@@ -1172,6 +1339,15 @@ lpc_condprepend(char *prep)
 {
     char prevblade[BLADECACHE];
 
+    // sort is an ORDER blade, with its options as the pattern.
+    if (!strncmp(prep, "sort", 4) && (prep[4] == '\0' || prep[4] == ' ')) {
+	prep += prep[4] ? 5 : 4;
+	if (lpc_ctx.curBlade->ttype == ORDER
+	    && !strcmp(lpc_ctx.curBlade->pattern, prep))
+	    return;
+	lpc_newORD(prep);
+	return;
+    }
     if (lpc_ctx.curBlade->ttype == BLACKBOX) {
 	if (!strcmp(lpc_ctx.curBlade->pattern, prep)) {	// Previous element meets pre-req.
 	    return;
@@ -1311,6 +1487,7 @@ helpscreen()
 	"Navigation\n"
 	" Cursor_Left:  focus on the previous blade to the current one\n"
 	" Cursor_Right: focus on the next blade after the current one\n"
+	" F: Follow lines appended to the source, through the toolset (F, PgUp/PgDn or r to stop)\n"
 	"\n"
 	"Load/Save toolset\n"
 	" [: Load a toolset\n"
@@ -1330,8 +1507,10 @@ void
 updateTextPipeline(char pl[BLADECACHE], int script)
 {
 
-    // XXX Here is where we will decide whether to generate the optimized or unoptimized pipeline
-    // XXX The optimized pipeline code is not yet written.
+    // A script gets the pipeline as lpc_plan_build() rewrites it. The UI shows the
+    // blades as they are, since bladeoffset/bladelen locate each one in the text.
+    struct lpc_plan plan;
+    struct tailhead *blades = &head;
 
     memset(pl, 0, BLADECACHE);
     //int more=0;
@@ -1349,15 +1528,20 @@ updateTextPipeline(char pl[BLADECACHE], int script)
 	strlcpy(lpc_ctx.tspart, pl, PATH_MAX);
     }
     lpc_pipestate = PIPE;
-
+    if (script) {
+	lpc_plan_build(&plan, &head, LPC_PLAN_SHELL);
+	blades = &plan.blades;
+    }
     // strcat(pl, "egrep -v '");
-    TAILQ_FOREACH(lpc_ctx.np, &head, entries) {
+    TAILQ_FOREACH(lpc_ctx.np, blades, entries) {
 	switch (lpc_ctx.np->ttype) {
 	case BLACKBOX:
 	case INCLUDE:
 	case EXCLUDE:
 	case FORMAT:
 	case SUMMARIZE:
+	case ORDER:
+	case UNIQUE:
 	    //pc_pipe_transition( lpc_pipestate, (Tooltype)EXCLUDE, lpc_ctx.np->pattern, pl);
 	    lpc_ctx.np->bladeoffset = strlen(pl);
 	    lpc_pipe_transition(lpc_pipestate, lpc_ctx.np->ttype,
@@ -1373,6 +1557,8 @@ updateTextPipeline(char pl[BLADECACHE], int script)
 	    continue;
 	}
     }
+    if (script)
+	lpc_plan_free(&plan);
 }
 
 /* This function handles generating the text representation of the blades in their native
@@ -1388,7 +1574,7 @@ lpc_pipe_transition(Pipestate lpc_pipestate, Tooltype ttype, char *patt,
     char *pl, int script)
 {
 
-    char bladetext[100];	// XXX Can't be fixed size
+    char bladetext[BLADECACHE];	// XXX Can't be fixed size
 
     switch (ttype) {
 
@@ -1420,8 +1606,7 @@ lpc_pipe_transition(Pipestate lpc_pipestate, Tooltype ttype, char *patt,
     case FORMAT:
 	switch (lpc_pipestate) {
 	case PIPE:
-	    snprintf(bladetext, 100, "%s%s%s", lpc_toolcmds[(ttype * 2) + 0],
-		patt, lpc_toolcmds[(ttype * 2) + 1]);
+	    lpc_format_awk(patt, bladetext, sizeof(bladetext));
 	    strcat(pl, " | ");
 	    strcat(pl, bladetext);
 	    lpc_pipestate = PIPE;
@@ -1442,7 +1627,7 @@ lpc_pipe_transition(Pipestate lpc_pipestate, Tooltype ttype, char *patt,
 	    } else {
 		strcat(pl, "| \\\n");
 	    }
-	    strcat(pl, lpc_ctx.np->pattern);
+	    strcat(pl, patt);
 	    strcat(pl, " ");
 	    return;
 	    break;
@@ -1495,10 +1680,56 @@ lpc_pipe_transition(Pipestate lpc_pipestate, Tooltype ttype, char *patt,
 	}
 	return;
 	break;
-    case TNONE:		// None of these last four can occur yet. 2 are special cases, 2 unimplemented.
-    case STDIN:
     case ORDER:
+	switch (lpc_pipestate) {
+	case PIPE:
+	    if (!script) {
+		strcat(pl, "| sort ");
+	    } else {
+		strcat(pl, "| \\\nsort ");
+	    }
+	    if (patt[0]) {
+		strcat(pl, patt);
+		strcat(pl, " ");
+	    }
+	    lpc_pipestate = PIPE;
+	    return;
+	    break;
+	case PNONE:
+	default:
+	    fprintf(stderr,
+		"\nPipecut Error: Unexpected state encounted in lpc_pipe_transition()\n");
+	    exit(-1);
+	    break;
+	}
+	return;
+	break;
     case UNIQUE:
+	switch (lpc_pipestate) {
+	case PIPE:
+	    if (!script) {
+		strcat(pl, "| uniq ");
+	    } else {
+		strcat(pl, "| \\\nuniq ");
+	    }
+	    if (patt[0]) {
+		strcat(pl, patt);
+		strcat(pl, " ");
+	    }
+	    lpc_pipestate = PIPE;
+	    return;
+	    break;
+	case PNONE:
+	default:
+	    fprintf(stderr,
+		"\nPipecut Error: Unexpected state encounted in lpc_pipe_transition()\n");
+	    exit(-1);
+	    break;
+	}
+	return;
+	break;
+    case TNONE:		// These last two are special cases.
+    case STDIN:
 	return;
 	break;
     }
@@ -1506,26 +1737,57 @@ lpc_pipe_transition(Pipestate lpc_pipestate, Tooltype ttype, char *patt,
 
 void
 regenCaches()
+{
+    regenBlades(0);
+}
+
+/* Regenerate blade caches from the front of the toolset. With usecache, blades that
+   already hold a cache are left alone. A run of INCLUDE/EXCLUDE blades is matched in
+   one pass over its input, filling all of its caches at once. */
+void
+regenBlades(int usecache)
 {
     int i = 0;
+    int k, n, cached;
     char tmpbuf[BLADECACHE];
+    struct toolelement *te;
 
-    TAILQ_FOREACH(lpc_ctx.np, &head, entries) {
+    lpc_ctx.np = TAILQ_FIRST(&head);
+    while (lpc_ctx.np) {
 	if (lpc_ctx.debug)
 	    printw("Processing node %d\n", i++);
 	if (lpc_ctx.np->ttype == CAT) {
 	    // Cache is irrelevant - we source new input here.
 	    bladeAction(lpc_ctx.np, tmpbuf);
-	    lpc_ctx.n2 = lpc_ctx.np;
+	    strcpy(lpc_ctx.np->cache, tmpbuf);
+	} else if ((n = lpc_matchrun(lpc_ctx.np)) > 1) {
+	    // If any blade in the run lost its cache, redo the whole run.
+	    cached = usecache;
+	    for (k = 0, te = lpc_ctx.np; k < n; k++) {
+		if (te->cache[0] == '\0')
+		    cached = 0;
+		if (k < n - 1)
+		    te = TAILQ_NEXT(te, entries);
+	    }
+	    if (cached) {
+		if (lpc_ctx.debug)
+		    printw("Run of %d nodes is cached\n", n);
+	    } else {
+		lpc_match_caches(lpc_ctx.np, n, lpc_ctx.n2->cache);
+	    }
+	    lpc_ctx.np = te;
+	} else if (usecache && lpc_ctx.np->cache[0] != '\0') {
+	    if (lpc_ctx.debug)
+		printw("Node is cached\n");
 	} else {
-	    // This node is not cached, but the prior one was (or we regnerated it)                 
+	    // This node is not cached, but the prior one was (or we regnerated it)
 	    strcpy(tmpbuf, lpc_ctx.n2->cache);
 	    // Now apply the current node to the buffer
 	    bladeAction(lpc_ctx.np, tmpbuf);
-	    lpc_ctx.n2 = lpc_ctx.np;
-	    strcpy(lpc_ctx.np->cache, tmpbuf);	// XXX Added this later - check correctness?
+	    strcpy(lpc_ctx.np->cache, tmpbuf);
 	}
-	strcpy(lpc_ctx.np->cache, tmpbuf);
+	lpc_ctx.n2 = lpc_ctx.np;
+	lpc_ctx.np = TAILQ_NEXT(lpc_ctx.np, entries);
     }
 }
 
@@ -1538,8 +1800,6 @@ void
 displayfilepage(int redraw, char *exp)
 {
 
-    int i = 0;
-    char tmpbuf[BLADECACHE];
     int x1, y1;
     int withregexpHL = 0;
     int withlaHL = 0;
@@ -1575,7 +1835,8 @@ displayfilepage(int redraw, char *exp)
     refresh();
 
     //printw("EX %d WHY %d\n",x1,y1);
-    if (lpc_ctx.cacheon && lpc_ctx.curBlade->cache[0] != '\0') {
+    // While following, the caches are kept up to date as the source grows.
+    if (uigbl.follow || (lpc_ctx.cacheon && lpc_ctx.curBlade->cache[0] != '\0')) {
 	if (lpc_ctx.debug)
 	    printw("Blade is CACHED\n");
     } else {
@@ -1591,29 +1852,7 @@ displayfilepage(int redraw, char *exp)
 	//      printw("Current blade is head, and not cached. Regen.\n");
 	//      exit(-1);
 	//}
-	TAILQ_FOREACH(lpc_ctx.np, &head, entries) {
-	    if (lpc_ctx.debug)
-		printw("Processing node %d\n", i++);
-	    if (lpc_ctx.np->ttype == CAT) {
-		// Cache is irrelevant - we source new input here.
-		bladeAction(lpc_ctx.np, tmpbuf);
-		lpc_ctx.n2 = lpc_ctx.np;
-		strcpy(lpc_ctx.np->cache, tmpbuf);
-	    } else {
-		if (lpc_ctx.cacheon && lpc_ctx.np->cache[0] != '\0') {
-		    if (lpc_ctx.debug)
-			printw("Node is cached\n");
-		    lpc_ctx.n2 = lpc_ctx.np;
-		} else {
-		    // This node is not cached, but the prior one was (or we regnerated it)                 
-		    strcpy(tmpbuf, lpc_ctx.n2->cache);
-		    // Now apply the current node to the buffer
-		    bladeAction(lpc_ctx.np, tmpbuf);
-		    lpc_ctx.n2 = lpc_ctx.np;
-		    strcpy(lpc_ctx.np->cache, tmpbuf);
-		}
-	    }
-	}
+	regenBlades(lpc_ctx.cacheon);
     }
   OUT:
     if (1 || redraw) {
@@ -1660,7 +1899,10 @@ printvisible(char tmpbuf[BLADECACHE], int withHL, char *exp, int withLA,
     char *eosz;
 
     char fmt[20];
-    sz *szline;
+    static struct lpc_span *lines;	// Line index of tmpbuf, reused between calls
+    static int linecap;
+    static struct lpc_text scratch;
+    int i, nlines;
 
     int linelen;
     int row = 0;
@@ -1679,8 +1921,6 @@ printvisible(char tmpbuf[BLADECACHE], int withHL, char *exp, int withLA,
     int nMatchesHL;
     int nMatchesLA;
 
-    szline = SzFromStr("");
-
     int HL = withHL;
     int LA = withLA;
 
@@ -1701,105 +1941,93 @@ printvisible(char tmpbuf[BLADECACHE], int withHL, char *exp, int withLA,
 	    LA = 0;
     }
     move(0, 0);
-    bol = tmpbuf;
-  TOPPVLOOP:
-    if (*bol == '\0') {
-	goto ENDPVLOOP;
-    }
-    eol = strchr(bol, '\n');
-    if (!eol) {			// No \n at end of buffer. special case 
-	eol = bol + strlen(bol);
-    }
-    szncpy(szline, bol, eol - bol + 1);
-    tabbedcount = 0;
-    tabcheck = StrFromSz(szline);	// Walk a pointer down the line to be printed, and count tab spacing
-    eosz = tabcheck + szlen(szline);
-    printedchars = 0;
-    while (tabcheck < eosz && tabbedcount < uigbl.maxx) {
-	if (*tabcheck == '\t') {	// Adjust the count depending on how far the tab will move us forward
-	    rem = tabbedcount % 8;
-	    tabbedcount += 8 - rem;
-	    printedchars++;
-	} else {
-	    tabbedcount++;
-	    printedchars++;
+    nlines = lpc_splitlines(tmpbuf, &lines, &linecap);
+    for (i = 0; i < nlines && row < uigbl.maxy - 3; i++, row++) {
+	bol = (char *)lines[i].p;
+	eol = bol + lines[i].len;	// The '\n', or the NUL at end of buffer
+	tabbedcount = 0;
+	tabcheck = bol;		// Walk a pointer down the line to be printed, and count tab spacing
+	eosz = eol + 1;
+	printedchars = 0;
+	while (tabcheck < eosz && tabbedcount < uigbl.maxx) {
+	    if (*tabcheck == '\t') {	// Adjust the count depending on how far the tab will move us forward
+		rem = tabbedcount % 8;
+		tabbedcount += 8 - rem;
+		printedchars++;
+	    } else {
+		tabbedcount++;
+		printedchars++;
+	    }
+	    tabcheck++;
 	}
-	tabcheck++;
-    }
-    linelen = printedchars;
-    if (linelen == uigbl.maxx - 1) {
-	snprintf(fmt, 20, "%%.%ds\n", linelen);
-    } else {
-	snprintf(fmt, 20, "%%.%ds", linelen);
-	refresh();		// Sometimes useful for debugging.
-    }
-    //printw("%s\n",fmt);
-    mvprintw(row, 0, fmt, bol);
-    if (HL) {
-	// Now that the line is printed, go back and highlight it.
-	rc = regexec(&disreg, StrFromSz(szline), nMatchesHL, matchesHL, 0);
-	if (rc != REG_OK && rc != REG_NOMATCH) {
-	    printw("Failure to process regex that compiled OK?!\n");
-	    exit(-3);
+	linelen = printedchars;
+	if (linelen == uigbl.maxx - 1) {
+	    snprintf(fmt, 20, "%%.%ds\n", linelen);
 	} else {
-	    if (rc == REG_OK) {
-		tabbedcount = 0;
-		//printw("MATCHES 1:%s\n",line+matchesHL[0].rm_so,line+matchesHL[1].rm_so,bol+matchesHL[2].rm_so);
-		// Calculate TABS ... annoying.
-		tabcheck = StrFromSz(szline);
-		while (tabcheck < &StrFromSz(szline)[matchesHL[0].rm_so]) {
-		    if (*tabcheck == '\t') {	// Adjust the count depending on how far the tab will move us forward
-			rem = tabbedcount % 8;
-			tabbedcount += 8 - rem;
-		    } else {
-			tabbedcount++;
+	    snprintf(fmt, 20, "%%.%ds", linelen);
+	    refresh();		// Sometimes useful for debugging.
+	}
+	//printw("%s\n",fmt);
+	mvprintw(row, 0, fmt, bol);
+	if (HL) {
+	    // Now that the line is printed, go back and highlight it.
+	    rc = lpc_regmatch_span(&disreg, bol, eol - bol, nMatchesHL,
+		matchesHL, &scratch);
+	    if (rc != REG_OK && rc != REG_NOMATCH) {
+		printw("Failure to process regex that compiled OK?!\n");
+		exit(-3);
+	    } else {
+		if (rc == REG_OK) {
+		    tabbedcount = 0;
+		    //printw("MATCHES 1:%s\n",line+matchesHL[0].rm_so,line+matchesHL[1].rm_so,bol+matchesHL[2].rm_so);
+		    // Calculate TABS ... annoying.
+		    tabcheck = bol;
+		    while (tabcheck < bol + matchesHL[0].rm_so) {
+			if (*tabcheck == '\t') {	// Adjust the count depending on how far the tab will move us forward
+			    rem = tabbedcount % 8;
+			    tabbedcount += 8 - rem;
+			} else {
+			    tabbedcount++;
+			}
+			tabcheck++;
 		    }
-		    tabcheck++;
+		    mvwchgat(uigbl.mainwin, row, tabbedcount,
+			matchesHL[0].rm_eo - matchesHL[0].rm_so, A_STANDOUT,
+			(short)0, NULL);
 		}
-		mvwchgat(uigbl.mainwin, row, tabbedcount,
-		    matchesHL[0].rm_eo - matchesHL[0].rm_so, A_STANDOUT,
-		    (short)0, NULL);
 	    }
-	}
 
-    }
-    if (LA) {
-	// Now that the line is printed, go back and highlight it.
-	// For now, we just find and highlight the first match. We should loop over all matches XXX
-	rc = regexec(&lareg, StrFromSz(szline), nMatchesLA, matchesLA, 0);
-	if (rc != REG_OK && rc != REG_NOMATCH) {
-	    printw("Failure to process regex that compiled OK?!\n");
-	    exit(-3);
-	} else {
-	    if (rc == REG_OK) {
-		tabbedcount = 0;
-		// Calculate TABS ... annoying
-		tabcheck = bol;
-		while (tabcheck < bol + matchesLA[0].rm_so) {
-		    if (*tabcheck == '\t') {	// Adjust the count depending on how far the tab will move us forward
-			rem = tabbedcount % 8;
-			tabbedcount += 8 - rem;
-		    } else {
-			tabbedcount++;
+	}
+	if (LA) {
+	    // Now that the line is printed, go back and highlight it.
+	    // For now, we just find and highlight the first match. We should loop over all matches XXX
+	    rc = lpc_regmatch_span(&lareg, bol, eol - bol, nMatchesLA,
+		matchesLA, &scratch);
+	    if (rc != REG_OK && rc != REG_NOMATCH) {
+		printw("Failure to process regex that compiled OK?!\n");
+		exit(-3);
+	    } else {
+		if (rc == REG_OK) {
+		    tabbedcount = 0;
+		    // Calculate TABS ... annoying
+		    tabcheck = bol;
+		    while (tabcheck < bol + matchesLA[0].rm_so) {
+			if (*tabcheck == '\t') {	// Adjust the count depending on how far the tab will move us forward
+			    rem = tabbedcount % 8;
+			    tabbedcount += 8 - rem;
+			} else {
+			    tabbedcount++;
+			}
+			tabcheck++;
 		    }
-		    tabcheck++;
+		    mvwchgat(uigbl.mainwin, row, tabbedcount,
+			matchesLA[0].rm_eo - matchesLA[0].rm_so, A_STANDOUT,
+			(short)0, NULL);
 		}
-		mvwchgat(uigbl.mainwin, row, tabbedcount,
-		    matchesLA[0].rm_eo - matchesLA[0].rm_so, A_STANDOUT,
-		    (short)0, NULL);
 	    }
 	}
-	// szfree(szline); XXX This needs to be freed - just need to make sure it's in the right place.
-    }
-    row++;
-    if (row >= uigbl.maxy - 3) {
-	return;
     }
-    bol = eol + 1;
-    goto TOPPVLOOP;
-  ENDPVLOOP:
     return;
-
 }
 
 // This is the function where the actual processing of a blade's data transformation happens.
@@ -1812,19 +2040,40 @@ bladeAction(struct toolelement *blade, char tmpbuf[BLADECACHE])
     int lc = 0;
     char buf[240];
     char tmpbuf2[BLADECACHE];
-    char line[1024];
+    size_t olen = 0;
+    static struct lpc_span *lines;	// Line index of tmpbuf, reused between calls
+    static int linecap;
+    static struct lpc_text scratch;
+    static struct lpc_batch fmtbatch;	// FORMAT output, reused between calls
+    struct lpc_format *fmt;
+    struct lpc_stage st;
+    struct lineout out;
+    int i, nlines;
 
     int rc;
-    long wcl = 0, wcw = 0, wcc = 0;
+    struct lpc_wcount wc;
+    struct lpc_sortspec spec;
+    struct lpc_uniqspec uspec;
+    char sortcmd[BLADECACHE];
+    char count[32];
+    long n;
+    int k;
 
-    char *eol;
-    char *bol;
     blade->haseffect = 0;
     memset(tmpbuf2, 0, BLADECACHE);
 
     // Note: The ENDLOOP target is shared.
     switch (blade->ttype) {
     case CAT:
+	// Regular files are mapped once per session, and only remapped when they change size.
+	if (lpc_map_file(&catmap, lpc_ctx.np->pattern)) {
+	    if (lpc_gz_magic(catmap.p, catmap.len)) {
+		lpc_ctx.filepageend = catGzPage(lpc_ctx.fileoffset, tmpbuf);
+		break;
+	    }
+	    lpc_ctx.filepageend = catPage(&catmap, lpc_ctx.fileoffset, tmpbuf);
+	    break;
+	}
 	fp = fopen(lpc_ctx.np->pattern, "r");	// XXX Need to test for success here
 	if (!fp) {
 	    printf("Failed to open file %s\n", lpc_ctx.np->pattern);
@@ -1843,111 +2092,123 @@ bladeAction(struct toolelement *blade, char tmpbuf[BLADECACHE])
 	fclose(fp);
 	break;
     case INCLUDE:
-	bol = tmpbuf;
-      INCLUDELINELOOP:
-	// Read line-oriented input
-	if (*bol == '\0') {
-	    goto ENDLOOP;
-	}
-	eol = strchr(bol, '\n');
-	if (!eol) {		// No \n at end of buffer. special case 
-	    eol = bol + strlen(bol);
-	}
-	strlcpy(line, bol, eol - bol + 1);
-	bol = eol + 1;
-	rc = regexec(&blade->preg, line, 0, NULL, 0);
-	if (rc != REG_OK && rc != REG_NOMATCH) {
-	    endwin();
-	    printf
-		("Regex execution failed on exclusion %s = %d\n",
-		lpc_ctx.np->pattern, rc);
-	    exit(-1);
-	}
-	if (rc == REG_OK) {	// Matching lines are copied in an INCLUDE
-	    strcat(tmpbuf2, line);
-	    strcat(tmpbuf2, "\n");
-	    goto INCLUDELINELOOP;
-	}
-	if (rc == REG_NOMATCH) {	// Non-matching lines DO NOT carry over to output buffer
-	    blade->haseffect = 1;
-	    goto INCLUDELINELOOP;
+	nlines = lpc_splitlines(tmpbuf, &lines, &linecap);
+	for (i = 0; i < nlines; i++) {
+	    rc = lpc_regexec_span(&blade->preg, lines[i].p, lines[i].len,
+		&scratch);
+	    if (rc != REG_OK && rc != REG_NOMATCH) {
+		endwin();
+		printf
+		    ("Regex execution failed on exclusion %s = %d\n",
+		    lpc_ctx.np->pattern, rc);
+		exit(-1);
+	    }
+	    if (rc == REG_OK) {	// Matching lines are copied in an INCLUDE
+		if (!appendLine(tmpbuf2, &olen, lines[i].p, lines[i].len))
+		    break;	// Full
+	    } else {		// Non-matching lines DO NOT carry over to output buffer
+		blade->haseffect = 1;
+	    }
 	}
-	break;
+	goto ENDLOOP;
     case EXCLUDE:
-	bol = tmpbuf;
-      EXCLUDELINELOOP:
-	// Read line-oriented input
-	if (*bol == '\0') {
-	    goto ENDLOOP;
-	}
-	eol = strchr(bol, '\n');
-	if (!eol) {		// No \n at end of buffer. special case 
-	    eol = bol + strlen(bol);
-	}
-	strlcpy(line, bol, eol - bol + 1);
-	bol = eol + 1;
-	rc = regexec(&blade->preg, line, 0, NULL, 0);
-	if (rc != REG_OK && rc != REG_NOMATCH) {
-	    endwin();
-	    printf
-		("Regex execution failed on exclusion %s = %d\n",
-		lpc_ctx.np->pattern, rc);
-	    exit(-1);
-	}
-	if (rc == REG_OK) {	// Matching lines are NOT copied in an EXCLUDE
-	    blade->haseffect = 1;
-	    goto EXCLUDELINELOOP;
-	}
-	if (rc == REG_NOMATCH) {	// Non-matching lines carry over to output buffer
-	    strcat(tmpbuf2, line);
-	    strcat(tmpbuf2, "\n");
-	    goto EXCLUDELINELOOP;
+	nlines = lpc_splitlines(tmpbuf, &lines, &linecap);
+	for (i = 0; i < nlines; i++) {
+	    rc = lpc_regexec_span(&blade->preg, lines[i].p, lines[i].len,
+		&scratch);
+	    if (rc != REG_OK && rc != REG_NOMATCH) {
+		endwin();
+		printf
+		    ("Regex execution failed on exclusion %s = %d\n",
+		    lpc_ctx.np->pattern, rc);
+		exit(-1);
+	    }
+	    if (rc == REG_OK) {	// Matching lines are NOT copied in an EXCLUDE
+		blade->haseffect = 1;
+	    } else {		// Non-matching lines carry over to output buffer
+		if (!appendLine(tmpbuf2, &olen, lines[i].p, lines[i].len))
+		    break;	// Full
+	    }
 	}
-	break;
+	goto ENDLOOP;
     case SUMMARIZE:
-	bol = tmpbuf;
-      SUMMARIZELINELOOP:
-	// Read line-oriented input
-	if (*bol == '\0') {
-	    blade->haseffect = 1;
-	    snprintf(tmpbuf2, 80, "   %ld   %ld   %ld\n", wcl, wcw, wcc);
-	    goto ENDLOOP;
+	memset(&wc, 0, sizeof(struct lpc_wcount));
+	lpc_wc_scan(&wc, tmpbuf, strlen(tmpbuf));
+	blade->haseffect = 1;
+	snprintf(tmpbuf2, 80, "   %ld   %ld   %ld\n", wc.lines, wc.words,
+	    wc.bytes);
+	goto ENDLOOP;
+    case FORMAT:
+	nlines = lpc_splitlines(tmpbuf, &lines, &linecap);
+	fmt = lpc_format_new(blade->pattern);
+	lpc_batch_clear(&fmtbatch);
+	for (i = 0; i < nlines; i++)
+	    lpc_format_apply(fmt, &fmtbatch, lines[i].p, lines[i].len);
+	lpc_batch_commit(&fmtbatch);
+	lpc_format_free(fmt);
+	for (i = 0; i < fmtbatch.nlines; i++)
+	    if (!appendLine(tmpbuf2, &olen, fmtbatch.lines[i].p,
+		    fmtbatch.lines[i].len))
+		break;	// Full
+	blade->haseffect = 1;	// Could use more sophisticated method in this case.
+	goto ENDLOOP;
+    case ORDER:
+	if (!lpc_sort_clocale() || !lpc_sortspec_parse(&spec, blade->pattern)) {
+	    snprintf(sortcmd, BLADECACHE, "sort %s", blade->pattern);
+	    runpipe(sortcmd, tmpbuf);
+	    break;
 	}
-	eol = strchr(bol, '\n');
-	if (!eol) {		// No \n at end of buffer. special case 
-	    eol = bol + strlen(bol);
+	nlines = lpc_splitlines(tmpbuf, &lines, &linecap);
+	lpc_sort_spans(&spec, lines, nlines, 1);
+	for (i = 0; i < nlines; i++)
+	    if (!appendLine(tmpbuf2, &olen, lines[i].p, lines[i].len))
+		break;	// Full
+	blade->haseffect = 1;
+	goto ENDLOOP;
+    case UNIQUE:
+	if (!lpc_uniqspec_parse(&uspec, blade->pattern)) {
+	    snprintf(sortcmd, BLADECACHE, "uniq %s", blade->pattern);
+	    runpipe(sortcmd, tmpbuf);
+	    break;
 	}
-	strlcpy(line, bol, eol - bol + 1);
-	wcc += eol - bol + 1;	// Count characters
-	wcl++;			// Count a line
-	wcw += pc_wc_w(line);	// XXX Count words
-	bol = eol + 1;
-	goto SUMMARIZELINELOOP;
-	break;
-    case FORMAT:
-	bol = tmpbuf;
-      FORMATLINELOOP:
-	// Read line-oriented input
-	if (*bol == '\0') {
-	    blade->haseffect = 1;	// Could use more sophisticated method in this case.
-	    goto ENDLOOP;
+	nlines = lpc_splitlines(tmpbuf, &lines, &linecap);
+	for (i = 0; i < nlines; i += n) {
+	    for (n = 1; i + n < nlines && lines[i + n].len == lines[i].len
+		&& !memcmp(lines[i + n].p, lines[i].p, lines[i].len); n++) ;
+	    if (n > 1 || uspec.count)
+		blade->haseffect = 1;
+	    if (!lpc_uniq_show(&uspec, n)) {
+		blade->haseffect = 1;
+		continue;
+	    }
+	    if (uspec.count) {
+		k = snprintf(count, 32, LPC_UNIQ_FMT, n);
+		if (olen + k + lines[i].len + 2 > BLADECACHE)
+		    break;	// Full
+		memcpy(tmpbuf2 + olen, count, k);
+		olen += k;
+	    }
+	    if (!appendLine(tmpbuf2, &olen, lines[i].p, lines[i].len))
+		break;	// Full
 	}
-	eol = strchr(bol, '\n');
-	if (!eol) {		// No \n at end of buffer. special case 
-	    eol = bol + strlen(bol);
-	}
-	strlcpy(line, bol, eol - bol + 1);
-	bol = eol + 1;
-	// Format the line as per the awk arguments, and copy it to tmpbuf2
-	// XXX Implement FORMAT
-	strcat(tmpbuf2, line);
-	strcat(tmpbuf2, "\n");
-	goto FORMATLINELOOP;
       ENDLOOP:
 	memset(tmpbuf, 0, BLADECACHE);
 	strcpy(tmpbuf, tmpbuf2);
 	break;
     case BLACKBOX:		// Here's the fun part - running the bladecache through external commands.
+	// Commands pipecut can run itself (sort, cut, head ...) don't need the fork.
+	if (lpc_blade_stage(&st, blade)) {
+	    if (lpc_ctx.debug)
+		printw("Blade \"%s\" runs natively\n", blade->pattern);
+	    nlines = lpc_splitlines(tmpbuf, &lines, &linecap);
+	    out.dst = tmpbuf2;
+	    out.len = 0;
+	    out.full = 0;
+	    lpc_stage_lines(&st, lines, nlines, appendStageLine, &out);
+	    lpc_stage_free(&st);
+	    blade->haseffect = 1;
+	    goto ENDLOOP;
+	}
 	// Create the pipe  - first, run input through pipe to child, let child dump to stdout.
 	//sleep(1);
 	runpipe(blade->pattern, tmpbuf);
@@ -1993,6 +2254,11 @@ updateStatus()
 	xoff -= 8;		// noCache
 	strcat(status, "noCache ");
     }
+
+    if (uigbl.follow) {
+	xoff -= 7;		// Follow
+	strcat(status, "Follow ");
+    }
     mvprintw(uigbl.maxy - 1, xoff, status);
 }
 
@@ -2083,6 +2349,121 @@ start_background_thread(char *av1)
     // XXX Initial implementation removed while cross-platform debugging continues.
 }
 
+/* Parse the command line into lpc_ctx. Returns the index of the first argument that
+ * isn't an option. Also used by the server (--serve) for a client's command line.
+ */
+int
+pc_parseargs(int argc, char *argv[])
+{
+    char **files;
+    int ch, nfiles;
+
+    while ((ch = getopt_long(argc, argv, "df:hj:o:O:PS:t:v", lpc_longopts,
+		NULL)) != -1) {
+	switch (ch) {
+
+	case 'd':
+	    lpc_ctx.debug = 1;
+	    break;
+	case 'f':
+	    lpc_ctx.filtermode = 1;
+	    lpc_ctx.pctfile = optarg;
+	    break;
+	case 'h':
+	    usage(NULL);
+	    break;
+	case 'j':
+	    lpc_ctx.jobs = atoi(optarg);
+	    break;
+	case 'o':
+	    lpc_ctx.outputs = optarg;
+	    break;
+	case 'O':
+	    lpc_ctx.outdir = optarg;
+	    break;
+	case 'P':
+	    lpc_ctx.pipelined = 1;
+	    break;
+	case 'S':
+	    if (!(lpc_ctx.sortmem = lpc_sort_parsesize(optarg)))
+		usage(NULL);
+	    break;
+	case 't':
+	    lpc_ctx.filtermode = 1;
+	    lpc_ctx.filter = optarg;
+	    break;
+	case 'v':
+	    version();
+	    break;
+	case LPC_OPT_EXPLAIN:
+	    lpc_ctx.explain = 1;
+	    break;
+	case LPC_OPT_STATE:
+	    lpc_ctx.statefile = optarg;
+	    break;
+	case LPC_OPT_SERVE:
+	    lpc_ctx.serve = optarg;
+	    break;
+	case LPC_OPT_CONNECT:
+	    lpc_ctx.connect = optarg;
+	    break;
+	case LPC_OPT_COMPILE:
+	    lpc_ctx.compile = optarg;
+	    break;
+	case LPC_OPT_EMIT:
+	    lpc_ctx.emit = optarg;
+	    break;
+	case LPC_OPT_JIT:
+	    lpc_ctx.jit = 1;
+	    break;
+	case LPC_OPT_BENCH:
+	    lpc_ctx.bench = optarg;
+	    break;
+	case '?':
+	    usage(NULL);
+	    break;
+	default:
+	    break;
+	}
+    }
+    files = argv + optind;
+    nfiles = argc - optind;
+    if (lpc_ctx.pctfile) {	// The name comes from the file
+	if (lpc_ctx.filter)
+	    usage(NULL);
+	lpc_ctx.filter = "";
+    }
+    if ((lpc_ctx.explain || lpc_ctx.statefile || lpc_ctx.outdir
+	    || lpc_ctx.jit) && !lpc_ctx.filtermode)
+	usage(NULL);
+    if (lpc_ctx.filtermode) {	// Files to filter, instead of stdin
+	lpc_ctx.files = files;
+	lpc_ctx.nfiles = nfiles;
+    }
+    if ((lpc_ctx.outdir && lpc_ctx.nfiles == 0)
+	|| (lpc_ctx.statefile && lpc_ctx.nfiles > 1))
+	usage(NULL);
+    if (lpc_ctx.filtermode && strchr(lpc_ctx.filter, ',')
+	&& (lpc_ctx.statefile || lpc_ctx.outdir || lpc_ctx.nfiles > 1))
+	usage(NULL);		// A shared scan reads one input, and writes to -o
+    if (lpc_ctx.outputs && !lpc_ctx.compile
+	&& !(lpc_ctx.filtermode && strchr(lpc_ctx.filter, ',')))
+	usage(NULL);
+    if (lpc_ctx.compile && (lpc_ctx.filtermode || lpc_ctx.serve
+	    || lpc_ctx.connect || !lpc_ctx.outputs || nfiles))
+	usage(NULL);
+    if (lpc_ctx.emit && (lpc_ctx.filtermode || lpc_ctx.serve
+	    || lpc_ctx.connect || lpc_ctx.compile || nfiles != 1))
+	usage(NULL);		// The one argument is the toolset's name
+    if (lpc_ctx.bench && (lpc_ctx.filtermode || lpc_ctx.serve
+	    || lpc_ctx.connect || lpc_ctx.compile || lpc_ctx.emit || nfiles != 1))
+	usage(NULL);		// The one argument is the sample
+    if ((lpc_ctx.connect && !lpc_ctx.filtermode)
+	|| (lpc_ctx.serve && (lpc_ctx.filtermode || lpc_ctx.connect)))
+	usage(NULL);
+    return optind;
+}
+
 void
 usage(char *av0)
 {
@@ -2092,8 +2473,34 @@ usage(char *av0)
     fprintf(stderr,
 	"\nCommand line formats for pipecut:\n"
 	"a) pipecut filename    (enters fullscreen mode)\n"
-	"b) pipecut -t toolset  (loads toolset from ~/.pipecut.db (ignoring CAT) and acts as a filter)\n"
+	"b) pipecut -t toolset [file ...]\n"
+	"                       (loads toolset from ~/.pipecut.db (ignoring CAT) and acts as a filter,\n"
+	"                        on stdin, or on each file in turn)\n"
+	"   -P                  (filter mode: run each blade on its own thread)\n"
+	"   -j N                (filter mode, file input: process chunks of the file on N threads;\n"
+	"                        with several files, process N files at a time)\n"
+	"   -O dir              (filter mode, files: write each file's output to dir/file)\n"
+	"   -t a,b,c -o A,B,C   (filter mode: read the input once, and write what toolset a makes of it\n"
+	"                        to file A, b to B, and so on; - is stdout)\n"
+	"   -S size             (filter mode: memory for sorting before spilling to $TMPDIR, as sort -S)\n"
+	"   --explain           (filter mode: print the toolset as written and as it will run, and exit)\n"
+	"   --state FILE        (filter mode, file input: only process what was appended since the last run)\n"
+	"   --connect SOCKET    (filter mode: have the pipecut --serve on SOCKET do the filtering)\n"
+	"   -f file.pct         (filter mode: as -t, with a toolset from --compile, without the database)\n"
+	"   --jit               (filter mode: compile the toolset to machine code with cc, and run that;\n"
+	"                        cached in ~/.cache/pipecut)\n"
+	"   -d                  (debugging output, e.g. which BLACKBOX blades run natively)\n"
 	"c) history | pipecut   (pipecut consumes shell history and creates toolset from last cmd)\n"
+	"d) pipecut --serve SOCKET\n"
+	"                       (keep toolsets loaded, and filter for pipecut --connect clients)\n"
+	"e) pipecut --compile toolset -o file.pct\n"
+	"                       (plan the toolset once, and save it for -f)\n"
+	"f) pipecut --emit c|awk|perl|python toolset > filter\n"
+	"                       (write the toolset out as a program that filters stdin to stdout)\n"
+	"g) pipecut --bench toolset sample\n"
+	"                       (run the toolset over the sample in every backend: the shell pipeline,\n"
+	"                        -t, -P, -j, -f, --jit and each --emit language; check the outputs\n"
+	"                        match, and compare their speed, CPU time and memory)\n"
 	"\n");
     //printf("%s filename\n", av0);
     exit(-1);
@@ -2299,13 +2706,295 @@ clrtotop()
     return;
 }
 
-int
-pc_wc_w(char *str)
+/* Fill tmpbuf with a screenful of lines from a mapped file, starting at off. Returns the
+   offset just past the last line taken. A line too long for the cache is cut short. */
+static long
+catPage(struct lpc_map *m, long off, char tmpbuf[BLADECACHE])
+{
+    const char *cp, *ep, *eol;
+    size_t olen = 0, len;
+    int lc = 0;
+
+    if (!m->p) {		// Empty file
+	tmpbuf[0] = '\0';
+	return 0;
+    }
+    if (off < 0 || (size_t)off > m->len)
+	off = m->len;
+    cp = m->p + off;
+    ep = m->p + m->len;
+    while (cp < ep && lc < uigbl.maxy - 2) {
+	eol = memchr(cp, '\n', ep - cp);
+	eol = eol ? eol + 1 : ep;
+	len = eol - cp;
+	if (olen + len >= BLADECACHE) {
+	    if (lc > 0)		// Leave it for the next page
+		break;
+	    len = BLADECACHE - 2;
+	    memcpy(tmpbuf, cp, len);
+	    tmpbuf[len++] = '\n';
+	    olen = len;
+	    cp = eol;
+	    break;
+	}
+	memcpy(tmpbuf + olen, cp, len);
+	olen += len;
+	lc++;
+	cp = eol;
+    }
+    tmpbuf[olen] = '\0';
+    return cp - m->p;
+}
+
+/* catPage() for a gzip'd file: offsets are into the uncompressed text, and a page is
+   decompressed from the seek point before it. The index is built on first use. */
+static long
+catGzPage(long off, char tmpbuf[BLADECACHE])
+{
+    static char win[BLADECACHE];
+    struct lpc_map m;
+    ssize_t n;
+
+    if (catgz.p != (const unsigned char *)catmap.p || catgz.len != catmap.len) {
+	lpc_gz_close(&catgz);	// New file, or it was remapped
+	lpc_gz_open(&catgz, catmap.p, catmap.len, catmap.path);
+    }
+    if (off < 0 || off > catgz.usize)
+	off = catgz.usize;
+    n = lpc_gz_pread(&catgz, win, sizeof(win), off);
+    memset(&m, 0, sizeof(struct lpc_map));
+    m.p = win;
+    m.len = n > 0 ? n : 0;
+    return off + catPage(&m, 0, tmpbuf);
+}
+
+// Append a line and its '\n' to a cache buffer. Returns 0, appending nothing, once it is full.
+static int
+appendLine(char dst[BLADECACHE], size_t *dlen, const char *p, size_t len)
+{
+    if (*dlen + len + 2 > BLADECACHE)
+	return 0;
+    memcpy(dst + *dlen, p, len);
+    *dlen += len;
+    dst[(*dlen)++] = '\n';
+    dst[*dlen] = '\0';
+    return 1;
+}
+
+// lpc_stage_lines() callback: append a line to a blade cache
+static void
+appendStageLine(void *arg, const char *p, size_t len)
+{
+    struct lineout *out = arg;
+
+    if (!out->full && !appendLine(out->dst, &out->len, p, len))
+	out->full = 1;
+}
+
+/* Follow mode ('F'): the view follows what is appended to the source, as less +F does,
+ * but through the toolset. Each blade's cache holds the last screenful of its output.
+ * The streaming blades right after the source keep their stages between reads, so only
+ * the new lines go through them. A wc among them counts all that follow mode reads: its
+ * cache shows a copy of its counts, flushed after every read. From the first blade that needs all of
+ * its input (sort, tail) on, blades work on the page before them, as they do outside
+ * follow mode.
+ */
+#define LPC_FOLLOWMAX 64		// Streaming blades fed incrementally
+#define LPC_FOLLOWROUNDS 16		// Batches read between two looks at the keyboard
+
+static struct lpc_follow follow;
+static struct lpc_stage fstages[LPC_FOLLOWMAX];
+static int nfstages;
+static struct lpc_batch fbatch;
+static char fsig[BLADECACHE];	// The toolset we were started for
+
+// A fingerprint of the toolset: which blades, and their patterns
+static void
+followSig(char sig[BLADECACHE])
+{
+    struct toolelement *te;
+    char blade[64];
+
+    sig[0] = '\0';
+    TAILQ_FOREACH(te, &head, entries) {
+	snprintf(blade, sizeof(blade), "%p %d ", (void *)te, te->ttype);
+	strlcat(sig, blade, BLADECACHE);
+	if (te->pattern)
+	    strlcat(sig, te->pattern, BLADECACHE);
+	strlcat(sig, "\n", BLADECACHE);
+    }
+}
+
+// Append n lines to a cache, keeping only the last screenful.
+static void
+followWindow(char cache[BLADECACHE], struct lpc_span *nl, int n)
+{
+    static char win[BLADECACHE];
+    size_t wlen = 0;
+    int keep = uigbl.maxy - 3, skip = 0, i;	// What printvisible() shows
+    char *p, *e;
+
+    if (keep < 1)
+	keep = 1;
+    for (p = cache; (e = strchr(p, '\n')); p = e + 1)
+	skip++;
+    skip += n - keep;
+    win[0] = '\0';
+    for (p = cache; (e = strchr(p, '\n')); p = e + 1)
+	if (skip-- <= 0 && !appendLine(win, &wlen, p, e - p))
+	    goto FULL;
+    for (i = 0; i < n; i++)
+	if (skip-- <= 0 && !appendLine(win, &wlen, nl[i].p, nl[i].len))
+	    break;
+  FULL:
+    memcpy(cache, win, wlen + 1);
+}
+
+/* A stage whose whole state is a few counters (wc, wc -l) can go on streaming: a
+ * fresh copy with the counts merged in is flushed for the display. The merge of a
+ * sort | uniq group would use up the stage's spilled runs, so that one can't.
+ */
+static int
+followCounts(struct lpc_stage *st)
+{
+    return st->clone && st->merge && st->ttype != ORDER;
+}
+
+// Flush a copy of a counting stage into its blade's cache. The stage itself goes on.
+static void
+followShow(struct lpc_stage *st, char cache[BLADECACHE])
+{
+    struct lpc_stage copy;
+    struct lpc_batch b;
+    size_t len = 0;
+    int i, rc;
+
+    lpc_stage_clone(&copy, st);
+    copy.merge(&copy, st);
+    lpc_batch_init(&b);
+    cache[0] = '\0';
+    do {
+	lpc_batch_clear(&b);
+	rc = copy.flush(&copy, &b);
+	for (i = 0; i < b.nlines; i++)
+	    appendLine(cache, &len, b.lines[i].p, b.lines[i].len);
+    } while (rc == LPC_MORE);
+    lpc_batch_free(&b);
+    lpc_stage_free(&copy);
+}
+
+// Put what was appended to the source through the toolset.
+static void
+followFeed()
 {
-    int n = 0;
-    for (str = strtok(str, " -.!,;"); str; str = strtok(NULL, " -.!,;"))
-	n++;
-    return n;
+    struct toolelement *te, *prev;
+    struct lpc_stage *last = nfstages ? &fstages[nfstages - 1] : NULL;
+    char tmpbuf[BLADECACHE];
+    struct stat sb;
+    int i, rounds = 0;
+
+    // The source was truncated, and lpc_follow_read() starts over: so do the counts.
+    if (last && last->flush && fstat(follow.fd, &sb) == 0
+	&& sb.st_size < follow.pos) {
+	te = last->blade;
+	lpc_stage_free(last);
+	lpc_blade_stage(last, te);
+    }
+    while (rounds++ < LPC_FOLLOWROUNDS && lpc_follow_read(&follow, &fbatch)) {
+	te = TAILQ_FIRST(&head);
+	followWindow(te->cache, fbatch.lines, fbatch.nlines);
+	for (i = 0; i < nfstages; i++) {
+	    fstages[i].run(&fstages[i], &fbatch);
+	    te = TAILQ_NEXT(te, entries);
+	    if (!fstages[i].flush)
+		followWindow(te->cache, fbatch.lines, fbatch.nlines);
+	}
+    }
+    prev = TAILQ_FIRST(&head);
+    for (i = 0; i < nfstages; i++)
+	prev = TAILQ_NEXT(prev, entries);
+    if (last && last->flush)
+	followShow(last, prev->cache);
+    // Past the streaming blades, each blade runs on the page before it.
+    for (te = TAILQ_NEXT(prev, entries); te; prev = te, te = TAILQ_NEXT(te, entries)) {
+	lpc_ctx.np = te;
+	strcpy(tmpbuf, prev->cache);
+	bladeAction(te, tmpbuf);
+	strcpy(te->cache, tmpbuf);
+    }
+}
+
+static void
+followStop()
+{
+    int i;
+
+    if (!uigbl.follow)
+	return;
+    for (i = 0; i < nfstages; i++)
+	lpc_stage_free(&fstages[i]);
+    nfstages = 0;
+    lpc_follow_close(&follow);
+    uigbl.follow = 0;
+}
+
+// (Re)start following, for the toolset as it is now. 0 if the source can't be followed.
+static int
+followStart()
+{
+    struct toolelement *te = TAILQ_FIRST(&head);
+
+    followStop();
+    if (!te || te->ttype != CAT || !lpc_ctx.sourcefile[0]
+	|| !lpc_follow_open(&follow, lpc_ctx.sourcefile))
+	return 0;
+    uigbl.follow = 1;
+    followSig(fsig);
+    TAILQ_FOREACH(te, &head, entries)
+	te->cache[0] = '\0';
+    for (te = TAILQ_NEXT(TAILQ_FIRST(&head), entries);
+	te && nfstages < LPC_FOLLOWMAX; te = TAILQ_NEXT(te, entries)) {
+	if (!lpc_blade_stage(&fstages[nfstages], te))
+	    break;
+	if (fstages[nfstages].flush) {	// Needs the whole input
+	    if (followCounts(&fstages[nfstages]))
+		nfstages++;	// The last streaming blade: its output is the counts
+	    else
+		lpc_stage_free(&fstages[nfstages]);
+	    break;
+	}
+	nfstages++;
+    }
+    followFeed();
+    return 1;
+}
+
+/* The main loop's next key. While following, whatever is appended to the source in the
+ * meantime goes through the toolset and onto the display.
+ */
+static int
+nextKey()
+{
+    char sig[BLADECACHE];
+    int c;
+
+    if (uigbl.follow) {
+	followSig(sig);
+	if (strcmp(sig, fsig)) {	// The toolset changed: start over with it
+	    if (!followStart())
+		regenCaches();
+	    displayfilepage(1, NULL);
+	}
+	while (uigbl.follow && lpc_follow_wait(&follow, fileno(stdin))) {
+	    followFeed();
+	    displayfilepage(1, NULL);
+	    refresh();		// getch() isn't going to do it for us
+	}
+    }
+    c = getch();
+    if (uigbl.follow && (c == KEY_PPAGE || c == KEY_NPAGE || c == 'r'))
+	followStop();		// Paging back through the file
+    return c;
 }
 
 void
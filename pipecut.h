@@ -84,6 +84,9 @@
 #define StrCopySz(x) szencode(x)
 #define StrFromSz(x) szdata(x)
 
+// Command line (main, and the server for its clients)
+int pc_parseargs(int argc, char *argv[]);
+
 // Filter execution (in filter mode, and UI mode)
 void fullrun(char lesspipe[BLADECACHE]);
 void filterrun(char lesspipe[BLADECACHE]);
@@ -96,12 +99,18 @@ void lpc_newBB(char *cmd);
 void lpc_newEX(char *excl);
 void lpc_newIN(char *);
 void lpc_newCat(char *src);
+void lpc_newSUM();
+void lpc_newFMT(char *fmt);
+void lpc_newORD(char *flags);
+void lpc_newUNQ(char *flags);
 
 // lpc_ database persistance routines
 void pc_loadToolset(int);	// Should be lpc, pending front/backend refactoring
+int pc_toolsetExists(const char *name);
 void pc_saveToolset();
 
 void regenCaches();
+void regenBlades(int usecache);
 
 // Toolset AST manipulation routines
 void lpc_removeTail();
@@ -114,8 +123,8 @@ enum lpc_pipestate {
 };
 /* At the moment, the Mealy machine in lpc_pipe_transition only needs PNONE and PIPE.
  * Including these others causes compiler time warnings in switch statements that don't handle them.
-        EGREP, // We have processed one or more EXCLUDEs, but could add more
-        AWK, // We last processed an awk
+	EGREP, // We have processed one or more EXCLUDEs, but could add more
+	AWK, // We last processed an awk
 */
 
 typedef enum lpc_pipestate Pipestate;
@@ -130,7 +139,23 @@ struct pipecut_ctx {
     int filepageend;
     int linecount;		// Populated by the stats thread
     int filtermode;		// When run with -t, set this flag, and store the toolset name in 'filter'
+    int pipelined;		// -P: filter mode runs one thread per blade
+    int jobs;			// -j: worker threads for chunked filtering of regular files
+    size_t sortmem;		// -S: memory for a native sort before it spills to disk
     int debug;
+    int explain;		// --explain: print the plan for the -t toolset instead of running it
+    char *statefile;		// --state: resume filtering the input where the last run stopped
+    char **files;		// Filter mode input files, if named on the command line (else stdin)
+    int nfiles;
+    char *outdir;		// -O: write the output for each input file to a file in this directory
+    char *outputs;		// -o: where each of several -t toolsets writes, comma separated
+    char *serve;		// --serve: socket to take filter requests on
+    char *connect;		// --connect: socket of the server to hand the filtering to
+    char *pctfile;		// -f: filter with a toolset compiled by --compile, instead of -t
+    char *compile;		// --compile: toolset to write to the -o file
+    char *emit;			// --emit: language to write the named toolset out in
+    int jit;			// --jit: filter mode runs the toolset compiled by cc(1)
+    char *bench;		// --bench: toolset to time in every backend, over a sample file
     char *filter;
     char tstext[BLADECACHE];	// XXX - size needs to be dynamic
     char tspart[BLADECACHE];	// XXX - size needs to be dynamic
@@ -175,6 +200,9 @@ TAILQ_HEAD(tailhead, toolelement) head;
 	int bladelen;
 	char cache[BLADECACHE];	// XXX - size needs to be dynamic
 	regex_t preg;
+	bool hasre;		// preg is compiled (plan blades compile theirs when first run)
+	char *reqlit;		// INCLUDE/EXCLUDE: string every match contains (NULL if none). Shares pattern's allocation.
+	int reqlitlen;
     };
 
 #endif